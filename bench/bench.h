@@ -0,0 +1,149 @@
+/**
+ * @file bench.h
+ * @brief Timing harness shared by the luup_bench workloads
+ *
+ * Each workload runs a callable a fixed number of times after one untimed
+ * warmup run and records every sample. Results are collected as JSON so
+ * runs can be compared by scripts; a one-line summary per workload goes to
+ * stderr. Inputs are generated from fixed seeds, so every run measures the
+ * same work.
+ */
+
+#ifndef LUUP_BENCH_H
+#define LUUP_BENCH_H
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <initializer_list>
+#include <random>
+#include <string>
+#include <vector>
+
+class BenchRunner {
+public:
+    // iterations > 0 overrides every workload's own count; filter selects
+    // workloads whose name contains it (empty runs all)
+    BenchRunner(int iterations, const std::string& filter)
+        : iterations_(iterations), filter_(filter), results_(nlohmann::json::array()) {}
+    
+    bool enabled(const std::string& name) const {
+        return filter_.empty() || name.find(filter_) != std::string::npos;
+    }
+    
+    // Whether any prefix + suffix is enabled, for workloads sharing setup
+    bool any_enabled(const std::string& prefix, std::initializer_list<const char*> suffixes) const {
+        for (const char* suffix : suffixes) {
+            if (enabled(prefix + suffix)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Time fn; extra is stored with the result (e.g. input sizes)
+    void run(const std::string& name, int iterations, const std::function<void()>& fn,
+             const nlohmann::json& extra = nlohmann::json::object()) {
+        if (!enabled(name)) {
+            return;
+        }
+        int n = iterations_ > 0 ? iterations_ : iterations;
+        
+        fn();   // Warmup: first-touch allocations, connections, caches
+        std::vector<double> samples;
+        samples.reserve(n);
+        for (int i = 0; i < n; i++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            samples.push_back(std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        record(name, samples, extra);
+    }
+    
+    // Add samples measured by the workload itself, in unit
+    void record(const std::string& name, std::vector<double> samples,
+                const nlohmann::json& extra = nlohmann::json::object(),
+                const std::string& unit = "ms") {
+        if (samples.empty() || !enabled(name)) {
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        double total = 0.0;
+        for (double sample : samples) {
+            total += sample;
+        }
+        
+        nlohmann::json result = {
+            {"name", name},
+            {"unit", unit},
+            {"samples", samples.size()},
+            {"mean", total / samples.size()},
+            {"min", samples.front()},
+            {"p50", percentile(samples, 0.50)},
+            {"p95", percentile(samples, 0.95)},
+            {"max", samples.back()}
+        };
+        if (!extra.empty()) {
+            result["params"] = extra;
+        }
+        results_.push_back(result);
+        
+        fprintf(stderr, "%-44s %7zu samples  mean %11.4f  p95 %11.4f %s\n", name.c_str(),
+                samples.size(), result["mean"].get<double>(), result["p95"].get<double>(),
+                unit.c_str());
+    }
+    
+    // Note a workload that could not run (e.g. no model given)
+    void skip(const std::string& name, const std::string& reason) {
+        results_.push_back({{"name", name}, {"skipped", reason}});
+        fprintf(stderr, "%-40s skipped: %s\n", name.c_str(), reason.c_str());
+    }
+    
+    const nlohmann::json& results() const { return results_; }
+
+private:
+    static double percentile(const std::vector<double>& sorted, double q) {
+        size_t idx = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(idx, sorted.size() - 1)];
+    }
+    
+    int iterations_;
+    std::string filter_;
+    nlohmann::json results_;
+};
+
+// Deterministic filler text: n words drawn from a small vocabulary
+inline std::string bench_words(std::mt19937& rng, size_t n) {
+    static const char* vocabulary[] = {
+        "the", "agent", "model", "tool", "call", "result", "context", "token",
+        "weather", "city", "forecast", "schedule", "meeting", "note", "todo",
+        "summary", "history", "prompt", "cache", "stream", "latency", "batch"
+    };
+    const size_t n_vocabulary = sizeof(vocabulary) / sizeof(vocabulary[0]);
+    std::string out;
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0) {
+            out += ' ';
+        }
+        out += vocabulary[rng() % n_vocabulary];
+    }
+    return out;
+}
+
+// Keep a result alive so the timed work isn't optimized away
+inline void bench_consume(size_t value) {
+    static volatile size_t sink = 0;
+    sink = sink + value;
+}
+
+// Workload groups (one translation unit each)
+void bench_prompt(BenchRunner& runner);
+void bench_tools(BenchRunner& runner);
+void bench_storage(BenchRunner& runner);
+void bench_remote(BenchRunner& runner);
+void bench_local(BenchRunner& runner, const std::string& model_path);
+
+#endif // LUUP_BENCH_H
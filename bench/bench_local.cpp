@@ -0,0 +1,91 @@
+/**
+ * @file bench_local.cpp
+ * @brief End-to-end turns on a local GGUF model
+ *
+ * Meant for a tiny model (a few million parameters), so the numbers track
+ * the library's scheduling, prefix reuse and streaming rather than the
+ * model's arithmetic. Sampling is greedy with a fixed seed and a fixed
+ * token count, so two runs decode the same tokens.
+ */
+
+#include "bench.h"
+#include <luup_agent.h>
+
+namespace {
+    bool keep_going(const char*, void*) {
+        return true;
+    }
+    
+    luup_agent* create_agent(luup_model* model, int max_tokens) {
+        luup_agent_config config = {};
+        config.model = model;
+        config.system_prompt = "You are a helpful assistant.";
+        config.temperature = 0.0f;
+        config.seed = 42;
+        config.max_tokens = max_tokens;
+        config.enable_tool_calling = false;
+        config.enable_history_management = true;
+        config.enable_builtin_tools = false;
+        return luup_agent_create(&config);
+    }
+    
+    // Append a turn's ttft, prefill time, decode rate and cached prompt share
+    void collect(const luup_turn_metrics* metrics, void* user_data) {
+        auto series = static_cast<std::vector<std::vector<double>>*>(user_data);
+        (*series)[0].push_back(metrics->ttft_ms);
+        (*series)[1].push_back(metrics->prefill_ms);
+        (*series)[2].push_back(metrics->decode_tokens_per_sec);
+        (*series)[3].push_back(metrics->prompt_tokens > 0
+            ? 100.0 * metrics->cached_tokens / metrics->prompt_tokens : 0.0);
+    }
+}
+
+void bench_local(BenchRunner& runner, const std::string& model_path) {
+    if (!runner.any_enabled("local/", {"turn_32_tokens", "session_8_turns",
+                                       "session_8_turns/ttft", "session_8_turns/prefill",
+                                       "session_8_turns/decode_rate",
+                                       "session_8_turns/cached_prompt"})) {
+        return;
+    }
+    if (model_path.empty()) {
+        runner.skip("local/*", "No model given (--model path/to/tiny.gguf)");
+        return;
+    }
+    
+    luup_model_config config = luup_model_default_config();
+    config.path = model_path.c_str();
+    config.context_size = 4096;
+    luup_model* model = luup_model_create_local(&config);
+    if (!model || luup_model_warmup(model) != LUUP_SUCCESS) {
+        runner.skip("local/*", luup_get_last_error());
+        luup_model_destroy(model);
+        return;
+    }
+    
+    // Independent turns: the system prompt prefix stays in the KV cache
+    luup_agent* agent = create_agent(model, 32);
+    runner.run("local/turn_32_tokens", 50, [&] {
+        luup_agent_clear_history(agent);
+        luup_agent_generate_stream(agent, "Write one sentence about the sea.", keep_going, nullptr);
+    }, {{"max_tokens", 32}});
+    
+    // Each turn only prefills the new messages on top of the cached history
+    std::vector<std::vector<double>> series(4);
+    luup_agent_set_metrics_callback(agent, collect, &series);
+    runner.run("local/session_8_turns", 10, [&] {
+        luup_agent_clear_history(agent);
+        for (int turn = 0; turn < 8; turn++) {
+            luup_agent_generate_stream(agent, "Continue the story.", keep_going, nullptr);
+        }
+    }, {{"turns", 8}, {"max_tokens", 32}});
+    luup_agent_set_metrics_callback(agent, nullptr, nullptr);
+    
+    // Per-turn series from the turn metrics
+    runner.record("local/session_8_turns/ttft", series[0]);
+    runner.record("local/session_8_turns/prefill", series[1]);
+    runner.record("local/session_8_turns/decode_rate", series[2], {}, "tokens/s");
+    runner.record("local/session_8_turns/cached_prompt", series[3], {}, "%");
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
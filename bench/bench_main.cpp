@@ -0,0 +1,92 @@
+/**
+ * @file bench_main.cpp
+ * @brief luup_bench entry point
+ *
+ * Usage:
+ *   luup_bench [--filter TEXT] [--iterations N] [--model tiny.gguf] [--output results.json]
+ *
+ * Runs every workload whose name contains TEXT and writes the results as
+ * JSON to the output file (stdout by default). Local model workloads are
+ * skipped unless --model is given.
+ */
+
+#include "bench.h"
+#include <luup_agent.h>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+    void print_usage(const char* program) {
+        fprintf(stderr,
+                "Usage: %s [--filter TEXT] [--iterations N] [--model PATH] [--output FILE]\n"
+                "  --filter TEXT    Run only workloads whose name contains TEXT\n"
+                "  --iterations N   Samples per workload (default: per workload)\n"
+                "  --model PATH     Tiny GGUF model for the local end-to-end workloads\n"
+                "  --output FILE    Write JSON results to FILE instead of stdout\n",
+                program);
+    }
+    
+    std::string timestamp() {
+        char buf[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        return buf;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string model_path;
+    std::string output_path;
+    int iterations = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--iterations") == 0 && has_value) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--model") == 0 && has_value) {
+            model_path = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            output_path = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    
+    BenchRunner runner(iterations, filter);
+    bench_prompt(runner);
+    bench_tools(runner);
+    bench_storage(runner);
+    bench_remote(runner);
+    bench_local(runner, model_path);
+    
+    nlohmann::json report = {
+        {"library_version", luup_version()},
+        {"timestamp", timestamp()},
+        {"hardware_threads", std::thread::hardware_concurrency()},
+        {"filter", filter},
+        {"results", runner.results()}
+    };
+    if (!model_path.empty()) {
+        report["model"] = model_path;
+    }
+    
+    if (output_path.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream out(output_path);
+        if (!out) {
+            fprintf(stderr, "Failed to open %s\n", output_path.c_str());
+            return 1;
+        }
+        out << report.dump(2) << std::endl;
+    }
+    return 0;
+}
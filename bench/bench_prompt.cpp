@@ -0,0 +1,108 @@
+/**
+ * @file bench_prompt.cpp
+ * @brief Prompt building and history accounting workloads
+ */
+
+#include "bench.h"
+#include "core/internal.h"
+
+namespace {
+    std::vector<Message> make_history(size_t n_messages, std::mt19937& rng) {
+        std::vector<Message> history;
+        Message system;
+        system.role = "system";
+        system.content = "You are a helpful assistant. " + bench_words(rng, 40);
+        history.push_back(system);
+        
+        for (size_t i = 1; i < n_messages; i++) {
+            Message msg;
+            msg.role = (i % 2 == 1) ? "user" : "assistant";
+            msg.content = bench_words(rng, 20 + rng() % 120);
+            history.push_back(msg);
+        }
+        return history;
+    }
+    
+    // Agent on a remote model: nothing is sent, but token counting and the
+    // tool schema go through the same code as a real session
+    luup_model* create_offline_model() {
+        luup_model_config config = luup_model_default_config();
+        config.path = "bench";
+        config.api_key = "bench";
+        config.api_base_url = "http://127.0.0.1:9/v1";
+        return luup_model_create_remote(&config);
+    }
+}
+
+void bench_prompt(BenchRunner& runner) {
+    std::mt19937 rng(42);
+    
+    for (size_t n_messages : {50, 500}) {
+        std::vector<Message> history = make_history(n_messages, rng);
+        std::string name = "format_chat_history/" + std::to_string(n_messages) + "_messages";
+        runner.run(name, 200, [&] {
+            bench_consume(format_chat_history(history).size());
+        }, {{"messages", n_messages}});
+    }
+    
+    if (!runner.any_enabled("", {"build_agent_prompt/20_turn_session",
+                                 "build_agent_prompt/rebuild_500_messages",
+                                 "history_token_count/recount_500_messages",
+                                 "history_token_count/cached_500_messages"})) {
+        return;
+    }
+    
+    luup_model* model = create_offline_model();
+    if (!model) {
+        runner.skip("build_agent_prompt", luup_get_last_error());
+        return;
+    }
+    
+    luup_agent_config config = {};
+    config.model = model;
+    config.system_prompt = "You are a helpful assistant.";
+    config.enable_tool_calling = true;
+    config.enable_history_management = true;
+    config.enable_builtin_tools = true;
+    luup_agent* agent = luup_agent_create(&config);
+    if (!agent) {
+        runner.skip("build_agent_prompt", luup_get_last_error());
+        luup_model_destroy(model);
+        return;
+    }
+    
+    // A 20-turn session: every turn appends a user and an assistant message
+    // and rebuilds the prompt, which only formats the new messages
+    std::vector<Message> turns = make_history(41, rng);
+    runner.run("build_agent_prompt/20_turn_session", 200, [&] {
+        agent->history.assign(turns.begin(), turns.begin() + 1);
+        agent->invalidate_history();
+        for (size_t i = 1; i + 1 < turns.size(); i += 2) {
+            agent->history.push_back(turns[i]);
+            bench_consume(build_agent_prompt(agent).size());
+            agent->history.push_back(turns[i + 1]);
+        }
+    }, {{"turns", 20}});
+    
+    // Full rebuild after a non-append change (e.g. trimming)
+    agent->history = make_history(500, rng);
+    runner.run("build_agent_prompt/rebuild_500_messages", 200, [&] {
+        agent->invalidate_history();
+        bench_consume(build_agent_prompt(agent).size());
+    }, {{"messages", 500}});
+    
+    runner.run("history_token_count/recount_500_messages", 200, [&] {
+        for (const auto& msg : agent->history) {
+            msg.n_tokens = -1;
+        }
+        agent->invalidate_history();
+        bench_consume(history_token_count(agent));
+    }, {{"messages", 500}});
+    
+    runner.run("history_token_count/cached_500_messages", 2000, [&] {
+        bench_consume(history_token_count(agent));
+    }, {{"messages", 500}});
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
@@ -0,0 +1,261 @@
+/**
+ * @file bench_remote.cpp
+ * @brief End-to-end turns against a local mock OpenAI server
+ *
+ * The server answers instantly with scripted replies, so the samples are
+ * the client's own cost: request building, HTTP on pooled connections, SSE
+ * parsing, tool dispatch and history upkeep.
+ */
+
+#include "bench.h"
+#include <luup_agent.h>
+#include <httplib.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+using json = nlohmann::json;
+
+namespace {
+    // Minimal /v1/chat/completions. Requests that offer tools get a call to
+    // the first tool until the turn holds tool_rounds results; everything
+    // else gets reply_words words, streamed one per SSE event when asked.
+    class MockOpenAIServer {
+    public:
+        MockOpenAIServer() : port_(-1), tool_rounds(0), reply_words(64) {}
+        ~MockOpenAIServer() { stop(); }
+        
+        bool start() {
+            server_.Post("/v1/chat/completions", [this](const httplib::Request& req,
+                                                        httplib::Response& res) {
+                handle(req, res);
+            });
+            port_ = server_.bind_to_any_port("127.0.0.1");
+            if (port_ <= 0) {
+                return false;
+            }
+            thread_ = std::thread([this] { server_.listen_after_bind(); });
+            server_.wait_until_ready();
+            return true;
+        }
+        
+        void stop() {
+            if (thread_.joinable()) {
+                server_.stop();
+                thread_.join();
+            }
+        }
+        
+        std::string base_url() const {
+            return "http://127.0.0.1:" + std::to_string(port_) + "/v1";
+        }
+        
+        std::atomic<int> tool_rounds;
+        std::atomic<size_t> reply_words;
+    
+    private:
+        void handle(const httplib::Request& req, httplib::Response& res) {
+            json body = json::parse(req.body, nullptr, false);
+            if (body.is_discarded() || !body.contains("messages")) {
+                res.status = 400;
+                res.set_content("{\"error\": {\"message\": \"bad request\"}}", "application/json");
+                return;
+            }
+            
+            // Tool results since the last real user message
+            int n_results = 0;
+            for (const auto& msg : body["messages"]) {
+                std::string role = msg.value("role", "");
+                if (role == "tool") {
+                    n_results++;
+                } else if (role == "user") {
+                    bool is_result = msg["content"].is_string() &&
+                                     msg["content"].get<std::string>().rfind("Tool '", 0) == 0;
+                    n_results = is_result ? n_results + 1 : 0;
+                }
+            }
+            
+            std::string tool;
+            if (body.contains("tools") && body["tools"].is_array() && !body["tools"].empty() &&
+                n_results < tool_rounds) {
+                tool = body["tools"][0]["function"].value("name", "");
+            }
+            bool stream = body.value("stream", false);
+            int prompt_tokens = static_cast<int>(req.body.size() / 4);
+            
+            if (!stream) {
+                json message = {{"role", "assistant"}, {"content", tool.empty() ? reply() : ""}};
+                if (!tool.empty()) {
+                    message["tool_calls"] = json::array({tool_call(tool, n_results)});
+                }
+                json out = {
+                    {"choices", json::array({{{"index", 0}, {"message", message}}})},
+                    {"usage", {{"prompt_tokens", prompt_tokens},
+                               {"completion_tokens", static_cast<int>(reply_words)}}}
+                };
+                res.set_content(out.dump(), "application/json");
+                return;
+            }
+            
+            // One SSE event per word, or one carrying the whole tool call
+            auto events = std::make_shared<std::vector<std::string>>();
+            auto event = [&](const json& delta) {
+                json chunk = {{"choices", json::array({{{"index", 0}, {"delta", delta}}})}};
+                events->push_back("data: " + chunk.dump() + "\n\n");
+            };
+            if (!tool.empty()) {
+                json call = tool_call(tool, n_results);
+                call["index"] = 0;
+                event({{"tool_calls", json::array({call})}});
+            } else {
+                std::mt19937 rng(static_cast<unsigned int>(n_results));
+                for (size_t i = 0; i < reply_words; i++) {
+                    event({{"content", (i > 0 ? " " : "") + bench_words(rng, 1)}});
+                }
+            }
+            events->push_back("data: [DONE]\n\n");
+            
+            res.set_chunked_content_provider("text/event-stream",
+                                             [events](size_t, httplib::DataSink& sink) {
+                for (const auto& e : *events) {
+                    if (!sink.write(e.data(), e.size())) {
+                        return false;
+                    }
+                }
+                sink.done();
+                return true;
+            });
+        }
+        
+        std::string reply() const {
+            std::mt19937 rng(1);
+            return bench_words(rng, reply_words);
+        }
+        
+        static json tool_call(const std::string& name, int round) {
+            json args = {{"query", "round " + std::to_string(round)}};
+            return {
+                {"id", "call_" + std::to_string(round)},
+                {"type", "function"},
+                {"function", {{"name", name}, {"arguments", args.dump()}}}
+            };
+        }
+        
+        httplib::Server server_;
+        std::thread thread_;
+        int port_;
+    };
+    
+    char* lookup_tool(const char* params_json, void*) {
+        std::string result = std::string("{\"found\": true, \"echo\": ") + params_json + "}";
+        return strdup(result.c_str());
+    }
+    
+    bool count_chunk(const char*, void* user_data) {
+        (*static_cast<size_t*>(user_data))++;
+        return true;
+    }
+    
+    void collect_ttft(const luup_turn_metrics* metrics, void* user_data) {
+        static_cast<std::vector<double>*>(user_data)->push_back(metrics->ttft_ms);
+    }
+    
+    luup_agent* create_agent(luup_model* model, bool history, bool tools, int max_rounds) {
+        luup_agent_config config = {};
+        config.model = model;
+        config.system_prompt = "You are a helpful assistant.";
+        config.temperature = 0.7f;
+        config.enable_tool_calling = tools;
+        config.enable_history_management = history;
+        config.enable_builtin_tools = false;
+        config.max_tool_rounds = max_rounds;
+        luup_agent* agent = luup_agent_create(&config);
+        if (agent && tools) {
+            luup_tool tool = {
+                "lookup",
+                "Look up a query in the knowledge base",
+                "{\"type\": \"object\", \"properties\": {\"query\": {\"type\": \"string\"}}, "
+                "\"required\": [\"query\"]}"
+            };
+            luup_agent_register_tool(agent, &tool, lookup_tool, nullptr);
+        }
+        return agent;
+    }
+}
+
+void bench_remote(BenchRunner& runner) {
+    if (!runner.any_enabled("remote/", {"turn_blocking_64_words", "turn_stream_512_events",
+                                        "turn_stream_512_events/ttft", "tool_heavy_turn_4_rounds",
+                                        "session_10_turns"})) {
+        return;
+    }
+    
+    MockOpenAIServer server;
+    if (!server.start()) {
+        runner.skip("remote/*", "Failed to start mock server");
+        return;
+    }
+    
+    std::string base_url = server.base_url();
+    luup_model_config model_config = luup_model_default_config();
+    model_config.path = "mock";
+    model_config.api_key = "bench";
+    model_config.api_base_url = base_url.c_str();
+    luup_model* model = luup_model_create_remote(&model_config);
+    if (!model) {
+        runner.skip("remote/*", luup_get_last_error());
+        return;
+    }
+    
+    // Single blocking turn, no history kept between samples
+    luup_agent* agent = create_agent(model, false, false, 0);
+    server.reply_words = 64;
+    runner.run("remote/turn_blocking_64_words", 200, [&] {
+        char* response = luup_agent_generate(agent, "What is the forecast?");
+        bench_consume(response ? strlen(response) : 0);
+        luup_free_string(response);
+    }, {{"reply_words", 64}});
+    
+    // Streaming turn: SSE parsing and per-event callbacks dominate
+    std::vector<double> ttft;
+    server.reply_words = 512;
+    runner.run("remote/turn_stream_512_events", 100, [&] {
+        size_t n_chunks = 0;
+        luup_agent_generate_stream(agent, "Tell me a story.", count_chunk, &n_chunks);
+        bench_consume(n_chunks);
+    }, {{"events", 512}});
+    luup_agent_set_metrics_callback(agent, collect_ttft, &ttft);
+    for (int i = 0; i < 50; i++) {
+        size_t n_chunks = 0;
+        luup_agent_generate_stream(agent, "Tell me a story.", count_chunk, &n_chunks);
+    }
+    runner.record("remote/turn_stream_512_events/ttft", ttft, {{"events", 512}});
+    luup_agent_destroy(agent);
+    
+    // Four tool rounds before the answer, each a request and a tool call
+    agent = create_agent(model, false, true, 8);
+    server.reply_words = 32;
+    server.tool_rounds = 4;
+    runner.run("remote/tool_heavy_turn_4_rounds", 100, [&] {
+        size_t n_chunks = 0;
+        luup_agent_generate_stream(agent, "Research this for me.", count_chunk, &n_chunks);
+        bench_consume(n_chunks);
+    }, {{"tool_rounds", 4}, {"reply_words", 32}});
+    luup_agent_destroy(agent);
+    
+    // Ten turns with history, so every request carries a longer transcript
+    agent = create_agent(model, true, true, 4);
+    server.tool_rounds = 1;
+    runner.run("remote/session_10_turns", 20, [&] {
+        luup_agent_clear_history(agent);
+        for (int turn = 0; turn < 10; turn++) {
+            size_t n_chunks = 0;
+            luup_agent_generate_stream(agent, "And what about tomorrow?", count_chunk, &n_chunks);
+            bench_consume(n_chunks);
+        }
+    }, {{"turns", 10}, {"tool_rounds", 1}, {"reply_words", 32}});
+    luup_agent_destroy(agent);
+    
+    luup_model_destroy(model);
+    server.stop();
+}
@@ -0,0 +1,145 @@
+/**
+ * @file bench_storage.cpp
+ * @brief Built-in notes and todo storage at 10k entries
+ *
+ * Operations go through the tool callbacks, as a model's calls would, so
+ * JSON parsing and result formatting are part of every sample. Each store
+ * runs in memory and journaled to a temporary file.
+ */
+
+#include "bench.h"
+#include "core/internal.h"
+#include <filesystem>
+
+namespace {
+    constexpr int n_entries = 10000;
+    
+    std::string call(luup_agent* agent, const char* tool, const nlohmann::json& params) {
+        return execute_tool(tool, params.dump(), agent->tools);
+    }
+    
+    // Time each call separately; the count is fixed by the workload
+    template <typename Fn>
+    std::vector<double> time_each(int n, Fn&& fn) {
+        std::vector<double> samples;
+        samples.reserve(n);
+        for (int i = 0; i < n; i++) {
+            auto start = std::chrono::steady_clock::now();
+            fn(i);
+            samples.push_back(std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        return samples;
+    }
+    
+    luup_agent* create_agent() {
+        luup_agent_config config = {};
+        config.model = reinterpret_cast<luup_model*>(0x1);   // Never generates
+        config.enable_tool_calling = true;
+        config.enable_history_management = true;
+        config.enable_builtin_tools = false;
+        return luup_agent_create(&config);
+    }
+    
+    void remove_store(const std::string& path) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        std::filesystem::remove(path + ".log", ec);
+        std::filesystem::remove(path + ".tmp", ec);
+    }
+    
+    void bench_notes(BenchRunner& runner, const std::string& mode, const std::string& path) {
+        std::string prefix = "notes_" + mode + "/";
+        if (!runner.any_enabled(prefix, {"create_10k", "search_word_10k", "search_tag_10k",
+                                         "list_page_10k", "update_1k"})) {
+            return;
+        }
+        luup_agent* agent = create_agent();
+        const char* storage_path = path.empty() ? nullptr : path.c_str();
+        if (!agent || luup_agent_enable_builtin_notes(agent, storage_path) != LUUP_SUCCESS) {
+            runner.skip(prefix + "*", luup_get_last_error());
+            luup_agent_destroy(agent);
+            return;
+        }
+        
+        std::mt19937 rng(11);
+        static const char* tags[] = {"work", "home", "ideas", "travel", "reading"};
+        runner.record(prefix + "create_10k", time_each(n_entries, [&](int) {
+            nlohmann::json params = {
+                {"operation", "create"},
+                {"content", bench_words(rng, 10 + rng() % 30)},
+                {"tags", nlohmann::json::array({tags[rng() % 5]})}
+            };
+            bench_consume(call(agent, "notes", params).size());
+        }), {{"entries", n_entries}});
+        
+        runner.run(prefix + "search_word_10k", 200, [&] {
+            bench_consume(call(agent, "notes", {{"operation", "search"},
+                                                {"query", "forecast meet"}}).size());
+        }, {{"entries", n_entries}});
+        runner.run(prefix + "search_tag_10k", 200, [&] {
+            bench_consume(call(agent, "notes", {{"operation", "search"}, {"tag", "travel"},
+                                                {"query", "city"}}).size());
+        }, {{"entries", n_entries}});
+        runner.run(prefix + "list_page_10k", 200, [&] {
+            bench_consume(call(agent, "notes", {{"operation", "list"}, {"offset", 5000},
+                                                {"limit", 20}}).size());
+        }, {{"entries", n_entries}});
+        runner.record(prefix + "update_1k", time_each(1000, [&](int i) {
+            nlohmann::json params = {
+                {"operation", "update"},
+                {"id", 1 + (i * 7) % n_entries},
+                {"content", bench_words(rng, 20)}
+            };
+            bench_consume(call(agent, "notes", params).size());
+        }), {{"entries", n_entries}});
+        
+        luup_agent_destroy(agent);
+    }
+    
+    void bench_todo(BenchRunner& runner, const std::string& mode, const std::string& path) {
+        std::string prefix = "todo_" + mode + "/";
+        if (!runner.any_enabled(prefix, {"add_10k", "complete_1k", "list_10k"})) {
+            return;
+        }
+        luup_agent* agent = create_agent();
+        const char* storage_path = path.empty() ? nullptr : path.c_str();
+        if (!agent || luup_agent_enable_builtin_todo(agent, storage_path) != LUUP_SUCCESS) {
+            runner.skip(prefix + "*", luup_get_last_error());
+            luup_agent_destroy(agent);
+            return;
+        }
+        
+        std::mt19937 rng(13);
+        runner.record(prefix + "add_10k", time_each(n_entries, [&](int) {
+            bench_consume(call(agent, "todo", {{"operation", "add"},
+                                               {"title", bench_words(rng, 6)}}).size());
+        }), {{"entries", n_entries}});
+        runner.record(prefix + "complete_1k", time_each(1000, [&](int i) {
+            bench_consume(call(agent, "todo", {{"operation", "complete"},
+                                               {"id", 1 + (i * 7) % n_entries}}).size());
+        }), {{"entries", n_entries}});
+        runner.run(prefix + "list_10k", 20, [&] {
+            bench_consume(call(agent, "todo", {{"operation", "list"}}).size());
+        }, {{"entries", n_entries}});
+        
+        luup_agent_destroy(agent);
+    }
+}
+
+void bench_storage(BenchRunner& runner) {
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::temp_directory_path(ec);
+    std::string notes_path = (dir / "luup_bench_notes.json").string();
+    std::string todo_path = (dir / "luup_bench_todo.json").string();
+    
+    bench_notes(runner, "memory", "");
+    bench_todo(runner, "memory", "");
+    
+    remove_store(notes_path);
+    remove_store(todo_path);
+    bench_notes(runner, "journal", notes_path);
+    bench_todo(runner, "journal", todo_path);
+    remove_store(notes_path);
+    remove_store(todo_path);
+}
@@ -0,0 +1,109 @@
+/**
+ * @file bench_tools.cpp
+ * @brief Tool call parsing, schema and dispatch workloads
+ */
+
+#include "bench.h"
+#include "core/internal.h"
+#include <cstring>
+
+namespace {
+    // Model output of about target_bytes with n_calls tool calls spread
+    // through prose, some of it brace-heavy so the scanner has to work
+    std::string make_output(size_t target_bytes, size_t n_calls, std::mt19937& rng) {
+        std::string out;
+        size_t gap = n_calls > 0 ? target_bytes / (n_calls + 1) : target_bytes;
+        for (size_t i = 0; i <= n_calls; i++) {
+            size_t start = out.size();
+            while (out.size() - start < gap) {
+                out += bench_words(rng, 12);
+                out += (rng() % 4 == 0) ? " {not: json} " : ". ";
+            }
+            if (i < n_calls) {
+                out += "{\"tool_calls\": [{\"name\": \"get_weather\", \"parameters\": "
+                       "{\"city\": \"Paris\", \"days\": " + std::to_string(i % 7 + 1) + "}}]}\n";
+            }
+        }
+        return out;
+    }
+    
+    char* echo_tool(const char* params_json, void*) {
+        return strdup(params_json);
+    }
+    
+    std::map<std::string, ToolInfo> make_tools(size_t n_tools) {
+        static std::vector<std::string> names;
+        static const char* schema =
+            "{\"type\": \"object\", \"properties\": {\"city\": {\"type\": \"string\"}, "
+            "\"days\": {\"type\": \"integer\"}}, \"required\": [\"city\"]}";
+        names.clear();
+        for (size_t i = 0; i < n_tools; i++) {
+            names.push_back(i == 0 ? "get_weather" : "tool_" + std::to_string(i));
+        }
+        
+        std::map<std::string, ToolInfo> tools;
+        for (const auto& name : names) {
+            ToolInfo info;
+            info.tool.name = name.c_str();
+            info.tool.description = "Look something up for the given city";
+            info.tool.parameters_json = schema;
+            info.callback = echo_tool;
+            tools[name] = info;
+        }
+        return tools;
+    }
+}
+
+void bench_tools(BenchRunner& runner) {
+    std::mt19937 rng(7);
+    
+    std::string small = make_output(64 * 1024, 1, rng);
+    runner.run("parse_tool_calls/64KB_1_call", 200, [&] {
+        bench_consume(parse_tool_calls(small).size());
+    }, {{"bytes", small.size()}, {"calls", 1}});
+    
+    std::string large = make_output(1024 * 1024, 50, rng);
+    runner.run("parse_tool_calls/1MB_50_calls", 20, [&] {
+        bench_consume(parse_tool_calls(large).size());
+    }, {{"bytes", large.size()}, {"calls", 50}});
+    
+    // An unmatched brace per byte used to rescan the rest of the output
+    std::string braces = std::string(64 * 1024, '{') +
+                         "{\"name\": \"tool_0\", \"parameters\": {}}";
+    runner.run("parse_tool_calls/64KB_unmatched_braces", 20, [&] {
+        bench_consume(parse_tool_calls(braces).size());
+    }, {{"bytes", braces.size()}, {"calls", 1}});
+    
+    // Streaming detection sees the output a few bytes at a time
+    runner.run("tool_call_scanner/1MB_16B_chunks", 20, [&] {
+        ToolCallScanner scanner;
+        size_t n_found = 0;
+        for (size_t pos = 0; pos < large.size(); pos += 16) {
+            size_t len = std::min<size_t>(16, large.size() - pos);
+            n_found += scanner.feed(large.data() + pos, len).size();
+        }
+        n_found += scanner.finish().size();
+        bench_consume(n_found);
+    }, {{"bytes", large.size()}, {"chunk_bytes", 16}});
+    
+    std::map<std::string, ToolInfo> tools = make_tools(20);
+    runner.run("generate_tool_schema/20_tools", 500, [&] {
+        bench_consume(generate_tool_schema(tools, false).size());
+    }, {{"tools", 20}});
+    runner.run("generate_tool_grammar/20_tools", 500, [&] {
+        bench_consume(generate_tool_grammar(tools).size());
+    }, {{"tools", 20}});
+    runner.run("generate_native_tools/20_tools", 500, [&] {
+        bench_consume(generate_native_tools(tools).size());
+    }, {{"tools", 20}});
+    
+    // Dispatch overhead of a tool-heavy round, sequential and on workers
+    std::vector<ToolCall> calls = parse_tool_calls(make_output(8 * 1024, 16, rng));
+    ToolPool pool(4);
+    runner.run("execute_tools/16_calls_sequential", 500, [&] {
+        bench_consume(execute_tools(calls, tools, nullptr, 0).size());
+    }, {{"calls", calls.size()}});
+    runner.run("execute_tools/16_calls_parallel_4", 200, [&] {
+        bench_consume(execute_tools(calls, tools, &pool, 0).size());
+    }, {{"calls", calls.size()}, {"max_parallel", 4}});
+}
@@ -25,7 +25,7 @@ Examples:
 """
 
 from .model import Model
-from .agent import Agent
+from .agent import Agent, set_executor_threads
 from .exceptions import (
     LuupError,
     InvalidParameterError,
@@ -36,6 +36,8 @@ from .exceptions import (
     JsonParseError,
     HttpError,
     BackendInitError,
+    ContextOverflowError,
+    ToolLimitError,
 )
 from ._native import get_version, get_version_tuple
 
@@ -46,6 +48,7 @@ __all__ = [
     # Main classes
     "Model",
     "Agent",
+    "set_executor_threads",
     # Exceptions
     "LuupError",
     "InvalidParameterError",
@@ -56,6 +59,8 @@ __all__ = [
     "JsonParseError",
     "HttpError",
     "BackendInitError",
+    "ContextOverflowError",
+    "ToolLimitError",
     # Version info
     "__version__",
     "__version_info__",
@@ -62,6 +62,17 @@ except OSError as e:
         f"Make sure it's built and available. Error: {e}"
     ) from e
 
+# Struct layouts below match this LUUP_ABI_VERSION of luup_agent.h
+ABI_VERSION = 4
+
+_lib.luup_abi_version.argtypes = []
+_lib.luup_abi_version.restype = ctypes.c_int
+if _lib.luup_abi_version() != ABI_VERSION:
+    raise ImportError(
+        f"luup-agent library ABI version {_lib.luup_abi_version()} does not match "
+        f"the Python bindings (expected {ABI_VERSION}). Rebuild or reinstall them together."
+    )
+
 
 # ============================================================================
 # C Structure Definitions
@@ -77,6 +88,20 @@ class CModelConfig(ctypes.Structure):
         ("threads", ctypes.c_int),
         ("api_key", ctypes.c_char_p),
         ("api_base_url", ctypes.c_char_p),
+        ("http_pool_size", ctypes.c_int),
+        ("http_connect_timeout", ctypes.c_int),
+        ("http_read_timeout", ctypes.c_int),
+        ("max_sequences", ctypes.c_int),
+        ("prefill_chunk_size", ctypes.c_int),
+        ("cache_type_k", ctypes.c_int),
+        ("cache_type_v", ctypes.c_int),
+        ("flash_attn", ctypes.c_int),
+        ("batch_size", ctypes.c_int),
+        ("ubatch_size", ctypes.c_int),
+        ("threads_batch", ctypes.c_int),
+        ("no_mmap", ctypes.c_bool),
+        ("use_mlock", ctypes.c_bool),
+        ("stream_usage", ctypes.c_bool),
     ]
 
 
@@ -88,6 +113,20 @@ class CModelInfo(ctypes.Structure):
         ("gpu_layers_loaded", ctypes.c_int),
         ("memory_usage", ctypes.c_size_t),
         ("context_size", ctypes.c_int),
+        ("draft_tokens_proposed", ctypes.c_size_t),
+        ("draft_tokens_accepted", ctypes.c_size_t),
+        ("cache_type_k", ctypes.c_int),
+        ("cache_type_v", ctypes.c_int),
+        ("flash_attn", ctypes.c_int),
+        ("batch_size", ctypes.c_int),
+        ("ubatch_size", ctypes.c_int),
+        ("threads", ctypes.c_int),
+        ("threads_batch", ctypes.c_int),
+        ("use_mmap", ctypes.c_bool),
+        ("use_mlock", ctypes.c_bool),
+        ("response_cache_hits", ctypes.c_size_t),
+        ("response_cache_misses", ctypes.c_size_t),
+        ("response_cache_entries", ctypes.c_size_t),
     ]
 
 
@@ -101,6 +140,53 @@ class CAgentConfig(ctypes.Structure):
         ("enable_tool_calling", ctypes.c_bool),
         ("enable_history_management", ctypes.c_bool),
         ("enable_builtin_tools", ctypes.c_bool),
+        ("top_k", ctypes.c_int),
+        ("top_p", ctypes.c_float),
+        ("min_p", ctypes.c_float),
+        ("repeat_penalty", ctypes.c_float),
+        ("seed", ctypes.c_uint),
+        ("max_parallel_tools", ctypes.c_int),
+        ("tool_timeout_ms", ctypes.c_int),
+        ("max_tool_rounds", ctypes.c_int),
+        ("token_budget", ctypes.c_int),
+        ("enable_tool_grammar", ctypes.c_bool),
+        ("compact_tool_schema", ctypes.c_bool),
+        ("summarizer_model", ctypes.c_void_p),
+        ("context_strategy", ctypes.c_int),
+        ("context_budget", ctypes.c_int),
+    ]
+
+
+class CToolMetrics(ctypes.Structure):
+    """C structure: luup_tool_metrics"""
+    _fields_ = [
+        ("name", ctypes.c_char_p),
+        ("calls", ctypes.c_int),
+        ("total_ms", ctypes.c_double),
+    ]
+
+
+class CTurnMetrics(ctypes.Structure):
+    """C structure: luup_turn_metrics"""
+    _fields_ = [
+        ("generations", ctypes.c_int),
+        ("prompt_tokens", ctypes.c_int),
+        ("cached_tokens", ctypes.c_int),
+        ("generated_tokens", ctypes.c_int),
+        ("prefill_ms", ctypes.c_double),
+        ("decode_ms", ctypes.c_double),
+        ("decode_tokens_per_sec", ctypes.c_double),
+        ("ttft_ms", ctypes.c_double),
+        ("http_connect_ms", ctypes.c_double),
+        ("http_ttfb_ms", ctypes.c_double),
+        ("tool_calls", ctypes.c_int),
+        ("tool_ms", ctypes.c_double),
+        ("tools", ctypes.POINTER(CToolMetrics)),
+        ("n_tools", ctypes.c_int),
+        ("summarization_ms", ctypes.c_double),
+        ("total_ms", ctypes.c_double),
+        ("cache_hits", ctypes.c_int),
+        ("cache_misses", ctypes.c_int),
     ]
 
 
@@ -124,9 +210,9 @@ CToolCallback = ctypes.CFUNCTYPE(
     ctypes.c_void_p   # user_data
 )
 
-# Stream callback: void (*)(const char* token, void* user_data)
+# Stream callback: bool (*)(const char* token, void* user_data)
 CStreamCallback = ctypes.CFUNCTYPE(
-    None,             # return type (void)
+    ctypes.c_bool,    # return type (false stops generation)
     ctypes.c_char_p,  # token
     ctypes.c_void_p   # user_data
 )
@@ -139,6 +225,42 @@ CErrorCallback = ctypes.CFUNCTYPE(
     ctypes.c_void_p   # user_data
 )
 
+# Metrics callback: void (*)(const luup_turn_metrics* metrics, void* user_data)
+CMetricsCallback = ctypes.CFUNCTYPE(
+    None,                          # return type (void)
+    ctypes.POINTER(CTurnMetrics),  # metrics
+    ctypes.c_void_p                # user_data
+)
+
+# Generation notify: void (*)(void* user_data)
+CGenerationNotify = ctypes.CFUNCTYPE(
+    None,             # return type (void)
+    ctypes.c_void_p   # user_data
+)
+
+# Completion: void (*)(luup_error_t code, const char* response,
+#                     const char* error_message, void* user_data)
+CCompletionCallback = ctypes.CFUNCTYPE(
+    None,             # return type (void)
+    ctypes.c_int,     # error code
+    ctypes.c_char_p,  # response (NULL on error)
+    ctypes.c_char_p,  # error message
+    ctypes.c_void_p   # user_data
+)
+
+# luup_generation_status
+GENERATION_RUNNING = 0
+GENERATION_DONE = 1
+GENERATION_FAILED = 2
+
+# Token counter: size_t (*)(const char* text, void* user_data)
+CTokenCounter = ctypes.CFUNCTYPE(
+    ctypes.c_size_t,  # return type (token count)
+    ctypes.c_char_p,  # text
+    ctypes.c_void_p   # user_data
+)
+
+
 
 # ============================================================================
 # Error Handling Functions
@@ -155,6 +277,9 @@ _lib.luup_set_error_callback.restype = None
 # Model Layer Functions
 # ============================================================================
 
+_lib.luup_model_default_config.argtypes = []
+_lib.luup_model_default_config.restype = CModelConfig
+
 _lib.luup_model_create_local.argtypes = [ctypes.POINTER(CModelConfig)]
 _lib.luup_model_create_local.restype = ctypes.c_void_p
 
@@ -167,6 +292,31 @@ _lib.luup_model_warmup.restype = ctypes.c_int
 _lib.luup_model_get_info.argtypes = [ctypes.c_void_p, ctypes.POINTER(CModelInfo)]
 _lib.luup_model_get_info.restype = ctypes.c_int
 
+_lib.luup_model_set_draft.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int]
+_lib.luup_model_set_draft.restype = ctypes.c_int
+
+_lib.luup_model_set_response_cache.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_int,
+    ctypes.c_int,
+    ctypes.c_char_p
+]
+_lib.luup_model_set_response_cache.restype = ctypes.c_int
+
+_lib.luup_model_set_token_counter.argtypes = [
+    ctypes.c_void_p,
+    CTokenCounter,
+    ctypes.c_void_p
+]
+_lib.luup_model_set_token_counter.restype = ctypes.c_int
+
+_lib.luup_model_count_tokens.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_char_p,
+    ctypes.POINTER(ctypes.c_int)
+]
+_lib.luup_model_count_tokens.restype = ctypes.c_int
+
 _lib.luup_model_destroy.argtypes = [ctypes.c_void_p]
 _lib.luup_model_destroy.restype = None
 
@@ -186,6 +336,9 @@ _lib.luup_agent_register_tool.argtypes = [
 ]
 _lib.luup_agent_register_tool.restype = ctypes.c_int
 
+_lib.luup_agent_set_tool_enabled.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_bool]
+_lib.luup_agent_set_tool_enabled.restype = ctypes.c_int
+
 _lib.luup_agent_generate_stream.argtypes = [
     ctypes.c_void_p,
     ctypes.c_char_p,
@@ -197,6 +350,51 @@ _lib.luup_agent_generate_stream.restype = ctypes.c_int
 _lib.luup_agent_generate.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
 _lib.luup_agent_generate.restype = ctypes.c_void_p  # Return raw pointer for manual memory management
 
+_lib.luup_agent_submit.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_char_p,
+    CStreamCallback,
+    CCompletionCallback,
+    ctypes.c_void_p
+]
+_lib.luup_agent_submit.restype = ctypes.c_int
+
+_lib.luup_set_executor_threads.argtypes = [ctypes.c_int]
+_lib.luup_set_executor_threads.restype = ctypes.c_int
+
+_lib.luup_agent_generate_start.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_char_p,
+    ctypes.c_size_t,
+    CGenerationNotify,
+    ctypes.c_void_p
+]
+_lib.luup_agent_generate_start.restype = ctypes.c_void_p
+
+_lib.luup_generation_read.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_void_p,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.c_int
+]
+_lib.luup_generation_read.restype = ctypes.c_int
+
+_lib.luup_generation_cancel.argtypes = [ctypes.c_void_p]
+_lib.luup_generation_cancel.restype = None
+
+_lib.luup_generation_error.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p)]
+_lib.luup_generation_error.restype = ctypes.c_int
+
+_lib.luup_generation_free.argtypes = [ctypes.c_void_p]
+_lib.luup_generation_free.restype = None
+
+_lib.luup_agent_get_last_metrics.argtypes = [ctypes.c_void_p, ctypes.POINTER(CTurnMetrics)]
+_lib.luup_agent_get_last_metrics.restype = ctypes.c_int
+
+_lib.luup_agent_set_metrics_callback.argtypes = [ctypes.c_void_p, CMetricsCallback, ctypes.c_void_p]
+_lib.luup_agent_set_metrics_callback.restype = ctypes.c_int
+
 _lib.luup_agent_add_message.argtypes = [
     ctypes.c_void_p,
     ctypes.c_char_p,
@@ -210,6 +408,18 @@ _lib.luup_agent_clear_history.restype = ctypes.c_int
 _lib.luup_agent_get_history_json.argtypes = [ctypes.c_void_p]
 _lib.luup_agent_get_history_json.restype = ctypes.c_char_p
 
+_lib.luup_agent_save_state.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.luup_agent_save_state.restype = ctypes.c_int
+
+_lib.luup_agent_load_state.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+_lib.luup_agent_load_state.restype = ctypes.c_int
+
+_lib.luup_agent_save_state_buffer.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+_lib.luup_agent_save_state_buffer.restype = ctypes.c_void_p
+
+_lib.luup_agent_load_state_buffer.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+_lib.luup_agent_load_state_buffer.restype = ctypes.c_int
+
 _lib.luup_agent_enable_builtin_todo.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
 _lib.luup_agent_enable_builtin_todo.restype = ctypes.c_int
 
@@ -230,6 +440,9 @@ _lib.luup_agent_destroy.restype = None
 _lib.luup_free_string.argtypes = [ctypes.c_void_p]
 _lib.luup_free_string.restype = None
 
+_lib.luup_free_buffer.argtypes = [ctypes.c_void_p]
+_lib.luup_free_buffer.restype = None
+
 
 # ============================================================================
 # Version Information Functions
@@ -279,6 +492,9 @@ __all__ = [
     'CToolCallback',
     'CStreamCallback',
     'CErrorCallback',
+    'CTokenCounter',
+    'CGenerationNotify',
+    'CCompletionCallback',
     'get_version',
     'get_version_tuple',
 ]
@@ -9,9 +9,12 @@ import asyncio
 import json
 import ctypes
 import inspect
+import itertools
+import threading
+from concurrent.futures import Future
 from functools import wraps
 from typing import (
-    Callable, Optional, Iterator, AsyncIterator, Dict, Any, List
+    Callable, Optional, Iterator, AsyncIterator, Dict, Any, List, Literal, Union
 )
 
 # For Self type (Python 3.11+)
@@ -24,6 +27,113 @@ from . import _native
 from .exceptions import check_error
 from .model import Model
 
+# luup_context_strategy values
+_CONTEXT_STRATEGIES = {
+    "keep_all": 0,
+    "sliding_window": 1,
+    "drop_tool_results": 2,
+}
+
+
+# Bytes taken per luup_generation_read(); one buffer serves a whole generation
+_READ_SIZE = 64 * 1024
+
+
+class _Generation:
+    """A native background generation (luup_generation), read in batches."""
+    
+    def __init__(self, agent_handle, message: str, notify=None):
+        # Keep the callback alive for as long as the native thread may call it
+        self._notify = notify if notify is not None else _native.CGenerationNotify()
+        self._handle = _native._lib.luup_agent_generate_start(
+            agent_handle, message.encode('utf-8'), 0, self._notify, None
+        )
+        if not self._handle:
+            error_msg = _native._lib.luup_get_last_error()
+            msg = error_msg.decode('utf-8') if error_msg else "Generation failed"
+            raise RuntimeError(msg)
+        self._buffer = ctypes.create_string_buffer(_READ_SIZE)
+        self._length = ctypes.c_size_t()
+        self.running = True
+    
+    def read(self, timeout_ms: int):
+        """Return (text, status), waiting up to timeout_ms (-1 = no limit) for text."""
+        status = _native._lib.luup_generation_read(
+            self._handle, self._buffer, _READ_SIZE, ctypes.byref(self._length), timeout_ms
+        )
+        if status != _native.GENERATION_RUNNING:
+            self.running = False
+        n = self._length.value
+        text = str(memoryview(self._buffer)[:n], 'utf-8') if n else ""
+        return text, status
+    
+    def check(self) -> None:
+        """Raise the error the generation ended with, if any."""
+        message = ctypes.c_char_p()
+        error_code = _native._lib.luup_generation_error(self._handle, ctypes.byref(message))
+        check_error(error_code, lambda: message.value)
+    
+    def cancel(self) -> None:
+        _native._lib.luup_generation_cancel(self._handle)
+    
+    def close(self) -> None:
+        """Stop the generation and free it; blocks until the executor is done with it."""
+        if self._handle:
+            _native._lib.luup_generation_free(self._handle)
+            self._handle = None
+            self.running = False
+
+
+# Futures of submitted requests by id, passed as the C user_data. One
+# module-level callback serves them all, so no per-request thunk has to be
+# kept alive past its own call.
+_submitted: Dict[int, Future] = {}
+_submitted_lock = threading.Lock()
+_submit_ids = itertools.count(1)
+
+
+@_native.CCompletionCallback
+def _on_submit_complete(code, response, error_message, user_data):
+    with _submitted_lock:
+        future = _submitted.pop(user_data, None)
+    if future is None:
+        return
+    try:
+        check_error(code, lambda: error_message)
+        future.set_result(response.decode('utf-8') if response else "")
+    except Exception as e:
+        future.set_exception(e)
+
+
+def set_executor_threads(n_threads: int) -> None:
+    """
+    Set the number of native threads that run submitted turns and streams.
+    
+    Only takes effect before the first turn is queued.
+    
+    Args:
+        n_threads: Worker threads (0 = hardware threads, at least 4)
+    """
+    error_code = _native._lib.luup_set_executor_threads(n_threads)
+    check_error(error_code, _native._lib.luup_get_last_error)
+
+
+def _metrics_to_dict(metrics: _native.CTurnMetrics) -> Dict[str, Any]:
+    """Convert a luup_turn_metrics struct to a dictionary."""
+    result = {
+        name: getattr(metrics, name)
+        for name, _ in _native.CTurnMetrics._fields_
+        if name not in ("tools", "n_tools")
+    }
+    result["tools"] = {
+        metrics.tools[i].name.decode('utf-8'): {
+            "calls": metrics.tools[i].calls,
+            "total_ms": metrics.tools[i].total_ms,
+        }
+        for i in range(metrics.n_tools)
+    }
+    return result
+
 
 class Agent:
     """
@@ -65,6 +175,20 @@ class Agent:
         enable_tool_calling: bool = True,
         enable_history: bool = True,
         enable_builtin_tools: bool = True,
+        top_k: int = 0,
+        top_p: float = 0.0,
+        min_p: float = 0.0,
+        repeat_penalty: float = 0.0,
+        seed: int = 0,
+        max_parallel_tools: int = 0,
+        tool_timeout_ms: int = 0,
+        max_tool_rounds: int = 0,
+        token_budget: int = 0,
+        enable_tool_grammar: bool = False,
+        compact_tool_schema: bool = False,
+        summarizer_model: Optional[Model] = None,
+        context_strategy: Literal["keep_all", "sliding_window", "drop_tool_results"] = "keep_all",
+        context_budget: int = 0,
     ):
         """
         Create a new agent.
@@ -77,15 +201,35 @@ class Agent:
             enable_tool_calling: Enable automatic tool calling
             enable_history: Enable automatic conversation history management
             enable_builtin_tools: Enable built-in tools (todo, notes, summarization) - opt-out design
+            top_k: Keep only the k most likely tokens (0 = disabled)
+            top_p: Nucleus sampling threshold (0 = disabled)
+            min_p: Minimum token probability relative to the top token (0 = disabled)
+            repeat_penalty: Repetition penalty, e.g. 1.1 (0 = disabled)
+            seed: Sampling seed for reproducible output (0 = random)
+            max_parallel_tools: Run up to this many tool calls from one response
+                concurrently (0 = sequential). Tool callbacks must be thread-safe.
+            tool_timeout_ms: Per-call tool timeout in milliseconds (0 = no timeout)
+            max_tool_rounds: Rounds of tool calls executed per turn (0 = default of 5).
+                A turn that still asks for tools after that raises ToolLimitError.
+            token_budget: Tokens generated across all rounds of a turn (0 = no limit)
+            enable_tool_grammar: Constrain tool-call JSON to the registered tool schemas
+                (local models only)
+            compact_tool_schema: Render tools one per line with minified schemas
+            summarizer_model: Model for built-in summarization (default: the agent's model)
+            context_strategy: How history is trimmed to fit context_budget:
+                "keep_all", "sliding_window" or "drop_tool_results"
+            context_budget: Tokens of history to keep (0 = 75% of the context window)
             
         Raises:
             InvalidParameterError: If parameters are invalid
         """
         self._handle: Optional[int] = None
         self._model = model
+        self._summarizer_model = summarizer_model  # Keep alive while the agent uses it
         self._closed = False
         self._tools: Dict[str, Callable] = {}
         self._tool_callbacks: Dict[str, _native.CToolCallback] = {}
+        self._metrics_callback: Optional[_native.CMetricsCallback] = None
         
         # Create C config structure
         config = _native.CAgentConfig(
@@ -96,6 +240,20 @@ class Agent:
             enable_tool_calling=enable_tool_calling,
             enable_history_management=enable_history,
             enable_builtin_tools=enable_builtin_tools,
+            top_k=top_k,
+            top_p=top_p,
+            min_p=min_p,
+            repeat_penalty=repeat_penalty,
+            seed=seed,
+            max_parallel_tools=max_parallel_tools,
+            tool_timeout_ms=tool_timeout_ms,
+            max_tool_rounds=max_tool_rounds,
+            token_budget=token_budget,
+            enable_tool_grammar=enable_tool_grammar,
+            compact_tool_schema=compact_tool_schema,
+            summarizer_model=summarizer_model._handle if summarizer_model else None,
+            context_strategy=_CONTEXT_STRATEGIES[context_strategy],
+            context_budget=context_budget,
         )
         
         # Create agent
@@ -148,97 +306,126 @@ class Agent:
     
     def generate_stream(self, message: str) -> Iterator[str]:
         """
-        Generate response with token-by-token streaming (blocking iterator).
+        Generate response with streaming (blocking iterator).
         
-        Yields tokens as they're generated. This is a synchronous iterator
-        that blocks on each token.
+        Yields text as it is generated. Generation runs on a native thread
+        and the GIL is released while waiting, so each chunk holds whatever
+        accumulated since the previous one (one or more tokens).
         
         Args:
             message: User message to respond to
             
         Yields:
-            Generated tokens as strings
+            Generated text chunks
             
         Example:
-            >>> for token in agent.generate_stream("Hello"):
-            ...     print(token, end='', flush=True)
+            >>> for chunk in agent.generate_stream("Hello"):
+            ...     print(chunk, end='', flush=True)
             
         Raises:
             InferenceError: If generation fails
         """
         self._check_closed()
-        
-        tokens: List[str] = []
-        
-        # Create callback that collects tokens
-        @_native.CStreamCallback
-        def callback(token_ptr, user_data):
-            if token_ptr:
-                token = token_ptr.decode('utf-8')
-                tokens.append(token)
-        
-        # Call C function
-        error_code = _native._lib.luup_agent_generate_stream(
-            self._handle,
-            message.encode('utf-8'),
-            callback,
-            None
-        )
-        
-        check_error(error_code, _native._lib.luup_get_last_error)
-        
-        # Yield collected tokens
-        yield from tokens
+        generation = _Generation(self._handle, message)
+        try:
+            while True:
+                text, status = generation.read(-1)
+                if text:
+                    yield text
+                if status != _native.GENERATION_RUNNING:
+                    break
+            generation.check()
+        finally:
+            generation.close()
     
     async def generate_async(self, message: str) -> AsyncIterator[str]:
         """
         Generate response asynchronously with streaming.
         
-        This is an async generator that yields tokens without blocking the
-        event loop. Uses asyncio.to_thread() to run blocking operations.
+        The generation runs on a native thread that wakes the event loop
+        when text is ready; no executor thread is held while it runs, so
+        one loop can drive many concurrent generations. Each chunk holds
+        everything generated since the loop last read.
         
         Args:
             message: User message to respond to
             
         Yields:
-            Generated tokens as strings
+            Generated text chunks
             
         Example:
-            >>> async for token in agent.generate_async("Hello"):
-            ...     print(token, end='', flush=True)
+            >>> async for chunk in agent.generate_async("Hello"):
+            ...     print(chunk, end='', flush=True)
             
         Raises:
             InferenceError: If generation fails
         """
-        # Run streaming in a thread to not block event loop
-        loop = asyncio.get_event_loop()
-        
-        # Use a queue to pass tokens from thread to async context
-        queue: asyncio.Queue[Optional[str]] = asyncio.Queue()
+        self._check_closed()
+        loop = asyncio.get_running_loop()
+        ready = asyncio.Event()
         
-        def run_stream():
-            """Run streaming in thread and put tokens in queue."""
+        @_native.CGenerationNotify
+        def notify(user_data):
             try:
-                for token in self.generate_stream(message):
-                    # Use call_soon_threadsafe to put in queue from thread
-                    loop.call_soon_threadsafe(queue.put_nowait, token)
-            except Exception as e:
-                loop.call_soon_threadsafe(queue.put_nowait, e)
-            finally:
-                # Signal completion
-                loop.call_soon_threadsafe(queue.put_nowait, None)
-        
-        # Start streaming in thread
-        await asyncio.to_thread(run_stream)
-        
-        # Yield tokens from queue
-        while True:
-            token = await queue.get()
-            if token is None:
-                break
-            if isinstance(token, Exception):
-                raise token
-            yield token
+                loop.call_soon_threadsafe(ready.set)
+            except RuntimeError:
+                pass  # Loop already closed
+        
+        generation = _Generation(self._handle, message, notify)
+        try:
+            while True:
+                ready.clear()
+                text, status = generation.read(0)
+                if text:
+                    yield text
+                if status != _native.GENERATION_RUNNING:
+                    break
+                if not text:
+                    await ready.wait()
+            generation.check()
+        finally:
+            if generation.running:
+                # Stopped early: wait for the native thread off the loop
+                generation.cancel()
+                await loop.run_in_executor(None, generation.close)
+            else:
+                generation.close()
+    
+    def submit(self, message: str) -> "Future[str]":
+        """
+        Queue a turn on the library's shared executor.
+        
+        Turns submitted to one agent run one at a time in order; turns of
+        different agents run in parallel on native threads, so many agents
+        can be served without a Python thread each.
+        
+        Args:
+            message: User message to respond to
+            
+        Returns:
+            Future resolving to the response text, or to the turn's error
+            
+        Example:
+            >>> futures = [agent.submit(q) for agent, q in zip(agents, questions)]
+            >>> answers = [f.result() for f in futures]
+            >>> answer = await asyncio.wrap_future(agent.submit("Hello"))
+        """
+        self._check_closed()
+        future: Future = Future()
+        future.set_running_or_notify_cancel()
+        request_id = next(_submit_ids)
+        with _submitted_lock:
+            _submitted[request_id] = future
+        
+        error_code = _native._lib.luup_agent_submit(
+            self._handle, message.encode('utf-8'), _native.CStreamCallback(),
+            _on_submit_complete, request_id
+        )
+        if error_code != 0:
+            with _submitted_lock:
+                _submitted.pop(request_id, None)
+            check_error(error_code, _native._lib.luup_get_last_error)
+        return future
     
     def tool(
         self,
@@ -418,6 +605,53 @@ class Agent:
         
         check_error(error_code, _native._lib.luup_get_last_error)
     
+    def get_last_metrics(self) -> Dict[str, Any]:
+        """
+        Get counts and timings of the last generate() or generate_stream() call.
+        
+        Returns:
+            Dictionary with the turn's metrics:
+                - generations: Model calls made, including tool follow-ups
+                - prompt_tokens, cached_tokens, generated_tokens: Token counts
+                - prefill_ms, decode_ms, decode_tokens_per_sec: Model throughput
+                - ttft_ms: Time to first token
+                - http_connect_ms, http_ttfb_ms: Remote request timings
+                - tool_calls, tool_ms: Tools executed and time spent in them
+                - tools: Per-tool {"calls", "total_ms"} keyed by name
+                - summarization_ms: Generating summaries applied during the turn
+                - total_ms: Wall time of the turn
+                - cache_hits, cache_misses: Generations answered from, or
+                  missing, the model's response cache
+        """
+        self._check_closed()
+        metrics = _native.CTurnMetrics()
+        error_code = _native._lib.luup_agent_get_last_metrics(self._handle, ctypes.byref(metrics))
+        check_error(error_code, _native._lib.luup_get_last_error)
+        return _metrics_to_dict(metrics)
+    
+    def set_metrics_callback(self, callback: Optional[Callable[[Dict[str, Any]], None]]) -> None:
+        """
+        Call a function with the metrics of every turn, as returned by get_last_metrics().
+        
+        Args:
+            callback: Called on the generating thread after each turn (None to remove)
+        """
+        self._check_closed()
+        
+        if callback is None:
+            c_callback = _native.CMetricsCallback()
+        else:
+            @_native.CMetricsCallback
+            def c_callback(metrics_ptr, user_data):
+                try:
+                    callback(_metrics_to_dict(metrics_ptr.contents))
+                except Exception:
+                    pass  # Exceptions can't cross the C boundary
+        
+        error_code = _native._lib.luup_agent_set_metrics_callback(self._handle, c_callback, None)
+        check_error(error_code, _native._lib.luup_get_last_error)
+        self._metrics_callback = c_callback  # Keep alive while registered
+    
     def add_message(self, role: str, content: str) -> None:
         """
         Manually add a message to conversation history.
@@ -437,6 +671,24 @@ class Agent:
         )
         check_error(error_code, _native._lib.luup_get_last_error)
     
+    def set_tool_enabled(self, name: str, enabled: bool) -> None:
+        """
+        Enable or disable a registered tool.
+        
+        Disabled tools are hidden from the model and cannot be called.
+        
+        Args:
+            name: Name of a registered tool
+            enabled: Whether the tool is available
+            
+        Raises:
+            ToolNotFoundError: If no tool with this name is registered
+        """
+        self._check_closed()
+        error_code = _native._lib.luup_agent_set_tool_enabled(
+            self._handle, name.encode('utf-8'), enabled)
+        check_error(error_code, _native._lib.luup_get_last_error)
+    
     def clear_history(self) -> None:
         """
         Clear conversation history.
@@ -476,6 +728,54 @@ class Agent:
         except json.JSONDecodeError:
             return []
     
+    def save_state(self, path: Optional[str] = None) -> Optional[bytes]:
+        """
+        Save conversation history and KV-cache state.
+        
+        Args:
+            path: File to write, or None to return the state as bytes
+            
+        Returns:
+            The state when no path is given, otherwise None
+            
+        Example:
+            >>> agent.save_state("session.bin")
+            >>> # later, possibly in another process
+            >>> agent.load_state("session.bin")
+        """
+        self._check_closed()
+        
+        if path is not None:
+            error_code = _native._lib.luup_agent_save_state(self._handle, path.encode('utf-8'))
+            check_error(error_code, _native._lib.luup_get_last_error)
+            return None
+        
+        size = ctypes.c_size_t(0)
+        buffer = _native._lib.luup_agent_save_state_buffer(self._handle, ctypes.byref(size))
+        if not buffer:
+            error_msg = _native._lib.luup_get_last_error()
+            msg = error_msg.decode('utf-8') if error_msg else "Failed to save state"
+            raise RuntimeError(msg)
+        try:
+            return ctypes.string_at(buffer, size.value)
+        finally:
+            _native._lib.luup_free_buffer(buffer)
+    
+    def load_state(self, state: Union[str, bytes]) -> None:
+        """
+        Restore state saved by save_state(), replacing the current history.
+        
+        Args:
+            state: Path to a state file, or the bytes returned by save_state()
+        """
+        self._check_closed()
+        
+        if isinstance(state, bytes):
+            error_code = _native._lib.luup_agent_load_state_buffer(self._handle, state, len(state))
+        else:
+            error_code = _native._lib.luup_agent_load_state(self._handle, state.encode('utf-8'))
+        check_error(error_code, _native._lib.luup_get_last_error)
+    
     def enable_builtin_todo(self, storage_path: Optional[str] = None) -> None:
         """
         Enable built-in todo list tool.
@@ -523,7 +823,7 @@ class Agent:
         Explicitly close and free agent resources.
         
         Called automatically by context manager and destructor.
-        Safe to call multiple times.
+        Safe to call multiple times. Waits for submitted turns to finish.
         """
         if not self._closed and self._handle:
             _native._lib.luup_agent_destroy(self._handle)
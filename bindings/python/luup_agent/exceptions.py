@@ -52,6 +52,16 @@ class BackendInitError(LuupError):
     pass
 
 
+class ContextOverflowError(LuupError):
+    """Prompt does not fit in the model's context window."""
+    pass
+
+
+class ToolLimitError(LuupError):
+    """Turn hit max_tool_rounds or token_budget with tool calls pending."""
+    pass
+
+
 # Map C error codes to Python exception classes
 # Based on luup_error_t enum in luup_agent.h
 ERROR_MAP: Dict[int, Type[LuupError]] = {
@@ -63,6 +73,8 @@ ERROR_MAP: Dict[int, Type[LuupError]] = {
     -6: JsonParseError,
     -7: HttpError,
     -8: BackendInitError,
+    -9: ContextOverflowError,
+    -10: ToolLimitError,
 }
 
 
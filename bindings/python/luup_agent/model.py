@@ -6,8 +6,9 @@ and automatic resource cleanup.
 """
 
 import atexit
+import ctypes
 from pathlib import Path
-from typing import Optional, Dict, Any, Literal
+from typing import Optional, Dict, Any, Literal, Callable
 
 # For Self type (Python 3.11+)
 try:
@@ -18,6 +19,23 @@ except ImportError:
 from . import _native
 from .exceptions import check_error, ModelNotFoundError, BackendInitError
 
+# luup_kv_cache_type and luup_flash_attn values
+_KV_CACHE_TYPES = {
+    "f16": 0,
+    "bf16": 1,
+    "f32": 2,
+    "q8_0": 3,
+    "q4_0": 4,
+}
+_KV_CACHE_NAMES = {value: name for name, value in _KV_CACHE_TYPES.items()}
+
+_FLASH_ATTN_MODES = {
+    "auto": 0,
+    "on": 1,
+    "off": 2,
+}
+_FLASH_ATTN_NAMES = {value: name for name, value in _FLASH_ATTN_MODES.items()}
+
 
 class Model:
     """
@@ -53,6 +71,15 @@ class Model:
         api_key: Optional[str] = None,
         api_base_url: Optional[str] = None,
         backend: Literal["local", "remote"] = "local",
+        cache_type_k: str = "f16",
+        cache_type_v: str = "f16",
+        flash_attn: Literal["auto", "on", "off"] = "auto",
+        batch_size: int = 0,
+        ubatch_size: int = 0,
+        threads_batch: int = 0,
+        use_mmap: bool = True,
+        use_mlock: bool = False,
+        stream_usage: bool = False,
     ):
         """
         Create a new model.
@@ -66,6 +93,15 @@ class Model:
             api_key: API key for remote models (optional)
             api_base_url: Custom API endpoint for remote models (optional)
             backend: Backend type - "local" or "remote"
+            cache_type_k: K cache type: "f16", "bf16", "f32", "q8_0" or "q4_0"
+            cache_type_v: V cache type (quantized types need flash attention)
+            flash_attn: Flash attention: "auto", "on" or "off"
+            batch_size: Max tokens per decode call (0 = default: 2048)
+            ubatch_size: Physical batch size (0 = default: 512)
+            threads_batch: CPU threads for prompt prefill (0 = same as threads)
+            use_mmap: Memory-map the model file instead of reading it
+            use_mlock: Lock the weights in RAM
+            stream_usage: Ask remote streams to report token usage (some servers reject this)
             
         Raises:
             ModelNotFoundError: If model file doesn't exist (local models)
@@ -74,6 +110,7 @@ class Model:
         """
         self._handle: Optional[int] = None
         self._closed = False
+        self._token_counter: Optional[_native.CTokenCounter] = None
         
         # Convert path to string and encode
         path_str = str(path)
@@ -89,6 +126,15 @@ class Model:
             threads=threads,
             api_key=api_key_bytes,
             api_base_url=api_base_url_bytes,
+            cache_type_k=_KV_CACHE_TYPES[cache_type_k],
+            cache_type_v=_KV_CACHE_TYPES[cache_type_v],
+            flash_attn=_FLASH_ATTN_MODES[flash_attn],
+            batch_size=batch_size,
+            ubatch_size=ubatch_size,
+            threads_batch=threads_batch,
+            no_mmap=not use_mmap,
+            use_mlock=use_mlock,
+            stream_usage=stream_usage,
         )
         
         # Create model using appropriate backend
@@ -121,6 +167,7 @@ class Model:
         gpu_layers: int = -1,
         context_size: int = 2048,
         threads: int = 0,
+        **options: Any,
     ) -> Self:
         """
         Create a model from a local GGUF file using llama.cpp backend.
@@ -130,6 +177,9 @@ class Model:
             gpu_layers: GPU layers (-1 for auto, 0 for CPU only)
             context_size: Context window size in tokens
             threads: CPU threads (0 for auto)
+            **options: Memory and speed settings (cache_type_k, cache_type_v,
+                       flash_attn, batch_size, ubatch_size, threads_batch,
+                       use_mmap, use_mlock), see Model()
             
         Returns:
             Model instance
@@ -144,6 +194,7 @@ class Model:
             context_size=context_size,
             threads=threads,
             backend="local",
+            **options,
         )
     
     @classmethod
@@ -153,6 +204,7 @@ class Model:
         api_key: str,
         *,
         context_size: int = 2048,
+        stream_usage: bool = False,
     ) -> Self:
         """
         Create a model using a remote OpenAI-compatible API.
@@ -161,6 +213,8 @@ class Model:
             endpoint: API endpoint URL (e.g., "https://api.openai.com/v1")
             api_key: API key for authentication
             context_size: Context window size in tokens
+            stream_usage: Ask streams to report token usage with
+                          stream_options, which some servers reject
             
         Returns:
             Model instance
@@ -173,6 +227,7 @@ class Model:
             api_key=api_key,
             context_size=context_size,
             backend="remote",
+            stream_usage=stream_usage,
         )
     
     def warmup(self) -> None:
@@ -200,6 +255,15 @@ class Model:
                 - gpu_layers_loaded: Number of layers actually loaded on GPU
                 - memory_usage: Estimated memory usage in bytes
                 - context_size: Configured context window size
+                - draft_tokens_proposed: Tokens proposed by the draft model
+                - draft_tokens_accepted: Proposed tokens the model accepted
+                - cache_type_k, cache_type_v: KV cache types in use
+                - flash_attn: Flash attention mode
+                - batch_size, ubatch_size: Batch sizes in use
+                - threads, threads_batch: Decode and prefill CPU threads
+                - use_mmap, use_mlock: How the weights are held in memory
+                - response_cache_hits, response_cache_misses: Response cache lookups
+                - response_cache_entries: Responses held in memory
                 
         Raises:
             InferenceError: If getting info fails
@@ -215,8 +279,119 @@ class Model:
             "gpu_layers_loaded": info.gpu_layers_loaded,
             "memory_usage": info.memory_usage,
             "context_size": info.context_size,
+            "draft_tokens_proposed": info.draft_tokens_proposed,
+            "draft_tokens_accepted": info.draft_tokens_accepted,
+            "cache_type_k": _KV_CACHE_NAMES.get(info.cache_type_k, "unknown"),
+            "cache_type_v": _KV_CACHE_NAMES.get(info.cache_type_v, "unknown"),
+            "flash_attn": _FLASH_ATTN_NAMES.get(info.flash_attn, "unknown"),
+            "batch_size": info.batch_size,
+            "ubatch_size": info.ubatch_size,
+            "threads": info.threads,
+            "threads_batch": info.threads_batch,
+            "use_mmap": info.use_mmap,
+            "use_mlock": info.use_mlock,
+            "response_cache_hits": info.response_cache_hits,
+            "response_cache_misses": info.response_cache_misses,
+            "response_cache_entries": info.response_cache_entries,
         }
     
+    def count_tokens(self, text: str) -> int:
+        """
+        Count tokens in text the way context accounting does.
+        
+        Local models count exactly with the model's vocabulary; remote
+        models use the counter from set_token_counter() or an estimate.
+        
+        Args:
+            text: Text to count
+            
+        Returns:
+            Number of tokens
+        """
+        self._check_closed()
+        count = ctypes.c_int()
+        error_code = _native._lib.luup_model_count_tokens(
+            self._handle, text.encode('utf-8'), ctypes.byref(count)
+        )
+        check_error(error_code, _native._lib.luup_get_last_error)
+        return count.value
+    
+    def set_token_counter(self, counter: Optional[Callable[[str], int]]) -> None:
+        """
+        Install a tokenizer for context accounting.
+        
+        Useful for remote models, e.g. with tiktoken:
+        ``model.set_token_counter(lambda t: len(enc.encode(t)))``
+        
+        Args:
+            counter: Function returning the token count of a string,
+                     or None to restore the default
+        """
+        self._check_closed()
+        if counter is None:
+            c_counter = _native.CTokenCounter()
+        else:
+            @_native.CTokenCounter
+            def c_counter(text, user_data):
+                try:
+                    return int(counter(text.decode('utf-8', errors='replace')))
+                except Exception:
+                    return len(text) // 4
+        
+        error_code = _native._lib.luup_model_set_token_counter(self._handle, c_counter, None)
+        check_error(error_code, _native._lib.luup_get_last_error)
+        # Keep the ctypes callback alive while the model uses it
+        self._token_counter = c_counter if counter is not None else None
+    
+    def set_draft(self, draft: Optional["Model"], n_draft: int = 0) -> None:
+        """
+        Attach a draft model for speculative decoding.
+        
+        The draft proposes tokens that this model verifies in one batch, so
+        output is unchanged but decoding gets faster when they agree.
+        
+        Args:
+            draft: Smaller local model with the same vocabulary, or None to detach
+            n_draft: Tokens proposed per step (0 = default of 8)
+            
+        Example:
+            >>> model = Model.from_local("qwen-7b.gguf")
+            >>> with Model.from_local("qwen-0.5b.gguf") as draft:
+            ...     model.set_draft(draft)
+        """
+        self._check_closed()
+        draft_handle = None
+        if draft is not None:
+            draft._check_closed()
+            draft_handle = draft._handle
+        error_code = _native._lib.luup_model_set_draft(self._handle, draft_handle, n_draft)
+        check_error(error_code, _native._lib.luup_get_last_error)
+    
+    def set_response_cache(self, max_entries: int, ttl_seconds: int = 0,
+                           disk_dir: Optional[str] = None) -> None:
+        """
+        Cache responses to repeated deterministic requests.
+        
+        Only requests with temperature <= 0 are cached, keyed on the prompt
+        (or messages and tools), sampling parameters and model. Agent turns
+        on local models are not cached, so their KV cache keeps up with the
+        history.
+        
+        Args:
+            max_entries: Responses held in memory (0 disables the cache)
+            ttl_seconds: Lifetime of an entry (0 = no expiry)
+            disk_dir: Directory that also keeps every response across runs
+            
+        Example:
+            >>> model.set_response_cache(256, ttl_seconds=3600, disk_dir=".luup_cache")
+        """
+        self._check_closed()
+        error_code = _native._lib.luup_model_set_response_cache(
+            self._handle, max_entries, ttl_seconds,
+            disk_dir.encode('utf-8') if disk_dir else None
+        )
+        check_error(error_code, _native._lib.luup_get_last_error)
+    
     def close(self) -> None:
         """
         Explicitly close and free model resources.
@@ -13,7 +13,7 @@ if readme_file.exists():
 
 setup(
     name="luup-agent",
-    version="0.1.0",
+    version="0.2.0",
     description="Multi-agent LLM library with tool calling",
     long_description=long_description,
     long_description_content_type="text/markdown",
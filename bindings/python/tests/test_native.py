@@ -0,0 +1,60 @@
+"""
+Tests that the ctypes structures match the C header.
+"""
+
+import ctypes
+import shutil
+import subprocess
+from pathlib import Path
+
+import pytest
+
+from luup_agent import _native
+
+
+HEADER_DIR = Path(__file__).parent.parent.parent.parent / "include"
+
+STRUCTS = {
+    "luup_model_config": _native.CModelConfig,
+    "luup_model_info": _native.CModelInfo,
+    "luup_agent_config": _native.CAgentConfig,
+    "luup_tool": _native.CTool,
+    "luup_tool_metrics": _native.CToolMetrics,
+    "luup_turn_metrics": _native.CTurnMetrics,
+}
+
+
+@pytest.fixture(scope="module")
+def c_layout(tmp_path_factory):
+    """
+    Compile a probe against luup_agent.h and return the sizes and field
+    offsets it reports, keyed by "struct" or "struct.field".
+    """
+    compiler = shutil.which("cc") or shutil.which("gcc") or shutil.which("clang")
+    if not compiler:
+        pytest.skip("No C compiler found")
+    
+    lines = ["#include <stdio.h>", "#include <stddef.h>", "#include <luup_agent.h>", "int main(void) {"]
+    for c_name, py_struct in STRUCTS.items():
+        lines.append(f'    printf("{c_name} %zu\\n", sizeof({c_name}));')
+        for field, _ in py_struct._fields_:
+            lines.append(f'    printf("{c_name}.{field} %zu\\n", offsetof({c_name}, {field}));')
+    lines += ["    return 0;", "}"]
+    
+    tmp = tmp_path_factory.mktemp("layout")
+    source = tmp / "probe.c"
+    source.write_text("\n".join(lines) + "\n")
+    binary = tmp / "probe"
+    subprocess.run([compiler, "-I", str(HEADER_DIR), str(source), "-o", str(binary)], check=True)
+    output = subprocess.run([str(binary)], check=True, capture_output=True, text=True).stdout
+    return {key: int(value) for key, value in (line.split() for line in output.splitlines())}
+
+
+@pytest.mark.parametrize("c_name", list(STRUCTS))
+def test_struct_layout(c_layout, c_name):
+    """Each structure has the C size and every field sits at its C offset."""
+    py_struct = STRUCTS[c_name]
+    
+    assert ctypes.sizeof(py_struct) == c_layout[c_name]
+    for field, _ in py_struct._fields_:
+        assert getattr(py_struct, field).offset == c_layout[f"{c_name}.{field}"], field
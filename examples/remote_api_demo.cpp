@@ -25,9 +25,10 @@
 #include <string>
 
 // Streaming callback
-void stream_callback(const char* token, void* user_data) {
+bool stream_callback(const char* token, void* user_data) {
     printf("%s", token);
     fflush(stdout);
+    return true;  // Keep generating
 }
 
 // Error callback for diagnostics
@@ -4,7 +4,7 @@
  * 
  * Cross-platform C library for LLM inference with multi-agent support and tool calling.
  * 
- * @version 0.1.0
+ * @version 0.2.0
  * @author luup-agent contributors
  * @copyright MIT License
  */
@@ -21,9 +21,14 @@ extern "C" {
 
 // Version information
 #define LUUP_VERSION_MAJOR 0
-#define LUUP_VERSION_MINOR 1
+#define LUUP_VERSION_MINOR 2
 #define LUUP_VERSION_PATCH 0
 
+// Incremented whenever a public struct changes layout. Code that loads the
+// library dynamically (e.g. language bindings) should compare it with
+// luup_abi_version() before passing structs across.
+#define LUUP_ABI_VERSION 4
+
 // Export/Import macros for Windows DLL
 #if defined(_WIN32)
     #ifdef LUUP_EXPORT
@@ -53,7 +58,9 @@ typedef enum {
     LUUP_ERROR_TOOL_NOT_FOUND = -5,      /**< Requested tool not registered */
     LUUP_ERROR_JSON_PARSE_FAILED = -6,   /**< JSON parsing failed */
     LUUP_ERROR_HTTP_FAILED = -7,         /**< HTTP request failed */
-    LUUP_ERROR_BACKEND_INIT_FAILED = -8  /**< Backend initialization failed */
+    LUUP_ERROR_BACKEND_INIT_FAILED = -8, /**< Backend initialization failed */
+    LUUP_ERROR_CONTEXT_OVERFLOW = -9,    /**< Prompt does not fit in the context window */
+    LUUP_ERROR_TOOL_LIMIT = -10          /**< Turn limit reached with tool calls still pending */
 } luup_error_t;
 
 /**
@@ -86,8 +93,31 @@ LUUP_API void luup_set_error_callback(luup_error_callback_t callback, void* user
  */
 typedef struct luup_model luup_model;
 
+/**
+ * @brief KV-cache element type for local models
+ */
+typedef enum {
+    LUUP_KV_CACHE_F16 = 0,         /**< 16-bit floats (default) */
+    LUUP_KV_CACHE_BF16 = 1,        /**< bfloat16 */
+    LUUP_KV_CACHE_F32 = 2,         /**< 32-bit floats, twice the memory of F16 */
+    LUUP_KV_CACHE_Q8_0 = 3,        /**< 8-bit quantized, about half the memory of F16 */
+    LUUP_KV_CACHE_Q4_0 = 4         /**< 4-bit quantized, about a quarter, with some quality loss */
+} luup_kv_cache_type;
+
+/**
+ * @brief Flash attention mode for local models
+ */
+typedef enum {
+    LUUP_FLASH_ATTN_AUTO = 0,      /**< Enable when the device supports it (default) */
+    LUUP_FLASH_ATTN_ON = 1,        /**< Always enable */
+    LUUP_FLASH_ATTN_OFF = 2        /**< Never enable */
+} luup_flash_attn;
+
 /**
  * @brief Model configuration structure
+ * 
+ * Zero-initialized fields take their defaults; luup_model_default_config()
+ * returns a config with every default spelled out.
  */
 typedef struct {
     const char* path;              /**< Path to GGUF file or API endpoint URL */
@@ -96,6 +126,20 @@ typedef struct {
     int threads;                   /**< CPU threads (0 for auto-detect) */
     const char* api_key;           /**< API key for remote models (optional) */
     const char* api_base_url;      /**< Custom API endpoint (optional) */
+    int http_pool_size;            /**< Max idle keep-alive connections for remote models (0 for default: 4) */
+    int http_connect_timeout;      /**< Remote connection timeout in seconds (0 for default: 30) */
+    int http_read_timeout;         /**< Remote read timeout in seconds (0 for default: 120, 300 when streaming) */
+    int max_sequences;             /**< Local: agents that can generate concurrently, batched together (0 for default: 1) */
+    int prefill_chunk_size;        /**< Local: max prompt tokens per request in one decode step (0 for default: n_batch) */
+    luup_kv_cache_type cache_type_k; /**< Local: K cache type (default: F16) */
+    luup_kv_cache_type cache_type_v; /**< Local: V cache type (default: F16; quantized types need flash attention) */
+    luup_flash_attn flash_attn;    /**< Local: flash attention (default: auto) */
+    int batch_size;                /**< Local: logical batch, max tokens per decode call (0 for default: 2048) */
+    int ubatch_size;               /**< Local: physical batch processed at once (0 for default: 512) */
+    int threads_batch;             /**< Local: CPU threads for prompt prefill (0 for default: same as threads) */
+    bool no_mmap;                  /**< Local: read weights into memory instead of memory-mapping the file */
+    bool use_mlock;                /**< Local: lock weights in RAM so they are never paged out */
+    bool stream_usage;             /**< Remote: ask streams for token usage (stream_options), which some servers reject */
 } luup_model_config;
 
 /**
@@ -107,8 +151,28 @@ typedef struct {
     int gpu_layers_loaded;         /**< Actual number of layers loaded on GPU */
     size_t memory_usage;           /**< Estimated memory usage in bytes */
     int context_size;              /**< Configured context window size */
+    size_t draft_tokens_proposed;  /**< Tokens proposed by the draft model (speculative decoding) */
+    size_t draft_tokens_accepted;  /**< Proposed tokens the model accepted */
+    luup_kv_cache_type cache_type_k; /**< K cache type in use */
+    luup_kv_cache_type cache_type_v; /**< V cache type in use */
+    luup_flash_attn flash_attn;    /**< Flash attention mode requested */
+    int batch_size;                /**< Logical batch size in use */
+    int ubatch_size;               /**< Physical batch size in use */
+    int threads;                   /**< CPU threads for decoding */
+    int threads_batch;             /**< CPU threads for prompt prefill */
+    bool use_mmap;                 /**< Weights are memory-mapped */
+    bool use_mlock;                /**< Weights are locked in RAM */
+    size_t response_cache_hits;    /**< Requests answered from the response cache */
+    size_t response_cache_misses;  /**< Cacheable requests that went to the model */
+    size_t response_cache_entries; /**< Responses held in memory */
 } luup_model_info;
 
+/**
+ * @brief Get a model configuration with every field set to its default
+ * @return Configuration to fill in (set at least path)
+ */
+LUUP_API luup_model_config luup_model_default_config(void);
+
 /**
  * @brief Create a local model using llama.cpp backend
  * @param config Model configuration
@@ -127,7 +191,10 @@ LUUP_API luup_model* luup_model_create_remote(const luup_model_config* config);
  * @brief Pre-warm model by running a dummy inference
  * 
  * This reduces first-token latency for subsequent generations.
- * Optional but recommended for better user experience.
+ * Optional but recommended for better user experience. A local model
+ * warms up on a KV-cache sequence no agent is bound to, so it never evicts
+ * an agent's cached prompt; once every sequence is bound, it fails with
+ * LUUP_ERROR_INFERENCE_FAILED. Warm up before agents generate.
  * 
  * @param model Model handle
  * @return LUUP_SUCCESS or error code
@@ -142,6 +209,83 @@ LUUP_API luup_error_t luup_model_warmup(luup_model* model);
  */
 LUUP_API luup_error_t luup_model_get_info(luup_model* model, luup_model_info* out_info);
 
+/**
+ * @brief Attach a draft model for speculative decoding
+ * 
+ * The draft proposes up to n_draft tokens per step and the model verifies
+ * them in a single batch, keeping the ones it would have sampled itself.
+ * Output is unchanged; decoding is faster when the draft often agrees.
+ * Both models must be local and share a vocabulary. The draft's weights
+ * are shared, so its handle may be destroyed once attached.
+ * 
+ * @param model Model handle
+ * @param draft Smaller local model with the same vocabulary, or NULL to detach
+ * @param n_draft Tokens proposed per step (0 = default of 8)
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_model_set_draft(luup_model* model, luup_model* draft, int n_draft);
+
+/**
+ * @brief Cache responses to repeated deterministic requests
+ * 
+ * Requests are keyed on a hash of the final prompt (or messages and tools
+ * for remote models), the sampling parameters and the model identity, and
+ * only cached when sampling is deterministic (temperature <= 0). On local
+ * models agent turns are never cached, since a hit would leave the agent's
+ * KV cache behind its history; only calls outside a turn, such as built-in
+ * summaries, are. Entries
+ * are evicted least-recently-used beyond max_entries and expire after
+ * ttl_seconds. With disk_dir set, responses are also written there, one
+ * file per key, and survive the process; the directory is created if
+ * missing and is not trimmed. Calling again replaces the cache; it may
+ * be called while generating, and generations already running finish
+ * with the cache they started with.
+ * 
+ * @param model Model handle
+ * @param max_entries Responses held in memory (0 to disable the cache)
+ * @param ttl_seconds Lifetime of an entry (0 = no expiry)
+ * @param disk_dir Directory for the on-disk tier, or NULL for memory only
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_model_set_response_cache(luup_model* model, int max_entries,
+                                                    int ttl_seconds, const char* disk_dir);
+
+/**
+ * @brief Token counting callback
+ * @param text Null-terminated text to count
+ * @param user_data User-provided data pointer
+ * @return Number of tokens in text
+ */
+typedef size_t (*luup_token_counter_t)(const char* text, void* user_data);
+
+/**
+ * @brief Set the token counter used for context accounting
+ * 
+ * Local models count exactly with the model's vocabulary. Remote models
+ * fall back to an estimate of one token per 4 characters; install the
+ * provider's tokenizer here for exact counts. A counter set on a local
+ * model replaces the vocabulary count.
+ * 
+ * @param model Model handle
+ * @param counter Counting function, or NULL to restore the default
+ * @param user_data User data passed to counter
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_model_set_token_counter(
+    luup_model* model,
+    luup_token_counter_t counter,
+    void* user_data
+);
+
+/**
+ * @brief Count tokens in text as the model's context accounting does
+ * @param model Model handle
+ * @param text Text to count
+ * @param out_count Receives the token count
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_model_count_tokens(luup_model* model, const char* text, int* out_count);
+
 /**
  * @brief Destroy model and free resources
  * @param model Model handle
@@ -157,17 +301,43 @@ LUUP_API void luup_model_destroy(luup_model* model);
  */
 typedef struct luup_agent luup_agent;
 
+/**
+ * @brief How history is trimmed to fit the agent's context budget
+ * 
+ * System messages and the current turn (the latest user message and the
+ * tool results after it) are never removed.
+ */
+typedef enum {
+    LUUP_CONTEXT_KEEP_ALL = 0,              /**< Never trim history (default) */
+    LUUP_CONTEXT_SLIDING_WINDOW = 1,        /**< Drop the oldest messages first */
+    LUUP_CONTEXT_DROP_TOOL_RESULTS = 2      /**< Drop the oldest tool results first, then the oldest messages */
+} luup_context_strategy;
+
 /**
  * @brief Agent configuration structure
  */
 typedef struct {
     luup_model* model;                  /**< Model to use (can be shared across agents) */
     const char* system_prompt;          /**< System prompt defining agent's role */
-    float temperature;                  /**< Sampling temperature: 0.0 to 2.0 (default: 0.7) */
+    float temperature;                  /**< Sampling temperature: 0.0 (greedy) to 2.0 (default: 0.7) */
     int max_tokens;                     /**< Maximum tokens to generate (0 for no limit) */
     bool enable_tool_calling;           /**< Enable function calling (default: true) */
     bool enable_history_management;     /**< Auto-manage conversation history (default: true) */
     bool enable_builtin_tools;          /**< Auto-register built-in tools (default: true, opt-out) */
+    int top_k;                          /**< Keep the k most likely tokens (0 = disabled) */
+    float top_p;                        /**< Nucleus sampling threshold (0 = disabled) */
+    float min_p;                        /**< Minimum probability relative to the top token (0 = disabled) */
+    float repeat_penalty;               /**< Repetition penalty, e.g. 1.1 (0 = disabled) */
+    unsigned int seed;                  /**< Sampling seed for reproducible output (0 = random) */
+    int max_parallel_tools;             /**< Tool calls from one response run concurrently, up to this many (0/1 = sequential) */
+    int tool_timeout_ms;                /**< Per-call tool timeout in milliseconds (0 = no timeout) */
+    int max_tool_rounds;                /**< Rounds of tool calls executed per turn (default: 5) */
+    int token_budget;                   /**< Tokens generated across all rounds of a turn (0 = no limit) */
+    bool enable_tool_grammar;           /**< Constrain local tool-call JSON to the tool schemas (default: false) */
+    bool compact_tool_schema;           /**< Render tools one per line with minified schemas (default: false) */
+    luup_model* summarizer_model;       /**< Model for built-in summarization (NULL = the agent's model) */
+    luup_context_strategy context_strategy; /**< History trimming strategy (default: keep all) */
+    int context_budget;                 /**< Tokens of history and tool schema to keep (0 = 75% of context) */
 } luup_agent_config;
 
 /**
@@ -192,11 +362,13 @@ typedef char* (*luup_tool_callback_t)(const char* params_json, void* user_data);
  * @brief Streaming callback function type
  * 
  * Called for each generated token during streaming generation.
+ * Tokens are always delivered as complete UTF-8 sequences.
  * 
  * @param token Generated token string
  * @param user_data User-provided data pointer
+ * @return true to continue generation, false to stop early
  */
-typedef void (*luup_stream_callback_t)(const char* token, void* user_data);
+typedef bool (*luup_stream_callback_t)(const char* token, void* user_data);
 
 /**
  * @brief Create a new agent
@@ -223,11 +395,30 @@ LUUP_API luup_error_t luup_agent_register_tool(
     void* user_data
 );
 
+/**
+ * @brief Enable or disable a registered tool
+ * 
+ * Disabled tools are left out of the tool schema shown to the model and
+ * calls to them are rejected. Use this to expose only the tools relevant
+ * to the next turn. Changing the tool set invalidates the cached prompt.
+ * 
+ * @param agent Agent handle
+ * @param tool_name Name of a registered tool
+ * @param enabled Whether the tool is available
+ * @return LUUP_SUCCESS, or LUUP_ERROR_TOOL_NOT_FOUND if not registered
+ */
+LUUP_API luup_error_t luup_agent_set_tool_enabled(
+    luup_agent* agent,
+    const char* tool_name,
+    bool enabled
+);
+
 /**
  * @brief Generate response with streaming
  * 
  * Generates tokens one at a time, calling the callback for each token.
- * Handles tool calling automatically if enabled.
+ * Handles tool calling automatically if enabled. Returning false from the
+ * callback stops generation; the partial response is kept in history.
  * 
  * @param agent Agent handle
  * @param user_message User's input message
@@ -254,12 +445,239 @@ LUUP_API luup_error_t luup_agent_generate_stream(
  */
 LUUP_API char* luup_agent_generate(luup_agent* agent, const char* user_message);
 
+/**
+ * @brief Completion function for a submitted request
+ * 
+ * @param code LUUP_SUCCESS or the error the turn ended with
+ * @param response Final response on success, NULL otherwise (valid during the call)
+ * @param error_message Error message on failure, empty otherwise (valid during the call)
+ * @param user_data User-provided data pointer
+ */
+typedef void (*luup_completion_callback_t)(luup_error_t code, const char* response,
+                                           const char* error_message, void* user_data);
+
+/**
+ * @brief Queue a turn on the shared executor and return immediately
+ * 
+ * Requests to one agent run one at a time in the order submitted; requests
+ * to different agents run in parallel on the executor's threads. The
+ * callbacks run on an executor thread. luup_agent_destroy() waits for the
+ * agent's queued requests; called from one of their callbacks it returns
+ * at once instead and the agent is destroyed after the last of them.
+ * 
+ * @param agent Agent handle
+ * @param user_message User's input message
+ * @param stream_callback Receives the streamed text (NULL to not stream)
+ * @param on_complete Called once the turn has ended (may be NULL)
+ * @param user_data User data to pass to both callbacks
+ * @return LUUP_SUCCESS if queued, or error code
+ */
+LUUP_API luup_error_t luup_agent_submit(
+    luup_agent* agent,
+    const char* user_message,
+    luup_stream_callback_t stream_callback,
+    luup_completion_callback_t on_complete,
+    void* user_data
+);
+
+/**
+ * @brief Set the number of threads of the shared executor
+ * 
+ * Takes effect only before the first request is queued (by
+ * luup_agent_submit() or luup_agent_generate_start()).
+ * 
+ * @param n_threads Worker threads (0 for default: hardware threads, at least 4)
+ * @return LUUP_SUCCESS, or LUUP_ERROR_INVALID_PARAM once the executor is running
+ */
+LUUP_API luup_error_t luup_set_executor_threads(int n_threads);
+
+/**
+ * @brief Handle of a generation running in the background
+ */
+typedef struct luup_generation luup_generation;
+
+/**
+ * @brief State of a background generation, as seen by its reader
+ */
+typedef enum {
+    LUUP_GENERATION_RUNNING = 0,   /**< More text may follow */
+    LUUP_GENERATION_DONE = 1,      /**< Finished and all text read */
+    LUUP_GENERATION_FAILED = 2     /**< Stopped by an error (see luup_generation_error) and all text read */
+} luup_generation_status;
+
+/**
+ * @brief Wake-up function for a background generation
+ * 
+ * Called on the generating thread when text arrives after the reader
+ * drained the buffer, and once when the generation ends. Text arriving
+ * before the next read does not call it again, so a reader woken once
+ * collects a whole batch. Keep it short (e.g. signal an event loop);
+ * it may call luup_generation_read().
+ * 
+ * @param user_data User-provided data pointer
+ */
+typedef void (*luup_generation_notify_t)(void* user_data);
+
+/**
+ * @brief Start generating a response in the background
+ * 
+ * Queues luup_agent_generate_stream() on the shared executor like
+ * luup_agent_submit(), writing the streamed text into a ring buffer of
+ * buffer_size bytes to be collected with luup_generation_read().
+ * Generation pauses while the buffer is full, which keeps an executor
+ * thread waiting, so read generations that have started. Tool callbacks
+ * run on the generating thread.
+ * 
+ * @param agent Agent handle
+ * @param user_message User's input message
+ * @param buffer_size Ring buffer capacity in bytes (0 for default: 64 KiB, at least 4)
+ * @param notify Wake-up function (NULL to only poll or block in read)
+ * @param user_data User data to pass to notify
+ * @return Generation handle (free with luup_generation_free) or NULL on error
+ */
+LUUP_API luup_generation* luup_agent_generate_start(
+    luup_agent* agent,
+    const char* user_message,
+    size_t buffer_size,
+    luup_generation_notify_t notify,
+    void* user_data
+);
+
+/**
+ * @brief Take the text generated so far
+ * 
+ * Copies up to buffer_size bytes of pending text, ending on a UTF-8
+ * sequence boundary, and frees that space for the generator. Not NUL
+ * terminated. Only one thread may read a generation.
+ * 
+ * @param generation Generation handle
+ * @param buffer Receives the text
+ * @param buffer_size Capacity of buffer (at least 4 bytes)
+ * @param out_len Receives the number of bytes copied
+ * @param timeout_ms Wait this long for text when none is pending (0 = don't wait, -1 = no limit)
+ * @return LUUP_GENERATION_RUNNING while more text may follow; DONE or FAILED once it has ended and been read
+ */
+LUUP_API luup_generation_status luup_generation_read(
+    luup_generation* generation,
+    char* buffer,
+    size_t buffer_size,
+    size_t* out_len,
+    int timeout_ms
+);
+
+/**
+ * @brief Ask a generation to stop at the next token
+ * 
+ * The text already generated can still be read; the generation then
+ * ends as DONE.
+ * 
+ * @param generation Generation handle
+ */
+LUUP_API void luup_generation_cancel(luup_generation* generation);
+
+/**
+ * @brief Get how a generation ended
+ * 
+ * @param generation Generation handle
+ * @param out_message Receives the error message, valid until the handle is freed (may be NULL)
+ * @return LUUP_SUCCESS, the generation's error code, or LUUP_ERROR_INVALID_PARAM while it is still running
+ */
+LUUP_API luup_error_t luup_generation_error(luup_generation* generation, const char** out_message);
+
+/**
+ * @brief Cancel a generation if needed, wait for it to stop and free it
+ * 
+ * notify is not called once this returns. Called from notify, it
+ * cancels the generation and returns at once; the handle is freed when
+ * the generation stops.
+ * 
+ * @param generation Generation handle (NULL is a no-op)
+ */
+LUUP_API void luup_generation_free(luup_generation* generation);
+
+/**
+ * @brief Time spent in one tool during a turn
+ */
+typedef struct {
+    const char* name;                   /**< Tool name */
+    int calls;                          /**< Calls made during the turn */
+    double total_ms;                    /**< Wall time across those calls */
+} luup_tool_metrics;
+
+/**
+ * @brief Counts and timings of an agent turn
+ * 
+ * A turn covers every generation of one luup_agent_generate() or
+ * luup_agent_generate_stream() call, including tool follow-ups. Token
+ * counts and times are summed over those generations. Values a backend
+ * can't measure are 0: remote models report token counts only when the
+ * server returns usage (streams only with stream_usage set), local models
+ * have no HTTP timings.
+ */
+typedef struct {
+    int generations;                    /**< Model calls made during the turn */
+    int prompt_tokens;                  /**< Prompt tokens across calls */
+    int cached_tokens;                  /**< Prompt tokens reused from the KV cache */
+    int generated_tokens;               /**< Tokens generated across calls */
+    double prefill_ms;                  /**< Prompt processing time */
+    double decode_ms;                   /**< Generation time after the first token */
+    double decode_tokens_per_sec;       /**< generated_tokens over decode_ms */
+    double ttft_ms;                     /**< Time to first token of the turn's first call */
+    double http_connect_ms;             /**< Connecting (0 for reused connections and streams) */
+    double http_ttfb_ms;                /**< Request sent to response headers (streams include connecting) */
+    int tool_calls;                     /**< Tools executed */
+    double tool_ms;                     /**< Wall time spent executing tools */
+    const luup_tool_metrics* tools;     /**< Per-tool breakdown (valid until the next turn) */
+    int n_tools;                        /**< Entries in tools */
+    double summarization_ms;            /**< Generating summaries applied during the turn */
+    double total_ms;                    /**< Wall time of the whole turn */
+    int cache_hits;                     /**< Generations answered from the response cache */
+    int cache_misses;                   /**< Cacheable generations that ran the model */
+} luup_turn_metrics;
+
+/**
+ * @brief Metrics callback function type
+ * 
+ * Called on the generating thread at the end of each turn, whether it
+ * succeeded or not.
+ * 
+ * @param metrics Metrics of the turn (valid during the call)
+ * @param user_data User-provided data pointer
+ */
+typedef void (*luup_metrics_callback_t)(const luup_turn_metrics* metrics, void* user_data);
+
+/**
+ * @brief Get the metrics of the agent's last turn
+ * 
+ * @param agent Agent handle
+ * @param out_metrics Receives the metrics (all zero before the first turn)
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_agent_get_last_metrics(
+    luup_agent* agent,
+    luup_turn_metrics* out_metrics
+);
+
+/**
+ * @brief Set a callback that receives the metrics of every turn
+ * 
+ * @param agent Agent handle
+ * @param callback Called after each turn (NULL to remove)
+ * @param user_data User data to pass to callback
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_agent_set_metrics_callback(
+    luup_agent* agent,
+    luup_metrics_callback_t callback,
+    void* user_data
+);
+
 /**
  * @brief Manually add a message to conversation history
  * @param agent Agent handle
  * @param role Message role: "user", "assistant", or "system"
  * @param content Message content
- * @return LUUP_SUCCESS or error code
+ * @return LUUP_SUCCESS or error code (LUUP_ERROR_INVALID_PARAM for any other role)
  */
 LUUP_API luup_error_t luup_agent_add_message(
     luup_agent* agent,
@@ -281,6 +699,52 @@ LUUP_API luup_error_t luup_agent_clear_history(luup_agent* agent);
  */
 LUUP_API char* luup_agent_get_history_json(luup_agent* agent);
 
+/**
+ * @brief Save conversation history and KV-cache state to a file
+ * 
+ * For local models the agent's KV-cache sequence is saved with the history,
+ * so luup_agent_load_state() can resume without prefilling it again.
+ * 
+ * @param agent Agent handle
+ * @param path File to write
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_agent_save_state(luup_agent* agent, const char* path);
+
+/**
+ * @brief Restore state saved by luup_agent_save_state()
+ * 
+ * Replaces the agent's history. The file is memory-mapped where supported.
+ * KV-cache state saved from a different model is skipped, and the next
+ * turn prefills the restored history as usual.
+ * 
+ * @param agent Agent handle
+ * @param path File to read
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_agent_load_state(luup_agent* agent, const char* path);
+
+/**
+ * @brief Save conversation history and KV-cache state to a buffer
+ * @param agent Agent handle
+ * @param out_size Receives the buffer size in bytes
+ * @return Buffer (caller must free with luup_free_buffer) or NULL on error
+ */
+LUUP_API void* luup_agent_save_state_buffer(luup_agent* agent, size_t* out_size);
+
+/**
+ * @brief Restore state saved by luup_agent_save_state_buffer()
+ * @param agent Agent handle
+ * @param data Buffer contents
+ * @param size Buffer size in bytes
+ * @return LUUP_SUCCESS or error code
+ */
+LUUP_API luup_error_t luup_agent_load_state_buffer(
+    luup_agent* agent,
+    const void* data,
+    size_t size
+);
+
 /**
  * @brief Enable built-in todo list tool
  * @param agent Agent handle
@@ -307,6 +771,9 @@ LUUP_API luup_error_t luup_agent_enable_builtin_notes(
  * @brief Enable built-in auto-summarization
  * 
  * Automatically summarizes conversation history when context fills.
+ * Summaries are generated in the background when the summarizer is remote
+ * or a local sequence is free to reserve for it (raise max_sequences by
+ * one); otherwise they are generated inside the turn that needs them.
  * 
  * @param agent Agent handle
  * @return LUUP_SUCCESS or error code
@@ -315,6 +782,11 @@ LUUP_API luup_error_t luup_agent_enable_builtin_summarization(luup_agent* agent)
 
 /**
  * @brief Destroy agent and free resources
+ * 
+ * Waits for the agent's queued requests to finish first. From a callback
+ * of one of them, returns at once and the agent is destroyed after the
+ * last one; don't use the handle again either way.
+ * 
  * @param agent Agent handle
  */
 LUUP_API void luup_agent_destroy(luup_agent* agent);
@@ -335,13 +807,22 @@ LUUP_API void luup_agent_destroy(luup_agent* agent);
  */
 LUUP_API void luup_free_string(char* str);
 
+/**
+ * @brief Free buffer allocated by library
+ * 
+ * Use this to free buffers returned by luup_agent_save_state_buffer().
+ * 
+ * @param buffer Buffer to free
+ */
+LUUP_API void luup_free_buffer(void* buffer);
+
 // ============================================================================
 // Version Information
 // ============================================================================
 
 /**
  * @brief Get library version string
- * @return Version string (e.g., "0.1.0")
+ * @return Version string (e.g., "0.2.0")
  */
 LUUP_API const char* luup_version(void);
 
@@ -353,6 +834,12 @@ LUUP_API const char* luup_version(void);
  */
 LUUP_API void luup_version_components(int* major, int* minor, int* patch);
 
+/**
+ * @brief Get the struct layout version the library was built with
+ * @return LUUP_ABI_VERSION of the library
+ */
+LUUP_API int luup_abi_version(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,55 +1,228 @@
 /**
  * @file local_llama.cpp
  * @brief llama.cpp backend integration
+ * 
+ * A model owns one llama_context with several KV-cache sequences. Agents are
+ * bound to a sequence, and a scheduler thread merges the prefill and decode
+ * work of every active generation into a single llama_batch per step.
+ * Callers block on their own request and receive sampled tokens as they are
+ * produced, so stream callbacks still run on the calling thread.
+ * 
+ * Weights are shared: handles created with the same path and GPU settings
+ * reference one llama_model through a process-wide registry and only own
+ * their llama_context.
  */
 
 #include "../../include/luup_agent.h"
 #include "../core/internal.h"
 #include <llama.h>
+#include <ggml-backend.h>
+#include <gguf.h>
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <thread>
+#include <functional>
 
-// Backend data structure for llama.cpp
-struct llama_backend_data {
+// Loaded weights, shared by every backend created with the same load params
+struct llama_shared_model {
     llama_model* model;
+    int n_gpu_layers;    // Layers actually requested at load time
+    
+    llama_shared_model() : model(nullptr), n_gpu_layers(0) {}
+    
+    ~llama_shared_model() {
+        if (model) {
+            llama_model_free(model);
+        }
+    }
+};
+
+// Small model that proposes tokens for the target to verify (speculative
+// decoding). It has its own context with one sequence per target sequence.
+struct llama_draft {
+    std::shared_ptr<llama_shared_model> weights;
     llama_context* ctx;
+    llama_sampler* sampler;   // Greedy
+    llama_batch batch;
+    bool batch_allocated;
+    int n_draft;              // Tokens proposed per decode step
+    
+    // Tokens held in the draft cache, per target sequence
+    std::vector<std::vector<llama_token>> cached;
+    
+    llama_draft() : ctx(nullptr), sampler(nullptr), batch(), batch_allocated(false), n_draft(0) {}
+    
+    ~llama_draft() {
+        if (batch_allocated) {
+            llama_batch_free(batch);
+        }
+        if (sampler) {
+            llama_sampler_free(sampler);
+        }
+        if (ctx) {
+            llama_free(ctx);
+        }
+    }
+};
+
+// A KV-cache sequence that one or more agents are bound to
+struct llama_sequence {
+    llama_seq_id id;
     llama_sampler* sampler;
+    SamplingParams sampler_params;   // Parameters the sampler was built with
+    
+    // Tokens currently held in the KV cache for this sequence, in position
+    // order. Used to reuse the longest common prefix across generations.
+    std::vector<llama_token> cached_tokens;
+    
+    int n_users;   // Agents bound to this sequence
+    bool reserved; // Held by one caller alone; never handed out by acquire
+    bool busy;     // A request is running on this sequence
+    
+    explicit llama_sequence(llama_seq_id seq_id)
+        : id(seq_id), sampler(nullptr), n_users(0), reserved(false), busy(false) {}
+    
+    ~llama_sequence() {
+        if (sampler) {
+            llama_sampler_free(sampler);
+        }
+    }
+};
+
+// One generation submitted to the scheduler
+struct llama_request {
+    llama_sequence* seq;
+    std::vector<llama_token> prompt;
+    SamplingParams sampling;
+    int max_tokens;
+    bool discard_after;      // Drop the sequence's cache when finished (warmup)
+    
+    // Scheduler-side state
+    size_t n_prompt_done;    // Prompt tokens already in the KV cache
+    size_t n_chunk;          // Prompt tokens submitted in the current batch
+    bool has_pending;        // A sampled token is waiting to be decoded
+    llama_token pending;
+    int n_generated;
+    int batch_idx;           // Logits index in the current batch, or -1
+    bool admitted;           // Owns seq->busy
+    std::vector<llama_token> drafted;   // Draft tokens verified in the current batch
+    
+    // Shared with the calling thread (guarded by llama_backend_data::mutex)
+    std::vector<llama_token> output;
+    bool done;
+    bool failed;
+    bool cancelled;
+    std::string error;
+    std::condition_variable cv;
+    
+    
+    // Timeline for GenerationStats (guarded like the fields above)
+    size_t n_cached;         // Prompt tokens reused at admission
+    std::chrono::steady_clock::time_point t_admitted;
+    std::chrono::steady_clock::time_point t_first_token;
+    std::chrono::steady_clock::time_point t_done;
+    
+    llama_request()
+        : seq(nullptr), max_tokens(0), discard_after(false),
+          n_prompt_done(0), n_chunk(0), has_pending(false), pending(0),
+          n_generated(0), batch_idx(-1), admitted(false),
+          done(false), failed(false), cancelled(false), n_cached(0) {}
+};
+
+// Sequence state I/O, run by the scheduler while no batch is decoding and
+// the sequence (if any) has no request in flight
+struct llama_state_job {
+    llama_sequence* seq;
+    std::function<bool(std::string& error)> run;
+    bool done;
+    bool ok;
+    std::string error;
+    std::condition_variable cv;
+    
+    llama_state_job() : seq(nullptr), done(false), ok(false) {}
+};
+
+// Backend data structure for llama.cpp
+struct llama_backend_data {
+    std::shared_ptr<llama_shared_model> weights;
+    llama_model* model;      // weights->model
+    llama_context* ctx;
     std::string device_type;
     int gpu_layers_loaded;
     size_t memory_usage;
+    LlamaBackendParams params;   // As resolved at init
+    
+    std::vector<std::unique_ptr<llama_sequence>> sequences;
+    int n_ctx_seq;           // Context window available to each sequence
+    size_t prefill_chunk;    // Max prompt tokens per request in one step
+    
+    // Scheduler state
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<llama_request>> pending;
+    std::deque<std::shared_ptr<llama_state_job>> state_jobs;
+    std::thread scheduler;
+    bool running;
+    llama_batch batch;
+    bool batch_allocated;
+    
+    // Speculative decoding (scheduler thread only, swapped through a state job)
+    std::unique_ptr<llama_draft> draft;
+    size_t n_drafted;        // Draft tokens proposed (guarded by mutex)
+    size_t n_accepted;       // Draft tokens the target agreed with
     
     llama_backend_data() 
-        : model(nullptr), ctx(nullptr), sampler(nullptr),
-          device_type("CPU"), gpu_layers_loaded(0), memory_usage(0) {}
+        : model(nullptr), ctx(nullptr),
+          device_type("CPU"), gpu_layers_loaded(0), memory_usage(0),
+          n_ctx_seq(0), prefill_chunk(0), running(false), batch(), batch_allocated(false),
+          n_drafted(0), n_accepted(0) {}
     
     ~llama_backend_data() {
-        if (sampler) {
-            llama_sampler_free(sampler);
+        if (scheduler.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running = false;
+            }
+            cv.notify_all();
+            scheduler.join();
+        }
+        if (batch_allocated) {
+            llama_batch_free(batch);
         }
+        sequences.clear();
+        draft.reset();
         if (ctx) {
             llama_free(ctx);
         }
-        if (model) {
-            llama_model_free(model);
-        }
+        // The context is gone, so the weights can be released
+        model = nullptr;
+        weights.reset();
     }
 };
 
 namespace {
     // Global initialization flag
-    bool llama_initialized = false;
+    std::once_flag llama_init_flag;
     
     // Initialize llama.cpp backend once
     void ensure_llama_initialized() {
-        if (!llama_initialized) {
-            llama_backend_init();
-            llama_initialized = true;
-        }
+        std::call_once(llama_init_flag, [] { llama_backend_init(); });
     }
     
+    // Registry of loaded weights keyed by path and load params. Entries are
+    // weak so the weights are freed with the last backend that uses them.
+    std::mutex model_registry_mutex;
+    std::map<std::string, std::weak_ptr<llama_shared_model>> model_registry;
+    
     // Detect available GPU backend
     std::string detect_gpu_backend() {
 #if defined(__APPLE__) && defined(GGML_USE_METAL)
@@ -65,18 +238,814 @@ namespace {
 #endif
     }
     
-    // Auto-detect optimal number of GPU layers
-    int auto_detect_gpu_layers(llama_model* model) {
-        // Get total layers in model
-        int n_layers = llama_model_n_layer(model);
+    // Layer count and weight sizes read from GGUF metadata
+    struct gguf_layer_info {
+        int n_layer;
+        size_t layer_bytes;   // Average size of one repeating block
+        size_t other_bytes;   // Embeddings, output head and other non-block tensors
+        
+        gguf_layer_info() : n_layer(0), layer_bytes(0), other_bytes(0) {}
+    };
+    
+    // Read layer info from the GGUF header without loading any tensor data
+    bool read_gguf_layer_info(const char* path, gguf_layer_info& out) {
+        gguf_init_params params;
+        params.no_alloc = true;
+        params.ctx = nullptr;
+        
+        gguf_context* gguf = gguf_init_from_file(path, params);
+        if (!gguf) {
+            return false;
+        }
         
-        // Try to offload all layers to GPU if available
-        std::string backend = detect_gpu_backend();
-        if (backend != "CPU") {
-            return n_layers;
+        // Block count is stored under "<arch>.block_count"
+        int64_t arch_key = gguf_find_key(gguf, "general.architecture");
+        if (arch_key >= 0 && gguf_get_kv_type(gguf, arch_key) == GGUF_TYPE_STRING) {
+            std::string key = std::string(gguf_get_val_str(gguf, arch_key)) + ".block_count";
+            int64_t n_layer_key = gguf_find_key(gguf, key.c_str());
+            if (n_layer_key >= 0) {
+                switch (gguf_get_kv_type(gguf, n_layer_key)) {
+                    case GGUF_TYPE_UINT32:
+                        out.n_layer = static_cast<int>(gguf_get_val_u32(gguf, n_layer_key));
+                        break;
+                    case GGUF_TYPE_INT32:
+                        out.n_layer = gguf_get_val_i32(gguf, n_layer_key);
+                        break;
+                    case GGUF_TYPE_UINT64:
+                        out.n_layer = static_cast<int>(gguf_get_val_u64(gguf, n_layer_key));
+                        break;
+                    default:
+                        break;
+                }
+            }
         }
         
-        return 0;
+        // Repeating blocks are named "blk.<N>.*"
+        size_t block_bytes = 0;
+        int64_t n_tensors = gguf_get_n_tensors(gguf);
+        for (int64_t i = 0; i < n_tensors; i++) {
+            size_t size = gguf_get_tensor_size(gguf, i);
+            if (strncmp(gguf_get_tensor_name(gguf, i), "blk.", 4) == 0) {
+                block_bytes += size;
+            } else {
+                out.other_bytes += size;
+            }
+        }
+        if (out.n_layer > 0) {
+            out.layer_bytes = block_bytes / out.n_layer;
+        }
+        
+        gguf_free(gguf);
+        return out.n_layer > 0;
+    }
+    
+    // Free memory summed over all GPU devices (0 if there are none)
+    size_t free_gpu_memory() {
+        size_t total_free = 0;
+        for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+            ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+            if (ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_GPU) {
+                size_t free = 0;
+                size_t total = 0;
+                ggml_backend_dev_memory(dev, &free, &total);
+                total_free += free;
+            }
+        }
+        return total_free;
+    }
+    
+    // Auto-detect how many layers fit in free VRAM
+    int auto_detect_gpu_layers(const char* model_path) {
+        size_t free_vram = free_gpu_memory();
+        if (free_vram == 0) {
+            return 0;
+        }
+        
+        gguf_layer_info info;
+        if (!read_gguf_layer_info(model_path, info) || info.layer_bytes == 0) {
+            // Unknown layout: offload everything and let llama.cpp clamp it
+            return 999;
+        }
+        
+        // Keep headroom for the KV cache and compute buffers
+        const size_t min_reserve = 512ull * 1024 * 1024;
+        size_t reserve = std::max(free_vram / 10, min_reserve);
+        if (free_vram <= reserve + info.other_bytes) {
+            return 0;
+        }
+        
+        size_t budget = free_vram - reserve - info.other_bytes;
+        size_t n_fit = budget / info.layer_bytes;
+        return static_cast<int>(std::min(n_fit, static_cast<size_t>(info.n_layer)));
+    }
+    
+    // Tokenize text with the model's vocab (returns empty vector on failure)
+    std::vector<llama_token> tokenize(const llama_vocab* vocab, const char* text, bool add_special) {
+        int n_text = static_cast<int>(strlen(text));
+        int n_tokens = -llama_tokenize(vocab, text, n_text, nullptr, 0, add_special, true);
+        if (n_tokens <= 0) {
+            return {};
+        }
+        
+        std::vector<llama_token> tokens(n_tokens);
+        if (llama_tokenize(vocab, text, n_text, tokens.data(), n_tokens, add_special, true) < 0) {
+            return {};
+        }
+        return tokens;
+    }
+    
+    // Length of the longest prefix of text that doesn't end in the middle of
+    // a UTF-8 sequence. Pieces can split multi-byte characters across tokens.
+    size_t utf8_complete_length(const std::string& text) {
+        size_t len = text.size();
+        
+        // Walk back over at most 3 continuation bytes to find a lead byte
+        size_t i = len;
+        int n_cont = 0;
+        while (i > 0 && n_cont < 3 &&
+               (static_cast<unsigned char>(text[i - 1]) & 0xC0) == 0x80) {
+            i--;
+            n_cont++;
+        }
+        if (i == 0) {
+            return len;
+        }
+        
+        unsigned char lead = static_cast<unsigned char>(text[i - 1]);
+        int expected = 0;
+        if ((lead & 0x80) == 0x00) {
+            expected = 0;
+        } else if ((lead & 0xE0) == 0xC0) {
+            expected = 1;
+        } else if ((lead & 0xF0) == 0xE0) {
+            expected = 2;
+        } else if ((lead & 0xF8) == 0xF0) {
+            expected = 3;
+        } else {
+            return len; // Invalid lead byte, nothing to wait for
+        }
+        
+        return n_cont < expected ? i - 1 : len;
+    }
+    
+    // Drop everything a sequence holds in the KV cache
+    void reset_sequence(llama_backend_data* backend, llama_sequence* seq) {
+        llama_memory_seq_rm(llama_get_memory(backend->ctx), seq->id, -1, -1);
+        seq->cached_tokens.clear();
+    }
+    
+    // Shortest run of cached tokens worth moving with a KV shift
+    constexpr size_t kv_shift_min_chunk = 64;
+    
+    // After the common prefix, move cached runs that reappear later in the
+    // prompt down to their new positions. This keeps the cache when history
+    // was trimmed at the front (the dropped span is removed from the cache
+    // and the rest shifted down) instead of re-decoding everything after it.
+    // Returns the new number of prompt tokens in the cache.
+    size_t shift_kv_chunks(llama_backend_data* backend, llama_sequence* seq,
+                           const std::vector<llama_token>& tokens, size_t n_past) {
+        auto& cached = seq->cached_tokens;
+        llama_memory_t mem = llama_get_memory(backend->ctx);
+        if (!llama_memory_can_shift(mem)) {
+            return n_past;
+        }
+        
+        size_t head_c = n_past;   // Cache cursor
+        size_t head_p = n_past;   // Prompt cursor
+        while (head_c < cached.size() && head_p < tokens.size()) {
+            size_t n_match = 0;
+            while (head_c + n_match < cached.size() && head_p + n_match < tokens.size() &&
+                   cached[head_c + n_match] == tokens[head_p + n_match]) {
+                n_match++;
+            }
+            
+            if (n_match < kv_shift_min_chunk) {
+                head_c++;
+                continue;
+            }
+            
+            // Drop the gap and slide the run down to where the prompt wants it
+            llama_pos shift = static_cast<llama_pos>(head_p) - static_cast<llama_pos>(head_c);
+            llama_memory_seq_rm(mem, seq->id, static_cast<llama_pos>(head_p),
+                                static_cast<llama_pos>(head_c));
+            llama_memory_seq_add(mem, seq->id, static_cast<llama_pos>(head_c),
+                                 static_cast<llama_pos>(head_c + n_match), shift);
+            std::copy(cached.begin() + head_c, cached.begin() + head_c + n_match,
+                      cached.begin() + head_p);
+            head_c += n_match;
+            head_p += n_match;
+        }
+        
+        // Cached tokens from head_c on now hold stale positions
+        if (head_p != n_past) {
+            llama_memory_seq_rm(mem, seq->id, static_cast<llama_pos>(head_p), -1);
+            cached.resize(head_p);
+        }
+        return head_p;
+    }
+    
+    // Prepare a sequence for a new prompt by keeping the longest common
+    // prefix with the previous generation (plus any shifted chunks) and
+    // removing the diverging tail. Returns the number of prompt tokens that
+    // are already in the cache.
+    size_t reuse_kv_prefix(llama_backend_data* backend, llama_sequence* seq,
+                           const std::vector<llama_token>& tokens) {
+        auto& cached = seq->cached_tokens;
+        
+        size_t n_past = 0;
+        while (n_past < cached.size() && n_past < tokens.size() &&
+               cached[n_past] == tokens[n_past]) {
+            n_past++;
+        }
+        if (n_past < cached.size() && n_past < tokens.size()) {
+            n_past = shift_kv_chunks(backend, seq, tokens, n_past);
+        }
+        
+        // Always re-decode at least the last prompt token so we get fresh logits
+        if (n_past == tokens.size() && n_past > 0) {
+            n_past--;
+        }
+        
+        if (n_past < cached.size()) {
+            llama_memory_t mem = llama_get_memory(backend->ctx);
+            if (!llama_memory_seq_rm(mem, seq->id, static_cast<llama_pos>(n_past), -1)) {
+                // Partial removal not supported (e.g. recurrent models)
+                reset_sequence(backend, seq);
+                return 0;
+            }
+            cached.resize(n_past);
+        }
+        
+        return n_past;
+    }
+    
+    // Append a token to the batch for one sequence
+    void batch_add(llama_batch& batch, llama_token token, llama_pos pos,
+                   llama_seq_id seq_id, bool logits) {
+        int i = batch.n_tokens;
+        batch.token[i] = token;
+        batch.pos[i] = pos;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = seq_id;
+        batch.logits[i] = logits;
+        batch.n_tokens++;
+    }
+    
+    // Mark a request finished and wake its caller (mutex must be held)
+    void finish_request(llama_backend_data* backend, llama_request& req,
+                        bool failed, const char* error) {
+        if (req.admitted) {
+            if (req.discard_after || failed) {
+                reset_sequence(backend, req.seq);
+            }
+            req.seq->busy = false;
+            req.admitted = false;
+        }
+        req.done = true;
+        req.t_done = std::chrono::steady_clock::now();
+        req.failed = failed;
+        if (error) {
+            req.error = error;
+        }
+        req.cv.notify_all();
+    }
+    
+    // Build a sampler chain for the given parameters
+    llama_sampler* create_sampler(const llama_vocab* vocab, const SamplingParams& params) {
+        llama_sampler* sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+        
+        // The grammar goes first so later stages only see allowed tokens.
+        // It stays inactive until the output starts a tool-call object.
+        if (!params.grammar.empty()) {
+            const char* triggers[] = { R"([\s\S]*?(\{\s*"tool_calls")[\s\S]*)" };
+            llama_sampler* grammar = llama_sampler_init_grammar_lazy_patterns(
+                vocab, params.grammar.c_str(), "root", triggers, 1, nullptr, 0);
+            if (grammar) {
+                llama_sampler_chain_add(sampler, grammar);
+            }
+        }
+        if (params.repeat_penalty > 0.0f && params.repeat_penalty != 1.0f) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_penalties(
+                64, params.repeat_penalty, 0.0f, 0.0f));  // Last 64 tokens
+        }
+        if (params.temperature <= 0.0f) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+            return sampler;
+        }
+        if (params.top_k > 0) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_top_k(params.top_k));
+        }
+        if (params.top_p > 0.0f && params.top_p < 1.0f) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_top_p(params.top_p, 1));
+        }
+        if (params.min_p > 0.0f) {
+            llama_sampler_chain_add(sampler, llama_sampler_init_min_p(params.min_p, 1));
+        }
+        llama_sampler_chain_add(sampler, llama_sampler_init_temp(params.temperature));
+        llama_sampler_chain_add(sampler, llama_sampler_init_dist(
+            params.seed != 0 ? params.seed : LLAMA_DEFAULT_SEED));
+        return sampler;
+    }
+    
+    // Make the sequence's sampler match a request. The chain is rebuilt
+    // only when the parameters change; otherwise it is reset so penalty
+    // history and the RNG start fresh and seeded runs are reproducible.
+    void prepare_sampler(const llama_vocab* vocab, llama_sequence& seq,
+                         const SamplingParams& params) {
+        if (seq.sampler && seq.sampler_params == params) {
+            llama_sampler_reset(seq.sampler);
+            return;
+        }
+        if (seq.sampler) {
+            llama_sampler_free(seq.sampler);
+        }
+        seq.sampler = create_sampler(vocab, params);
+        seq.sampler_params = params;
+    }
+    
+    // Greedily draft up to n_max tokens continuing a sequence's cached tokens
+    // plus its pending token. The draft cache only decodes what changed since
+    // the last call. Runs on the scheduler thread.
+    void draft_propose(llama_draft& draft, const llama_vocab* vocab, llama_seq_id seq_id,
+                       const std::vector<llama_token>& cached, llama_token pending,
+                       int n_max, std::vector<llama_token>& out) {
+        out.clear();
+        auto& held = draft.cached[seq_id];
+        llama_memory_t mem = llama_get_memory(draft.ctx);
+        const size_t n_total = cached.size() + 1;
+        auto token_at = [&](size_t i) { return i < cached.size() ? cached[i] : pending; };
+        
+        // Keep the common prefix, but always decode the last token again
+        // since its logits are what the first draft is sampled from
+        size_t n_past = 0;
+        while (n_past + 1 < n_total && n_past < held.size() && held[n_past] == token_at(n_past)) {
+            n_past++;
+        }
+        llama_memory_seq_rm(mem, seq_id, static_cast<llama_pos>(n_past), -1);
+        held.resize(n_past);
+        
+        const size_t n_batch = llama_n_batch(draft.ctx);
+        while (held.size() < n_total) {
+            size_t start = held.size();
+            size_t n = std::min(n_batch, n_total - start);
+            draft.batch.n_tokens = 0;
+            for (size_t k = 0; k < n; k++) {
+                batch_add(draft.batch, token_at(start + k), static_cast<llama_pos>(start + k),
+                          seq_id, start + k == n_total - 1);
+            }
+            if (llama_decode(draft.ctx, draft.batch) != 0) {
+                llama_memory_seq_rm(mem, seq_id, -1, -1);
+                held.clear();
+                return;
+            }
+            for (size_t k = 0; k < n; k++) {
+                held.push_back(token_at(start + k));
+            }
+        }
+        
+        for (int i = 0; i < n_max; i++) {
+            llama_token token = llama_sampler_sample(draft.sampler, draft.ctx, -1);
+            out.push_back(token);
+            if (i + 1 == n_max || llama_vocab_is_eog(vocab, token)) {
+                break;
+            }
+            draft.batch.n_tokens = 0;
+            batch_add(draft.batch, token, static_cast<llama_pos>(held.size()), seq_id, true);
+            if (llama_decode(draft.ctx, draft.batch) != 0) {
+                break;
+            }
+            held.push_back(token);
+        }
+    }
+    
+    // Scheduler loop: every step decodes one token for each generating
+    // request and fills the rest of the batch with pending prompt tokens.
+    void run_scheduler(llama_backend_data* backend) {
+        std::vector<std::shared_ptr<llama_request>> active;
+        const llama_vocab* vocab = llama_model_get_vocab(backend->model);
+        const size_t n_batch = llama_n_batch(backend->ctx);
+        llama_batch& batch = backend->batch;
+        
+        std::unique_lock<std::mutex> lock(backend->mutex);
+        while (true) {
+            backend->cv.wait(lock, [&] {
+                return !backend->running || !active.empty() || !backend->pending.empty() ||
+                       !backend->state_jobs.empty();
+            });
+            if (!backend->running) {
+                break;
+            }
+            
+            // State I/O goes first so a save or restore isn't starved by
+            // requests queued behind it
+            for (auto it = backend->state_jobs.begin(); it != backend->state_jobs.end();) {
+                auto& job = *it;
+                if (job->seq && job->seq->busy) {
+                    ++it;
+                    continue;
+                }
+                job->ok = job->run(job->error);
+                job->done = true;
+                job->cv.notify_all();
+                it = backend->state_jobs.erase(it);
+            }
+            
+            // Admit queued requests whose sequence is idle
+            for (auto it = backend->pending.begin(); it != backend->pending.end();) {
+                auto& req = *it;
+                if (req->cancelled) {
+                    finish_request(backend, *req, false, nullptr);
+                    it = backend->pending.erase(it);
+                } else if (!req->seq->busy) {
+                    req->seq->busy = true;
+                    req->admitted = true;
+                    prepare_sampler(vocab, *req->seq, req->sampling);
+                    req->n_prompt_done = reuse_kv_prefix(backend, req->seq, req->prompt);
+                    req->n_cached = req->n_prompt_done;
+                    req->t_admitted = std::chrono::steady_clock::now();
+                    active.push_back(req);
+                    it = backend->pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            
+            // Retire requests cancelled by their caller
+            for (auto& req : active) {
+                if (req->cancelled) {
+                    finish_request(backend, *req, false, nullptr);
+                }
+            }
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [](const std::shared_ptr<llama_request>& r) { return r->done; }),
+                         active.end());
+            if (active.empty()) {
+                continue;
+            }
+            
+            // Let the draft model propose continuations for generating
+            // requests. Only this thread touches the caches and the draft,
+            // so the lock isn't needed while it runs.
+            if (backend->draft) {
+                lock.unlock();
+                for (auto& req : active) {
+                    req->drafted.clear();
+                    if (!req->has_pending) {
+                        continue;
+                    }
+                    int n_room = backend->n_ctx_seq - static_cast<int>(req->seq->cached_tokens.size()) - 2;
+                    int n_max = std::min({backend->draft->n_draft,
+                                          req->max_tokens - req->n_generated - 1, n_room});
+                    if (n_max > 0) {
+                        draft_propose(*backend->draft, vocab, req->seq->id, req->seq->cached_tokens,
+                                      req->pending, n_max, req->drafted);
+                    }
+                }
+                lock.lock();
+            }
+            
+            // Build one batch: decode steps first to keep token latency low,
+            // then prompt prefill in the remaining space. Long prompts are
+            // split into chunks so they interleave with other requests.
+            batch.n_tokens = 0;
+            for (auto& req : active) {
+                req->batch_idx = -1;
+                req->n_chunk = 0;
+                if (req->has_pending && static_cast<size_t>(batch.n_tokens) < n_batch) {
+                    llama_pos pos = static_cast<llama_pos>(req->seq->cached_tokens.size());
+                    batch_add(batch, req->pending, pos, req->seq->id, true);
+                    req->batch_idx = batch.n_tokens - 1;
+                    
+                    // Drafted tokens follow the pending one, all with logits
+                    size_t room = n_batch - static_cast<size_t>(batch.n_tokens);
+                    if (req->drafted.size() > room) {
+                        req->drafted.resize(room);
+                    }
+                    for (size_t k = 0; k < req->drafted.size(); k++) {
+                        batch_add(batch, req->drafted[k], pos + 1 + static_cast<llama_pos>(k),
+                                  req->seq->id, true);
+                    }
+                } else {
+                    req->drafted.clear();
+                }
+            }
+            for (auto& req : active) {
+                size_t remaining = req->prompt.size() - req->n_prompt_done;
+                size_t room = n_batch - static_cast<size_t>(batch.n_tokens);
+                if (remaining == 0 || room == 0) {
+                    continue;
+                }
+                
+                req->n_chunk = std::min({remaining, room, backend->prefill_chunk});
+                llama_pos pos = static_cast<llama_pos>(req->seq->cached_tokens.size());
+                for (size_t k = 0; k < req->n_chunk; k++) {
+                    size_t idx = req->n_prompt_done + k;
+                    bool last = (idx == req->prompt.size() - 1);
+                    batch_add(batch, req->prompt[idx], pos + static_cast<llama_pos>(k),
+                              req->seq->id, last);
+                }
+                if (req->n_prompt_done + req->n_chunk == req->prompt.size()) {
+                    req->batch_idx = batch.n_tokens - 1;
+                }
+            }
+            if (batch.n_tokens == 0) {
+                continue;
+            }
+            
+            // Decode without holding the lock so callers can queue work
+            lock.unlock();
+            int rc = llama_decode(backend->ctx, batch);
+            lock.lock();
+            
+            if (rc != 0) {
+                // The cache may be partially written, don't trust it next time
+                for (auto& req : active) {
+                    if (req->n_chunk > 0 || req->batch_idx >= 0) {
+                        finish_request(backend, *req, true, "Failed to decode batch");
+                    }
+                }
+                active.erase(std::remove_if(active.begin(), active.end(),
+                                            [](const std::shared_ptr<llama_request>& r) { return r->done; }),
+                             active.end());
+                continue;
+            }
+            
+            // Record what was decoded and sample the next token per request
+            for (auto& req : active) {
+                auto& cached = req->seq->cached_tokens;
+                if (req->n_chunk > 0) {
+                    auto first = req->prompt.begin() + static_cast<std::ptrdiff_t>(req->n_prompt_done);
+                    cached.insert(cached.end(), first, first + static_cast<std::ptrdiff_t>(req->n_chunk));
+                    req->n_prompt_done += req->n_chunk;
+                } else if (req->batch_idx >= 0) {
+                    cached.push_back(req->pending);
+                    req->has_pending = false;
+                }
+                
+                if (req->batch_idx < 0) {
+                    continue;
+                }
+                
+                // Sample after the pending token, then after each drafted
+                // token for as long as the target agrees with the draft. The
+                // sampler sees exactly the emitted tokens, so the output is
+                // what plain decoding would have sampled.
+                size_t n_accepted = 0;
+                int idx = req->batch_idx;
+                while (true) {
+                    llama_token token = llama_sampler_sample(req->seq->sampler, backend->ctx, idx);
+                    if (llama_vocab_is_eog(vocab, token)) {
+                        finish_request(backend, *req, false, nullptr);
+                        break;
+                    }
+                    
+                    if (req->output.empty()) {
+                        req->t_first_token = std::chrono::steady_clock::now();
+                    }
+                    req->output.push_back(token);
+                    req->n_generated++;
+                    
+                    // Stop at the token limit or when the sequence has no room left
+                    if (req->n_generated >= req->max_tokens ||
+                        cached.size() + 1 >= static_cast<size_t>(backend->n_ctx_seq)) {
+                        finish_request(backend, *req, false, nullptr);
+                        break;
+                    }
+                    if (n_accepted < req->drafted.size() && token == req->drafted[n_accepted]) {
+                        cached.push_back(token);   // Already decoded as a draft
+                        n_accepted++;
+                        idx++;
+                        continue;
+                    }
+                    
+                    req->pending = token;
+                    req->has_pending = true;
+                    req->cv.notify_all();
+                    break;
+                }
+                
+                if (!req->drafted.empty()) {
+                    // Rejected drafts sit in the KV cache past the accepted ones
+                    llama_memory_seq_rm(llama_get_memory(backend->ctx), req->seq->id,
+                                        static_cast<llama_pos>(cached.size()), -1);
+                    backend->n_drafted += req->drafted.size();
+                    backend->n_accepted += n_accepted;
+                    req->drafted.clear();
+                }
+            }
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [](const std::shared_ptr<llama_request>& r) { return r->done; }),
+                         active.end());
+        }
+        
+        // Shutting down: release every waiting caller
+        for (auto& req : active) {
+            finish_request(backend, *req, true, "Model is being destroyed");
+        }
+        for (auto& req : backend->pending) {
+            finish_request(backend, *req, true, "Model is being destroyed");
+        }
+        backend->pending.clear();
+        for (auto& job : backend->state_jobs) {
+            job->error = "Model is being destroyed";
+            job->done = true;
+            job->cv.notify_all();
+        }
+        backend->state_jobs.clear();
+    }
+    
+    // Run sequence state I/O on the scheduler thread and wait for it
+    bool run_state_job(llama_backend_data* backend, llama_sequence* seq,
+                       std::function<bool(std::string& error)> run) {
+        auto job = std::make_shared<llama_state_job>();
+        job->seq = seq;
+        job->run = std::move(run);
+        
+        std::unique_lock<std::mutex> lock(backend->mutex);
+        if (!backend->running) {
+            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "Model scheduler is not running");
+            return false;
+        }
+        backend->state_jobs.push_back(job);
+        backend->cv.notify_all();
+        job->cv.wait(lock, [&] { return job->done; });
+        
+        if (!job->ok) {
+            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, job->error.c_str());
+        }
+        return job->ok;
+    }
+    
+    // Identifies the weights a saved sequence belongs to
+    std::string model_fingerprint(const llama_model* model) {
+        char desc[256];
+        llama_model_desc(model, desc, sizeof(desc));
+        return std::string(desc) + "|" + std::to_string(llama_model_n_params(model)) +
+               "|" + std::to_string(llama_vocab_n_tokens(llama_model_get_vocab(model)));
+    }
+    
+    void append_u32(std::vector<uint8_t>& out, uint32_t value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+    
+    bool read_u32(const uint8_t*& data, const uint8_t* end, uint32_t& value) {
+        if (static_cast<size_t>(end - data) < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, data, sizeof(value));
+        data += sizeof(value);
+        return true;
+    }
+    
+    // Submit a request and block until it finishes, streaming pieces to the
+    // callback on the calling thread. Returns false if the request failed.
+    bool run_request(llama_backend_data* backend, const std::shared_ptr<llama_request>& req,
+                     std::string& response, luup_stream_callback_t callback, void* user_data) {
+        const llama_vocab* vocab = llama_model_get_vocab(backend->model);
+        const auto t_submit = std::chrono::steady_clock::now();
+        
+        std::unique_lock<std::mutex> lock(backend->mutex);
+        if (!backend->running) {
+            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "Model scheduler is not running");
+            return false;
+        }
+        backend->pending.push_back(req);
+        backend->cv.notify_all();
+        
+        size_t n_read = 0;
+        size_t n_streamed = 0;  // Bytes of response already sent to callback
+        bool cancelled = false;
+        std::vector<llama_token> fresh;
+        
+        while (true) {
+            req->cv.wait(lock, [&] { return req->done || req->output.size() > n_read; });
+            fresh.assign(req->output.begin() + static_cast<std::ptrdiff_t>(n_read), req->output.end());
+            n_read = req->output.size();
+            bool done = req->done;
+            lock.unlock();
+            
+            for (llama_token token : fresh) {
+                if (cancelled) {
+                    break;
+                }
+                
+                // Decode token to text
+                char buf[256];
+                int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
+                if (n > 0) {
+                    response.append(buf, n);
+                }
+                
+                // Stream complete UTF-8 characters only
+                if (callback) {
+                    size_t n_complete = utf8_complete_length(response);
+                    if (n_complete > n_streamed) {
+                        std::string piece = response.substr(n_streamed, n_complete - n_streamed);
+                        n_streamed = n_complete;
+                        if (!callback(piece.c_str(), user_data)) {
+                            cancelled = true;
+                        }
+                    }
+                }
+            }
+            
+            lock.lock();
+            if (cancelled && !req->cancelled) {
+                req->cancelled = true;
+                backend->cv.notify_all();
+            }
+            if (done) {
+                break;
+            }
+        }
+        
+        bool failed = req->failed;
+        std::string error = req->error;
+        
+        // Without output, prefill ran until the request finished
+        using ms = std::chrono::duration<double, std::milli>;
+        GenerationStats& stats = luup_last_generation_stats();
+        stats.prompt_tokens = static_cast<int>(req->prompt.size());
+        stats.cached_tokens = static_cast<int>(req->n_cached);
+        stats.generated_tokens = static_cast<int>(req->output.size());
+        if (req->t_admitted != std::chrono::steady_clock::time_point()) {
+            auto t_first = req->output.empty() ? req->t_done : req->t_first_token;
+            stats.prefill_ms = ms(t_first - req->t_admitted).count();
+            stats.decode_ms = ms(req->t_done - t_first).count();
+            stats.ttft_ms = ms(t_first - t_submit).count();
+        }
+        lock.unlock();
+        
+        if (failed) {
+            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, error.c_str());
+            return false;
+        }
+        
+        // Flush any trailing bytes held back at a character boundary
+        if (callback && !cancelled && n_streamed < response.size()) {
+            callback(response.c_str() + n_streamed, user_data);
+        }
+        return true;
+    }
+    
+    // Load weights, or reuse them if another backend already holds them.
+    // gpu_layers is the value from the config, so auto (-1) handles share.
+    std::shared_ptr<llama_shared_model> acquire_shared_model(const char* model_path,
+                                                             int gpu_layers,
+                                                             bool use_mmap, bool use_mlock) {
+        std::string key = std::string(model_path) + "|" + std::to_string(gpu_layers) +
+                          "|" + (use_mmap ? "mmap" : "read") + (use_mlock ? "|mlock" : "");
+        
+        // Hold the lock across the load so concurrent creators of the same
+        // model wait for one load instead of each doing their own
+        std::lock_guard<std::mutex> lock(model_registry_mutex);
+        auto it = model_registry.find(key);
+        if (it != model_registry.end()) {
+            if (auto existing = it->second.lock()) {
+                return existing;
+            }
+        }
+        
+        llama_model_params model_params = llama_model_default_params();
+        model_params.use_mmap = use_mmap;
+        model_params.use_mlock = use_mlock;
+        
+        // Configure GPU layers. Auto mode reads the layout from GGUF metadata
+        // so the weights are only loaded once.
+        if (gpu_layers == -1) {
+            model_params.n_gpu_layers = auto_detect_gpu_layers(model_path);
+        } else {
+            model_params.n_gpu_layers = gpu_layers;
+        }
+        
+        auto shared = std::make_shared<llama_shared_model>();
+        shared->model = llama_model_load_from_file(model_path, model_params);
+        if (!shared->model) {
+            return nullptr;
+        }
+        shared->n_gpu_layers = model_params.n_gpu_layers;
+        
+        // Drop entries whose weights have already been freed
+        for (auto entry = model_registry.begin(); entry != model_registry.end();) {
+            entry = entry->second.expired() ? model_registry.erase(entry) : std::next(entry);
+        }
+        model_registry[key] = shared;
+        return shared;
+    }
+    
+    ggml_type to_ggml_type(luup_kv_cache_type type) {
+        switch (type) {
+            case LUUP_KV_CACHE_BF16: return GGML_TYPE_BF16;
+            case LUUP_KV_CACHE_F32: return GGML_TYPE_F32;
+            case LUUP_KV_CACHE_Q8_0: return GGML_TYPE_Q8_0;
+            case LUUP_KV_CACHE_Q4_0: return GGML_TYPE_Q4_0;
+            default: return GGML_TYPE_F16;
+        }
+    }
+    
+    bool is_quantized(luup_kv_cache_type type) {
+        return type == LUUP_KV_CACHE_Q8_0 || type == LUUP_KV_CACHE_Q4_0;
     }
     
     // Check if file exists
@@ -91,10 +1060,16 @@ namespace {
 }
 
 // Initialize llama.cpp backend with given model
-void* llama_backend_init(const char* model_path, int gpu_layers, 
-                         int context_size, int threads) {
+void* llama_backend_init(const char* model_path, const LlamaBackendParams& params) {
     ensure_llama_initialized();
     
+    // llama.cpp only supports a quantized V cache with flash attention
+    if (is_quantized(params.cache_type_v) && params.flash_attn == LUUP_FLASH_ATTN_OFF) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM,
+                       "A quantized V cache requires flash attention");
+        return nullptr;
+    }
+    
     // Check if model file exists
     if (!file_exists(model_path)) {
         luup_set_error(LUUP_ERROR_MODEL_NOT_FOUND, 
@@ -105,39 +1080,48 @@ void* llama_backend_init(const char* model_path, int gpu_layers,
     try {
         auto backend = new llama_backend_data();
         
-        // Set up model parameters
-        llama_model_params model_params = llama_model_default_params();
-        
-        // Configure GPU layers
-        if (gpu_layers == -1) {
-            // Auto-detect: load model first to count layers
-            llama_model* temp_model = llama_model_load_from_file(model_path, model_params);
-            if (!temp_model) {
-                luup_set_error(LUUP_ERROR_BACKEND_INIT_FAILED, 
-                              "Failed to load model for GPU layer detection");
-                delete backend;
-                return nullptr;
-            }
-            model_params.n_gpu_layers = auto_detect_gpu_layers(temp_model);
-            llama_model_free(temp_model);
-        } else {
-            model_params.n_gpu_layers = gpu_layers;
-        }
-        
-        // Load model
-        backend->model = llama_model_load_from_file(model_path, model_params);
-        if (!backend->model) {
+        // Load model, sharing weights with other handles where possible
+        backend->weights = acquire_shared_model(model_path, params.gpu_layers,
+                                                params.use_mmap, params.use_mlock);
+        if (!backend->weights) {
             luup_set_error(LUUP_ERROR_BACKEND_INIT_FAILED, 
                           "Failed to load model from file");
             delete backend;
             return nullptr;
         }
+        backend->model = backend->weights->model;
+        
+        // Set up context parameters. Every sequence gets the full context
+        // window, so agents sharing the model don't shrink each other's.
+        int n_ctx_seq = params.context_size > 0 ? params.context_size : 2048;
+        int n_seq = params.n_sequences > 0 ? params.n_sequences : 1;
         
-        // Set up context parameters
         llama_context_params ctx_params = llama_context_default_params();
-        ctx_params.n_ctx = context_size > 0 ? context_size : 2048;
-        ctx_params.n_threads = threads > 0 ? threads : std::thread::hardware_concurrency();
-        ctx_params.n_threads_batch = ctx_params.n_threads;
+        ctx_params.n_ctx = static_cast<uint32_t>(n_ctx_seq) * n_seq;
+        ctx_params.n_seq_max = n_seq;
+        ctx_params.n_threads = params.threads > 0
+            ? params.threads
+            : static_cast<int32_t>(std::thread::hardware_concurrency());
+        ctx_params.n_threads_batch = params.threads_batch > 0 ? params.threads_batch
+                                                              : ctx_params.n_threads;
+        if (params.batch_size > 0) {
+            ctx_params.n_batch = params.batch_size;
+        }
+        if (params.prefill_chunk_size > 0 &&
+            static_cast<uint32_t>(params.prefill_chunk_size) > ctx_params.n_batch) {
+            ctx_params.n_batch = params.prefill_chunk_size;  // A chunk must fit in one batch
+        }
+        if (params.ubatch_size > 0) {
+            ctx_params.n_ubatch = params.ubatch_size;
+        }
+        ctx_params.n_ubatch = std::min(ctx_params.n_ubatch, ctx_params.n_batch);
+        ctx_params.type_k = to_ggml_type(params.cache_type_k);
+        ctx_params.type_v = to_ggml_type(params.cache_type_v);
+        switch (params.flash_attn) {
+            case LUUP_FLASH_ATTN_ON: ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED; break;
+            case LUUP_FLASH_ATTN_OFF: ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED; break;
+            default: ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_AUTO; break;
+        }
         
         // Create context
         backend->ctx = llama_init_from_model(backend->model, ctx_params);
@@ -147,17 +1131,40 @@ void* llama_backend_init(const char* model_path, int gpu_layers,
             delete backend;
             return nullptr;
         }
+        backend->n_ctx_seq = n_ctx_seq;
+        backend->prefill_chunk = params.prefill_chunk_size > 0
+            ? static_cast<size_t>(params.prefill_chunk_size)
+            : llama_n_batch(backend->ctx);
+        
+        // Record what the context actually uses
+        backend->params = params;
+        backend->params.context_size = n_ctx_seq;
+        backend->params.n_sequences = n_seq;
+        backend->params.threads = llama_n_threads(backend->ctx);
+        backend->params.threads_batch = llama_n_threads_batch(backend->ctx);
+        backend->params.batch_size = static_cast<int>(llama_n_batch(backend->ctx));
+        backend->params.ubatch_size = static_cast<int>(llama_n_ubatch(backend->ctx));
+        backend->params.gpu_layers = backend->weights->n_gpu_layers;
+        
+        // One slot per sequence, each with its own sampler state
+        for (int i = 0; i < n_seq; i++) {
+            auto seq = std::make_unique<llama_sequence>(i);
+            seq->sampler = create_sampler(llama_model_get_vocab(backend->model),
+                                          seq->sampler_params);
+            backend->sequences.push_back(std::move(seq));
+        }
+        
+        // Batch large enough for a full llama_decode call
+        backend->batch = llama_batch_init(static_cast<int32_t>(llama_n_batch(backend->ctx)), 0, 1);
+        backend->batch_allocated = true;
         
-        // Create sampler with default parameters
-        backend->sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
-        llama_sampler_chain_add(backend->sampler, 
-                               llama_sampler_init_temp(0.7f)); // Default temperature
-        llama_sampler_chain_add(backend->sampler,
-                               llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+        // Start the scheduler
+        backend->running = true;
+        backend->scheduler = std::thread(run_scheduler, backend);
         
         // Store backend info
         backend->device_type = detect_gpu_backend();
-        backend->gpu_layers_loaded = model_params.n_gpu_layers;
+        backend->gpu_layers_loaded = backend->weights->n_gpu_layers;
         
         // Estimate memory usage
         size_t model_size = llama_model_size(backend->model);
@@ -166,7 +1173,7 @@ void* llama_backend_init(const char* model_path, int gpu_layers,
         
         luup_clear_error();
         return backend;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
         return nullptr;
@@ -201,6 +1208,91 @@ bool llama_backend_get_info(void* backend_data, const char** device,
     return true;
 }
 
+// Settings the backend was created with, after defaults
+void llama_backend_get_params(void* backend_data, LlamaBackendParams* out_params) {
+    if (backend_data && out_params) {
+        *out_params = static_cast<llama_backend_data*>(backend_data)->params;
+    }
+}
+
+// Bind a caller to the least used sequence that isn't reserved
+int llama_backend_acquire_sequence(void* backend_data) {
+    if (!backend_data) {
+        return -1;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    std::lock_guard<std::mutex> lock(backend->mutex);
+    
+    llama_sequence* best = nullptr;
+    for (auto& seq : backend->sequences) {
+        if (seq->reserved) {
+            continue;
+        }
+        if (!best || seq->n_users < best->n_users) {
+            best = seq.get();
+        }
+    }
+    if (!best) {
+        return -1;
+    }
+    
+    best->n_users++;
+    return best->id;
+}
+
+// Reserve a sequence no caller is bound to for one caller alone. Another
+// sequence is kept for agents unless none is bound yet (a model used only
+// by its reserving callers). -1 when there is none to spare.
+int llama_backend_reserve_sequence(void* backend_data) {
+    if (!backend_data) {
+        return -1;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    std::lock_guard<std::mutex> lock(backend->mutex);
+    
+    llama_sequence* unused = nullptr;
+    int n_shared = 0;
+    bool bound = false;
+    for (auto& seq : backend->sequences) {
+        if (seq->reserved) {
+            continue;
+        }
+        n_shared++;
+        bound = bound || seq->n_users > 0;
+        if (!unused && seq->n_users == 0) {
+            unused = seq.get();
+        }
+    }
+    if (!unused || (bound && n_shared < 2)) {
+        return -1;
+    }
+    
+    unused->reserved = true;
+    unused->n_users = 1;
+    return unused->id;
+}
+
+// Unbind a caller from its sequence (or give up its reservation)
+void llama_backend_release_sequence(void* backend_data, int seq_id) {
+    if (!backend_data) {
+        return;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    std::lock_guard<std::mutex> lock(backend->mutex);
+    if (seq_id >= 0 && seq_id < static_cast<int>(backend->sequences.size())) {
+        auto& seq = backend->sequences[seq_id];
+        if (seq->n_users > 0) {
+            seq->n_users--;
+        }
+        if (seq->n_users == 0) {
+            seq->reserved = false;
+        }
+    }
+}
+
 // Perform warmup inference
 bool llama_backend_warmup(void* backend_data) {
     if (!backend_data) {
@@ -210,144 +1302,103 @@ bool llama_backend_warmup(void* backend_data) {
     
     auto backend = static_cast<llama_backend_data*>(backend_data);
     
+    // Warm up on a sequence no agent is bound to: dropping the warmup's
+    // cache afterwards would evict an agent's cached prompt. It stays bound
+    // meanwhile so agents created now pick another one when they can.
+    llama_sequence* seq = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(backend->mutex);
+        for (auto& candidate : backend->sequences) {
+            if (candidate->n_users == 0 && !candidate->reserved) {
+                seq = candidate.get();
+                seq->n_users++;
+                break;
+            }
+        }
+    }
+    if (!seq) {
+        luup_set_error(LUUP_ERROR_INFERENCE_FAILED,
+                       "Every sequence is bound to an agent; warm up before agents generate");
+        return false;
+    }
+    
+    bool ok = false;
     try {
-        // Tokenize a simple warmup prompt
-        const char* warmup_prompt = "Hello";
-        std::vector<llama_token> tokens;
-        
         // Get vocab from model
         const llama_vocab* vocab = llama_model_get_vocab(backend->model);
         
-        // Tokenize
-        int n_tokens = llama_tokenize(
-            vocab,
-            warmup_prompt,
-            strlen(warmup_prompt),
-            nullptr,
-            0,
-            true,  // add_special
-            true   // parse_special
-        );
-        
-        if (n_tokens <= 0) {
+        // Run a one-token generation, then drop the sequence's cache since
+        // warmup output is not part of any conversation
+        auto req = std::make_shared<llama_request>();
+        req->seq = seq;
+        req->prompt = tokenize(vocab, "Hello", true);
+        req->max_tokens = 1;
+        req->discard_after = true;
+        std::string response;
+        if (req->prompt.empty()) {
             luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "Failed to tokenize warmup prompt");
-            return false;
-        }
-        
-        tokens.resize(n_tokens);
-        llama_tokenize(
-            vocab,
-            warmup_prompt,
-            strlen(warmup_prompt),
-            tokens.data(),
-            tokens.size(),
-            true,
-            true
-        );
-        
-        // Create batch
-        llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
-        
-        // Decode (process prompt)
-        if (llama_decode(backend->ctx, batch) != 0) {
-            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "Failed to decode warmup prompt");
-            return false;
+        } else if (run_request(backend, req, response, nullptr, nullptr)) {
+            ok = true;
         }
-        
-        // Sample one token
-        llama_token new_token = llama_sampler_sample(backend->sampler, backend->ctx, -1);
-        
-        // Note: KV cache will be cleared at start of next generation
-        
-        luup_clear_error();
-        return true;
-        
+        // Otherwise the error is already set by run_request
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_INFERENCE_FAILED, e.what());
-        return false;
     }
+    
+    llama_backend_release_sequence(backend, seq->id);
+    if (ok) {
+        luup_clear_error();
+    }
+    return ok;
 }
 
-// Generate text (basic implementation)
-char* llama_backend_generate(void* backend_data, const char* prompt, 
-                             float temperature, int max_tokens) {
+// Generate text, optionally streaming each piece to a callback
+char* llama_backend_generate_stream(void* backend_data, int seq_id, const char* prompt,
+                                    const SamplingParams& sampling, int max_tokens,
+                                    luup_stream_callback_t callback,
+                                    void* user_data) {
     if (!backend_data || !prompt) {
         luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
         return nullptr;
     }
     
     auto backend = static_cast<llama_backend_data*>(backend_data);
+    if (seq_id < 0 || seq_id >= static_cast<int>(backend->sequences.size())) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid sequence id");
+        return nullptr;
+    }
     
+    luup_last_generation_stats().reset();
     try {
-        // Note: For simplicity, we create fresh context for each generation
-        // In production, you'd want to manage KV cache more efficiently
-        
         // Get vocab from model
         const llama_vocab* vocab = llama_model_get_vocab(backend->model);
         
         // Tokenize prompt
-        std::vector<llama_token> tokens;
-        int n_tokens = llama_tokenize(
-            vocab,
-            prompt,
-            strlen(prompt),
-            nullptr,
-            0,
-            true,
-            true
-        );
-        
-        if (n_tokens <= 0) {
+        auto req = std::make_shared<llama_request>();
+        req->seq = backend->sequences[seq_id].get();
+        req->prompt = tokenize(vocab, prompt, true);
+        req->sampling = sampling;
+        req->max_tokens = max_tokens > 0 ? max_tokens : 512;
+        if (req->prompt.empty()) {
             luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "Failed to tokenize prompt");
             return nullptr;
         }
         
-        tokens.resize(n_tokens);
-        llama_tokenize(
-            vocab,
-            prompt,
-            strlen(prompt),
-            tokens.data(),
-            tokens.size(),
-            true,
-            true
-        );
-        
-        // Process prompt
-        llama_batch batch = llama_batch_get_one(tokens.data(), tokens.size());
-        if (llama_decode(backend->ctx, batch) != 0) {
-            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "Failed to decode prompt");
+        // Leave room for at least one generated token
+        if (req->prompt.size() >= static_cast<size_t>(backend->n_ctx_seq)) {
+            std::string msg = "Prompt is " + std::to_string(req->prompt.size()) +
+                              " tokens but the context window is " +
+                              std::to_string(backend->n_ctx_seq) + " tokens";
+            luup_set_error(LUUP_ERROR_CONTEXT_OVERFLOW, msg.c_str());
             return nullptr;
         }
         
-        // Generate tokens
+        // The scheduler reuses the cached prefix and only decodes the suffix
         std::string response;
-        int n_generated = 0;
-        int max_gen = max_tokens > 0 ? max_tokens : 512;
-        
-        while (n_generated < max_gen) {
-            // Sample next token
-            llama_token new_token = llama_sampler_sample(backend->sampler, backend->ctx, -1);
-            
-            // Check for EOS
-            if (llama_vocab_is_eog(vocab, new_token)) {
-                break;
-            }
-            
-            // Decode token to text
-            char buf[256];
-            int n = llama_token_to_piece(vocab, new_token, buf, sizeof(buf), 0, true);
-            if (n > 0) {
-                response.append(buf, n);
-            }
-            
-            // Prepare next batch with single token
-            batch = llama_batch_get_one(&new_token, 1);
-            if (llama_decode(backend->ctx, batch) != 0) {
-                break;
-            }
-            
-            n_generated++;
+        if (!run_request(backend, req, response, callback, user_data)) {
+            // Error already set by run_request
+            return nullptr;
         }
         
         // Allocate and return result
@@ -359,10 +1410,208 @@ char* llama_backend_generate(void* backend_data, const char* prompt,
         
         luup_clear_error();
         return result;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_INFERENCE_FAILED, e.what());
         return nullptr;
     }
 }
 
+// Attach a draft model for speculative decoding, or detach it (NULL)
+bool llama_backend_set_draft(void* backend_data, void* draft_data, int n_draft) {
+    if (!backend_data) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid backend data");
+        return false;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    std::unique_ptr<llama_draft> draft;
+    
+    if (draft_data) {
+        auto source = static_cast<llama_backend_data*>(draft_data);
+        const llama_vocab* vocab = llama_model_get_vocab(backend->model);
+        const llama_vocab* draft_vocab = llama_model_get_vocab(source->model);
+        if (llama_vocab_n_tokens(vocab) != llama_vocab_n_tokens(draft_vocab) ||
+            llama_vocab_bos(vocab) != llama_vocab_bos(draft_vocab) ||
+            llama_vocab_eos(vocab) != llama_vocab_eos(draft_vocab)) {
+            luup_set_error(LUUP_ERROR_INVALID_PARAM,
+                           "Draft model vocabulary does not match the target model");
+            return false;
+        }
+        
+        // The draft gets its own context shaped like the target's, so every
+        // target sequence has a draft sequence with the same id. The weights
+        // are shared, so the draft's own handle may be destroyed afterwards.
+        draft = std::make_unique<llama_draft>();
+        draft->weights = source->weights;
+        draft->n_draft = n_draft > 0 ? n_draft : 8;
+        
+        llama_context_params ctx_params = llama_context_default_params();
+        ctx_params.n_ctx = llama_n_ctx(backend->ctx);
+        ctx_params.n_seq_max = static_cast<uint32_t>(backend->sequences.size());
+        ctx_params.n_batch = llama_n_batch(backend->ctx);
+        ctx_params.n_threads = llama_n_threads(backend->ctx);
+        ctx_params.n_threads_batch = llama_n_threads_batch(backend->ctx);
+        ctx_params.n_ubatch = llama_n_ubatch(backend->ctx);
+        ctx_params.type_k = to_ggml_type(backend->params.cache_type_k);
+        ctx_params.type_v = to_ggml_type(backend->params.cache_type_v);
+        if (backend->params.flash_attn == LUUP_FLASH_ATTN_ON) {
+            ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        } else if (backend->params.flash_attn == LUUP_FLASH_ATTN_OFF) {
+            ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+        }
+        draft->ctx = llama_init_from_model(draft->weights->model, ctx_params);
+        if (!draft->ctx) {
+            luup_set_error(LUUP_ERROR_BACKEND_INIT_FAILED, "Failed to create draft context");
+            return false;
+        }
+        draft->sampler = llama_sampler_init_greedy();
+        draft->batch = llama_batch_init(static_cast<int32_t>(llama_n_batch(draft->ctx)), 0, 1);
+        draft->batch_allocated = true;
+        draft->cached.resize(backend->sequences.size());
+    }
+    
+    // Swap on the scheduler thread; the old draft is freed here afterwards
+    bool ok = run_state_job(backend, nullptr, [&](std::string&) {
+        backend->draft.swap(draft);
+        backend->n_drafted = 0;
+        backend->n_accepted = 0;
+        return true;
+    });
+    if (ok) {
+        luup_clear_error();
+    }
+    return ok;
+}
+
+// Draft tokens proposed and accepted since the draft was attached
+void llama_backend_get_draft_stats(void* backend_data, size_t* n_drafted, size_t* n_accepted) {
+    *n_drafted = 0;
+    *n_accepted = 0;
+    if (!backend_data) {
+        return;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    std::lock_guard<std::mutex> lock(backend->mutex);
+    *n_drafted = backend->n_drafted;
+    *n_accepted = backend->n_accepted;
+}
+
+// Serialize a sequence: model fingerprint, cached tokens, then llama's
+// own sequence state
+bool llama_backend_save_sequence(void* backend_data, int seq_id, std::vector<uint8_t>& out) {
+    if (!backend_data) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid backend data");
+        return false;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    if (seq_id < 0 || seq_id >= static_cast<int>(backend->sequences.size())) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid sequence id");
+        return false;
+    }
+    llama_sequence* seq = backend->sequences[seq_id].get();
+    
+    return run_state_job(backend, seq, [&](std::string& error) {
+        std::string fingerprint = model_fingerprint(backend->model);
+        out.clear();
+        append_u32(out, static_cast<uint32_t>(fingerprint.size()));
+        out.insert(out.end(), fingerprint.begin(), fingerprint.end());
+        append_u32(out, static_cast<uint32_t>(seq->cached_tokens.size()));
+        const uint8_t* tokens = reinterpret_cast<const uint8_t*>(seq->cached_tokens.data());
+        out.insert(out.end(), tokens, tokens + seq->cached_tokens.size() * sizeof(llama_token));
+        
+        size_t header = out.size();
+        size_t n_state = llama_state_seq_get_size(backend->ctx, seq->id);
+        out.resize(header + n_state);
+        size_t n_written = llama_state_seq_get_data(backend->ctx, out.data() + header,
+                                                    n_state, seq->id);
+        if (n_written == 0 && n_state > 0) {
+            error = "Failed to read sequence state";
+            return false;
+        }
+        out.resize(header + n_written);
+        return true;
+    });
+}
+
+// Restore a sequence written by llama_backend_save_sequence. Fails, leaving
+// the sequence empty, if it was saved from different weights.
+bool llama_backend_load_sequence(void* backend_data, int seq_id, const uint8_t* data, size_t size) {
+    if (!backend_data || !data) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return false;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    if (seq_id < 0 || seq_id >= static_cast<int>(backend->sequences.size())) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid sequence id");
+        return false;
+    }
+    llama_sequence* seq = backend->sequences[seq_id].get();
+    
+    const uint8_t* end = data + size;
+    uint32_t n_fingerprint = 0;
+    uint32_t n_tokens = 0;
+    if (!read_u32(data, end, n_fingerprint) || static_cast<size_t>(end - data) < n_fingerprint) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Truncated sequence state");
+        return false;
+    }
+    std::string fingerprint(reinterpret_cast<const char*>(data), n_fingerprint);
+    data += n_fingerprint;
+    if (fingerprint != model_fingerprint(backend->model)) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Sequence state was saved from a different model");
+        return false;
+    }
+    if (!read_u32(data, end, n_tokens) ||
+        static_cast<size_t>(end - data) < n_tokens * sizeof(llama_token)) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Truncated sequence state");
+        return false;
+    }
+    if (n_tokens >= static_cast<uint32_t>(backend->n_ctx_seq)) {
+        luup_set_error(LUUP_ERROR_CONTEXT_OVERFLOW, "Saved sequence does not fit in the context window");
+        return false;
+    }
+    std::vector<llama_token> tokens(n_tokens);
+    memcpy(tokens.data(), data, n_tokens * sizeof(llama_token));
+    data += n_tokens * sizeof(llama_token);
+    
+    return run_state_job(backend, seq, [&](std::string& error) {
+        reset_sequence(backend, seq);
+        if (n_tokens == 0) {
+            return true;
+        }
+        if (llama_state_seq_set_data(backend->ctx, data, static_cast<size_t>(end - data), seq->id) == 0) {
+            reset_sequence(backend, seq);
+            error = "Failed to restore sequence state";
+            return false;
+        }
+        seq->cached_tokens = std::move(tokens);
+        return true;
+    });
+}
+
+// Count tokens in text with the model's vocab, without special tokens
+int llama_backend_count_tokens(void* backend_data, const char* text, size_t len) {
+    if (!backend_data || !text) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    
+    auto backend = static_cast<llama_backend_data*>(backend_data);
+    const llama_vocab* vocab = llama_model_get_vocab(backend->model);
+    
+    // A zero-sized buffer makes llama_tokenize return minus the required count
+    int n_tokens = llama_tokenize(vocab, text, static_cast<int32_t>(len), nullptr, 0, false, true);
+    return n_tokens < 0 ? -n_tokens : n_tokens;
+}
+
+// Generate text (blocking)
+char* llama_backend_generate(void* backend_data, int seq_id, const char* prompt,
+                             const SamplingParams& sampling, int max_tokens) {
+    return llama_backend_generate_stream(backend_data, seq_id, prompt, sampling,
+                                         max_tokens, nullptr, nullptr);
+}
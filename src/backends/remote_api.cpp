@@ -11,24 +11,15 @@
 #include <sstream>
 #include <memory>
 #include <regex>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
 #include <cstring>
 
 using json = nlohmann::json;
 
-// Backend data structure for remote API
-struct openai_backend_data {
-    std::string api_endpoint;
-    std::string api_key;
-    std::string model_name;
-    int context_size;
-    
-    openai_backend_data(const char* endpoint, const char* key, const char* model, int ctx_size)
-        : api_endpoint(endpoint ? endpoint : "https://api.openai.com/v1"),
-          api_key(key ? key : ""),
-          model_name(model ? model : "gpt-4"),
-          context_size(ctx_size > 0 ? ctx_size : 8192) {}
-};
-
 namespace {
     // Parse URL into components
     struct ParsedURL {
@@ -42,7 +33,7 @@ namespace {
     
     bool parse_url(const std::string& url, ParsedURL& out) {
         // Simple URL parser for https://host:port/path format
-        std::regex url_regex(R"(^(https?)://([^:/]+)(?::(\d+))?(/.*)?$)");
+        static const std::regex url_regex(R"(^(https?)://([^:/]+)(?::(\d+))?(/.*)?$)");
         std::smatch match;
         
         if (std::regex_match(url, match, url_regex)) {
@@ -63,28 +54,148 @@ namespace {
     }
     
     // Parse SSE (Server-Sent Events) data line
-    std::string parse_sse_data(const std::string& line) {
-        if (line.find("data: ") == 0) {
-            return line.substr(6); // Skip "data: " prefix
+    // Returns false if the line is not a data field
+    bool parse_sse_data(const char* line, size_t len, std::string& out) {
+        if (len < 5 || strncmp(line, "data:", 5) != 0) {
+            return false;
         }
-        return "";
+        size_t start = 5;
+        if (start < len && line[start] == ' ') {
+            start++; // Single optional space after the colon
+        }
+        out.assign(line + start, len - start);
+        return true;
+    }
+    
+    // Incremental SSE parser: bytes are fed as they arrive and complete
+    // "data:" payloads are passed to on_data. The line buffer is reused
+    // across chunks so memory stays bounded by the longest line.
+    class SSEParser {
+    public:
+        template <typename Fn>
+        bool feed(const char* data, size_t len, Fn&& on_data) {
+            buffer_.append(data, len);
+            
+            size_t start = 0;
+            size_t newline_pos;
+            bool keep_going = true;
+            while (keep_going &&
+                   (newline_pos = buffer_.find('\n', start)) != std::string::npos) {
+                size_t end = newline_pos;
+                if (end > start && buffer_[end - 1] == '\r') {
+                    end--;
+                }
+                
+                if (end > start && parse_sse_data(buffer_.data() + start, end - start, data_)) {
+                    keep_going = on_data(data_);
+                }
+                start = newline_pos + 1;
+            }
+            
+            buffer_.erase(0, start);
+            return keep_going;
+        }
+    
+    private:
+        std::string buffer_;
+        std::string data_;
+    };
+    
+    // Add optional sampling fields. Only those in the OpenAI schema are sent,
+    // since strict endpoints reject unknown parameters.
+    void add_sampling_params(json& request_body, const SamplingParams& sampling) {
+        if (sampling.top_p > 0.0f && sampling.top_p < 1.0f) {
+            request_body["top_p"] = sampling.top_p;
+        }
+        if (sampling.seed != 0) {
+            request_body["seed"] = sampling.seed;
+        }
+    }
+    
+    // Native tool calls in our text format, {"tool_calls": [{"id", "name", "parameters"}]},
+    // so they go through the same detection as calls written by the model.
+    // The ids let the agent answer each call with a "tool" message.
+    std::string format_native_tool_calls(const json& tool_calls) {
+        std::vector<ToolCall> calls;
+        for (const auto& tc : tool_calls) {
+            if (!tc.contains("function") || !tc["function"].contains("name") ||
+                !tc["function"]["name"].is_string()) {
+                continue;
+            }
+            const json& function = tc["function"];
+            ToolCall call;
+            if (tc.contains("id") && tc["id"].is_string()) {
+                call.id = tc["id"].get<std::string>();
+            }
+            call.tool_name = function["name"].get<std::string>();
+            
+            // Arguments are a JSON-encoded string; kept as a string if it isn't JSON
+            call.parameters_json = "{}";
+            if (function.contains("arguments") && function["arguments"].is_string() &&
+                !function["arguments"].get_ref<const std::string&>().empty()) {
+                call.parameters_json = function["arguments"].get<std::string>();
+            }
+            calls.push_back(call);
+        }
+        return format_tool_calls(calls);
     }
     
-    // Extract content from streaming chunk
-    std::string extract_streaming_content(const std::string& json_str) {
+    // Streamed tool calls arrive as fragments keyed by index, with the
+    // arguments string split across chunks
+    struct StreamedToolCalls {
+        json calls = json::array();
+        
+        void add(const json& deltas) {
+            for (const auto& delta : deltas) {
+                size_t index = delta.value("index", static_cast<size_t>(0));
+                while (calls.size() <= index) {
+                    calls.push_back({{"function", {{"name", ""}, {"arguments", ""}}}});
+                }
+                json& call = calls[index];
+                if (delta.contains("id") && delta["id"].is_string()) {
+                    call["id"] = delta["id"];
+                }
+                if (!delta.contains("function")) {
+                    continue;
+                }
+                const json& function = delta["function"];
+                if (function.contains("name") && function["name"].is_string()) {
+                    call["function"]["name"] = call["function"]["name"].get<std::string>() +
+                                               function["name"].get<std::string>();
+                }
+                if (function.contains("arguments") && function["arguments"].is_string()) {
+                    call["function"]["arguments"] = call["function"]["arguments"].get<std::string>() +
+                                                    function["arguments"].get<std::string>();
+                }
+            }
+        }
+    };
+    
+    // Extract content from streaming chunk, collecting tool call fragments.
+    // A chunk carrying "usage" (the last one, when the request asked for it)
+    // is kept in usage_chunk.
+    std::string extract_streaming_content(const std::string& json_str, StreamedToolCalls& tool_calls,
+                                          json& usage_chunk) {
         try {
             if (json_str == "[DONE]") {
                 return "";
             }
             
             auto j = json::parse(json_str);
+            if (j.contains("usage") && j["usage"].is_object()) {
+                usage_chunk = j;
+            }
             if (j.contains("choices") && !j["choices"].empty()) {
                 auto& choice = j["choices"][0];
                 if (choice.contains("delta")) {
                     auto& delta = choice["delta"];
                     
+                    if (delta.contains("tool_calls") && delta["tool_calls"].is_array()) {
+                        tool_calls.add(delta["tool_calls"]);
+                    }
+                    
                     // Try content field first
-                    if (delta.contains("content")) {
+                    if (delta.contains("content") && delta["content"].is_string()) {
                         std::string content = delta["content"].get<std::string>();
                         if (!content.empty()) {
                             return content;
@@ -92,7 +203,7 @@ namespace {
                     }
                     
                     // Try reasoning field (used by some models like qwen3)
-                    if (delta.contains("reasoning")) {
+                    if (delta.contains("reasoning") && delta["reasoning"].is_string()) {
                         return delta["reasoning"].get<std::string>();
                     }
                 }
@@ -108,20 +219,9 @@ namespace {
         try {
             if (response.contains("choices") && !response["choices"].empty()) {
                 auto& choice = response["choices"][0];
-                if (choice.contains("message") && choice["message"].contains("tool_calls")) {
-                    // Convert OpenAI tool calls to our format
-                    auto& tool_calls = choice["message"]["tool_calls"];
-                    if (!tool_calls.empty()) {
-                        std::string result;
-                        for (const auto& tc : tool_calls) {
-                            if (tc.contains("function")) {
-                                std::string name = tc["function"]["name"];
-                                std::string args = tc["function"]["arguments"];
-                                result += "<tool_call>" + name + "(" + args + ")</tool_call>\n";
-                            }
-                        }
-                        return result;
-                    }
+                if (choice.contains("message") && choice["message"].contains("tool_calls") &&
+                    choice["message"]["tool_calls"].is_array()) {
+                    return format_native_tool_calls(choice["message"]["tool_calls"]);
                 }
             }
         } catch (const json::exception&) {
@@ -129,11 +229,183 @@ namespace {
         }
         return "";
     }
+    
+    // History as an OpenAI messages array. Roles map one to one, so a stable
+    // history prefix gives a stable request prefix for provider-side caching.
+    // An assistant message's native calls are sent as "tool_calls", each
+    // answered by the "tool" messages right after it. Calls or results that
+    // lost their partner (e.g. to context trimming) are sent as plain text,
+    // since the API rejects unpaired ones. Throws std::invalid_argument on
+    // a role the API has no equivalent for.
+    json build_messages(const std::vector<Message>& messages) {
+        json out = json::array();
+        std::vector<std::string> open_ids;   // Calls of the last assistant message
+        for (size_t i = 0; i < messages.size(); i++) {
+            const Message& msg = messages[i];
+            if (msg.role == "tool") {
+                auto it = std::find(open_ids.begin(), open_ids.end(), msg.tool_call_id);
+                if (!msg.tool_call_id.empty() && it != open_ids.end()) {
+                    out.push_back({{"role", "tool"}, {"tool_call_id", msg.tool_call_id},
+                                   {"content", msg.content}});
+                } else {
+                    out.push_back({{"role", "user"}, {"content", msg.content}});
+                }
+                continue;
+            }
+            open_ids.clear();
+            if (msg.role != "system" && msg.role != "user" && msg.role != "assistant") {
+                throw std::invalid_argument("Unsupported message role '" + msg.role + "'");
+            }
+            
+            json entry = {{"role", msg.role}, {"content", msg.content}};
+            json calls = json::array();
+            std::vector<ToolCall> unanswered;
+            for (const auto& call : msg.tool_calls) {
+                bool answered = false;
+                for (size_t j = i + 1; j < messages.size() && messages[j].role == "tool"; j++) {
+                    answered = answered || messages[j].tool_call_id == call.id;
+                }
+                if (!answered || call.id.empty()) {
+                    unanswered.push_back(call);
+                    unanswered.back().id.clear();
+                    continue;
+                }
+                calls.push_back({{"id", call.id}, {"type", "function"},
+                                 {"function", {{"name", call.tool_name},
+                                               {"arguments", call.parameters_json}}}});
+                open_ids.push_back(call.id);
+            }
+            if (!unanswered.empty()) {
+                std::string text = format_tool_calls(unanswered);
+                entry["content"] = msg.content.empty() ? text : msg.content + "\n\n" + text;
+            }
+            if (!calls.empty()) {
+                entry["tool_calls"] = calls;
+                if (entry["content"].get_ref<const std::string&>().empty()) {
+                    entry["content"] = nullptr;
+                }
+            }
+            out.push_back(entry);
+        }
+        return out;
+    }
+    
+    char* to_c_string(const std::string& text) {
+        char* result = static_cast<char*>(malloc(text.size() + 1));
+        if (result) {
+            memcpy(result, text.c_str(), text.size());
+            result[text.size()] = '\0';
+        }
+        return result;
+    }
 }
 
+// Small thread-safe pool of keep-alive HTTP clients for one endpoint.
+// Reusing clients avoids a TCP and TLS handshake on every request.
+class ClientPool {
+public:
+    ClientPool(const ParsedURL& endpoint, size_t max_idle,
+               int connect_timeout, int read_timeout)
+        : endpoint_(endpoint), max_idle_(max_idle),
+          connect_timeout_(connect_timeout), read_timeout_(read_timeout) {}
+    
+    // Take an idle client or create a new one
+    std::unique_ptr<httplib::ClientImpl> acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                auto client = std::move(idle_.back());
+                idle_.pop_back();
+                return client;
+            }
+        }
+        
+        std::unique_ptr<httplib::ClientImpl> client;
+        if (endpoint_.scheme == "https") {
+            client = std::make_unique<httplib::SSLClient>(endpoint_.host, endpoint_.port);
+        } else {
+            client = std::make_unique<httplib::ClientImpl>(endpoint_.host, endpoint_.port);
+        }
+        client->set_keep_alive(true);
+        client->set_connection_timeout(connect_timeout_, 0);
+        return client;
+    }
+    
+    // Return a client whose connection is still usable
+    void release(std::unique_ptr<httplib::ClientImpl> client) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (client && idle_.size() < max_idle_) {
+            idle_.push_back(std::move(client));
+        }
+    }
+    
+    // Configured read timeout in seconds (0 to use the per-request default)
+    int read_timeout() const { return read_timeout_; }
+
+private:
+    ParsedURL endpoint_;
+    size_t max_idle_;
+    int connect_timeout_;
+    int read_timeout_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<httplib::ClientImpl>> idle_;
+};
+
+// Client checked out of a pool for the duration of one request. The client
+// goes back to the pool on destruction unless discard() was called.
+class PooledClient {
+public:
+    explicit PooledClient(ClientPool& pool) : pool_(pool), client_(pool.acquire()) {}
+    ~PooledClient() { pool_.release(std::move(client_)); }
+    
+    httplib::ClientImpl* operator->() { return client_.get(); }
+    
+    // Drop the connection instead of reusing it (after errors or aborts)
+    void discard() { client_.reset(); }
+
+private:
+    ClientPool& pool_;
+    std::unique_ptr<httplib::ClientImpl> client_;
+};
+
+// Backend data structure for remote API
+struct openai_backend_data {
+    std::string api_endpoint;
+    std::string api_key;
+    std::string model_name;
+    int context_size;
+    bool stream_usage;   // Ask streams for a final usage chunk
+    
+    // Parsed once at init and reused for every request
+    ParsedURL endpoint;
+    std::string completions_path;
+    ClientPool pool;
+    
+    openai_backend_data(const char* endpoint_url, const char* key, const char* model, int ctx_size,
+                        const ParsedURL& parsed, int pool_size,
+                        int connect_timeout, int read_timeout, bool usage_in_streams)
+        : api_endpoint(endpoint_url ? endpoint_url : "https://api.openai.com/v1"),
+          api_key(key ? key : ""),
+          model_name(model ? model : "gpt-4"),
+          context_size(ctx_size > 0 ? ctx_size : 8192),
+          stream_usage(usage_in_streams),
+          endpoint(parsed),
+          pool(parsed, pool_size > 0 ? pool_size : 4,
+               connect_timeout > 0 ? connect_timeout : 30,
+               read_timeout) {
+        completions_path = endpoint.path;
+        if (completions_path.empty() || completions_path.back() != '/') {
+            completions_path += "/";
+        }
+        completions_path += "chat/completions";
+    }
+};
+
 // Initialize remote API backend
 void* openai_backend_init(const char* api_endpoint, const char* api_key, 
-                          const char* model_name, int context_size) {
+                          const char* model_name, int context_size,
+                          int pool_size, int connect_timeout, int read_timeout,
+                          bool stream_usage) {
     // Validate parameters
     if (!api_key || strlen(api_key) == 0) {
         luup_set_error(LUUP_ERROR_INVALID_PARAM, "API key is required for remote models");
@@ -160,14 +432,16 @@ void* openai_backend_init(const char* api_endpoint, const char* api_key,
         }
         
         // Create backend data
-        auto backend = new openai_backend_data(endpoint, api_key, model_name, context_size);
+        auto backend = new openai_backend_data(endpoint, api_key, model_name, context_size,
+                                               parsed, pool_size, connect_timeout, read_timeout,
+                                               stream_usage);
         
         // Test connection with a simple request (optional, but good for validation)
         // For now, we'll just validate the parameters and return
         
         luup_clear_error();
         return backend;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_BACKEND_INIT_FAILED, e.what());
         return nullptr;
@@ -181,68 +455,128 @@ void openai_backend_free(void* backend_data) {
     }
 }
 
-// Generate text using OpenAI API
-char* openai_backend_generate(void* backend_data, const char* prompt,
-                               float temperature, int max_tokens) {
-    if (!backend_data || !prompt) {
-        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
-        return nullptr;
-    }
-    
-    auto backend = static_cast<openai_backend_data*>(backend_data);
-    
-    try {
-        // Parse endpoint URL
-        ParsedURL parsed;
-        if (!parse_url(backend->api_endpoint, parsed)) {
-            luup_set_error(LUUP_ERROR_HTTP_FAILED, "Invalid API endpoint URL");
-            return nullptr;
-        }
-        
-        // Build request body
+namespace {
+    // Chat completion request body
+    json build_request(const openai_backend_data* backend, const std::vector<Message>& messages,
+                       const std::string& tools_json, const SamplingParams& sampling,
+                       int max_tokens, bool stream) {
         json request_body = {
             {"model", backend->model_name},
-            {"messages", json::array({
-                {{"role", "user"}, {"content", prompt}}
-            })},
-            {"temperature", temperature},
-            {"stream", false}
+            {"messages", build_messages(messages)},
+            {"temperature", sampling.temperature},
+            {"stream", stream}
         };
         
+        if (stream && backend->stream_usage) {
+            // Servers only report usage for a stream in an extra final chunk.
+            // Opt-in, since strict endpoints reject stream_options.
+            request_body["stream_options"] = {{"include_usage", true}};
+        }
         if (max_tokens > 0) {
             request_body["max_tokens"] = max_tokens;
         }
+        add_sampling_params(request_body, sampling);
         
-        std::string body_str = request_body.dump();
+        if (!tools_json.empty()) {
+            json tools = json::parse(tools_json, nullptr, false);
+            if (tools.is_array() && !tools.empty()) {
+                request_body["tools"] = tools;
+            }
+        }
+        return request_body;
+    }
+    
+    // Timestamps of one HTTP exchange. A blocking request sends its body
+    // through a content provider, which httplib first calls once the
+    // connection is up (TCP and TLS for a new one) and the headers are
+    // written. A stream sends its body with the headers and notes when the
+    // response headers arrive instead, so its connection time is part of
+    // the time to first byte; it also notes the first content chunk, so
+    // prefill and decode can be split.
+    struct RequestTimer {
+        using clock = std::chrono::steady_clock;
+        clock::time_point sent;
+        clock::time_point connected;
+        clock::time_point first_byte;
+        clock::time_point first_token;
+        clock::time_point finished;
+        
+        // Provider writing body, noting when it starts being written
+        httplib::ContentProvider body_provider(const std::string& body) {
+            return [this, &body](size_t offset, size_t length, httplib::DataSink& sink) {
+                if (offset == 0) {
+                    connected = clock::now();
+                }
+                return sink.write(body.data() + offset, length);
+            };
+        }
         
-        // Build headers
-        httplib::Headers headers = {
-            {"Content-Type", "application/json"},
-            {"Authorization", "Bearer " + backend->api_key}
+        void record() {
+            using ms = std::chrono::duration<double, std::milli>;
+            const clock::time_point unset;
+            finished = clock::now();
+            GenerationStats& stats = luup_last_generation_stats();
+            if (first_byte == unset) {
+                return;
+            }
+            clock::time_point start = sent;
+            if (connected != unset) {
+                stats.http_connect_ms = ms(connected - sent).count();
+                start = connected;
+            }
+            stats.http_ttfb_ms = ms(first_byte - start).count();
+            if (first_token != unset) {
+                stats.ttft_ms = ms(first_token - sent).count();
+                stats.prefill_ms = ms(first_token - start).count();
+                stats.decode_ms = ms(finished - first_token).count();
+            } else {
+                // Blocking responses arrive once generation is done
+                stats.ttft_ms = ms(finished - sent).count();
+            }
+        }
+    };
+    
+    // Token counts the server reports in "usage", when it does
+    void record_usage(const json& response) {
+        auto count = [](const json& object, const char* key) {
+            auto it = object.find(key);
+            return it != object.end() && it->is_number_integer() ? it->get<int>() : 0;
         };
-        
-        // Make request to /chat/completions endpoint
-        std::string endpoint_path = parsed.path;
-        if (endpoint_path.back() != '/') {
-            endpoint_path += "/";
+        auto usage = response.find("usage");
+        if (usage == response.end() || !usage->is_object()) {
+            return;
         }
-        endpoint_path += "chat/completions";
-        
-        // Create HTTP client and make request
-        httplib::Result response;
-        if (parsed.scheme == "https") {
-            httplib::SSLClient client(parsed.host, parsed.port);
-            client.set_connection_timeout(30, 0);  // 30 seconds
-            client.set_read_timeout(120, 0);       // 120 seconds for generation
-            response = client.Post(endpoint_path, headers, body_str, "application/json");
-        } else {
-            httplib::Client client(parsed.host, parsed.port);
-            client.set_connection_timeout(30, 0);
-            client.set_read_timeout(120, 0);
-            response = client.Post(endpoint_path, headers, body_str, "application/json");
+        GenerationStats& stats = luup_last_generation_stats();
+        stats.prompt_tokens = count(*usage, "prompt_tokens");
+        stats.generated_tokens = count(*usage, "completion_tokens");
+        auto details = usage->find("prompt_tokens_details");
+        if (details != usage->end() && details->is_object()) {
+            stats.cached_tokens = count(*details, "cached_tokens");
+        }
+    }
+    
+    // Blocking chat completion. Native tool calls are returned after any
+    // content, in the text format parse_tool_calls understands.
+    char* send_chat(openai_backend_data* backend, const json& request_body) {
+        std::string body_str = request_body.dump();
+        RequestTimer timer;
+        httplib::Headers headers = {{"Authorization", "Bearer " + backend->api_key}};
+        
+        // Make request to /chat/completions endpoint on a pooled connection
+        PooledClient client(backend->pool);
+        int read_timeout = backend->pool.read_timeout();
+        client->set_read_timeout(read_timeout > 0 ? read_timeout : 120, 0);  // 120 seconds for generation
+        timer.sent = RequestTimer::clock::now();
+        httplib::Result response = client->Post(backend->completions_path, headers, body_str.size(),
+                                                timer.body_provider(body_str), "application/json");
+        if (response) {
+            // Headers and body come together once the completion is done
+            timer.first_byte = RequestTimer::clock::now();
         }
+        timer.record();
         
         if (!response) {
+            client.discard();
             luup_set_error(LUUP_ERROR_HTTP_FAILED, "Failed to connect to API endpoint");
             return nullptr;
         }
@@ -267,195 +601,208 @@ char* openai_backend_generate(void* backend_data, const char* prompt,
         
         // Parse response
         auto response_json = json::parse(response->body);
-        
-        // Check for tool calls first
         std::string tool_calls = extract_tool_calls(response_json);
-        if (!tool_calls.empty()) {
-            char* result = static_cast<char*>(malloc(tool_calls.size() + 1));
-            if (result) {
-                memcpy(result, tool_calls.c_str(), tool_calls.size());
-                result[tool_calls.size()] = '\0';
-            }
-            luup_clear_error();
-            return result;
-        }
+        record_usage(response_json);
         
         // Extract content
+        std::string content;
         if (response_json.contains("choices") && !response_json["choices"].empty()) {
             auto& choice = response_json["choices"][0];
             if (choice.contains("message")) {
                 auto& message = choice["message"];
-                std::string content;
                 
                 // Try to get content from "content" field first
-                if (message.contains("content")) {
+                if (message.contains("content") && message["content"].is_string()) {
                     content = message["content"].get<std::string>();
                 }
                 
                 // If content is empty, try "reasoning" field (used by some models like qwen3)
-                if (content.empty() && message.contains("reasoning")) {
+                if (content.empty() && tool_calls.empty() && message.contains("reasoning") &&
+                    message["reasoning"].is_string()) {
                     content = message["reasoning"].get<std::string>();
                 }
-                
-                if (!content.empty()) {
-                    // Allocate and return result
-                    char* result = static_cast<char*>(malloc(content.size() + 1));
-                    if (result) {
-                        memcpy(result, content.c_str(), content.size());
-                        result[content.size()] = '\0';
-                    }
-                    
-                    luup_clear_error();
-                    return result;
-                }
             }
         }
         
-        luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "No content in API response");
-        return nullptr;
-        
-    } catch (const json::exception& e) {
-        luup_set_error(LUUP_ERROR_JSON_PARSE_FAILED, e.what());
-        return nullptr;
-    } catch (const std::exception& e) {
-        luup_set_error(LUUP_ERROR_HTTP_FAILED, e.what());
-        return nullptr;
-    }
-}
-
-// Generate text with streaming using OpenAI API
-bool openai_backend_generate_stream(void* backend_data, const char* prompt,
-                                    float temperature, int max_tokens,
-                                    void (*callback)(const char* token, void* user_data),
-                                    void* user_data) {
-    if (!backend_data || !prompt || !callback) {
-        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
-        return false;
-    }
-    
-    auto backend = static_cast<openai_backend_data*>(backend_data);
-    
-    try {
-        // Parse endpoint URL
-        ParsedURL parsed;
-        if (!parse_url(backend->api_endpoint, parsed)) {
-            luup_set_error(LUUP_ERROR_HTTP_FAILED, "Invalid API endpoint URL");
-            return false;
+        if (!tool_calls.empty()) {
+            content += content.empty() ? tool_calls : "\n\n" + tool_calls;
         }
-        
-        // Build request body
-        json request_body = {
-            {"model", backend->model_name},
-            {"messages", json::array({
-                {{"role", "user"}, {"content", prompt}}
-            })},
-            {"temperature", temperature},
-            {"stream", true}
-        };
-        
-        if (max_tokens > 0) {
-            request_body["max_tokens"] = max_tokens;
+        if (content.empty()) {
+            luup_set_error(LUUP_ERROR_INFERENCE_FAILED, "No content in API response");
+            return nullptr;
         }
         
-        std::string body_str = request_body.dump();
-        
-        // Build headers
-        httplib::Headers headers = {
+        luup_clear_error();
+        return to_c_string(content);
+    }
+    
+    // Streaming chat completion. Returns the full text, which is partial if
+    // the callback stopped the stream. Native tool calls are assembled from
+    // their fragments and delivered as one final chunk.
+    char* send_chat_stream(openai_backend_data* backend, const json& request_body,
+                           luup_stream_callback_t callback, void* user_data) {
+        RequestTimer timer;
+        
+        // Parse the SSE stream as bytes arrive instead of buffering the body
+        SSEParser parser;
+        StreamedToolCalls tool_calls;
+        json usage_chunk;
+        std::string error_body;
+        int status = 0;
+        bool cancelled = false;
+        std::string response_text;
+        
+        httplib::Request req;
+        req.method = "POST";
+        req.path = backend->completions_path;
+        req.headers = {
             {"Content-Type", "application/json"},
             {"Authorization", "Bearer " + backend->api_key}
         };
+        req.body = request_body.dump();
+        req.response_handler = [&](const httplib::Response& res) {
+            timer.first_byte = RequestTimer::clock::now();
+            status = res.status;
+            return true;
+        };
+        req.content_receiver = [&](const char* data, size_t len, uint64_t, uint64_t) {
+            if (status != 200) {
+                error_body.append(data, len);
+                return true;
+            }
+            
+            return parser.feed(data, len, [&](const std::string& data_str) {
+                if (data_str == "[DONE]") {
+                    return true;
+                }
+                
+                // Extract content from chunk
+                std::string content = extract_streaming_content(data_str, tool_calls, usage_chunk);
+                if (!content.empty() && timer.first_token == RequestTimer::clock::time_point()) {
+                    timer.first_token = RequestTimer::clock::now();
+                }
+                response_text += content;
+                if (!content.empty() && !callback(content.c_str(), user_data)) {
+                    cancelled = true;  // Caller asked to stop
+                    return false;
+                }
+                return true;
+            });
+        };
         
-        // Build endpoint path
-        std::string endpoint_path = parsed.path;
-        if (endpoint_path.back() != '/') {
-            endpoint_path += "/";
-        }
-        endpoint_path += "chat/completions";
-        
-        // Create HTTP client and make streaming request
-        httplib::Result response;
-        if (parsed.scheme == "https") {
-            httplib::SSLClient client(parsed.host, parsed.port);
-            client.set_connection_timeout(30, 0);
-            client.set_read_timeout(300, 0);  // Longer timeout for streaming
-            response = client.Post(endpoint_path, headers, body_str, "application/json");
-        } else {
-            httplib::Client client(parsed.host, parsed.port);
-            client.set_connection_timeout(30, 0);
-            client.set_read_timeout(300, 0);
-            response = client.Post(endpoint_path, headers, body_str, "application/json");
-        }
-        
-        if (!response) {
+        // Make streaming request on a pooled connection
+        PooledClient client(backend->pool);
+        int read_timeout = backend->pool.read_timeout();
+        client->set_read_timeout(read_timeout > 0 ? read_timeout : 300, 0);  // Longer timeout for streaming
+        timer.sent = RequestTimer::clock::now();
+        httplib::Result response = client->send(req);
+        timer.record();
+        record_usage(usage_chunk);
+        
+        if (cancelled) {
+            // Returning false from the receiver aborts the request on purpose,
+            // the connection is left mid-response and can't be reused
+            client.discard();
+        } else if (!response) {
+            client.discard();
             luup_set_error(LUUP_ERROR_HTTP_FAILED, "Failed to connect to API endpoint");
-            return false;
-        }
-        
-        if (response->status != 200) {
+            return nullptr;
+        } else if (status != 200) {
             std::string error_msg = "API streaming request failed with status " + 
-                                   std::to_string(response->status);
+                                   std::to_string(status);
             
             // Try to extract error message from response
             try {
-                auto error_json = json::parse(response->body);
+                auto error_json = json::parse(error_body);
                 if (error_json.contains("error") && error_json["error"].contains("message")) {
                     error_msg += ": " + error_json["error"]["message"].get<std::string>();
                 }
             } catch (...) {
-                if (!response->body.empty()) {
-                    error_msg += ": " + response->body;
+                if (!error_body.empty()) {
+                    error_msg += ": " + error_body;
                 }
             }
             
             luup_set_error(LUUP_ERROR_HTTP_FAILED, error_msg.c_str());
-            return false;
-        }
-        
-        // Parse SSE response and call callback for each token
-        std::string buffer = response->body;
-        size_t pos = 0;
-        
-        while (pos < buffer.size()) {
-            // Find next newline
-            size_t newline_pos = buffer.find('\n', pos);
-            if (newline_pos == std::string::npos) {
-                // Process remaining data
-                newline_pos = buffer.size();
-            }
-            
-            std::string line = buffer.substr(pos, newline_pos - pos);
-            pos = newline_pos + 1;
-            
-            // Skip empty lines
-            if (line.empty() || line == "\r") {
-                continue;
-            }
-            
-            // Parse SSE data
-            std::string data_str = parse_sse_data(line);
-            if (data_str.empty()) {
-                continue;
-            }
-            
-            // Extract content from chunk
-            std::string content = extract_streaming_content(data_str);
-            if (!content.empty()) {
-                callback(content.c_str(), user_data);
+            return nullptr;
+        } else {
+            std::string calls_text = format_native_tool_calls(tool_calls.calls);
+            if (!calls_text.empty()) {
+                if (!response_text.empty()) {
+                    calls_text = "\n\n" + calls_text;
+                }
+                response_text += calls_text;
+                callback(calls_text.c_str(), user_data);
             }
         }
         
         luup_clear_error();
-        return true;
-        
+        return to_c_string(response_text);
+    }
+}
+
+// Chat completion from structured messages, with tools_json (an OpenAI
+// "tools" array, may be empty) sent as native tools. Streams through
+// callback when one is given.
+char* openai_backend_chat(void* backend_data, const std::vector<Message>& messages,
+                          const std::string& tools_json, const SamplingParams& sampling,
+                          int max_tokens, luup_stream_callback_t callback, void* user_data) {
+    if (!backend_data || messages.empty()) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return nullptr;
+    }
+    
+    auto backend = static_cast<openai_backend_data*>(backend_data);
+    luup_last_generation_stats().reset();
+    
+    try {
+        json request_body = build_request(backend, messages, tools_json, sampling,
+                                          max_tokens, callback != nullptr);
+        return callback ? send_chat_stream(backend, request_body, callback, user_data)
+                        : send_chat(backend, request_body);
     } catch (const json::exception& e) {
         luup_set_error(LUUP_ERROR_JSON_PARSE_FAILED, e.what());
-        return false;
+        return nullptr;
+    } catch (const std::invalid_argument& e) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, e.what());
+        return nullptr;
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_HTTP_FAILED, e.what());
-        return false;
+        return nullptr;
     }
 }
 
+// Generate text using OpenAI API, sending the prompt as one user message
+char* openai_backend_generate(void* backend_data, const char* prompt,
+                               const SamplingParams& sampling, int max_tokens) {
+    if (!backend_data || !prompt) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return nullptr;
+    }
+    
+    Message msg;
+    msg.role = "user";
+    msg.content = prompt;
+    return openai_backend_chat(backend_data, {msg}, "", sampling, max_tokens, nullptr, nullptr);
+}
+
+// Generate text with streaming using OpenAI API. Returns the full text,
+// which is partial if the callback stopped the stream.
+char* openai_backend_generate_stream(void* backend_data, const char* prompt,
+                                    const SamplingParams& sampling, int max_tokens,
+                                    luup_stream_callback_t callback,
+                                    void* user_data) {
+    if (!backend_data || !prompt || !callback) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return nullptr;
+    }
+    
+    Message msg;
+    msg.role = "user";
+    msg.content = prompt;
+    return openai_backend_chat(backend_data, {msg}, "", sampling, max_tokens, callback, user_data);
+}
+
 // Get backend information
 bool openai_backend_get_info(void* backend_data, const char** model_name, 
                              int* context_size) {
@@ -5,75 +5,214 @@
 
 #include "../../include/luup_agent.h"
 #include "../core/internal.h"
+#include "record_journal.h"
 #include <nlohmann/json.hpp>
 #include <string>
-#include <fstream>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <iterator>
+#include <cctype>
 #include <ctime>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 #include <algorithm>
 
 using json = nlohmann::json;
 
 extern void luup_set_error(luup_error_t code, const char* message);
 
-// Storage structure for notes
+// Paging defaults for 'list' and 'search': results go back into the prompt
+static const int default_page_size = 20;
+static const int max_page_size = 100;
+
+static std::string to_lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+// Split text into lowercase words. Bytes outside ASCII count as word
+// characters so UTF-8 words stay whole.
+static std::vector<std::string> tokenize(const std::string& text) {
+    std::vector<std::string> tokens;
+    std::string current;
+    for (unsigned char c : text) {
+        if (std::isalnum(c) || c >= 0x80) {
+            current += static_cast<char>(std::tolower(c));
+        } else if (!current.empty()) {
+            tokens.push_back(current);
+            current.clear();
+        }
+    }
+    if (!current.empty()) {
+        tokens.push_back(current);
+    }
+    return tokens;
+}
+
+// Storage structure for notes. Notes are kept by id (ids only grow, so
+// this is also creation order) and persisted through an append-only journal.
+// Tags and content words are indexed so searches don't scan every note.
 struct NotesStorage {
-    json data;
+    std::map<int, json> notes;
+    std::unordered_map<std::string, std::set<int>> tag_index;   // Lowercase tag -> ids
+    std::map<std::string, std::set<int>> token_index;            // Word -> ids, ordered for prefix lookups
     std::string storage_path;
+    RecordJournal journal;
+    bool loaded;
     int next_id;
+    std::mutex mutex;   // Tool calls may run in parallel
+    
+    NotesStorage() : journal("notes"), loaded(false), next_id(1) {}
     
-    NotesStorage() : next_id(1) {
-        data = json::object();
-        data["notes"] = json::array();
+    // Load on first use rather than when the tool is enabled
+    void ensure_loaded() {
+        if (loaded) {
+            return;
+        }
+        loaded = true;
+        journal.open(storage_path, notes);
+        for (const auto& entry : notes) {
+            index(entry.second, true);
+        }
+        if (!notes.empty()) {
+            next_id = notes.rbegin()->first + 1;
+        }
     }
     
-    bool load_from_file() {
-        if (storage_path.empty()) {
-            return false;
+    // Add (or remove) a note's tags and words in the indexes
+    void index(const json& note, bool add) {
+        int id = note.value("id", 0);
+        std::set<std::string> words;
+        for (const auto& token : tokenize(note.value("content", ""))) {
+            words.insert(token);
         }
-        
-        try {
-            std::ifstream file(storage_path);
-            if (file.is_open()) {
-                file >> data;
-                file.close();
-                
-                // Update next_id based on existing notes
-                if (data.contains("notes") && data["notes"].is_array()) {
-                    for (const auto& note : data["notes"]) {
-                        if (note.contains("id") && note["id"].is_number()) {
-                            int id = note["id"].get<int>();
-                            if (id >= next_id) {
-                                next_id = id + 1;
-                            }
-                        }
-                    }
+        if (note.contains("tags") && note["tags"].is_array()) {
+            for (const auto& tag : note["tags"]) {
+                if (!tag.is_string()) {
+                    continue;
                 }
-                return true;
+                std::string tag_lower = to_lower(tag.get<std::string>());
+                update_index(tag_index, tag_lower, id, add);
+                // Tag words are searchable like content
+                for (const auto& token : tokenize(tag_lower)) {
+                    words.insert(token);
+                }
+            }
+        }
+        for (const auto& word : words) {
+            update_index(token_index, word, id, add);
+        }
+    }
+    
+    template <typename Index>
+    static void update_index(Index& idx, const std::string& key, int id, bool add) {
+        if (add) {
+            idx[key].insert(id);
+            return;
+        }
+        auto it = idx.find(key);
+        if (it != idx.end()) {
+            it->second.erase(id);
+            if (it->second.empty()) {
+                idx.erase(it);
             }
-        } catch (const std::exception& e) {
-            // File doesn't exist or is invalid, start fresh
         }
-        return false;
     }
     
-    bool save_to_file() {
-        if (storage_path.empty()) {
-            return true; // Memory only mode
+    // Insert or replace a note, keeping indexes and journal in step.
+    // Returns false if the journal couldn't record it.
+    bool put(const json& note) {
+        int id = note["id"].get<int>();
+        auto it = notes.find(id);
+        if (it != notes.end()) {
+            index(it->second, false);
         }
+        notes[id] = note;
+        index(note, true);
+        return journal.put(note, notes);
+    }
+    
+    // Remove an existing note; returns false if the journal couldn't record it
+    bool remove(int id) {
+        auto it = notes.find(id);
+        index(it->second, false);
+        notes.erase(it);
+        return journal.remove(id, notes);
+    }
+    
+    // Ids of notes carrying tag (if not empty) whose words start with every
+    // word of query, in creation order
+    std::vector<int> search(const std::string& query, const std::string& tag) const {
+        std::vector<std::string> tokens = tokenize(query);
+        std::set<int> matches;
+        bool filtered = false;
         
-        try {
-            std::ofstream file(storage_path);
-            if (file.is_open()) {
-                file << data.dump(2);
-                file.close();
-                return true;
+        if (!tag.empty()) {
+            auto it = tag_index.find(to_lower(tag));
+            if (it != tag_index.end()) {
+                matches = it->second;
             }
-        } catch (const std::exception& e) {
-            return false;
+            filtered = true;
         }
-        return false;
+        
+        for (const auto& token : tokens) {
+            std::set<int> hits;
+            for (auto it = token_index.lower_bound(token);
+                 it != token_index.end() && it->first.compare(0, token.size(), token) == 0; ++it) {
+                hits.insert(it->second.begin(), it->second.end());
+            }
+            if (filtered) {
+                std::set<int> both;
+                std::set_intersection(matches.begin(), matches.end(), hits.begin(), hits.end(),
+                                      std::inserter(both, both.begin()));
+                matches.swap(both);
+            } else {
+                matches.swap(hits);
+                filtered = true;
+            }
+            if (matches.empty()) {
+                break;
+            }
+        }
+        
+        if (!filtered) {
+            std::vector<int> all;
+            all.reserve(notes.size());
+            for (const auto& entry : notes) {
+                all.push_back(entry.first);
+            }
+            return all;
+        }
+        return std::vector<int>(matches.begin(), matches.end());
+    }
+    
+    // One page of notes by id, with the totals needed to ask for the next
+    json page(const std::vector<int>& ids, const json& params) const {
+        int offset = std::max(0, params.value("offset", 0));
+        int limit = params.value("limit", default_page_size);
+        if (limit <= 0) {
+            limit = default_page_size;
+        }
+        limit = std::min(limit, max_page_size);
+        
+        json items = json::array();
+        for (size_t i = static_cast<size_t>(offset);
+             i < ids.size() && items.size() < static_cast<size_t>(limit); i++) {
+            items.push_back(notes.at(ids[i]));
+        }
+        
+        json result;
+        result["notes"] = items;
+        result["count"] = items.size();
+        result["total"] = ids.size();
+        result["offset"] = offset;
+        if (static_cast<size_t>(offset) + items.size() < ids.size()) {
+            result["next_offset"] = offset + static_cast<int>(items.size());
+        }
+        return result;
     }
 };
 
@@ -84,10 +223,21 @@ static std::string get_current_timestamp() {
     return std::string(buf);
 }
 
+// A change kept in memory that the journal couldn't record is lost on
+// restart; tell the model rather than reporting plain success
+static void report_unsaved(json& result, bool saved) {
+    if (!saved) {
+        result["error"] = "Change could not be saved to storage and will be lost on restart";
+    }
+}
+
 static char* notes_tool_callback(const char* params_json, void* user_data) {
     auto storage = static_cast<NotesStorage*>(user_data);
+    std::lock_guard<std::mutex> lock(storage->mutex);
     
     try {
+        storage->ensure_loaded();
+        
         json params = json::parse(params_json);
         std::string operation = params.value("operation", "list");
         
@@ -112,15 +262,15 @@ static char* notes_tool_callback(const char* params_json, void* user_data) {
                 note["tags"] = json::array();
             }
             
-            storage->data["notes"].push_back(note);
-            storage->save_to_file();
+            bool saved = storage->put(note);
             
             json result;
             result["success"] = true;
             result["message"] = "Note created successfully";
             result["note"] = note;
+            report_unsaved(result, saved);
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "read") {
             // Read specific note
             int id = params.value("id", 0);
@@ -130,18 +280,17 @@ static char* notes_tool_callback(const char* params_json, void* user_data) {
                 return strdup(error.dump().c_str());
             }
             
-            for (const auto& note : storage->data["notes"]) {
-                if (note["id"] == id) {
-                    json result;
-                    result["note"] = note;
-                    return strdup(result.dump().c_str());
-                }
+            auto it = storage->notes.find(id);
+            if (it == storage->notes.end()) {
+                json error;
+                error["error"] = "Note not found";
+                return strdup(error.dump().c_str());
             }
             
-            json error;
-            error["error"] = "Note not found";
-            return strdup(error.dump().c_str());
-            
+            json result;
+            result["note"] = it->second;
+            return strdup(result.dump().c_str());
+        
         } else if (operation == "update") {
             // Update existing note
             int id = params.value("id", 0);
@@ -151,38 +300,34 @@ static char* notes_tool_callback(const char* params_json, void* user_data) {
                 return strdup(error.dump().c_str());
             }
             
-            bool found = false;
-            for (auto& note : storage->data["notes"]) {
-                if (note["id"] == id) {
-                    // Update content if provided
-                    if (params.contains("content")) {
-                        note["content"] = params["content"];
-                    }
-                    
-                    // Update tags if provided
-                    if (params.contains("tags") && params["tags"].is_array()) {
-                        note["tags"] = params["tags"];
-                    }
-                    
-                    note["modified"] = get_current_timestamp();
-                    found = true;
-                    break;
-                }
-            }
-            
-            if (!found) {
+            auto it = storage->notes.find(id);
+            if (it == storage->notes.end()) {
                 json error;
                 error["error"] = "Note not found";
                 return strdup(error.dump().c_str());
             }
             
-            storage->save_to_file();
+            json note = it->second;
+            
+            // Update content if provided
+            if (params.contains("content")) {
+                note["content"] = params["content"];
+            }
+            
+            // Update tags if provided
+            if (params.contains("tags") && params["tags"].is_array()) {
+                note["tags"] = params["tags"];
+            }
+            
+            note["modified"] = get_current_timestamp();
+            bool saved = storage->put(note);
             
             json result;
             result["success"] = true;
             result["message"] = "Note updated successfully";
+            report_unsaved(result, saved);
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "delete") {
             // Delete note
             int id = params.value("id", 0);
@@ -192,85 +337,35 @@ static char* notes_tool_callback(const char* params_json, void* user_data) {
                 return strdup(error.dump().c_str());
             }
             
-            auto& notes = storage->data["notes"];
-            bool found = false;
-            for (size_t i = 0; i < notes.size(); i++) {
-                if (notes[i]["id"] == id) {
-                    notes.erase(notes.begin() + i);
-                    found = true;
-                    break;
-                }
-            }
-            
-            if (!found) {
+            if (storage->notes.count(id) == 0) {
                 json error;
                 error["error"] = "Note not found";
                 return strdup(error.dump().c_str());
             }
-            
-            storage->save_to_file();
+            bool saved = storage->remove(id);
             
             json result;
             result["success"] = true;
             result["message"] = "Note deleted successfully";
+            report_unsaved(result, saved);
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "search") {
-            // Search notes by content or tags
-            std::string query = params.value("query", "");
-            json matching_notes = json::array();
-            
-            for (const auto& note : storage->data["notes"]) {
-                bool matches = false;
-                
-                // Search in content
-                std::string content = note.value("content", "");
-                std::string content_lower = content;
-                std::string query_lower = query;
-                std::transform(content_lower.begin(), content_lower.end(), content_lower.begin(), ::tolower);
-                std::transform(query_lower.begin(), query_lower.end(), query_lower.begin(), ::tolower);
-                
-                if (content_lower.find(query_lower) != std::string::npos) {
-                    matches = true;
-                }
-                
-                // Search in tags
-                if (!matches && note.contains("tags") && note["tags"].is_array()) {
-                    for (const auto& tag : note["tags"]) {
-                        std::string tag_str = tag.get<std::string>();
-                        std::string tag_lower = tag_str;
-                        std::transform(tag_lower.begin(), tag_lower.end(), tag_lower.begin(), ::tolower);
-                        
-                        if (tag_lower.find(query_lower) != std::string::npos) {
-                            matches = true;
-                            break;
-                        }
-                    }
-                }
-                
-                if (matches || query.empty()) {
-                    matching_notes.push_back(note);
-                }
-            }
-            
-            json result;
-            result["notes"] = matching_notes;
-            result["count"] = matching_notes.size();
-            return strdup(result.dump().c_str());
-            
+            // Search notes by content words or tags through the indexes
+            std::vector<int> ids = storage->search(params.value("query", ""),
+                                                   params.value("tag", ""));
+            return strdup(storage->page(ids, params).dump().c_str());
+        
         } else if (operation == "list") {
             // List all notes (same as search with empty query)
-            json result;
-            result["notes"] = storage->data["notes"];
-            result["count"] = storage->data["notes"].size();
-            return strdup(result.dump().c_str());
-            
+            return strdup(storage->page(storage->search("", ""), params).dump().c_str());
+        
         } else {
             json error;
             error["error"] = "Unknown operation: " + operation;
             return strdup(error.dump().c_str());
         }
-        
+    
     } catch (const std::exception& e) {
         json error;
         error["error"] = std::string("Notes tool error: ") + e.what();
@@ -293,8 +388,7 @@ luup_error_t luup_agent_enable_builtin_notes(
         // Create storage
         auto storage = new NotesStorage();
         if (storage_path) {
-            storage->storage_path = storage_path;
-            storage->load_from_file();
+            storage->storage_path = storage_path;  // Loaded on first use
         }
         
         // Define tool
@@ -325,7 +419,19 @@ luup_error_t luup_agent_enable_builtin_notes(
             "    },"
             "    \"query\": {"
             "      \"type\": \"string\","
-            "      \"description\": \"Search query for 'search' operation\""
+            "      \"description\": \"Search query for 'search' operation; matches notes containing words starting with each query word\""
+            "    },"
+            "    \"tag\": {"
+            "      \"type\": \"string\","
+            "      \"description\": \"Only return notes with this tag ('search')\""
+            "    },"
+            "    \"limit\": {"
+            "      \"type\": \"number\","
+            "      \"description\": \"Maximum notes to return for 'search' and 'list' (default 20, max 100)\""
+            "    },"
+            "    \"offset\": {"
+            "      \"type\": \"number\","
+            "      \"description\": \"Number of matching notes to skip, for paging (default 0)\""
             "    }"
             "  },"
             "  \"required\": [\"operation\"]"
@@ -345,7 +451,7 @@ luup_error_t luup_agent_enable_builtin_notes(
         }
         
         return LUUP_SUCCESS;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
         return LUUP_ERROR_OUT_OF_MEMORY;
@@ -0,0 +1,174 @@
+/**
+ * @file record_journal.cpp
+ * @brief Append-only persistence for the built-in todo and notes stores
+ */
+
+#include "record_journal.h"
+#include <fstream>
+#include <cstdio>
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+    // Compact once the log holds this many operations and more than the
+    // live records, which keeps the amortized cost per mutation constant
+    constexpr size_t min_ops_before_compaction = 256;
+    
+    void apply_op(const json& op, std::map<int, json>& records) {
+        if (!op.is_object()) {
+            return;
+        }
+        std::string kind = op.value("op", "");
+        if (kind == "put" && op.contains("record") && op["record"].contains("id") &&
+            op["record"]["id"].is_number_integer()) {
+            records[op["record"]["id"].get<int>()] = op["record"];
+        } else if (kind == "del" && op.contains("id") && op["id"].is_number_integer()) {
+            records.erase(op["id"].get<int>());
+        }
+    }
+    
+    // Flush a file's data to disk before it is renamed into place
+    bool sync_file(FILE* file) {
+        if (fflush(file) != 0) {
+            return false;
+        }
+#if defined(_WIN32)
+        return _commit(_fileno(file)) == 0;
+#else
+        return fsync(fileno(file)) == 0;
+#endif
+    }
+    
+    // Replace dst with src in one step
+    bool replace_file(const std::string& src, const std::string& dst) {
+#if defined(_WIN32)
+        return MoveFileExA(src.c_str(), dst.c_str(),
+                           MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return std::rename(src.c_str(), dst.c_str()) == 0;
+#endif
+    }
+}
+
+RecordJournal::~RecordJournal() {
+    if (log_) {
+        fclose(log_);
+    }
+}
+
+bool RecordJournal::open(const std::string& path, std::map<int, json>& records) {
+    path_ = path;
+    if (path_.empty()) {
+        return true;   // Memory only mode
+    }
+    
+    // Snapshot, if any
+    {
+        std::ifstream file(path_);
+        if (file.is_open()) {
+            json snapshot = json::parse(file, nullptr, false);
+            if (snapshot.is_object() && snapshot.contains(collection_) &&
+                snapshot[collection_].is_array()) {
+                for (const auto& record : snapshot[collection_]) {
+                    if (record.contains("id") && record["id"].is_number_integer()) {
+                        records[record["id"].get<int>()] = record;
+                    }
+                }
+            }
+        }
+    }
+    
+    // Operations since the snapshot. A torn last line (crash mid-append)
+    // fails to parse and is skipped.
+    bool torn = false;
+    {
+        std::ifstream file(log_path());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            apply_op(json::parse(line, nullptr, false), records);
+            n_logged_++;
+            torn = file.eof();   // Last line had no newline
+        }
+    }
+    
+    log_ = fopen(log_path().c_str(), "ab");
+    if (log_ && torn) {
+        fputc('\n', log_);   // Keep the next operation on a line of its own
+    }
+    return log_ != nullptr;
+}
+
+bool RecordJournal::put(const json& record, const std::map<int, json>& records) {
+    return append({{"op", "put"}, {"record", record}}, records);
+}
+
+bool RecordJournal::remove(int id, const std::map<int, json>& records) {
+    return append({{"op", "del"}, {"id", id}}, records);
+}
+
+bool RecordJournal::append(const json& op, const std::map<int, json>& records) {
+    if (path_.empty()) {
+        return true;
+    }
+    if (!log_) {
+        return false;
+    }
+    
+    std::string line = op.dump() + "\n";
+    if (fwrite(line.data(), 1, line.size(), log_) != line.size() || fflush(log_) != 0) {
+        return false;
+    }
+    n_logged_++;
+    
+    if (n_logged_ >= min_ops_before_compaction && n_logged_ > records.size()) {
+        return compact(records);
+    }
+    return true;
+}
+
+bool RecordJournal::compact(const std::map<int, json>& records) {
+    if (path_.empty()) {
+        return true;
+    }
+    
+    json items = json::array();
+    for (const auto& entry : records) {
+        items.push_back(entry.second);
+    }
+    json snapshot = json::object();
+    snapshot[collection_] = items;
+    std::string text = snapshot.dump(2);
+    
+    // Write the new snapshot next to the old one and swap it in, so a
+    // crash leaves either the old snapshot plus log or the new snapshot
+    std::string tmp_path = path_ + ".tmp";
+    FILE* tmp = fopen(tmp_path.c_str(), "wb");
+    if (!tmp) {
+        return false;
+    }
+    bool written = fwrite(text.data(), 1, text.size(), tmp) == text.size() && sync_file(tmp);
+    fclose(tmp);
+    if (!written || !replace_file(tmp_path, path_)) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    
+    // Replaying the old log over the new snapshot would be harmless (puts
+    // and deletes are idempotent), so it's fine to truncate it afterwards
+    if (log_) {
+        fclose(log_);
+    }
+    log_ = fopen(log_path().c_str(), "wb");
+    n_logged_ = 0;
+    return log_ != nullptr;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file record_journal.h
+ * @brief Append-only persistence for the built-in todo and notes stores
+ *
+ * Records are JSON objects keyed by an integer "id". The store file holds a
+ * compacted snapshot ({"<collection>": [records...]}, the format the tools
+ * always wrote) and "<path>.log" holds one operation per line written since:
+ *
+ *   {"op": "put", "record": {...}}   insert or replace a record
+ *   {"op": "del", "id": N}           remove a record
+ *
+ * A mutation appends one line, so its cost doesn't depend on the store size.
+ * Once the log outgrows the live records it is folded into a new snapshot,
+ * written to a temporary file and renamed over the old one.
+ */
+
+#ifndef LUUP_RECORD_JOURNAL_H
+#define LUUP_RECORD_JOURNAL_H
+
+#include <nlohmann/json.hpp>
+#include <cstdio>
+#include <map>
+#include <string>
+
+class RecordJournal {
+public:
+    explicit RecordJournal(const std::string& collection)
+        : collection_(collection), log_(nullptr), n_logged_(0) {}
+    ~RecordJournal();
+    
+    RecordJournal(const RecordJournal&) = delete;
+    RecordJournal& operator=(const RecordJournal&) = delete;
+    
+    // Read the snapshot and replay the log into records. An empty path
+    // keeps the journal in memory only.
+    bool open(const std::string& path, std::map<int, nlohmann::json>& records);
+    
+    // Log a mutation; compacts when the log has grown past the live records
+    bool put(const nlohmann::json& record, const std::map<int, nlohmann::json>& records);
+    bool remove(int id, const std::map<int, nlohmann::json>& records);
+    
+    // Write records as the new snapshot and start an empty log
+    bool compact(const std::map<int, nlohmann::json>& records);
+
+private:
+    bool append(const nlohmann::json& op, const std::map<int, nlohmann::json>& records);
+    std::string log_path() const { return path_ + ".log"; }
+    
+    std::string collection_;
+    std::string path_;
+    FILE* log_;
+    size_t n_logged_;   // Operations in the log since the last compaction
+};
+
+#endif // LUUP_RECORD_JOURNAL_H
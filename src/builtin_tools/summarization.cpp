@@ -2,8 +2,9 @@
  * @file summarization.cpp
  * @brief Built-in auto-summarization tool implementation
  * 
- * Monitors conversation history and automatically summarizes older messages
- * when context is ~75% full, preserving recent messages and tool calls.
+ * Monitors conversation history and summarizes older messages in the
+ * background once context is ~60% full, swapping the summary in at ~75%,
+ * preserving recent messages and tool calls.
  */
 
 #include "../../include/luup_agent.h"
@@ -11,6 +12,10 @@
 #include <nlohmann/json.hpp>
 #include <string>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 
@@ -18,157 +23,296 @@ using json = nlohmann::json;
 
 extern void luup_set_error(luup_error_t code, const char* message);
 
-// Forward declaration of internal structures (defined in agent.cpp)
-struct Message {
-    std::string role;
-    std::string content;
-};
-
-// Access to agent internals for summarization
-struct luup_agent {
-    luup_model* model;
-    std::string system_prompt;
-    float temperature;
-    int max_tokens;
-    bool enable_tool_calling;
-    bool enable_history_management;
-    bool enable_builtin_tools;
-    
-    std::vector<Message> history;
-    // ... other fields omitted
-};
-
-// Summarization state
-struct SummarizationState {
+// Summarization state. Once history passes start_threshold, older messages
+// are summarized on a background thread by the summarizer model; the
+// finished summary replaces them when history passes threshold. Turns never
+// wait for the summary.
+//
+// A local summarizer needs a KV-cache sequence of its own for that, reserved
+// when summarization is enabled, so it never evicts an agent's cached
+// prompt. Without one to spare, the summary is generated at threshold on the
+// agent's own model and sequence, inside the turn.
+//
+// The tool callback may run on a tool worker while the agent thread goes
+// on with the turn, so it never touches the history: "trigger" only sets a
+// flag for maintain(), and "status" reports what maintain() last saw.
+struct SummarizationState : public HistoryMaintainer {
     luup_agent* agent;
     size_t context_size;
+    float start_threshold;
     float threshold;
-    bool enabled;
+    std::atomic<bool> enabled;
+    
+    // Background job
+    std::thread worker;
+    std::mutex mutex;
+    std::atomic<bool> cancel;
+    bool running;             // Guarded by mutex
+    bool ready;               // Guarded by mutex
+    std::string summary;      // Guarded by mutex
+    double summary_ms;        // Guarded by mutex; time spent generating summary
+    double applied_ms;        // Guarded by mutex; summaries applied since take_work_ms()
+    size_t job_end;           // History messages the job covers
+    unsigned int job_epoch;   // agent->history_epoch at snapshot time
+    luup_model* model;        // Generates the summaries (local or remote)
+    int seq_id;               // Reserved sequence on model (-1: none, no background job)
+    
+    // Shared with the tool callback
+    bool trigger_requested;   // Guarded by mutex; summarize at the next maintain()
+    size_t status_tokens;     // Guarded by mutex; history tokens at the last maintain()
+    bool status_full;         // Guarded by mutex; should_summarize() then
     
     SummarizationState(luup_agent* a) 
-        : agent(a), context_size(2048), threshold(0.75f), enabled(true) {}
+        : agent(a), context_size(2048), start_threshold(0.6f), threshold(0.75f),
+          enabled(true), cancel(false), running(false), ready(false),
+          summary_ms(0.0), applied_ms(0.0), job_end(0), job_epoch(0),
+          model(a->summarizer_model ? a->summarizer_model : a->model), seq_id(-1),
+          trigger_requested(false), status_tokens(0), status_full(false) {}
+    
+    ~SummarizationState() override {
+        cancel = true;
+        if (worker.joinable()) {
+            worker.join();
+        }
+        luup_model_release_sequence(model, seq_id);
+    }
+    
+    int reserved_sequence() const override {
+        return seq_id;
+    }
     
     bool should_summarize() {
         if (!enabled || !agent) {
             return false;
         }
         
-        // Estimate token count in history
-        size_t estimated_tokens = 0;
-        for (const auto& msg : agent->history) {
-            estimated_tokens += estimate_token_count(msg.content);
-            estimated_tokens += 10; // Overhead for role and formatting
-        }
-        
-        // Check if we're at threshold
-        return estimated_tokens >= (context_size * threshold);
+        // Counted with the model's tokenizer, incrementally per message
+        return is_context_full(agent, context_size, threshold);
     }
     
-    std::string generate_summary() {
-        if (!agent || agent->history.empty()) {
-            return "";
-        }
-        
-        // Build a prompt to summarize the conversation
+    // Messages to summarize: the oldest 60% of history
+    size_t summary_end() const {
+        size_t num_to_summarize = static_cast<size_t>(agent->history.size() * 0.6);
+        return num_to_summarize < 2 ? 0 : num_to_summarize;
+    }
+    
+    // First message that may be summarized (a leading system prompt is kept)
+    size_t summary_begin() const {
+        return (!agent->history.empty() && agent->history[0].role == "system") ? 1 : 0;
+    }
+    
+    std::string build_summary_prompt(size_t end) const {
         std::string summary_prompt = 
             "Please provide a concise summary of the conversation below, "
             "capturing the key points, decisions, and context. Keep it brief "
             "but informative.\n\n";
         
-        // Include older messages (first 60% of history)
-        size_t num_to_summarize = static_cast<size_t>(agent->history.size() * 0.6);
-        if (num_to_summarize < 2) {
-            num_to_summarize = agent->history.size() > 2 ? 2 : 0;
-        }
-        
-        for (size_t i = 0; i < num_to_summarize && i < agent->history.size(); i++) {
+        for (size_t i = 0; i < end && i < agent->history.size(); i++) {
             const auto& msg = agent->history[i];
             summary_prompt += msg.role + ": " + msg.content + "\n\n";
         }
         
         summary_prompt += "Summary:";
-        
-        // Generate summary using the model
-        void* backend_data = luup_model_get_backend_data(agent->model);
-        if (!backend_data) {
-            return "";
+        return summary_prompt;
+    }
+    
+    // Generate a summary on the reserved sequence, or without one on the
+    // agent's own (agent thread only); stops early on cancel
+    std::string generate_summary(const std::string& summary_prompt, double& elapsed_ms) {
+        luup_model* target = model;
+        int target_seq = seq_id;
+        if (target_seq < 0) {
+            target = agent->model;
+            target_seq = luup_model_is_local(target) ? luup_agent_get_sequence(agent) : 0;
         }
         
-        char* summary_raw = llama_backend_generate(
-            backend_data,
-            summary_prompt.c_str(),
-            0.3f,  // Low temperature for consistent summaries
-            256    // Max tokens for summary
+        auto start = std::chrono::steady_clock::now();
+        
+        SamplingParams sampling;
+        sampling.temperature = 0.3f;  // Low temperature for consistent summaries
+        
+        auto keep_going = [](const char*, void* user_data) -> bool {
+            return !static_cast<std::atomic<bool>*>(user_data)->load();
+        };
+        char* summary_raw = luup_model_generate(
+            target,
+            target_seq,
+            summary_prompt,
+            sampling,
+            256,   // Max tokens for summary
+            keep_going,
+            &cancel
         );
+        elapsed_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
         
         if (!summary_raw) {
             return "";
         }
         
-        std::string summary(summary_raw);
+        std::string result(summary_raw);
         free(summary_raw);
-        
-        return summary;
+        return cancel ? "" : result;
     }
     
-    void apply_summarization() {
-        if (!agent) {
+    // Replace history[begin, end) with the summary, which took elapsed_ms
+    void replace_with_summary(size_t end, const std::string& text, double elapsed_ms) {
+        size_t begin = summary_begin();
+        if (end <= begin || end > agent->history.size()) {
             return;
         }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            applied_ms += elapsed_ms;
+        }
         
-        // Generate summary
-        std::string summary = generate_summary();
-        if (summary.empty()) {
+        Message summary_msg;
+        summary_msg.role = "system";
+        summary_msg.content = "[Previous conversation summary]: " + text;
+        
+        // Replace history
+        agent->history.erase(agent->history.begin() + begin, agent->history.begin() + end);
+        agent->history.insert(agent->history.begin() + begin, summary_msg);
+        agent->invalidate_history();
+    }
+    
+    // Snapshot the oldest messages and summarize them on the worker thread
+    void start_background_summary() {
+        size_t end = summary_end();
+        if (end <= summary_begin()) {
             return;
         }
+        if (worker.joinable()) {
+            worker.join();
+        }
         
-        // Calculate how many messages to keep
-        size_t num_to_summarize = static_cast<size_t>(agent->history.size() * 0.6);
-        if (num_to_summarize < 2) {
-            return; // Not enough history to summarize
+        std::string summary_prompt = build_summary_prompt(end);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = true;
+            ready = false;
+            summary.clear();
+            summary_ms = 0.0;
+            job_end = end;
+            job_epoch = agent->history_epoch;
+        }
+        
+        worker = std::thread([this, summary_prompt]() {
+            double elapsed_ms = 0.0;
+            std::string result = generate_summary(summary_prompt, elapsed_ms);
+            std::lock_guard<std::mutex> lock(mutex);
+            summary = result;
+            summary_ms = elapsed_ms;
+            ready = !result.empty();
+            running = false;
+        });
+    }
+    
+    // Called on the agent thread around each turn and after tool rounds.
+    // Only a requested trigger blocks on generation.
+    void maintain(luup_agent*) override {
+        bool trigger;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            trigger = trigger_requested;
+            trigger_requested = false;
+        }
+        if (enabled) {
+            if (trigger) {
+                apply_summarization();
+            } else {
+                maintain_background();
+            }
         }
         
-        // Create new history with summary
-        std::vector<Message> new_history;
+        size_t tokens = history_token_count(agent);
+        bool full = should_summarize();
+        std::lock_guard<std::mutex> lock(mutex);
+        status_tokens = tokens;
+        status_full = full;
+    }
+    
+    // Start a background summary or swap in a finished one
+    void maintain_background() {
+        if (seq_id < 0) {
+            // No sequence of its own: summarize now, once it is due
+            if (should_summarize()) {
+                apply_summarization();
+            }
+            return;
+        }
         
-        // Keep system message if present
-        if (!agent->history.empty() && agent->history[0].role == "system") {
-            new_history.push_back(agent->history[0]);
-            num_to_summarize = (num_to_summarize > 1) ? num_to_summarize - 1 : 0;
+        bool is_running;
+        bool has_summary;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // A summary of a rewritten history no longer applies
+            if (ready && job_epoch != agent->history_epoch) {
+                ready = false;
+                summary.clear();
+            }
+            is_running = running;
+            has_summary = ready;
         }
         
-        // Add summary message
-        Message summary_msg;
-        summary_msg.role = "system";
-        summary_msg.content = "[Previous conversation summary]: " + summary;
-        new_history.push_back(summary_msg);
+        if (has_summary) {
+            if (should_summarize()) {
+                std::string text;
+                size_t end;
+                double elapsed_ms;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    text.swap(summary);
+                    end = job_end;
+                    elapsed_ms = summary_ms;
+                    ready = false;
+                }
+                replace_with_summary(end, text, elapsed_ms);
+            }
+        } else if (!is_running && is_context_full(agent, context_size, start_threshold)) {
+            start_background_summary();
+        }
+    }
+    
+    // Summarize now on the agent thread (manual trigger)
+    void apply_summarization() {
+        if (!agent) {
+            return;
+        }
         
-        // Keep recent messages
-        size_t start_idx = agent->history.empty() ? 0 : 
-                          (agent->history[0].role == "system" ? num_to_summarize + 1 : num_to_summarize);
+        // Let a running job finish instead of racing it for the sequence
+        if (worker.joinable()) {
+            worker.join();
+        }
         
-        for (size_t i = start_idx; i < agent->history.size(); i++) {
-            new_history.push_back(agent->history[i]);
+        size_t end = summary_end();
+        if (end <= summary_begin()) {
+            return; // Not enough history to summarize
         }
         
-        // Replace history
-        agent->history = new_history;
-    }
-};
-
-// Hook function that checks and applies summarization before generation
-// This is called internally by the agent during generation
-static void check_and_summarize(SummarizationState* state) {
-    if (!state || !state->enabled) {
-        return;
+        double elapsed_ms = 0.0;
+        std::string text = generate_summary(build_summary_prompt(end), elapsed_ms);
+        if (text.empty()) {
+            return;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready = false;
+            summary.clear();
+        }
+        replace_with_summary(end, text, elapsed_ms);
     }
     
-    if (state->should_summarize()) {
-        state->apply_summarization();
+    double take_work_ms() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        double ms = applied_ms;
+        applied_ms = 0.0;
+        return ms;
     }
-}
+};
 
-// Dummy tool callback (summarization is automatic, not called by agent)
+// Tool callback for status and manual control (summarization itself is automatic)
 static char* summarization_tool_callback(const char* params_json, void* user_data) {
     auto state = static_cast<SummarizationState*>(user_data);
     
@@ -179,56 +323,60 @@ static char* summarization_tool_callback(const char* params_json, void* user_dat
         if (operation == "status") {
             // Return summarization status
             json result;
-            result["enabled"] = state->enabled;
+            result["enabled"] = state->enabled.load();
+            result["start_threshold"] = state->start_threshold;
             result["threshold"] = state->threshold;
             result["context_size"] = state->context_size;
             
-            if (state->agent) {
-                size_t estimated_tokens = 0;
-                for (const auto& msg : state->agent->history) {
-                    estimated_tokens += estimate_token_count(msg.content);
-                }
-                result["current_tokens"] = estimated_tokens;
-                result["should_summarize"] = state->should_summarize();
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                result["current_tokens"] = state->status_tokens;
+                result["should_summarize"] = state->status_full;
+                result["in_progress"] = state->running;
+                result["summary_ready"] = state->ready;
             }
+            result["background"] = state->seq_id >= 0;
             
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "trigger") {
-            // Manually trigger summarization
+            // Applied by the agent before its next generation
             if (state->agent && state->enabled) {
-                state->apply_summarization();
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->trigger_requested = true;
+                }
                 
                 json result;
                 result["success"] = true;
-                result["message"] = "Summarization applied";
+                result["message"] = "Summarization will be applied before the next response";
                 return strdup(result.dump().c_str());
             }
             
             json error;
             error["error"] = "Summarization not enabled or agent invalid";
             return strdup(error.dump().c_str());
-            
+        
         } else if (operation == "enable") {
             state->enabled = true;
             json result;
             result["success"] = true;
             result["message"] = "Summarization enabled";
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "disable") {
             state->enabled = false;
             json result;
             result["success"] = true;
             result["message"] = "Summarization disabled";
             return strdup(result.dump().c_str());
-            
+        
         } else {
             json error;
             error["error"] = "Unknown operation: " + operation;
             return strdup(error.dump().c_str());
         }
-        
+    
     } catch (const std::exception& e) {
         json error;
         error["error"] = std::string("Summarization tool error: ") + e.what();
@@ -244,6 +392,7 @@ luup_error_t luup_agent_enable_builtin_summarization(luup_agent* agent) {
         return LUUP_ERROR_INVALID_PARAM;
     }
     
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
     try {
         // Create summarization state
         auto state = new SummarizationState(agent);
@@ -284,12 +433,17 @@ luup_error_t luup_agent_enable_builtin_summarization(luup_agent* agent) {
             return result;
         }
         
-        // Note: In a complete implementation, we would hook into the agent's
-        // generation pipeline to call check_and_summarize() before each generation.
-        // For this phase, the tool provides manual control.
+        // The agent owns the state and runs it around each turn; this
+        // replaces (and stops) any previously enabled summarizer, which
+        // gives its sequence back first
+        agent->maintainer.reset(state);
+        if (state->model == agent->model && luup_model_is_local(agent->model)) {
+            luup_agent_get_sequence(agent);   // The summarizer can't take the agent's slot
+        }
+        state->seq_id = luup_model_reserve_sequence(state->model);
         
         return LUUP_SUCCESS;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
         return LUUP_ERROR_OUT_OF_MEMORY;
@@ -5,74 +5,49 @@
 
 #include "../../include/luup_agent.h"
 #include "../core/internal.h"
+#include "record_journal.h"
 #include <nlohmann/json.hpp>
 #include <string>
-#include <fstream>
+#include <map>
 #include <ctime>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 
 using json = nlohmann::json;
 
 extern void luup_set_error(luup_error_t code, const char* message);
 
-// Storage structure for todo list
+// Storage structure for todo list. Todos are kept by id (ids only grow, so
+// this is also creation order) and persisted through an append-only journal.
 struct TodoListStorage {
-    json data;
+    std::map<int, json> todos;
     std::string storage_path;
+    RecordJournal journal;
+    bool loaded;
     int next_id;
+    std::mutex mutex;   // Tool calls may run in parallel
     
-    TodoListStorage() : next_id(1) {
-        data = json::object();
-        data["todos"] = json::array();
-    }
+    TodoListStorage() : journal("todos"), loaded(false), next_id(1) {}
     
-    bool load_from_file() {
-        if (storage_path.empty()) {
-            return false;
+    // Load on first use rather than when the tool is enabled
+    void ensure_loaded() {
+        if (loaded) {
+            return;
         }
-        
-        try {
-            std::ifstream file(storage_path);
-            if (file.is_open()) {
-                file >> data;
-                file.close();
-                
-                // Update next_id based on existing todos
-                if (data.contains("todos") && data["todos"].is_array()) {
-                    for (const auto& todo : data["todos"]) {
-                        if (todo.contains("id") && todo["id"].is_number()) {
-                            int id = todo["id"].get<int>();
-                            if (id >= next_id) {
-                                next_id = id + 1;
-                            }
-                        }
-                    }
-                }
-                return true;
-            }
-        } catch (const std::exception& e) {
-            // File doesn't exist or is invalid, start fresh
+        loaded = true;
+        journal.open(storage_path, todos);
+        if (!todos.empty()) {
+            next_id = todos.rbegin()->first + 1;
         }
-        return false;
     }
     
-    bool save_to_file() {
-        if (storage_path.empty()) {
-            return true; // Memory only mode
+    json list() const {
+        json items = json::array();
+        for (const auto& entry : todos) {
+            items.push_back(entry.second);
         }
-        
-        try {
-            std::ofstream file(storage_path);
-            if (file.is_open()) {
-                file << data.dump(2);
-                file.close();
-                return true;
-            }
-        } catch (const std::exception& e) {
-            return false;
-        }
-        return false;
+        return items;
     }
 };
 
@@ -83,10 +58,21 @@ static std::string get_current_timestamp() {
     return std::string(buf);
 }
 
+// A change kept in memory that the journal couldn't record is lost on
+// restart; tell the model rather than reporting plain success
+static void report_unsaved(json& result, bool saved) {
+    if (!saved) {
+        result["error"] = "Change could not be saved to storage and will be lost on restart";
+    }
+}
+
 static char* todo_tool_callback(const char* params_json, void* user_data) {
     auto storage = static_cast<TodoListStorage*>(user_data);
+    std::lock_guard<std::mutex> lock(storage->mutex);
     
     try {
+        storage->ensure_loaded();
+        
         json params = json::parse(params_json);
         std::string operation = params.value("operation", "list");
         
@@ -105,21 +91,22 @@ static char* todo_tool_callback(const char* params_json, void* user_data) {
             todo["status"] = "pending";
             todo["created"] = get_current_timestamp();
             
-            storage->data["todos"].push_back(todo);
-            storage->save_to_file();
+            storage->todos[todo["id"].get<int>()] = todo;
+            bool saved = storage->journal.put(todo, storage->todos);
             
             json result;
             result["success"] = true;
             result["message"] = "Todo added successfully";
             result["todo"] = todo;
+            report_unsaved(result, saved);
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "list") {
             // List all todos
             json result;
-            result["todos"] = storage->data["todos"];
+            result["todos"] = storage->list();
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "complete") {
             // Mark todo as complete
             int id = params.value("id", 0);
@@ -129,29 +116,23 @@ static char* todo_tool_callback(const char* params_json, void* user_data) {
                 return strdup(error.dump().c_str());
             }
             
-            bool found = false;
-            for (auto& todo : storage->data["todos"]) {
-                if (todo["id"] == id) {
-                    todo["status"] = "completed";
-                    todo["completed"] = get_current_timestamp();
-                    found = true;
-                    break;
-                }
-            }
-            
-            if (!found) {
+            auto it = storage->todos.find(id);
+            if (it == storage->todos.end()) {
                 json error;
                 error["error"] = "Todo not found";
                 return strdup(error.dump().c_str());
             }
             
-            storage->save_to_file();
+            it->second["status"] = "completed";
+            it->second["completed"] = get_current_timestamp();
+            bool saved = storage->journal.put(it->second, storage->todos);
             
             json result;
             result["success"] = true;
             result["message"] = "Todo marked as completed";
+            report_unsaved(result, saved);
             return strdup(result.dump().c_str());
-            
+        
         } else if (operation == "delete") {
             // Delete todo
             int id = params.value("id", 0);
@@ -161,35 +142,26 @@ static char* todo_tool_callback(const char* params_json, void* user_data) {
                 return strdup(error.dump().c_str());
             }
             
-            auto& todos = storage->data["todos"];
-            bool found = false;
-            for (size_t i = 0; i < todos.size(); i++) {
-                if (todos[i]["id"] == id) {
-                    todos.erase(todos.begin() + i);
-                    found = true;
-                    break;
-                }
-            }
-            
-            if (!found) {
+            if (storage->todos.erase(id) == 0) {
                 json error;
                 error["error"] = "Todo not found";
                 return strdup(error.dump().c_str());
             }
             
-            storage->save_to_file();
+            bool saved = storage->journal.remove(id, storage->todos);
             
             json result;
             result["success"] = true;
             result["message"] = "Todo deleted successfully";
+            report_unsaved(result, saved);
             return strdup(result.dump().c_str());
-            
+        
         } else {
             json error;
             error["error"] = "Unknown operation: " + operation;
             return strdup(error.dump().c_str());
         }
-        
+    
     } catch (const std::exception& e) {
         json error;
         error["error"] = std::string("Todo tool error: ") + e.what();
@@ -212,8 +184,7 @@ luup_error_t luup_agent_enable_builtin_todo(
         // Create storage
         auto storage = new TodoListStorage();
         if (storage_path) {
-            storage->storage_path = storage_path;
-            storage->load_from_file();
+            storage->storage_path = storage_path;  // Loaded on first use
         }
         
         // Define tool
@@ -255,7 +226,7 @@ luup_error_t luup_agent_enable_builtin_todo(
         }
         
         return LUUP_SUCCESS;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
         return LUUP_ERROR_OUT_OF_MEMORY;
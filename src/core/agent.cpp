@@ -10,6 +10,8 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <cstdlib>
 
@@ -17,48 +19,435 @@ using json = nlohmann::json;
 
 extern void luup_set_error(luup_error_t code, const char* message);
 
-// Tool registration info (matches tool_calling.cpp)
-struct ToolInfo {
-    luup_tool tool;
-    luup_tool_callback_t callback;
-    void* user_data;
+namespace {
+    // Forwards streamed text to the caller and stops generation as soon as
+    // a complete tool call has been emitted, so it can run right away
+    struct ToolCallStream {
+        luup_stream_callback_t callback;
+        void* user_data;
+        bool detect;
+        bool delivered;           // Some text already reached the callback
+        bool stopped_by_caller;
+        ToolCallScanner scanner;
+        std::vector<ToolCall> calls;
+        
+        ToolCallStream(luup_stream_callback_t cb, void* data, bool detect_calls)
+            : callback(cb), user_data(data), detect(detect_calls),
+              delivered(false), stopped_by_caller(false) {}
+        
+        // Calls seen during streaming, plus any the end of output completes
+        std::vector<ToolCall> take_calls() {
+            std::vector<ToolCall> rest = scanner.finish();
+            calls.insert(calls.end(), rest.begin(), rest.end());
+            return std::move(calls);
+        }
+    };
     
-    ToolInfo() : callback(nullptr), user_data(nullptr) {
-        tool.name = nullptr;
-        tool.description = nullptr;
-        tool.parameters_json = nullptr;
+    bool tool_call_stream_callback(const char* token, void* user_data) {
+        auto stream = static_cast<ToolCallStream*>(user_data);
+        stream->delivered = true;
+        if (stream->callback && !stream->callback(token, stream->user_data)) {
+            stream->stopped_by_caller = true;
+            return false;
+        }
+        if (stream->detect) {
+            std::vector<ToolCall> found = stream->scanner.feed(token, strlen(token));
+            if (!found.empty()) {
+                stream->calls.insert(stream->calls.end(), found.begin(), found.end());
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    bool has_enabled_tools(const luup_agent* agent) {
+        for (const auto& entry : agent->tools) {
+            if (entry.second.enabled) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Enabled tools in the OpenAI "tools" format, cached like the schema
+    const std::string& agent_native_tools(luup_agent* agent) {
+        if (!agent->native_tools_valid) {
+            agent->native_tools = generate_native_tools(agent->tools);
+            agent->native_tools_valid = true;
+        }
+        return agent->native_tools;
+    }
+    
+    // Add the stats of the model call just made to the turn's metrics
+    void add_generation_metrics(luup_turn_metrics& metrics) {
+        const GenerationStats& stats = luup_last_generation_stats();
+        if (metrics.generations == 0) {
+            metrics.ttft_ms = stats.ttft_ms;
+        }
+        metrics.generations++;
+        metrics.prompt_tokens += stats.prompt_tokens;
+        metrics.cached_tokens += stats.cached_tokens;
+        metrics.generated_tokens += stats.generated_tokens;
+        metrics.prefill_ms += stats.prefill_ms;
+        metrics.decode_ms += stats.decode_ms;
+        metrics.http_connect_ms += stats.http_connect_ms;
+        metrics.http_ttfb_ms += stats.http_ttfb_ms;
+    }
+    
+    // Generate one response from the agent's backend. Local models take the
+    // formatted prompt; remote models take the messages and get the tools
+    // natively. With a callback the text is streamed through it; blocking
+    // remote calls skip streaming.
+    char* generate_uncached(luup_agent* agent, void* backend_data, const std::string& prompt,
+                            const std::vector<Message>& messages, const std::string& tools_json,
+                            const SamplingParams& sampling, int max_tokens, bool streaming,
+                            ToolCallStream& stream) {
+        if (luup_model_is_local(agent->model)) {
+            bool use_callback = streaming || stream.detect;
+            return llama_backend_generate_stream(
+                backend_data,
+                luup_agent_get_sequence(agent),
+                prompt.c_str(),
+                sampling,
+                max_tokens,
+                use_callback ? tool_call_stream_callback : nullptr,
+                &stream
+            );
+        }
+        
+        if (streaming) {
+            char* response = openai_backend_chat(
+                backend_data,
+                messages,
+                tools_json,
+                sampling,
+                max_tokens,
+                tool_call_stream_callback,
+                &stream
+            );
+            if (response || stream.delivered) {
+                return response;
+            }
+            // Fall back to non-streaming if streaming fails before any output
+        }
+        
+        char* response = openai_backend_chat(
+            backend_data,
+            messages,
+            tools_json,
+            sampling,
+            max_tokens,
+            nullptr,
+            nullptr
+        );
+        if (response && streaming) {
+            tool_call_stream_callback(response, &stream);  // Deliver as one chunk
+        } else if (response && stream.detect) {
+            stream.calls = parse_tool_calls(response);
+        }
+        return response;
+    }
+    
+    // Everything that decides a remote model's input, for the cache key
+    std::string remote_request_text(const std::vector<Message>& messages,
+                                    const std::string& tools_json) {
+        std::string text;
+        for (const auto& msg : messages) {
+            text += std::to_string(msg.role.size()) + ":" + msg.role;
+            text += std::to_string(msg.content.size()) + ":" + msg.content;
+            std::string calls = format_tool_calls(msg.tool_calls);
+            text += std::to_string(calls.size()) + ":" + calls;
+            text += std::to_string(msg.tool_call_id.size()) + ":" + msg.tool_call_id;
+        }
+        return text + "tools:" + tools_json;
+    }
+    
+    // generate_uncached behind the model's response cache. A hit is
+    // delivered as one chunk and counted instead of a generation. Turns on
+    // local models bypass the cache: a hit would leave the agent's KV
+    // sequence behind its history, so the next turn would prefill what the
+    // hit skipped.
+    char* generate_response(luup_agent* agent, void* backend_data, const std::string& prompt,
+                            const std::vector<Message>& messages, int max_tokens,
+                            bool streaming, ToolCallStream& stream) {
+        bool local = luup_model_is_local(agent->model);
+        
+        // Constrain tool-call JSON once the model starts one
+        SamplingParams sampling = agent->sampling;
+        if (local && stream.detect && agent->enable_tool_grammar) {
+            if (!agent->tool_grammar_valid) {
+                agent->tool_grammar = generate_tool_grammar(agent->tools);
+                agent->tool_grammar_valid = true;
+            }
+            sampling.grammar = agent->tool_grammar;
+        }
+        
+        static const std::string no_tools;
+        const std::string& tools_json = !local && stream.detect
+            ? agent_native_tools(agent) : no_tools;
+        
+        luup_turn_metrics& metrics = agent->last_metrics.metrics;
+        std::shared_ptr<ResponseCache> cache = local ? nullptr
+                                                     : luup_model_response_cache(agent->model);
+        std::string key = luup_model_cache_key(
+            agent->model, cache.get(), cache ? remote_request_text(messages, tools_json) : "",
+            sampling, max_tokens);
+        std::string cached;
+        if (luup_model_cache_lookup(cache.get(), key, cached)) {
+            metrics.cache_hits++;
+            if (streaming || stream.detect) {
+                tool_call_stream_callback(cached.c_str(), &stream);
+            }
+            return strdup(cached.c_str());
+        }
+        
+        char* response = generate_uncached(agent, backend_data, prompt, messages, tools_json,
+                                           sampling, max_tokens, streaming, stream);
+        add_generation_metrics(metrics);
+        if (!key.empty()) {
+            metrics.cache_misses++;
+            if (response && !stream.stopped_by_caller) {
+                luup_model_cache_store(cache.get(), key, response);
+            }
+        }
+        return response;
     }
-};
-
-// Message structure (matches context_manager.cpp)
-struct Message {
-    std::string role;
-    std::string content;
-};
-
-// Tool call structure (matches tool_calling.cpp)
-struct ToolCall {
-    std::string tool_name;
-    std::string parameters_json;
-};
-
-// Internal agent structure
-struct luup_agent {
-    luup_model* model;
-    std::string system_prompt;
-    float temperature;
-    int max_tokens;
-    bool enable_tool_calling;
-    bool enable_history_management;
-    bool enable_builtin_tools;
     
-    std::vector<Message> history;
-    std::map<std::string, ToolInfo> tools;
+    // Text of a remote response without the native calls the backend
+    // appended to it (see format_native_tool_calls)
+    std::string text_before_native_calls(const std::string& response) {
+        size_t pos = response.rfind("{\"tool_calls\":");
+        if (pos == std::string::npos) {
+            return response;
+        }
+        size_t end = pos;
+        while (end > 0 && (response[end - 1] == '\n' || response[end - 1] == ' ')) {
+            end--;
+        }
+        return response.substr(0, end);
+    }
+    
+    // Add one round of tool calls to the per-tool breakdown
+    void add_tool_metrics(TurnMetrics& turn, const std::vector<ToolCall>& calls,
+                          const std::vector<double>& elapsed_ms) {
+        for (size_t i = 0; i < calls.size(); i++) {
+            size_t idx = 0;
+            while (idx < turn.tool_names.size() && turn.tool_names[idx] != calls[i].tool_name) {
+                idx++;
+            }
+            if (idx == turn.tool_names.size()) {
+                turn.tool_names.push_back(calls[i].tool_name);
+                turn.tools.push_back(luup_tool_metrics());
+            }
+            turn.tools[idx].calls++;
+            turn.tools[idx].total_ms += elapsed_ms[i];
+            turn.metrics.tool_calls++;
+            turn.metrics.tool_ms += elapsed_ms[i];
+        }
+    }
+    
+    // Run one user turn. Tool calls are executed and their results added to
+    // the conversation, then the model is asked again, until it answers
+    // without a tool call. Calls made after max_tool_rounds rounds or once
+    // the token budget has run out are not executed and fail the turn. Each
+    // message is appended to history exactly once, so every round only
+    // prefills the new assistant and tool text.
+    luup_error_t run_turn_rounds(luup_agent* agent, const char* user_message,
+                                 luup_stream_callback_t callback, void* user_data,
+                                 std::string& final_response) {
+        void* backend_data = luup_model_get_backend_data(agent->model);
+        if (!backend_data) {
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, "Model backend not initialized");
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        
+        // Add user message to history if history management is enabled.
+        // Without history the turn's own messages live in a local prompt
+        // (local models) or message list (remote models).
+        const bool local = luup_model_is_local(agent->model);
+        std::string single_turn;
+        std::vector<Message> turn_messages;
+        if (agent->enable_history_management) {
+            if (agent->maintainer) {
+                agent->maintainer->maintain(agent);
+            }
+            Message msg;
+            msg.role = "user";
+            msg.content = user_message;
+            agent->history.push_back(msg);
+        } else if (local) {
+            single_turn = build_single_turn_prompt(agent, user_message);
+        } else {
+            if (!agent->system_prompt.empty()) {
+                Message system_msg;
+                system_msg.role = "system";
+                system_msg.content = agent->system_prompt;
+                turn_messages.push_back(system_msg);
+            }
+            Message msg;
+            msg.role = "user";
+            msg.content = user_message;
+            turn_messages.push_back(msg);
+        }
+        
+        const bool detect_tools = agent->enable_tool_calling && has_enabled_tools(agent);
+        const int max_rounds = agent->max_tool_rounds > 0 ? agent->max_tool_rounds : 5;
+        int tokens_used = 0;
+        
+        // round counts the rounds of tool calls executed so far
+        for (int round = 0;; round++) {
+            // Trim history to the context budget before building the prompt
+            if (agent->enable_history_management) {
+                apply_context_strategy(agent);
+            }
+            
+            // The cached prompt is only appended to between rounds
+            const std::string& prompt = local && agent->enable_history_management
+                ? build_agent_prompt(agent)
+                : single_turn;
+            const std::vector<Message>& messages = agent->enable_history_management
+                ? agent->history
+                : turn_messages;
+            
+            // Cap this round by what is left of the turn's budget
+            int max_tokens = agent->max_tokens;
+            if (agent->token_budget > 0) {
+                int remaining = std::max(agent->token_budget - tokens_used, 1);
+                max_tokens = max_tokens > 0 ? std::min(max_tokens, remaining) : remaining;
+            }
+            
+            ToolCallStream stream(callback, user_data, detect_tools);
+            char* response_raw = generate_response(agent, backend_data, prompt, messages,
+                                                   max_tokens, callback != nullptr, stream);
+            if (!response_raw) {
+                // Keep the backend's error code (e.g. context overflow)
+                luup_error_t code = luup_get_last_error_code();
+                return code != LUUP_SUCCESS ? code : LUUP_ERROR_INFERENCE_FAILED;
+            }
+            
+            std::string response(response_raw);
+            free(response_raw);
+            tokens_used += static_cast<int>(count_model_tokens(agent->model, response));
+            
+            std::vector<ToolCall> tool_calls;
+            if (detect_tools && !stream.stopped_by_caller) {
+                tool_calls = stream.take_calls();
+            }
+            
+            // Native calls from a remote model travel with the assistant
+            // message rather than in its text, and each gets a "tool" result
+            const bool native_calls = !local && !tool_calls.empty() &&
+                std::all_of(tool_calls.begin(), tool_calls.end(),
+                            [](const ToolCall& call) { return !call.id.empty(); });
+            Message assistant_msg;
+            assistant_msg.role = "assistant";
+            assistant_msg.content = native_calls ? text_before_native_calls(response) : response;
+            if (native_calls) {
+                assistant_msg.tool_calls = tool_calls;
+            }
+            
+            // Add assistant response to history
+            if (agent->enable_history_management) {
+                agent->history.push_back(assistant_msg);
+            }
+            bool budget_left = agent->token_budget <= 0 || tokens_used < agent->token_budget;
+            if (tool_calls.empty() || round >= max_rounds || !budget_left) {
+                if (agent->enable_history_management && agent->maintainer) {
+                    agent->maintainer->maintain(agent);
+                }
+                if (!tool_calls.empty()) {
+                    // The response is the calls, not an answer to hand back
+                    luup_set_error(LUUP_ERROR_TOOL_LIMIT, budget_left
+                        ? "Tool round limit reached with tool calls pending"
+                        : "Token budget ran out with tool calls pending");
+                    return LUUP_ERROR_TOOL_LIMIT;
+                }
+                final_response = response;
+                return LUUP_SUCCESS;
+            }
+            
+            // Execute tool calls; results keep the order of the calls
+            if (!agent->tool_pool && (agent->max_parallel_tools > 1 || agent->tool_timeout_ms > 0)) {
+                agent->tool_pool.reset(new ToolPool(std::max(agent->max_parallel_tools, 1)));
+            }
+            std::vector<double> elapsed_ms;
+            std::vector<std::string> results = execute_tools(
+                tool_calls, agent->tools, agent->tool_pool.get(), agent->tool_timeout_ms,
+                &elapsed_ms);
+            add_tool_metrics(agent->last_metrics, tool_calls, elapsed_ms);
+            std::string tool_results;
+            for (size_t i = 0; i < tool_calls.size(); i++) {
+                tool_results += format_tool_result(tool_calls[i].tool_name, results[i]) + "\n";
+            }
+            
+            // Feed the results back as the next user message, or as one
+            // "tool" message per native call
+            auto append_results = [&](std::vector<Message>& out) {
+                if (!native_calls) {
+                    Message tool_msg;
+                    tool_msg.role = "user";
+                    tool_msg.content = tool_results;
+                    tool_msg.tool_result = true;
+                    out.push_back(tool_msg);
+                    return;
+                }
+                for (size_t i = 0; i < tool_calls.size(); i++) {
+                    Message tool_msg;
+                    tool_msg.role = "tool";
+                    tool_msg.content = results[i];
+                    tool_msg.tool_result = true;
+                    tool_msg.tool_call_id = tool_calls[i].id;
+                    out.push_back(tool_msg);
+                }
+            };
+            if (agent->enable_history_management) {
+                append_results(agent->history);
+                
+                // Applies work the tools asked for, e.g. a summarization trigger
+                if (agent->maintainer) {
+                    agent->maintainer->maintain(agent);
+                }
+            } else if (local) {
+                single_turn += response + "\n\nUser: " + tool_results + "\n\nAssistant: ";
+            } else {
+                turn_messages.push_back(assistant_msg);
+                append_results(turn_messages);
+            }
+        }
+    }
     
-    luup_agent() : model(nullptr), temperature(0.7f), max_tokens(0),
-                   enable_tool_calling(true), enable_history_management(true),
-                   enable_builtin_tools(true) {}
-};
+    // Run a turn and record its metrics, then hand them to the callback
+    luup_error_t run_agent_turn(luup_agent* agent, const char* user_message,
+                                luup_stream_callback_t callback, void* user_data,
+                                std::string& final_response) {
+        using ms = std::chrono::duration<double, std::milli>;
+        auto start = std::chrono::steady_clock::now();
+        TurnMetrics& turn = agent->last_metrics;
+        turn.reset();
+        
+        luup_error_t result = run_turn_rounds(agent, user_message, callback, user_data,
+                                              final_response);
+        
+        luup_turn_metrics& metrics = turn.metrics;
+        if (metrics.decode_ms > 0.0 && metrics.generated_tokens > 0) {
+            metrics.decode_tokens_per_sec = metrics.generated_tokens * 1000.0 / metrics.decode_ms;
+        }
+        if (agent->maintainer) {
+            metrics.summarization_ms = agent->maintainer->take_work_ms();
+        }
+        for (size_t i = 0; i < turn.tools.size(); i++) {
+            turn.tools[i].name = turn.tool_names[i].c_str();
+        }
+        metrics.tools = turn.tools.empty() ? nullptr : turn.tools.data();
+        metrics.n_tools = static_cast<int>(turn.tools.size());
+        metrics.total_ms = ms(std::chrono::steady_clock::now() - start).count();
+        
+        if (agent->metrics_callback) {
+            agent->metrics_callback(&metrics, agent->metrics_user_data);
+        }
+        return result;
+    }
+}
 
 extern "C" {
 
@@ -72,11 +461,25 @@ luup_agent* luup_agent_create(const luup_agent_config* config) {
         auto agent = new luup_agent();
         agent->model = config->model;
         agent->system_prompt = config->system_prompt ? config->system_prompt : "";
-        agent->temperature = config->temperature;
+        agent->sampling.temperature = config->temperature;
+        agent->sampling.top_k = config->top_k;
+        agent->sampling.top_p = config->top_p;
+        agent->sampling.min_p = config->min_p;
+        agent->sampling.repeat_penalty = config->repeat_penalty;
+        agent->sampling.seed = config->seed;
         agent->max_tokens = config->max_tokens;
         agent->enable_tool_calling = config->enable_tool_calling;
         agent->enable_history_management = config->enable_history_management;
         agent->enable_builtin_tools = config->enable_builtin_tools;
+        agent->max_parallel_tools = config->max_parallel_tools;
+        agent->tool_timeout_ms = config->tool_timeout_ms;
+        agent->max_tool_rounds = config->max_tool_rounds;
+        agent->token_budget = config->token_budget;
+        agent->enable_tool_grammar = config->enable_tool_grammar;
+        agent->compact_tool_schema = config->compact_tool_schema;
+        agent->summarizer_model = config->summarizer_model;
+        agent->context_strategy = config->context_strategy;
+        agent->context_budget = config->context_budget;
         
         // Add system message to history if provided
         if (!agent->system_prompt.empty()) {
@@ -116,6 +519,7 @@ luup_error_t luup_agent_register_tool(
         return LUUP_ERROR_INVALID_PARAM;
     }
     
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
     try {
         ToolInfo info;
         info.tool = *tool;
@@ -123,6 +527,7 @@ luup_error_t luup_agent_register_tool(
         info.user_data = user_data;
         
         agent->tools[tool->name] = info;
+        agent->invalidate_tools();
         
         return LUUP_SUCCESS;
     } catch (const std::exception& e) {
@@ -131,6 +536,31 @@ luup_error_t luup_agent_register_tool(
     }
 }
 
+luup_error_t luup_agent_set_tool_enabled(
+    luup_agent* agent,
+    const char* tool_name,
+    bool enabled)
+{
+    if (!agent || !tool_name) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+    auto it = agent->tools.find(tool_name);
+    if (it == agent->tools.end()) {
+        luup_set_error(LUUP_ERROR_TOOL_NOT_FOUND,
+                      ("Tool not registered: " + std::string(tool_name)).c_str());
+        return LUUP_ERROR_TOOL_NOT_FOUND;
+    }
+    
+    if (it->second.enabled != enabled) {
+        it->second.enabled = enabled;
+        agent->invalidate_tools();
+    }
+    return LUUP_SUCCESS;
+}
+
 luup_error_t luup_agent_generate_stream(
     luup_agent* agent,
     const char* user_message,
@@ -142,142 +572,8 @@ luup_error_t luup_agent_generate_stream(
         return LUUP_ERROR_INVALID_PARAM;
     }
     
-    try {
-        // Add user message to history if history management is enabled
-        if (agent->enable_history_management) {
-            Message msg;
-            msg.role = "user";
-            msg.content = user_message;
-            agent->history.push_back(msg);
-        }
-        
-        // Build the prompt from conversation history
-        std::string prompt;
-        if (agent->enable_history_management) {
-            prompt = format_chat_history(agent->history);
-        } else {
-            // No history - just use system prompt + user message
-            if (!agent->system_prompt.empty()) {
-                prompt = "System: " + agent->system_prompt + "\n\nUser: " + 
-                         std::string(user_message) + "\n\nAssistant: ";
-            } else {
-                prompt = "User: " + std::string(user_message) + "\n\nAssistant: ";
-            }
-        }
-        
-        // Add tool schema if tools are registered and enabled
-        if (agent->enable_tool_calling && !agent->tools.empty()) {
-            std::string tool_schema = generate_tool_schema(agent->tools);
-            // Insert tool schema after system prompt
-            size_t insert_pos = prompt.find("User:");
-            if (insert_pos != std::string::npos) {
-                prompt.insert(insert_pos, tool_schema);
-            }
-        }
-        
-        // For now, use blocking generation and simulate streaming
-        // TODO: Implement true token-by-token streaming in future
-        void* backend_data = luup_model_get_backend_data(agent->model);
-        if (!backend_data) {
-            luup_set_error(LUUP_ERROR_INVALID_PARAM, "Model backend not initialized");
-            return LUUP_ERROR_INVALID_PARAM;
-        }
-        
-        // For remote models, try to use streaming backend if available
-        if (!luup_model_is_local(agent->model)) {
-            bool success = openai_backend_generate_stream(
-                backend_data,
-                prompt.c_str(),
-                agent->temperature,
-                agent->max_tokens,
-                callback,
-                user_data
-            );
-            
-            if (success) {
-                // Add a placeholder message to history for the streamed response
-                if (agent->enable_history_management) {
-                    Message msg;
-                    msg.role = "assistant";
-                    msg.content = "[streamed response]";
-                    agent->history.push_back(msg);
-                }
-                luup_clear_error();
-                return LUUP_SUCCESS;
-            }
-            // Fall back to non-streaming if streaming fails
-        }
-        
-        // For local models or fallback, use non-streaming generation
-        char* response_raw = luup_model_is_local(agent->model) 
-            ? llama_backend_generate(
-                backend_data,
-                prompt.c_str(),
-                agent->temperature,
-                agent->max_tokens
-            )
-            : openai_backend_generate(
-                backend_data,
-                prompt.c_str(),
-                agent->temperature,
-                agent->max_tokens
-            );
-        
-        if (!response_raw) {
-            return LUUP_ERROR_INFERENCE_FAILED;
-        }
-        
-        std::string response(response_raw);
-        free(response_raw);
-        
-        // Check for tool calls if enabled
-        if (agent->enable_tool_calling && !agent->tools.empty()) {
-            std::vector<ToolCall> tool_calls = parse_tool_calls(response);
-            
-            if (!tool_calls.empty()) {
-                // Execute tool calls
-                std::string tool_results;
-                for (const auto& tc : tool_calls) {
-                    std::string result = execute_tool(tc.tool_name, tc.parameters_json, agent->tools);
-                    tool_results += format_tool_result(tc.tool_name, result) + "\n";
-                }
-                
-                // Add tool results to history and regenerate
-                if (agent->enable_history_management) {
-                    Message assistant_msg;
-                    assistant_msg.role = "assistant";
-                    assistant_msg.content = response;
-                    agent->history.push_back(assistant_msg);
-                    
-                    Message tool_msg;
-                    tool_msg.role = "user";
-                    tool_msg.content = tool_results;
-                    agent->history.push_back(tool_msg);
-                }
-                
-                // Recursively generate final response
-                // (In real implementation, you'd want a max recursion depth)
-                return luup_agent_generate_stream(agent, tool_results.c_str(), callback, user_data);
-            }
-        }
-        
-        // Simulate streaming by calling callback with full response
-        callback(response.c_str(), user_data);
-        
-        // Add assistant response to history
-        if (agent->enable_history_management) {
-            Message msg;
-            msg.role = "assistant";
-            msg.content = response;
-            agent->history.push_back(msg);
-        }
-        
-        return LUUP_SUCCESS;
-        
-    } catch (const std::exception& e) {
-        luup_set_error(LUUP_ERROR_INFERENCE_FAILED, e.what());
-        return LUUP_ERROR_INFERENCE_FAILED;
-    }
+    std::string response;
+    return luup_agent_run_turn(agent, user_message, callback, user_data, response);
 }
 
 char* luup_agent_generate(luup_agent* agent, const char* user_message) {
@@ -286,123 +582,46 @@ char* luup_agent_generate(luup_agent* agent, const char* user_message) {
         return nullptr;
     }
     
-    try {
-        // Add user message to history if history management is enabled
-        if (agent->enable_history_management) {
-            Message msg;
-            msg.role = "user";
-            msg.content = user_message;
-            agent->history.push_back(msg);
-        }
-        
-        // Build the prompt from conversation history
-        std::string prompt;
-        if (agent->enable_history_management) {
-            prompt = format_chat_history(agent->history);
-        } else {
-            // No history - just use system prompt + user message
-            if (!agent->system_prompt.empty()) {
-                prompt = "System: " + agent->system_prompt + "\n\nUser: " + 
-                         std::string(user_message) + "\n\nAssistant: ";
-            } else {
-                prompt = "User: " + std::string(user_message) + "\n\nAssistant: ";
-            }
-        }
-        
-        // Add tool schema if tools are registered and enabled
-        if (agent->enable_tool_calling && !agent->tools.empty()) {
-            std::string tool_schema = generate_tool_schema(agent->tools);
-            // Insert tool schema after system prompt
-            size_t insert_pos = prompt.find("User:");
-            if (insert_pos != std::string::npos) {
-                prompt.insert(insert_pos, tool_schema);
-            }
-        }
-        
-        // Generate response
-        void* backend_data = luup_model_get_backend_data(agent->model);
-        if (!backend_data) {
-            luup_set_error(LUUP_ERROR_INVALID_PARAM, "Model backend not initialized");
-            return nullptr;
-        }
-        
-        // Call appropriate backend based on model type
-        char* response_raw;
-        if (luup_model_is_local(agent->model)) {
-            response_raw = llama_backend_generate(
-                backend_data,
-                prompt.c_str(),
-                agent->temperature,
-                agent->max_tokens
-            );
-        } else {
-            response_raw = openai_backend_generate(
-                backend_data,
-                prompt.c_str(),
-                agent->temperature,
-                agent->max_tokens
-            );
-        }
-        
-        if (!response_raw) {
-            return nullptr;
-        }
-        
-        std::string response(response_raw);
-        free(response_raw);
-        
-        // Check for tool calls if enabled
-        if (agent->enable_tool_calling && !agent->tools.empty()) {
-            std::vector<ToolCall> tool_calls = parse_tool_calls(response);
-            
-            if (!tool_calls.empty()) {
-                // Execute tool calls
-                std::string tool_results;
-                for (const auto& tc : tool_calls) {
-                    std::string result = execute_tool(tc.tool_name, tc.parameters_json, agent->tools);
-                    tool_results += format_tool_result(tc.tool_name, result) + "\n";
-                }
-                
-                // Add tool results to history and regenerate
-                if (agent->enable_history_management) {
-                    Message assistant_msg;
-                    assistant_msg.role = "assistant";
-                    assistant_msg.content = response;
-                    agent->history.push_back(assistant_msg);
-                    
-                    Message tool_msg;
-                    tool_msg.role = "user";
-                    tool_msg.content = tool_results;
-                    agent->history.push_back(tool_msg);
-                }
-                
-                // Recursively generate final response
-                // (In real implementation, you'd want a max recursion depth)
-                return luup_agent_generate(agent, tool_results.c_str());
-            }
-        }
-        
-        // Add assistant response to history
-        if (agent->enable_history_management) {
-            Message msg;
-            msg.role = "assistant";
-            msg.content = response;
-            agent->history.push_back(msg);
-        }
-        
-        // Allocate and return result
-        char* result = static_cast<char*>(malloc(response.size() + 1));
-        if (result) {
-            memcpy(result, response.c_str(), response.size());
-            result[response.size()] = '\0';
-        }
-        
-        return result;
-        
-    } catch (const std::exception& e) {
-        luup_set_error(LUUP_ERROR_INFERENCE_FAILED, e.what());
+    std::string response;
+    if (luup_agent_run_turn(agent, user_message, nullptr, nullptr, response) != LUUP_SUCCESS) {
+        // Error already set
         return nullptr;
     }
+    
+    // Allocate and return result
+    char* result = static_cast<char*>(malloc(response.size() + 1));
+    if (result) {
+        memcpy(result, response.c_str(), response.size());
+        result[response.size()] = '\0';
+    }
+    return result;
+}
+
+luup_error_t luup_agent_get_last_metrics(luup_agent* agent, luup_turn_metrics* out_metrics) {
+    if (!agent || !out_metrics) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+    *out_metrics = agent->last_metrics.metrics;
+    return LUUP_SUCCESS;
+}
+
+luup_error_t luup_agent_set_metrics_callback(
+    luup_agent* agent,
+    luup_metrics_callback_t callback,
+    void* user_data)
+{
+    if (!agent) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid agent");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+    agent->metrics_callback = callback;
+    agent->metrics_user_data = user_data;
+    return LUUP_SUCCESS;
 }
 
 luup_error_t luup_agent_add_message(
@@ -414,7 +633,13 @@ luup_error_t luup_agent_add_message(
         luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
         return LUUP_ERROR_INVALID_PARAM;
     }
+    if (strcmp(role, "user") != 0 && strcmp(role, "assistant") != 0 &&
+        strcmp(role, "system") != 0) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Role must be \"user\", \"assistant\" or \"system\"");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
     
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
     try {
         Message msg;
         msg.role = role;
@@ -434,7 +659,9 @@ luup_error_t luup_agent_clear_history(luup_agent* agent) {
         return LUUP_ERROR_INVALID_PARAM;
     }
     
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
     agent->history.clear();
+    agent->invalidate_history();
     
     // Re-add system prompt if present
     if (!agent->system_prompt.empty()) {
@@ -453,6 +680,7 @@ char* luup_agent_get_history_json(luup_agent* agent) {
         return nullptr;
     }
     
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
     try {
         json history_json = json::array();
         
@@ -460,6 +688,12 @@ char* luup_agent_get_history_json(luup_agent* agent) {
             json msg_json;
             msg_json["role"] = msg.role;
             msg_json["content"] = msg.content;
+            if (!msg.tool_calls.empty()) {
+                msg_json["tool_calls"] = json::parse(format_tool_calls(msg.tool_calls))["tool_calls"];
+            }
+            if (!msg.tool_call_id.empty()) {
+                msg_json["tool_call_id"] = msg.tool_call_id;
+            }
             history_json.push_back(msg_json);
         }
         
@@ -473,7 +707,7 @@ char* luup_agent_get_history_json(luup_agent* agent) {
         }
         
         return result;
-        
+    
     } catch (const std::exception& e) {
         luup_set_error(LUUP_ERROR_JSON_PARSE_FAILED, e.what());
         return nullptr;
@@ -485,9 +719,57 @@ char* luup_agent_get_history_json(luup_agent* agent) {
 
 void luup_agent_destroy(luup_agent* agent) {
     if (agent) {
+        // Called back from one of its requests: the drain task destroys
+        // the agent once the queue is empty
+        if (luup_agent_defer_destroy(agent)) {
+            return;
+        }
+        
+        // Let submitted requests and calls on other threads finish first
+        luup_agent_wait_idle(agent);
+        {
+            std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+            
+            // Stops background work that still refers to the agent, waiting
+            // for tool callbacks that outlived a timeout
+            agent->tool_pool.reset();
+            agent->maintainer.reset();
+            if (agent->seq_id >= 0) {
+                llama_backend_release_sequence(luup_model_get_backend_data(agent->model),
+                                               agent->seq_id);
+            }
+        }
         delete agent;
     }
 }
 
 } // extern "C"
 
+// Run a turn under the agent's lock, with the C API's error handling.
+// Shared by the generate functions and submitted requests.
+luup_error_t luup_agent_run_turn(luup_agent* agent, const char* user_message,
+                                 luup_stream_callback_t callback, void* user_data,
+                                 std::string& response) {
+    std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+    try {
+        luup_error_t result = run_agent_turn(agent, user_message, callback, user_data, response);
+        if (result == LUUP_SUCCESS) {
+            luup_clear_error();
+        }
+        return result;
+    
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_INFERENCE_FAILED, e.what());
+        return LUUP_ERROR_INFERENCE_FAILED;
+    }
+}
+
+// Bind the agent to a KV-cache sequence of its local model on first use
+int luup_agent_get_sequence(luup_agent* agent) {
+    if (agent->seq_id < 0) {
+        agent->seq_id = llama_backend_acquire_sequence(
+            luup_model_get_backend_data(agent->model));
+    }
+    return agent->seq_id;
+}
+
@@ -0,0 +1,378 @@
+/**
+ * @file agent_state.cpp
+ * @brief Saving and restoring agent sessions
+ *
+ * A state blob is a small header followed by two sections:
+ *
+ *   "LUUPSTAT", u32 version
+ *   u64 size, history JSON ({"history": [{"role", "content", ...}]})
+ *   u64 size, KV-cache sequence (empty for remote models or a fresh agent)
+ *
+ * The KV section is written by the llama backend and includes the cached
+ * tokens, so the next turn reuses the restored prefix like any other.
+ */
+
+#include "../../include/luup_agent.h"
+#include "internal.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+    const char state_magic[8] = {'L', 'U', 'U', 'P', 'S', 'T', 'A', 'T'};
+    const uint32_t state_version = 1;
+    
+    void append_bytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+    
+    void append_section(std::vector<uint8_t>& out, const void* data, size_t size) {
+        uint64_t n = size;
+        append_bytes(out, &n, sizeof(n));
+        append_bytes(out, data, size);
+    }
+    
+    bool read_section(const uint8_t*& data, const uint8_t* end,
+                      const uint8_t*& section, size_t& size) {
+        uint64_t n = 0;
+        if (static_cast<size_t>(end - data) < sizeof(n)) {
+            return false;
+        }
+        memcpy(&n, data, sizeof(n));
+        data += sizeof(n);
+        if (static_cast<uint64_t>(end - data) < n) {
+            return false;
+        }
+        section = data;
+        size = static_cast<size_t>(n);
+        data += size;
+        return true;
+    }
+    
+    bool serialize_state(luup_agent* agent, std::vector<uint8_t>& out) {
+        std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+        json messages = json::array();
+        for (const auto& msg : agent->history) {
+            json msg_json;
+            msg_json["role"] = msg.role;
+            msg_json["content"] = msg.content;
+            if (msg.tool_result) {
+                msg_json["tool_result"] = true;
+            }
+            if (!msg.tool_calls.empty()) {
+                msg_json["tool_calls"] = json::parse(format_tool_calls(msg.tool_calls))["tool_calls"];
+            }
+            if (!msg.tool_call_id.empty()) {
+                msg_json["tool_call_id"] = msg.tool_call_id;
+            }
+            messages.push_back(msg_json);
+        }
+        json state;
+        state["history"] = messages;
+        std::string history = state.dump();
+        
+        // Only an agent that already ran on a local model has KV state
+        std::vector<uint8_t> kv;
+        if (agent->seq_id >= 0 && luup_model_is_local(agent->model) &&
+            !llama_backend_save_sequence(luup_model_get_backend_data(agent->model),
+                                         agent->seq_id, kv)) {
+            return false;   // Error already set
+        }
+        
+        out.clear();
+        out.reserve(sizeof(state_magic) + sizeof(state_version) + 16 + history.size() + kv.size());
+        append_bytes(out, state_magic, sizeof(state_magic));
+        append_bytes(out, &state_version, sizeof(state_version));
+        append_section(out, history.data(), history.size());
+        append_section(out, kv.data(), kv.size());
+        return true;
+    }
+    
+    luup_error_t restore_state(luup_agent* agent, const uint8_t* data, size_t size) {
+        std::lock_guard<std::recursive_mutex> lock(agent->mutex);
+        const uint8_t* end = data + size;
+        uint32_t version = 0;
+        if (size < sizeof(state_magic) + sizeof(version) ||
+            memcmp(data, state_magic, sizeof(state_magic)) != 0) {
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, "Not a luup-agent state file");
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        data += sizeof(state_magic);
+        memcpy(&version, data, sizeof(version));
+        data += sizeof(version);
+        if (version != state_version) {
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, "Unsupported state version");
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        
+        const uint8_t* history_data = nullptr;
+        const uint8_t* kv_data = nullptr;
+        size_t history_size = 0;
+        size_t kv_size = 0;
+        if (!read_section(data, end, history_data, history_size) ||
+            !read_section(data, end, kv_data, kv_size)) {
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, "Truncated state");
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        
+        // Parse everything before touching the agent
+        std::vector<Message> history;
+        json state = json::parse(history_data, history_data + history_size, nullptr, false);
+        if (!state.is_object() || !state.contains("history") || !state["history"].is_array()) {
+            luup_set_error(LUUP_ERROR_JSON_PARSE_FAILED, "Invalid history in state");
+            return LUUP_ERROR_JSON_PARSE_FAILED;
+        }
+        for (const auto& msg_json : state["history"]) {
+            if (!msg_json.is_object()) {
+                continue;
+            }
+            Message msg;
+            msg.role = msg_json.value("role", "");
+            msg.content = msg_json.value("content", "");
+            msg.tool_result = msg_json.value("tool_result", false);
+            msg.tool_call_id = msg_json.value("tool_call_id", "");
+            if (msg_json.contains("tool_calls")) {
+                msg.tool_calls = parse_tool_calls(json{{"tool_calls", msg_json["tool_calls"]}}.dump());
+            }
+            history.push_back(std::move(msg));
+        }
+        
+        agent->history = std::move(history);
+        agent->invalidate_history();
+        
+        // The KV cache is an optimization: if it can't be restored (other
+        // weights, smaller context) the history is prefilled next turn
+        if (kv_size > 0 && luup_model_is_local(agent->model)) {
+            int seq_id = luup_agent_get_sequence(agent);
+            if (seq_id >= 0) {
+                llama_backend_load_sequence(luup_model_get_backend_data(agent->model),
+                                            seq_id, kv_data, kv_size);
+            }
+        }
+        
+        luup_clear_error();
+        return LUUP_SUCCESS;
+    }
+    
+    // Read-only view of a whole file, memory-mapped where possible so the
+    // KV section is handed to llama.cpp without another copy
+    class FileView {
+    public:
+        FileView() : data_(nullptr), size_(0), mapped_(false) {
+#if defined(_WIN32)
+            file_ = INVALID_HANDLE_VALUE;
+            mapping_ = nullptr;
+#endif
+        }
+        
+        ~FileView() {
+#if defined(_WIN32)
+            if (mapped_) {
+                UnmapViewOfFile(data_);
+            }
+            if (mapping_) {
+                CloseHandle(mapping_);
+            }
+            if (file_ != INVALID_HANDLE_VALUE) {
+                CloseHandle(file_);
+            }
+#else
+            if (mapped_) {
+                munmap(const_cast<uint8_t*>(data_), size_);
+            }
+#endif
+        }
+        
+        FileView(const FileView&) = delete;
+        FileView& operator=(const FileView&) = delete;
+        
+        bool open(const char* path) {
+            if (map(path)) {
+                return true;
+            }
+            
+            // Fall back to reading the file into memory
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open()) {
+                return false;
+            }
+            buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            data_ = buffer_.data();
+            size_ = buffer_.size();
+            return !file.bad();
+        }
+        
+        const uint8_t* data() const { return data_; }
+        size_t size() const { return size_; }
+    
+    private:
+        bool map(const char* path) {
+#if defined(_WIN32)
+            file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+            LARGE_INTEGER file_size;
+            if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &file_size) ||
+                file_size.QuadPart == 0) {
+                return false;
+            }
+            mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mapping_) {
+                return false;
+            }
+            void* view = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+            if (!view) {
+                return false;
+            }
+            data_ = static_cast<const uint8_t*>(view);
+            size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0) {
+                close(fd);
+                return false;
+            }
+            void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);   // The mapping keeps the file open
+            if (view == MAP_FAILED) {
+                return false;
+            }
+            data_ = static_cast<const uint8_t*>(view);
+            size_ = static_cast<size_t>(st.st_size);
+#endif
+            mapped_ = true;
+            return true;
+        }
+        
+        const uint8_t* data_;
+        size_t size_;
+        bool mapped_;
+        std::vector<uint8_t> buffer_;
+#if defined(_WIN32)
+        HANDLE file_;
+        HANDLE mapping_;
+#endif
+    };
+}
+
+extern "C" {
+
+luup_error_t luup_agent_save_state(luup_agent* agent, const char* path) {
+    if (!agent || !path) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        std::vector<uint8_t> state;
+        if (!serialize_state(agent, state)) {
+            return luup_get_last_error_code();
+        }
+        
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            std::string msg = std::string("Failed to open state file: ") + path;
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, msg.c_str());
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        bool written = fwrite(state.data(), 1, state.size(), file) == state.size();
+        written = fclose(file) == 0 && written;
+        if (!written) {
+            std::string msg = std::string("Failed to write state file: ") + path;
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, msg.c_str());
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        
+        luup_clear_error();
+        return LUUP_SUCCESS;
+    
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return LUUP_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+luup_error_t luup_agent_load_state(luup_agent* agent, const char* path) {
+    if (!agent || !path) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        FileView file;
+        if (!file.open(path)) {
+            std::string msg = std::string("Failed to open state file: ") + path;
+            luup_set_error(LUUP_ERROR_INVALID_PARAM, msg.c_str());
+            return LUUP_ERROR_INVALID_PARAM;
+        }
+        return restore_state(agent, file.data(), file.size());
+    
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return LUUP_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+void* luup_agent_save_state_buffer(luup_agent* agent, size_t* out_size) {
+    if (!agent || !out_size) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return nullptr;
+    }
+    
+    try {
+        std::vector<uint8_t> state;
+        if (!serialize_state(agent, state)) {
+            return nullptr;
+        }
+        
+        void* buffer = malloc(state.size());
+        if (!buffer) {
+            luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, "Failed to allocate state buffer");
+            return nullptr;
+        }
+        memcpy(buffer, state.data(), state.size());
+        *out_size = state.size();
+        
+        luup_clear_error();
+        return buffer;
+    
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return nullptr;
+    }
+}
+
+luup_error_t luup_agent_load_state_buffer(luup_agent* agent, const void* data, size_t size) {
+    if (!agent || !data) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        return restore_state(agent, static_cast<const uint8_t*>(data), size);
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return LUUP_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+} // extern "C"
@@ -7,33 +7,113 @@
 #include "internal.h"
 #include <string>
 #include <vector>
-#include <sstream>
+#include <algorithm>
 
-// Message structure
-struct Message {
-    std::string role;
-    std::string content;
-};
+namespace {
+    // Append one message in the chat template format. Native tool calls
+    // and their results (from a remote model) are written as text.
+    void append_message(std::string& out, const Message& msg) {
+        if (msg.role == "system") {
+            out += "System: ";
+        } else if (msg.role == "user" || msg.role == "tool") {
+            out += "User: ";
+        } else if (msg.role == "assistant") {
+            out += "Assistant: ";
+        } else {
+            return;
+        }
+        out += msg.content;
+        if (!msg.tool_calls.empty()) {
+            out += (msg.content.empty() ? "" : "\n\n") + format_tool_calls(msg.tool_calls);
+        }
+        out += "\n\n";
+    }
+    
+    // Tokens in one formatted message, counted once and cached on the message
+    size_t message_token_count(luup_model* model, const Message& msg) {
+        if (msg.n_tokens < 0) {
+            std::string formatted;
+            append_message(formatted, msg);
+            msg.n_tokens = static_cast<int>(count_model_tokens(model, formatted));
+        }
+        return static_cast<size_t>(msg.n_tokens);
+    }
+    
+    // Tool schema for the agent, or empty if tool calling is off
+    const std::string& agent_tool_schema(luup_agent* agent) {
+        if (!agent->tool_schema_valid) {
+            agent->tool_schema = agent->enable_tool_calling
+                ? generate_tool_schema(agent->tools, agent->compact_tool_schema)
+                : "";
+            agent->tool_schema_valid = true;
+        }
+        return agent->tool_schema;
+    }
+    
+    size_t tool_schema_token_count(luup_agent* agent) {
+        if (agent->tool_schema_tokens < 0) {
+            agent->tool_schema_tokens = static_cast<int>(
+                count_model_tokens(agent->model, agent_tool_schema(agent)));
+        }
+        return static_cast<size_t>(agent->tool_schema_tokens);
+    }
+}
 
 // Format conversation history into a prompt string
 // Uses a simple chat template format
 std::string format_chat_history(const std::vector<Message>& history) {
-    std::ostringstream oss;
-    
+    std::string out;
     for (const auto& msg : history) {
-        if (msg.role == "system") {
-            oss << "System: " << msg.content << "\n\n";
-        } else if (msg.role == "user") {
-            oss << "User: " << msg.content << "\n\n";
-        } else if (msg.role == "assistant") {
-            oss << "Assistant: " << msg.content << "\n\n";
-        }
+        append_message(out, msg);
     }
     
     // Add the prompt for assistant to respond
-    oss << "Assistant: ";
+    out += "Assistant: ";
+    return out;
+}
+
+// Prompt for an agent with history management. Leading system messages and
+// the tool schema form a stable prefix; later turns only append, so the
+// backend can reuse its KV cache for everything already sent.
+const std::string& build_agent_prompt(luup_agent* agent) {
+    PromptCache& cache = agent->prompt_cache;
+    if (!cache.valid || cache.n_messages > agent->history.size()) {
+        cache.text.clear();
+        cache.body_size = 0;
+        cache.n_messages = 0;
+        cache.schema_emitted = false;
+        cache.valid = true;
+    }
+    
+    // Drop the previous assistant cue and append new messages
+    cache.text.resize(cache.body_size);
+    for (; cache.n_messages < agent->history.size(); cache.n_messages++) {
+        const Message& msg = agent->history[cache.n_messages];
+        if (msg.role != "system" && !cache.schema_emitted) {
+            cache.text += agent_tool_schema(agent);
+            cache.schema_emitted = true;
+        }
+        append_message(cache.text, msg);
+    }
+    if (!cache.schema_emitted) {
+        cache.text += agent_tool_schema(agent);
+        cache.schema_emitted = true;
+    }
     
-    return oss.str();
+    cache.body_size = cache.text.size();
+    cache.text += "Assistant: ";
+    return cache.text;
+}
+
+// Prompt for an agent without history: system prompt, tool schema, message
+std::string build_single_turn_prompt(luup_agent* agent, const std::string& user_message) {
+    std::string prompt;
+    if (!agent->system_prompt.empty()) {
+        prompt += "System: " + agent->system_prompt + "\n\n";
+    }
+    prompt += agent_tool_schema(agent);
+    prompt += "User: " + user_message + "\n\nAssistant: ";
+    return prompt;
 }
 
 // Estimate token count (rough approximation: 1 token ≈ 4 characters)
@@ -41,16 +121,89 @@ size_t estimate_token_count(const std::string& text) {
     return text.size() / 4;
 }
 
-// Check if context window is getting full
-bool is_context_full(const std::vector<Message>& history, size_t context_size, float threshold) {
-    std::string formatted = format_chat_history(history);
-    size_t estimated_tokens = estimate_token_count(formatted);
-    return estimated_tokens >= (context_size * threshold);
+// Tokens in the agent's history. Only messages appended since the last
+// call are counted; per-message counts survive history rewrites.
+size_t history_token_count(luup_agent* agent) {
+    if (agent->history_tokens_counted > agent->history.size()) {
+        agent->history_tokens = 0;
+        agent->history_tokens_counted = 0;
+    }
+    for (; agent->history_tokens_counted < agent->history.size(); agent->history_tokens_counted++) {
+        agent->history_tokens += message_token_count(
+            agent->model, agent->history[agent->history_tokens_counted]);
+    }
+    return agent->history_tokens;
+}
+
+// Check if context window is getting full (history plus tool schema)
+bool is_context_full(luup_agent* agent, size_t context_size, float threshold) {
+    size_t tokens = history_token_count(agent) + tool_schema_token_count(agent);
+    return tokens >= (context_size * threshold);
+}
+
+// Drop messages until history and tool schema fit the agent's context
+// budget. Dropping from the front keeps the system prefix, and the local
+// backend shifts the remaining KV cache down instead of re-decoding it.
+void apply_context_strategy(luup_agent* agent) {
+    if (agent->context_strategy == LUUP_CONTEXT_KEEP_ALL) {
+        return;
+    }
+    
+    size_t budget = static_cast<size_t>(agent->context_budget);
+    if (budget == 0) {
+        luup_model_info info;
+        if (luup_model_get_info(agent->model, &info) != LUUP_SUCCESS) {
+            return;
+        }
+        budget = static_cast<size_t>(info.context_size) * 3 / 4;
+    }
+    
+    size_t used = history_token_count(agent) + tool_schema_token_count(agent);
+    if (used <= budget) {
+        return;
+    }
+    
+    // The current turn starts at the latest user message
+    std::vector<Message>& history = agent->history;
+    size_t current_turn = history.size();
+    while (current_turn > 0) {
+        const Message& msg = history[--current_turn];
+        if (msg.role == "user" && !msg.tool_result) {
+            break;
+        }
+    }
+    
+    std::vector<bool> drop(history.size(), false);
+    auto drop_oldest = [&](bool tool_results_only) {
+        for (size_t i = 0; i < current_turn && used > budget; i++) {
+            const Message& msg = history[i];
+            if (drop[i] || msg.role == "system" || (tool_results_only && !msg.tool_result)) {
+                continue;
+            }
+            drop[i] = true;
+            used -= std::min(used, message_token_count(agent->model, msg));
+        }
+    };
+    if (agent->context_strategy == LUUP_CONTEXT_DROP_TOOL_RESULTS) {
+        drop_oldest(true);
+    }
+    drop_oldest(false);
+    
+    size_t kept = 0;
+    for (size_t i = 0; i < history.size(); i++) {
+        if (!drop[i]) {
+            if (kept != i) {
+                history[kept] = std::move(history[i]);
+            }
+            kept++;
+        }
+    }
+    if (kept == history.size()) {
+        return;
+    }
+    history.resize(kept);
+    agent->invalidate_history();
 }
 
 // TODO: Future enhancements:
-// - Proper tokenization using model's tokenizer
 // - Automatic summarization when context fills
-// - Sliding window strategies
-// - Token budget management
-
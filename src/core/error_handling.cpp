@@ -8,6 +8,7 @@
 #include <cstring>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
 #include <sstream>
 
 namespace {
@@ -15,10 +16,12 @@ namespace {
     thread_local std::string last_error_message;
     thread_local luup_error_t last_error_code = LUUP_SUCCESS;
     
-    // Global error callback
+    // Global error callback. Threads reporting errors share the lock, so
+    // the callback may run on several threads at once; setting it waits
+    // for calls in progress.
     luup_error_callback_t global_error_callback = nullptr;
     void* global_error_callback_user_data = nullptr;
-    std::mutex callback_mutex;
+    std::shared_mutex callback_mutex;
     
     // Error code to string mapping
     const char* error_code_to_string(luup_error_t code) {
@@ -32,6 +35,8 @@ namespace {
             case LUUP_ERROR_JSON_PARSE_FAILED: return "JSON parse failed";
             case LUUP_ERROR_HTTP_FAILED: return "HTTP request failed";
             case LUUP_ERROR_BACKEND_INIT_FAILED: return "Backend initialization failed";
+            case LUUP_ERROR_CONTEXT_OVERFLOW: return "Context window exceeded";
+            case LUUP_ERROR_TOOL_LIMIT: return "Tool limit reached";
             default: return "Unknown error";
         }
     }
@@ -44,7 +49,7 @@ const char* luup_get_last_error(void) {
 }
 
 void luup_set_error_callback(luup_error_callback_t callback, void* user_data) {
-    std::lock_guard<std::mutex> lock(callback_mutex);
+    std::unique_lock<std::shared_mutex> lock(callback_mutex);
     global_error_callback = callback;
     global_error_callback_user_data = user_data;
 }
@@ -65,7 +70,7 @@ void luup_set_error(luup_error_t code, const char* message) {
     }
     
     // Call global error callback if set
-    std::lock_guard<std::mutex> lock(callback_mutex);
+    std::shared_lock<std::shared_mutex> lock(callback_mutex);
     if (global_error_callback) {
         global_error_callback(code, last_error_message.c_str(), global_error_callback_user_data);
     }
@@ -0,0 +1,214 @@
+/**
+ * @file executor.cpp
+ * @brief Shared executor for submitted requests
+ *
+ * One process-wide pool of worker threads runs queued agent requests.
+ * Each agent is an actor: its requests wait in the agent's own queue and
+ * at most one drain task per agent is in the pool at a time, so an agent
+ * never runs two requests at once and serves them in order. After each
+ * request the drain task goes to the back of the pool's queue, so a busy
+ * agent can't starve the others.
+ */
+
+#include "../../include/luup_agent.h"
+#include "internal.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+namespace {
+    class Executor {
+    public:
+        // Never destroyed: workers may still be running requests at exit
+        static Executor& instance() {
+            static Executor* executor = new Executor();
+            return *executor;
+        }
+        
+        bool set_threads(int n_threads) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (started_) {
+                return false;
+            }
+            n_threads_ = n_threads;
+            return true;
+        }
+        
+        // Throws if the workers can't be started
+        void post(std::function<void()> task) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!started_) {
+                size_t n = n_threads_ > 0
+                    ? static_cast<size_t>(n_threads_)
+                    : std::max<size_t>(4, std::thread::hardware_concurrency());
+                for (size_t i = 0; i < n; i++) {
+                    std::thread(&Executor::work, this).detach();
+                }
+                started_ = true;
+            }
+            tasks_.push_back(std::move(task));
+            available_.notify_one();
+        }
+    
+    private:
+        Executor() : n_threads_(0), started_(false) {}
+        
+        void work() {
+            for (;;) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    available_.wait(lock, [this] { return !tasks_.empty(); });
+                    task = std::move(tasks_.front());
+                    tasks_.pop_front();
+                }
+                task();
+            }
+        }
+        
+        std::mutex mutex_;
+        std::condition_variable available_;
+        std::deque<std::function<void()>> tasks_;
+        int n_threads_;
+        bool started_;
+    };
+    
+    // Agent whose request is running on this thread
+    thread_local luup_agent* draining_agent = nullptr;
+    
+    // Run the agent's next request, then requeue behind the other agents
+    // while it has more. Destroys the agent once the queue is empty if one
+    // of its requests asked for that.
+    void drain_agent(luup_agent* agent) {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(agent->queue_mutex);
+                task = std::move(agent->queue.front());
+                agent->queue.pop_front();
+            }
+            draining_agent = agent;
+            task();
+            draining_agent = nullptr;
+            
+            bool idle = false;
+            bool destroy = false;
+            {
+                std::lock_guard<std::mutex> lock(agent->queue_mutex);
+                if (agent->queue.empty()) {
+                    agent->queue_active = false;
+                    agent->queue_idle.notify_all();
+                    idle = true;
+                    destroy = agent->destroy_requested;
+                }
+            }
+            if (idle) {
+                if (destroy) {
+                    luup_agent_destroy(agent);
+                }
+                return;
+            }
+            try {
+                Executor::instance().post([agent] { drain_agent(agent); });
+                return;
+            } catch (const std::exception&) {
+                // Keep draining on this thread
+            }
+        }
+    }
+}
+
+bool luup_agent_enqueue(luup_agent* agent, std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(agent->queue_mutex);
+    try {
+        agent->queue.push_back(std::move(task));
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return false;
+    }
+    if (agent->queue_active) {
+        return true;
+    }
+    
+    try {
+        Executor::instance().post([agent] { drain_agent(agent); });
+    } catch (const std::exception& e) {
+        agent->queue.pop_back();
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return false;
+    }
+    agent->queue_active = true;
+    return true;
+}
+
+// From one of the agent's own requests, where waiting for the queue would
+// wait for the caller: leave the destroy to the drain task and return true
+bool luup_agent_defer_destroy(luup_agent* agent) {
+    if (draining_agent != agent) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(agent->queue_mutex);
+    agent->destroy_requested = true;
+    return true;
+}
+
+// Wait until every request queued for the agent has run
+void luup_agent_wait_idle(luup_agent* agent) {
+    std::unique_lock<std::mutex> lock(agent->queue_mutex);
+    agent->queue_idle.wait(lock, [agent] { return !agent->queue_active; });
+}
+
+extern "C" {
+
+luup_error_t luup_agent_submit(luup_agent* agent, const char* user_message,
+                               luup_stream_callback_t stream_callback,
+                               luup_completion_callback_t on_complete, void* user_data) {
+    if (!agent || !user_message) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters for generation");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    try {
+        std::string message = user_message;
+        auto task = [agent, message, stream_callback, on_complete, user_data] {
+            std::string response;
+            luup_error_t code = luup_agent_run_turn(agent, message.c_str(), stream_callback,
+                                                    user_data, response);
+            if (on_complete) {
+                bool ok = code == LUUP_SUCCESS;
+                on_complete(code, ok ? response.c_str() : nullptr,
+                            ok ? "" : luup_get_last_error(), user_data);
+            }
+        };
+        if (!luup_agent_enqueue(agent, task)) {
+            return luup_get_last_error_code();   // Error already set
+        }
+    } catch (const std::exception& e) {
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return LUUP_ERROR_OUT_OF_MEMORY;
+    }
+    
+    luup_clear_error();
+    return LUUP_SUCCESS;
+}
+
+luup_error_t luup_set_executor_threads(int n_threads) {
+    if (n_threads < 0) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid thread count");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    if (!Executor::instance().set_threads(n_threads)) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Executor is already running");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    luup_clear_error();
+    return LUUP_SUCCESS;
+}
+
+} // extern "C"
@@ -0,0 +1,293 @@
+/**
+ * @file generation.cpp
+ * @brief Background generations read through a ring buffer
+ *
+ * A generation runs luup_agent_generate_stream() on the shared executor
+ * and copies each streamed chunk into a fixed-size byte ring. The reader takes
+ * whatever has accumulated in one call, so a consumer that wakes up late
+ * (an event loop busy with other sessions) gets a batch rather than one
+ * callback per token. The notify hook is edge-triggered: it fires on the
+ * first write after a read, and once at the end.
+ */
+
+#include "../../include/luup_agent.h"
+#include "internal.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr size_t default_buffer_size = 64 * 1024;
+    
+    // Room for the longest UTF-8 sequence, which reads never split
+    constexpr size_t min_buffer_size = 4;
+    
+    // How many of the n bytes at head to hand out, leaving a trailing UTF-8
+    // sequence that is still missing bytes
+    size_t utf8_complete_length(const std::vector<char>& ring, size_t head, size_t n) {
+        size_t cap = ring.size();
+        for (size_t back = 1; back <= std::min<size_t>(n, 4); back++) {
+            unsigned char c = static_cast<unsigned char>(ring[(head + n - back) % cap]);
+            if ((c & 0xC0) == 0x80) {
+                continue;   // Continuation byte, keep looking for the lead
+            }
+            size_t expected = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3
+                            : (c & 0xF8) == 0xF0 ? 4 : 1;
+            return back < expected ? n - back : n;
+        }
+        return n;
+    }
+}
+
+struct luup_generation {
+    luup_agent* agent;
+    std::string message;
+    
+    // Pending text occupies size bytes of ring starting at head
+    std::vector<char> ring;
+    size_t head;
+    size_t size;
+    
+    std::mutex mutex;
+    std::condition_variable readable;
+    std::condition_variable writable;
+    bool notify_armed;        // The next write calls notify
+    bool cancelled;
+    bool finished;
+    bool stopped;             // The executor is done with the generation
+    bool free_requested;      // Freed from notify, the executor deletes it
+    std::condition_variable stopped_cv;
+    luup_error_t error;
+    std::string error_message;
+    
+    luup_generation_notify_t notify;
+    void* notify_data;
+    
+    luup_generation() : agent(nullptr), head(0), size(0), notify_armed(true),
+                        cancelled(false), finished(false), stopped(false),
+                        free_requested(false), error(LUUP_SUCCESS), notify(nullptr), notify_data(nullptr) {}
+};
+
+namespace {
+    // Generation running on this thread
+    thread_local luup_generation* running_generation = nullptr;
+    
+    // Only the generating thread sets free_requested, from notify itself
+    void call_notify(luup_generation* gen) {
+        if (gen->notify && !gen->free_requested) {
+            gen->notify(gen->notify_data);
+        }
+    }
+    
+    // Stream callback on the generating thread: append the chunk, waiting
+    // for the reader while the ring is full
+    bool write_chunk(const char* text, void* user_data) {
+        auto gen = static_cast<luup_generation*>(user_data);
+        size_t len = strlen(text);
+        size_t cap = gen->ring.size();
+        bool wake = false;
+        
+        std::unique_lock<std::mutex> lock(gen->mutex);
+        while (len > 0 && !gen->cancelled) {
+            if (gen->size == cap) {
+                // Make sure the reader knows about the full ring before waiting on it
+                if (wake) {
+                    wake = false;
+                    lock.unlock();
+                    call_notify(gen);
+                    lock.lock();
+                    continue;
+                }
+                gen->writable.wait(lock);
+                continue;
+            }
+            
+            size_t tail = (gen->head + gen->size) % cap;
+            size_t n = std::min(len, std::min(cap - gen->size, cap - tail));
+            memcpy(gen->ring.data() + tail, text, n);
+            gen->size += n;
+            text += n;
+            len -= n;
+            
+            gen->readable.notify_one();
+            if (gen->notify_armed) {
+                gen->notify_armed = false;
+                wake = true;
+            }
+        }
+        bool keep_going = !gen->cancelled;
+        lock.unlock();
+        
+        if (wake) {
+            call_notify(gen);
+        }
+        return keep_going;
+    }
+    
+    void run_generation(luup_generation* gen) {
+        running_generation = gen;
+        bool cancelled;
+        {
+            std::lock_guard<std::mutex> lock(gen->mutex);
+            cancelled = gen->cancelled;
+        }
+        
+        // Cancelled while queued: end without generating
+        luup_error_t code = LUUP_SUCCESS;
+        if (!cancelled) {
+            code = luup_agent_generate_stream(gen->agent, gen->message.c_str(), write_chunk, gen);
+        }
+        {
+            std::lock_guard<std::mutex> lock(gen->mutex);
+            gen->finished = true;
+            gen->error = code;
+            if (code != LUUP_SUCCESS) {
+                gen->error_message = luup_get_last_error();   // Set on this thread
+            }
+            gen->readable.notify_all();
+        }
+        call_notify(gen);
+        
+        // The handle may be freed as soon as this is set
+        running_generation = nullptr;
+        bool free_now;
+        {
+            std::lock_guard<std::mutex> lock(gen->mutex);
+            gen->stopped = true;
+            free_now = gen->free_requested;
+            gen->stopped_cv.notify_all();
+        }
+        if (free_now) {
+            delete gen;
+        }
+    }
+}
+
+extern "C" {
+
+luup_generation* luup_agent_generate_start(luup_agent* agent, const char* user_message,
+                                           size_t buffer_size, luup_generation_notify_t notify,
+                                           void* user_data) {
+    if (!agent || !user_message) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters for generation");
+        return nullptr;
+    }
+    
+    luup_generation* gen = nullptr;
+    try {
+        gen = new luup_generation();
+        gen->agent = agent;
+        gen->message = user_message;
+        gen->ring.resize(buffer_size > 0 ? std::max(buffer_size, min_buffer_size)
+                                         : default_buffer_size);
+        gen->notify = notify;
+        gen->notify_data = notify ? user_data : nullptr;
+    } catch (const std::exception& e) {
+        delete gen;
+        luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+        return nullptr;
+    }
+    
+    if (!luup_agent_enqueue(agent, [gen] { run_generation(gen); })) {
+        delete gen;
+        return nullptr;   // Error already set
+    }
+    
+    luup_clear_error();
+    return gen;
+}
+
+luup_generation_status luup_generation_read(luup_generation* generation, char* buffer,
+                                            size_t buffer_size, size_t* out_len,
+                                            int timeout_ms) {
+    if (out_len) {
+        *out_len = 0;
+    }
+    if (!generation || !buffer || buffer_size < 4 || !out_len) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_GENERATION_FAILED;
+    }
+    
+    luup_generation* gen = generation;
+    std::unique_lock<std::mutex> lock(gen->mutex);
+    auto ready = [gen] { return gen->size > 0 || gen->finished; };
+    if (timeout_ms < 0) {
+        gen->readable.wait(lock, ready);
+    } else if (timeout_ms > 0) {
+        gen->readable.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+    }
+    
+    // Leave a sequence that is still being written for the next read
+    size_t n = std::min(buffer_size, gen->size);
+    if (!(gen->finished && n == gen->size)) {
+        n = utf8_complete_length(gen->ring, gen->head, n);
+    }
+    
+    size_t cap = gen->ring.size();
+    size_t first = std::min(n, cap - gen->head);
+    memcpy(buffer, gen->ring.data() + gen->head, first);
+    memcpy(buffer + first, gen->ring.data(), n - first);
+    gen->head = (gen->head + n) % cap;
+    gen->size -= n;
+    gen->notify_armed = true;
+    gen->writable.notify_one();
+    *out_len = n;
+    
+    if (gen->finished && gen->size == 0) {
+        return gen->error == LUUP_SUCCESS ? LUUP_GENERATION_DONE : LUUP_GENERATION_FAILED;
+    }
+    return LUUP_GENERATION_RUNNING;
+}
+
+void luup_generation_cancel(luup_generation* generation) {
+    if (generation) {
+        std::lock_guard<std::mutex> lock(generation->mutex);
+        generation->cancelled = true;
+        generation->writable.notify_all();
+    }
+}
+
+luup_error_t luup_generation_error(luup_generation* generation, const char** out_message) {
+    if (out_message) {
+        *out_message = "";
+    }
+    if (!generation) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid generation handle");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    std::lock_guard<std::mutex> lock(generation->mutex);
+    if (!generation->finished) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Generation is still running");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    if (out_message) {
+        *out_message = generation->error_message.c_str();
+    }
+    return generation->error;
+}
+
+void luup_generation_free(luup_generation* generation) {
+    if (!generation) {
+        return;
+    }
+    luup_generation_cancel(generation);
+    if (running_generation == generation) {
+        // Called from notify, which the generating thread runs: waiting
+        // here would never end, so let run_generation delete it
+        std::lock_guard<std::mutex> lock(generation->mutex);
+        generation->free_requested = true;
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(generation->mutex);
+        generation->stopped_cv.wait(lock, [generation] { return generation->stopped; });
+    }
+    delete generation;
+}
+
+} // extern "C"
@@ -8,59 +8,416 @@
 
 #include "../../include/luup_agent.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <thread>
 
-// Forward declarations for internal types
-struct Message;
-struct ToolInfo;
-struct ToolCall;
+// Parsed tool call
+struct ToolCall {
+    std::string id;              // Native call id from a remote model (empty otherwise)
+    std::string tool_name;
+    std::string parameters_json;
+};
+
+// Conversation message. Remote models that call tools natively get an
+// assistant message carrying the calls, then one "tool" message per result.
+struct Message {
+    std::string role;
+    std::string content;
+    mutable int n_tokens;    // Tokens in the formatted message (-1 until counted)
+    bool tool_result;        // Tool output fed back to the model
+    std::vector<ToolCall> tool_calls;   // Native calls made by an assistant message
+    std::string tool_call_id;           // Call a "tool" message answers
+    
+    Message() : n_tokens(-1), tool_result(false) {}
+};
+
+// Tool registration info
+struct ToolInfo {
+    luup_tool tool;
+    luup_tool_callback_t callback;
+    void* user_data;
+    bool enabled;    // Exposed in the schema and callable
+    
+    ToolInfo() : callback(nullptr), user_data(nullptr), enabled(true) {
+        tool.name = nullptr;
+        tool.description = nullptr;
+        tool.parameters_json = nullptr;
+    }
+};
+
+// Sampling parameters for one generation. Zero disables a stage.
+struct SamplingParams {
+    float temperature;       // <= 0 selects greedy decoding
+    int top_k;
+    float top_p;
+    float min_p;
+    float repeat_penalty;    // 0 or 1 disables the penalty
+    unsigned int seed;       // 0 picks a random seed
+    std::string grammar;     // Tool-call GBNF, applied once a call starts (empty = none)
+    
+    SamplingParams() : temperature(0.7f), top_k(0), top_p(0.0f), min_p(0.0f),
+                       repeat_penalty(0.0f), seed(0) {}
+    
+    bool operator==(const SamplingParams& other) const {
+        return temperature == other.temperature && top_k == other.top_k &&
+               top_p == other.top_p && min_p == other.min_p &&
+               repeat_penalty == other.repeat_penalty && seed == other.seed &&
+               grammar == other.grammar;
+    }
+    bool operator!=(const SamplingParams& other) const { return !(*this == other); }
+};
+
+// Formatted prompt kept in sync with an agent's history. Messages are only
+// ever appended; any other history or tool change marks it invalid.
+struct PromptCache {
+    std::string text;        // Formatted messages followed by the assistant cue
+    size_t body_size;        // Length of text without the cue
+    size_t n_messages;       // History messages already formatted
+    bool schema_emitted;     // Tool schema written after the leading system messages
+    bool valid;
+    
+    PromptCache() : body_size(0), n_messages(0), schema_emitted(false), valid(false) {}
+    
+    void invalidate() { valid = false; }
+};
+
+// History upkeep run by the agent before and after each turn with history
+// management (e.g. background summarization). Owned by the agent and
+// destroyed before the rest of it, so it may keep work running in between.
+class HistoryMaintainer {
+public:
+    virtual ~HistoryMaintainer() {}
+    virtual void maintain(luup_agent* agent) = 0;
+    
+    // Milliseconds of work (e.g. summary generation) whose results were
+    // applied to the history since the last call
+    virtual double take_work_ms() { return 0.0; }
+    
+    // KV-cache sequence held for background work, or -1
+    virtual int reserved_sequence() const { return -1; }
+};
+
+// Fixed set of threads running an agent's tool calls. A call that timed
+// out keeps its thread until the callback returns, so a hanging tool
+// takes capacity away instead of adding threads. Destruction waits for
+// running callbacks; queued tasks that haven't started are dropped.
+class ToolPool {
+public:
+    explicit ToolPool(size_t n_workers);
+    ~ToolPool();
+    
+    size_t size() const { return workers_.size(); }
+    void run(std::function<void()> task);
+
+private:
+    void work();
+    
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> workers_;
+    bool stopping_;
+};
+
+// Metrics of an agent's last turn. metrics.tools points into tools, whose
+// names are kept in tool_names.
+struct TurnMetrics {
+    luup_turn_metrics metrics;
+    std::vector<luup_tool_metrics> tools;
+    std::vector<std::string> tool_names;
+    
+    TurnMetrics() { reset(); }
+    void reset() {
+        metrics = luup_turn_metrics();
+        tools.clear();
+        tool_names.clear();
+    }
+};
+
+// Internal agent structure (shared by the agent core and built-in tools)
+struct luup_agent {
+    luup_model* model;
+    std::string system_prompt;
+    SamplingParams sampling;
+    int max_tokens;
+    bool enable_tool_calling;
+    bool enable_history_management;
+    bool enable_builtin_tools;
+    int max_parallel_tools;
+    int tool_timeout_ms;
+    int max_tool_rounds;
+    int token_budget;
+    bool enable_tool_grammar;
+    bool compact_tool_schema;
+    luup_model* summarizer_model;    // Built-in summarization model (nullptr = model)
+    luup_context_strategy context_strategy;
+    int context_budget;              // Tokens; 0 = 75% of the model's context
+    
+    std::vector<Message> history;
+    std::map<std::string, ToolInfo> tools;
+    PromptCache prompt_cache;
+    
+    // Running token total over history[0, history_tokens_counted)
+    size_t history_tokens;
+    size_t history_tokens_counted;
+    
+    // Bumped on every non-append history change, so work based on an
+    // older snapshot of the history can tell it is stale
+    unsigned int history_epoch;
+    
+    // Call after any history change other than appending
+    void invalidate_history() {
+        history_tokens = 0;
+        history_tokens_counted = 0;
+        history_epoch++;
+        prompt_cache.invalidate();
+    }
+    
+    std::unique_ptr<HistoryMaintainer> maintainer;
+    
+    // Created on the first tool round that runs calls concurrently or with
+    // a timeout
+    std::unique_ptr<ToolPool> tool_pool;
+    
+    // Renderings of the current tool set, generated on first use and
+    // invalidated when tools are registered, enabled or disabled
+    std::string tool_schema;
+    bool tool_schema_valid;
+    int tool_schema_tokens;    // -1 until counted
+    std::string tool_grammar;
+    bool tool_grammar_valid;
+    std::string native_tools;    // OpenAI "tools" array for remote models
+    bool native_tools_valid;
+    
+    void invalidate_tools() {
+        tool_schema_valid = false;
+        tool_schema_tokens = -1;
+        tool_grammar_valid = false;
+        native_tools_valid = false;
+        prompt_cache.invalidate();
+    }
+    
+    // KV-cache sequence on a local model (-1 until first local generation)
+    int seq_id;
+    
+    TurnMetrics last_metrics;
+    luup_metrics_callback_t metrics_callback;
+    void* metrics_user_data;
+    
+    // Held by every public agent call for its whole duration, turns
+    // included. Recursive so callbacks may call back into the agent on the
+    // same thread.
+    std::recursive_mutex mutex;
+    
+    // Requests queued for the shared executor, run one at a time in order
+    std::mutex queue_mutex;
+    std::condition_variable queue_idle;
+    std::deque<std::function<void()>> queue;
+    bool queue_active;         // A drain task is scheduled or running
+    bool destroy_requested;    // Destroyed from one of its requests, pending
+    
+    luup_agent() : model(nullptr), max_tokens(0),
+                   enable_tool_calling(true), enable_history_management(true),
+                   enable_builtin_tools(true), max_parallel_tools(0), tool_timeout_ms(0),
+                   max_tool_rounds(0), token_budget(0), enable_tool_grammar(false),
+                   compact_tool_schema(false), summarizer_model(nullptr),
+                   context_strategy(LUUP_CONTEXT_KEEP_ALL), context_budget(0), history_tokens(0),
+                   history_tokens_counted(0), history_epoch(0), tool_schema_valid(false),
+                   tool_schema_tokens(-1), tool_grammar_valid(false),
+                   native_tools_valid(false), seq_id(-1), metrics_callback(nullptr),
+                   metrics_user_data(nullptr), queue_active(false),
+                   destroy_requested(false) {}
+};
 
 // Error handling functions
 extern void luup_set_error(luup_error_t code, const char* message);
 extern void luup_clear_error();
 extern luup_error_t luup_get_last_error_code();
 
+// Counts and timings of one model call. The backends fill in the calling
+// thread's copy, like the last error; fields a backend can't measure stay 0.
+struct GenerationStats {
+    int prompt_tokens;
+    int cached_tokens;         // Prompt tokens reused from the KV cache
+    int generated_tokens;
+    double prefill_ms;         // Admission to first token
+    double decode_ms;          // First token to end of generation
+    double ttft_ms;            // Call start to first token
+    double http_connect_ms;    // Opening the connection (0 when a pooled one was reused)
+    double http_ttfb_ms;       // Request sent to response headers
+    
+    GenerationStats() { reset(); }
+    void reset() {
+        prompt_tokens = cached_tokens = generated_tokens = 0;
+        prefill_ms = decode_ms = ttft_ms = http_connect_ms = http_ttfb_ms = 0.0;
+    }
+};
+
+extern GenerationStats& luup_last_generation_stats();
+
+// Settings for a local llama.cpp backend, taken from luup_model_config.
+// Zero sizes and thread counts mean the backend's default.
+struct LlamaBackendParams {
+    int gpu_layers;            // -1 for auto
+    int context_size;          // Per sequence
+    int threads;               // Decode
+    int threads_batch;         // Prompt prefill
+    int n_sequences;
+    int prefill_chunk_size;
+    int batch_size;
+    int ubatch_size;
+    luup_kv_cache_type cache_type_k;
+    luup_kv_cache_type cache_type_v;
+    luup_flash_attn flash_attn;
+    bool use_mmap;
+    bool use_mlock;
+    
+    LlamaBackendParams()
+        : gpu_layers(-1), context_size(0), threads(0), threads_batch(0), n_sequences(0),
+          prefill_chunk_size(0), batch_size(0), ubatch_size(0),
+          cache_type_k(LUUP_KV_CACHE_F16), cache_type_v(LUUP_KV_CACHE_F16),
+          flash_attn(LUUP_FLASH_ATTN_AUTO), use_mmap(true), use_mlock(false) {}
+};
+
 // llama.cpp backend functions
-extern void* llama_backend_init(const char* model_path, int gpu_layers, 
-                                int context_size, int threads);
+extern void* llama_backend_init(const char* model_path, const LlamaBackendParams& params);
+extern void llama_backend_get_params(void* backend_data, LlamaBackendParams* out_params);
 extern void llama_backend_free(void* backend_data);
 extern bool llama_backend_get_info(void* backend_data, const char** device,
                                    int* gpu_layers, size_t* memory_usage);
 extern bool llama_backend_warmup(void* backend_data);
-extern char* llama_backend_generate(void* backend_data, const char* prompt,
-                                    float temperature, int max_tokens);
+extern int llama_backend_acquire_sequence(void* backend_data);
+extern int llama_backend_reserve_sequence(void* backend_data);
+extern void llama_backend_release_sequence(void* backend_data, int seq_id);
+extern int llama_backend_count_tokens(void* backend_data, const char* text, size_t len);
+extern bool llama_backend_set_draft(void* backend_data, void* draft_data, int n_draft);
+extern void llama_backend_get_draft_stats(void* backend_data, size_t* n_drafted, size_t* n_accepted);
+extern bool llama_backend_save_sequence(void* backend_data, int seq_id, std::vector<uint8_t>& out);
+extern bool llama_backend_load_sequence(void* backend_data, int seq_id,
+                                        const uint8_t* data, size_t size);
+extern char* llama_backend_generate(void* backend_data, int seq_id, const char* prompt,
+                                    const SamplingParams& sampling, int max_tokens);
+extern char* llama_backend_generate_stream(void* backend_data, int seq_id, const char* prompt,
+                                           const SamplingParams& sampling, int max_tokens,
+                                           luup_stream_callback_t callback,
+                                           void* user_data);
 
 // OpenAI-compatible remote API backend functions
 extern void* openai_backend_init(const char* api_endpoint, const char* api_key,
-                                 const char* model_name, int context_size);
+                                 const char* model_name, int context_size,
+                                 int pool_size, int connect_timeout, int read_timeout,
+                                 bool stream_usage);
 extern void openai_backend_free(void* backend_data);
 extern bool openai_backend_get_info(void* backend_data, const char** model_name,
                                     int* context_size);
 extern char* openai_backend_generate(void* backend_data, const char* prompt,
-                                     float temperature, int max_tokens);
-extern bool openai_backend_generate_stream(void* backend_data, const char* prompt,
-                                           float temperature, int max_tokens,
-                                           void (*callback)(const char* token, void* user_data),
-                                           void* user_data);
+                                     const SamplingParams& sampling, int max_tokens);
+extern char* openai_backend_generate_stream(void* backend_data, const char* prompt,
+                                            const SamplingParams& sampling, int max_tokens,
+                                            luup_stream_callback_t callback,
+                                            void* user_data);
+extern char* openai_backend_chat(void* backend_data, const std::vector<Message>& messages,
+                                 const std::string& tools_json, const SamplingParams& sampling,
+                                 int max_tokens, luup_stream_callback_t callback, void* user_data);
 
 // Model helper functions
 extern void* luup_model_get_backend_data(luup_model* model);
 extern bool luup_model_is_local(luup_model* model);
+extern size_t count_model_tokens(luup_model* model, const std::string& text);
+extern int luup_model_reserve_sequence(luup_model* model);
+extern void luup_model_release_sequence(luup_model* model, int seq_id);
+extern char* luup_model_generate(luup_model* model, int seq_id, const std::string& prompt,
+                                 const SamplingParams& sampling, int max_tokens,
+                                 luup_stream_callback_t callback, void* user_data);
+
+// Response cache (from model.cpp). A generation takes the model's current
+// cache (null when off) once and uses that copy throughout, so the model may
+// replace it meanwhile. An empty key means the request is not cacheable;
+// lookup and store then do nothing.
+class ResponseCache;
+extern std::shared_ptr<ResponseCache> luup_model_response_cache(luup_model* model);
+extern std::string luup_model_cache_key(luup_model* model, const ResponseCache* cache,
+                                        const std::string& request,
+                                        const SamplingParams& sampling, int max_tokens);
+extern bool luup_model_cache_lookup(ResponseCache* cache, const std::string& key, std::string& out);
+extern void luup_model_cache_store(ResponseCache* cache, const std::string& key,
+                                   const std::string& response);
+
+// Agent helper functions (from agent.cpp)
+extern int luup_agent_get_sequence(luup_agent* agent);
+extern luup_error_t luup_agent_run_turn(luup_agent* agent, const char* user_message,
+                                        luup_stream_callback_t callback, void* user_data,
+                                        std::string& response);
+
+// Shared executor (from executor.cpp). Tasks of one agent run in the order
+// they were enqueued, never two at once; different agents run in parallel.
+extern bool luup_agent_enqueue(luup_agent* agent, std::function<void()> task);
+extern void luup_agent_wait_idle(luup_agent* agent);
+extern bool luup_agent_defer_destroy(luup_agent* agent);
 
 // Context manager functions (from context_manager.cpp)
 extern std::string format_chat_history(const std::vector<Message>& history);
+extern const std::string& build_agent_prompt(luup_agent* agent);
+extern std::string build_single_turn_prompt(luup_agent* agent, const std::string& user_message);
 extern size_t estimate_token_count(const std::string& text);
-extern bool is_context_full(const std::vector<Message>& history, size_t context_size, float threshold);
+extern size_t history_token_count(luup_agent* agent);
+extern bool is_context_full(luup_agent* agent, size_t context_size, float threshold);
+extern void apply_context_strategy(luup_agent* agent);
 
 // Tool calling functions (from tool_calling.cpp)
+
+// Incremental scanner for JSON tool calls in model output. Tracks brace
+// depth and string state, so every byte is examined once and a call is
+// reported as soon as its closing brace arrives. Objects are recorded as
+// their braces open; once the outermost one closes (or output ends with it
+// still open), they are tried outermost first, skipping the interior of any
+// that parsed.
+class ToolCallScanner {
+public:
+    ToolCallScanner() : in_string_(false), escaped_(false) {}
+    
+    // Feed more output; returns calls completed by this chunk
+    std::vector<ToolCall> feed(const char* data, size_t len);
+    
+    // End of output; tries the objects closed inside an unmatched brace
+    std::vector<ToolCall> finish();
+
+private:
+    struct Span {
+        size_t begin;   // Offset of '{' in candidate_
+        size_t end;     // Past its '}', or npos while open
+    };
+    
+    void resolve(std::vector<ToolCall>& calls);
+    
+    std::string candidate_;       // Output since the outermost open '{'
+    std::vector<Span> spans_;     // Objects in candidate_, in order of their '{'
+    std::vector<size_t> open_;    // Indexes in spans_ of the open braces
+    bool in_string_;
+    bool escaped_;
+};
+
 extern std::vector<ToolCall> parse_tool_calls(const std::string& text);
 extern std::string execute_tool(const std::string& tool_name, 
                                 const std::string& parameters_json,
                                 const std::map<std::string, ToolInfo>& tools);
+extern std::vector<std::string> execute_tools(const std::vector<ToolCall>& calls,
+                                              const std::map<std::string, ToolInfo>& tools,
+                                              ToolPool* pool, int timeout_ms,
+                                              std::vector<double>* elapsed_ms = nullptr);
+extern std::string format_tool_calls(const std::vector<ToolCall>& calls);
 extern std::string format_tool_result(const std::string& tool_name, const std::string& result_json);
-extern std::string generate_tool_schema(const std::map<std::string, ToolInfo>& tools);
+extern std::string generate_tool_schema(const std::map<std::string, ToolInfo>& tools, bool compact);
+extern std::string generate_tool_grammar(const std::map<std::string, ToolInfo>& tools);
+extern std::string generate_native_tools(const std::map<std::string, ToolInfo>& tools);
 
 #endif // LUUP_INTERNAL_H
 
@@ -7,8 +7,188 @@
 #include "internal.h"
 #include <string>
 #include <memory>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
 #include <cstring>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    // Two FNV-1a streams with different offsets, giving a 128-bit key.
+    // Strings are length-prefixed so adjacent fields can't run together.
+    class KeyHasher {
+    public:
+        KeyHasher() : a_(14695981039346656037ULL), b_(0x84222325cbf29ce4ULL) {}
+        
+        void add(const void* data, size_t len) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < len; i++) {
+                a_ = (a_ ^ p[i]) * 1099511628211ULL;
+                b_ = (b_ ^ p[i]) * 0x100000001b3ULL;
+                b_ ^= b_ >> 29;
+            }
+        }
+        void add(const std::string& s) {
+            add_value(s.size());
+            add(s.data(), s.size());
+        }
+        template <typename T>
+        void add_value(T value) {
+            add(&value, sizeof(value));
+        }
+        
+        std::string hex() const {
+            char buf[33];
+            snprintf(buf, sizeof(buf), "%016llx%016llx", static_cast<unsigned long long>(a_),
+                     static_cast<unsigned long long>(b_));
+            return buf;
+        }
+    
+    private:
+        uint64_t a_;
+        uint64_t b_;
+    };
+}
+
+// LRU of responses keyed by request hash, with an optional directory
+// holding every stored response as <key> files: a line with the expiry
+// (Unix time, 0 = none) followed by the text. Declared in internal.h so
+// generations can hold on to one.
+class ResponseCache {
+public:
+    ResponseCache(size_t max_entries, int ttl_seconds, const std::string& disk_dir)
+        : max_entries_(max_entries), ttl_(ttl_seconds), disk_dir_(disk_dir),
+          hits_(0), misses_(0) {}
+    
+    bool lookup(const std::string& key, std::string& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            if (Clock::now() >= it->second->expires) {
+                lru_.erase(it->second);
+                index_.erase(it);
+            } else {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                out = it->second->response;
+                hits_++;
+                return true;
+            }
+        }
+        
+        // Promote a hit on disk, keeping its remaining lifetime
+        long long expires_at = 0;
+        if (read_disk(key, out, expires_at)) {
+            Clock::time_point expires = Clock::time_point::max();
+            if (expires_at > 0) {
+                expires = Clock::now() + std::chrono::seconds(expires_at - std::time(nullptr));
+            }
+            insert(key, out, expires);
+            hits_++;
+            return true;
+        }
+        misses_++;
+        return false;
+    }
+    
+    void store(const std::string& key, const std::string& response) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert(key, response, ttl_.count() > 0 ? Clock::now() + ttl_
+                                                : Clock::time_point::max());
+        write_disk(key, response);
+    }
+    
+    void get_stats(size_t& hits, size_t& misses, size_t& entries) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hits = hits_;
+        misses = misses_;
+        entries = lru_.size();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    
+    struct Entry {
+        std::string key;
+        std::string response;
+        Clock::time_point expires;
+    };
+    
+    void insert(const std::string& key, const std::string& response,
+                Clock::time_point expires) {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            lru_.erase(it->second);
+        }
+        lru_.push_front(Entry{key, response, expires});
+        index_[key] = lru_.begin();
+        while (lru_.size() > max_entries_) {
+            index_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+    }
+    
+    bool read_disk(const std::string& key, std::string& out, long long& expires_at) {
+        if (disk_dir_.empty()) {
+            return false;
+        }
+        std::filesystem::path path = std::filesystem::path(disk_dir_) / key;
+        std::ifstream file(path, std::ios::binary);
+        if (!file || !(file >> expires_at) || file.get() != '\n') {
+            return false;
+        }
+        if (expires_at > 0 && std::time(nullptr) >= expires_at) {
+            file.close();
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            return false;
+        }
+        std::ostringstream text;
+        text << file.rdbuf();
+        out = text.str();
+        return true;
+    }
+    
+    // Written to a temporary file and renamed, so readers in other
+    // processes never see a partial response. Failures only lose the
+    // disk copy.
+    void write_disk(const std::string& key, const std::string& response) {
+        if (disk_dir_.empty()) {
+            return;
+        }
+        long long expires_at = ttl_.count() > 0
+            ? static_cast<long long>(std::time(nullptr)) + ttl_.count() : 0;
+        std::filesystem::path path = std::filesystem::path(disk_dir_) / key;
+        std::filesystem::path tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            file << expires_at << '\n' << response;
+            if (!file.flush()) {
+                return;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+    
+    size_t max_entries_;
+    std::chrono::seconds ttl_;
+    std::string disk_dir_;
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t hits_;
+    size_t misses_;
+    std::mutex mutex_;
+};
 
 // Internal model structure
 struct luup_model {
@@ -27,10 +207,21 @@ struct luup_model {
     std::string device_type;
     int gpu_layers_loaded;
     size_t memory_usage;
+    LlamaBackendParams local_params;   // Local: settings in effect
+    
+    // Caller-supplied tokenizer (overrides the built-in count)
+    luup_token_counter_t token_counter;
+    void* token_counter_data;
+    
+    // Responses to deterministic requests (null when disabled). Replaced
+    // under response_cache_mutex while generations may still use the old one.
+    std::shared_ptr<ResponseCache> response_cache;
+    std::mutex response_cache_mutex;
     
     luup_model() : gpu_layers(-1), context_size(2048), threads(0), 
                    is_local(true), backend_data(nullptr),
-                   gpu_layers_loaded(0), memory_usage(0) {}
+                   gpu_layers_loaded(0), memory_usage(0),
+                   token_counter(nullptr), token_counter_data(nullptr) {}
     
     ~luup_model() {
         if (backend_data) {
@@ -45,6 +236,24 @@ struct luup_model {
 
 extern "C" {
 
+luup_model_config luup_model_default_config(void) {
+    luup_model_config config;
+    memset(&config, 0, sizeof(config));
+    config.gpu_layers = -1;
+    config.context_size = 2048;
+    config.http_pool_size = 4;
+    config.http_connect_timeout = 30;
+    config.max_sequences = 1;
+    config.cache_type_k = LUUP_KV_CACHE_F16;
+    config.cache_type_v = LUUP_KV_CACHE_F16;
+    config.flash_attn = LUUP_FLASH_ATTN_AUTO;
+    config.batch_size = 2048;
+    config.ubatch_size = 512;
+    config.no_mmap = false;
+    config.use_mlock = false;
+    return config;
+}
+
 luup_model* luup_model_create_local(const luup_model_config* config) {
     if (!config || !config->path) {
         luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid model configuration");
@@ -60,12 +269,21 @@ luup_model* luup_model_create_local(const luup_model_config* config) {
         model->is_local = true;
         
         // Initialize llama.cpp backend
-        model->backend_data = llama_backend_init(
-            config->path,
-            config->gpu_layers,
-            model->context_size,
-            model->threads
-        );
+        LlamaBackendParams params;
+        params.gpu_layers = config->gpu_layers;
+        params.context_size = model->context_size;
+        params.threads = model->threads;
+        params.threads_batch = config->threads_batch;
+        params.n_sequences = config->max_sequences;
+        params.prefill_chunk_size = config->prefill_chunk_size;
+        params.batch_size = config->batch_size;
+        params.ubatch_size = config->ubatch_size;
+        params.cache_type_k = config->cache_type_k;
+        params.cache_type_v = config->cache_type_v;
+        params.flash_attn = config->flash_attn;
+        params.use_mmap = !config->no_mmap;
+        params.use_mlock = config->use_mlock;
+        model->backend_data = llama_backend_init(config->path, params);
         
         if (!model->backend_data) {
             // Error already set by llama_backend_init
@@ -81,6 +299,7 @@ luup_model* luup_model_create_local(const luup_model_config* config) {
         if (device) {
             model->device_type = device;
         }
+        llama_backend_get_params(model->backend_data, &model->local_params);
         
         return model;
     } catch (const std::exception& e) {
@@ -114,7 +333,11 @@ luup_model* luup_model_create_remote(const luup_model_config* config) {
             model->api_base_url.c_str(),
             model->api_key.c_str(),
             model->path.c_str(),  // Model name
-            model->context_size
+            model->context_size,
+            config->http_pool_size,
+            config->http_connect_timeout,
+            config->http_read_timeout,
+            config->stream_usage
         );
         
         if (!model->backend_data) {
@@ -172,11 +395,122 @@ luup_error_t luup_model_get_info(luup_model* model, luup_model_info* out_info) {
     out_info->gpu_layers_loaded = model->gpu_layers_loaded;
     out_info->memory_usage = model->memory_usage;
     out_info->context_size = model->context_size;
+    out_info->draft_tokens_proposed = 0;
+    out_info->draft_tokens_accepted = 0;
+    if (model->is_local && model->backend_data) {
+        llama_backend_get_draft_stats(model->backend_data, &out_info->draft_tokens_proposed,
+                                      &out_info->draft_tokens_accepted);
+    }
+    
+    // Local runtime settings; zero for remote models
+    const LlamaBackendParams& params = model->local_params;
+    bool local = model->is_local && model->backend_data;
+    out_info->cache_type_k = params.cache_type_k;
+    out_info->cache_type_v = params.cache_type_v;
+    out_info->flash_attn = params.flash_attn;
+    out_info->batch_size = local ? params.batch_size : 0;
+    out_info->ubatch_size = local ? params.ubatch_size : 0;
+    out_info->threads = local ? params.threads : 0;
+    out_info->threads_batch = local ? params.threads_batch : 0;
+    out_info->use_mmap = local && params.use_mmap;
+    out_info->use_mlock = local && params.use_mlock;
+    
+    out_info->response_cache_hits = 0;
+    out_info->response_cache_misses = 0;
+    out_info->response_cache_entries = 0;
+    std::shared_ptr<ResponseCache> cache = luup_model_response_cache(model);
+    if (cache) {
+        cache->get_stats(out_info->response_cache_hits,
+                         out_info->response_cache_misses,
+                         out_info->response_cache_entries);
+    }
+    
+    luup_clear_error();
+    return LUUP_SUCCESS;
+}
+
+luup_error_t luup_model_set_draft(luup_model* model, luup_model* draft, int n_draft) {
+    if (!model || model == draft) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    if (!model->is_local || !model->backend_data ||
+        (draft && (!draft->is_local || !draft->backend_data))) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Speculative decoding requires local models");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    if (!llama_backend_set_draft(model->backend_data, draft ? draft->backend_data : nullptr,
+                                 n_draft)) {
+        return luup_get_last_error_code();   // Error already set
+    }
+    return LUUP_SUCCESS;
+}
+
+luup_error_t luup_model_set_token_counter(luup_model* model, luup_token_counter_t counter,
+                                          void* user_data) {
+    if (!model) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid model handle");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    model->token_counter = counter;
+    model->token_counter_data = counter ? user_data : nullptr;
     
     luup_clear_error();
     return LUUP_SUCCESS;
 }
 
+luup_error_t luup_model_set_response_cache(luup_model* model, int max_entries,
+                                           int ttl_seconds, const char* disk_dir) {
+    if (!model || max_entries < 0 || ttl_seconds < 0) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    // Null when disabling
+    std::shared_ptr<ResponseCache> cache;
+    if (max_entries > 0) {
+        std::string dir = disk_dir ? disk_dir : "";
+        if (!dir.empty()) {
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            if (ec || !std::filesystem::is_directory(dir, ec)) {
+                luup_set_error(LUUP_ERROR_INVALID_PARAM, "Response cache directory is not usable");
+                return LUUP_ERROR_INVALID_PARAM;
+            }
+        }
+        
+        try {
+            cache = std::make_shared<ResponseCache>(static_cast<size_t>(max_entries),
+                                                    ttl_seconds, dir);
+        } catch (const std::exception& e) {
+            luup_set_error(LUUP_ERROR_OUT_OF_MEMORY, e.what());
+            return LUUP_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    
+    // Generations using the old cache keep it until they finish
+    {
+        std::lock_guard<std::mutex> lock(model->response_cache_mutex);
+        model->response_cache.swap(cache);
+    }
+    
+    luup_clear_error();
+    return LUUP_SUCCESS;
+}
+
+luup_error_t luup_model_count_tokens(luup_model* model, const char* text, int* out_count) {
+    if (!model || !text || !out_count) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Invalid parameters");
+        return LUUP_ERROR_INVALID_PARAM;
+    }
+    
+    *out_count = static_cast<int>(count_model_tokens(model, text));
+    luup_clear_error();
+    return LUUP_SUCCESS;
+}
+
 void luup_model_destroy(luup_model* model) {
     if (model) {
         delete model;
@@ -189,6 +523,12 @@ void luup_free_string(char* str) {
     }
 }
 
+void luup_free_buffer(void* buffer) {
+    if (buffer) {
+        free(buffer);
+    }
+}
+
 } // extern "C"
 
 // Helper function for internal use
@@ -200,3 +540,152 @@ bool luup_model_is_local(luup_model* model) {
     return model ? model->is_local : false;
 }
 
+// Token count of text: the caller's counter if set, the llama vocab for
+// local models, otherwise the character-based estimate
+size_t count_model_tokens(luup_model* model, const std::string& text) {
+    if (model && model->token_counter) {
+        return model->token_counter(text.c_str(), model->token_counter_data);
+    }
+    if (model && model->is_local && model->backend_data) {
+        int n = llama_backend_count_tokens(model->backend_data, text.data(), text.size());
+        if (n >= 0) {
+            return static_cast<size_t>(n);
+        }
+    }
+    return estimate_token_count(text);
+}
+
+// KV-cache sequence of a local model that no agent is bound to, held for
+// the caller alone (-1 when none is free); remote models have none and
+// always return 0
+int luup_model_reserve_sequence(luup_model* model) {
+    if (!model || !model->backend_data) {
+        return -1;
+    }
+    return model->is_local ? llama_backend_reserve_sequence(model->backend_data) : 0;
+}
+
+void luup_model_release_sequence(luup_model* model, int seq_id) {
+    if (model && model->is_local && model->backend_data && seq_id >= 0) {
+        llama_backend_release_sequence(model->backend_data, seq_id);
+    }
+}
+
+std::shared_ptr<ResponseCache> luup_model_response_cache(luup_model* model) {
+    if (!model) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(model->response_cache_mutex);
+    return model->response_cache;
+}
+
+// Response cache key of a request, or "" when it can't be cached: no cache,
+// or sampling that isn't deterministic. request is whatever fully decides
+// the model's input (the prompt, or the messages and tools).
+std::string luup_model_cache_key(luup_model* model, const ResponseCache* cache,
+                                 const std::string& request, const SamplingParams& sampling,
+                                 int max_tokens) {
+    if (!model || !cache || sampling.temperature > 0.0f) {
+        return "";
+    }
+    
+    KeyHasher hasher;
+    hasher.add_value(model->is_local);
+    hasher.add(model->path);
+    hasher.add(model->api_base_url);
+    hasher.add_value(model->local_params.cache_type_k);
+    hasher.add_value(model->local_params.cache_type_v);
+    hasher.add(request);
+    hasher.add_value(sampling.top_k);
+    hasher.add_value(sampling.top_p);
+    hasher.add_value(sampling.min_p);
+    hasher.add_value(sampling.repeat_penalty);
+    hasher.add(sampling.grammar);
+    hasher.add_value(max_tokens);
+    return hasher.hex();
+}
+
+bool luup_model_cache_lookup(ResponseCache* cache, const std::string& key, std::string& out) {
+    if (key.empty() || !cache) {
+        return false;
+    }
+    return cache->lookup(key, out);
+}
+
+void luup_model_cache_store(ResponseCache* cache, const std::string& key,
+                            const std::string& response) {
+    if (!key.empty() && cache) {
+        cache->store(key, response);
+    }
+}
+
+GenerationStats& luup_last_generation_stats() {
+    thread_local GenerationStats stats;
+    return stats;
+}
+
+namespace {
+    struct StopWatch {
+        luup_stream_callback_t callback;
+        void* user_data;
+        bool stopped;
+    };
+    
+    bool stop_watch_callback(const char* token, void* user_data) {
+        auto watch = static_cast<StopWatch*>(user_data);
+        watch->stopped = !watch->callback(token, watch->user_data);
+        return !watch->stopped;
+    }
+    
+    char* generate_uncached(luup_model* model, int seq_id, const std::string& prompt,
+                            const SamplingParams& sampling, int max_tokens,
+                            luup_stream_callback_t callback, void* user_data) {
+        if (model->is_local) {
+            return llama_backend_generate_stream(model->backend_data, seq_id, prompt.c_str(),
+                                                 sampling, max_tokens, callback, user_data);
+        }
+        if (callback) {
+            return openai_backend_generate_stream(model->backend_data, prompt.c_str(),
+                                                  sampling, max_tokens, callback, user_data);
+        }
+        return openai_backend_generate(model->backend_data, prompt.c_str(), sampling,
+                                       max_tokens);
+    }
+}
+
+// Generate on either backend. seq_id is only used by local models. With a
+// callback the text is streamed and the callback may stop it early; the
+// text generated so far is returned either way. Cached responses arrive
+// as one chunk.
+char* luup_model_generate(luup_model* model, int seq_id, const std::string& prompt,
+                          const SamplingParams& sampling, int max_tokens,
+                          luup_stream_callback_t callback, void* user_data) {
+    if (!model || !model->backend_data) {
+        luup_set_error(LUUP_ERROR_INVALID_PARAM, "Model backend not initialized");
+        return nullptr;
+    }
+    
+    std::shared_ptr<ResponseCache> cache = luup_model_response_cache(model);
+    std::string key = luup_model_cache_key(model, cache.get(), prompt, sampling, max_tokens);
+    std::string cached;
+    if (luup_model_cache_lookup(cache.get(), key, cached)) {
+        luup_last_generation_stats().reset();
+        if (callback) {
+            callback(cached.c_str(), user_data);
+        }
+        return strdup(cached.c_str());
+    }
+    if (key.empty()) {
+        return generate_uncached(model, seq_id, prompt, sampling, max_tokens, callback,
+                                 user_data);
+    }
+    
+    // Text the caller cut short is not what the model would have returned
+    StopWatch watch = {callback, user_data, false};
+    char* response = generate_uncached(model, seq_id, prompt, sampling, max_tokens,
+                                       callback ? stop_watch_callback : nullptr, &watch);
+    if (response && !watch.stopped) {
+        luup_model_cache_store(cache.get(), key, response);
+    }
+    return response;
+}
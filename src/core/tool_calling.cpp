@@ -9,29 +9,149 @@
 #include <string>
 #include <vector>
 #include <map>
-#include <regex>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 #include <sstream>
 
 using json = nlohmann::json;
 
-// Tool registration info structure
-struct ToolInfo {
-    luup_tool tool;
-    luup_tool_callback_t callback;
-    void* user_data;
+namespace {
+    // Invoke a registered tool's callback and take ownership of its result
+    std::string run_tool_callback(const ToolInfo& tool_info,
+                                  const std::string& tool_name,
+                                  const std::string& parameters_json) {
+        try {
+            // Execute the tool callback
+            char* result = tool_info.callback(parameters_json.c_str(), tool_info.user_data);
+            
+            if (result) {
+                std::string result_str(result);
+                free(result);  // Free the result returned by callback
+                return result_str;
+            } else {
+                // Callback returned null - execution failed
+                json error_result = {
+                    {"error", "Tool execution failed"},
+                    {"tool_name", tool_name}
+                };
+                return error_result.dump();
+            }
+        } catch (const std::exception& e) {
+            json error_result = {
+                {"error", e.what()},
+                {"tool_name", tool_name}
+            };
+            return error_result.dump();
+        }
+    }
     
-    ToolInfo() : callback(nullptr), user_data(nullptr) {
-        tool.name = nullptr;
-        tool.description = nullptr;
-        tool.parameters_json = nullptr;
+    // Append the tool calls described by one JSON object, if any
+    bool extract_tool_calls(const char* begin, const char* end, std::vector<ToolCall>& out) {
+        json j = json::parse(begin, end, nullptr, false);
+        if (j.is_discarded() || !j.is_object()) {
+            return false;
+        }
+        
+        auto add_call = [&out](const json& call) {
+            if (call.is_object() && call.contains("name") && call["name"].is_string() &&
+                call.contains("parameters")) {
+                ToolCall tc;
+                if (call.contains("id") && call["id"].is_string()) {
+                    tc.id = call["id"].get<std::string>();
+                }
+                tc.tool_name = call["name"].get<std::string>();
+                tc.parameters_json = call["parameters"].dump();
+                out.push_back(tc);
+            }
+        };
+        
+        // Check if this is a tool call structure
+        if (j.contains("tool_calls") && j["tool_calls"].is_array()) {
+            for (const auto& call : j["tool_calls"]) {
+                add_call(call);
+            }
+        }
+        // Also support direct tool call format
+        else {
+            add_call(j);
+        }
+        return true;
+    }
+}
+
+std::vector<ToolCall> ToolCallScanner::feed(const char* data, size_t len) {
+    std::vector<ToolCall> calls;
+    
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        
+        // Outside any object only an opening brace matters
+        if (open_.empty()) {
+            if (c == '{') {
+                candidate_.assign(1, c);
+                spans_.push_back({0, std::string::npos});
+                open_.push_back(0);
+                in_string_ = false;
+                escaped_ = false;
+            }
+            continue;
+        }
+        
+        candidate_ += c;
+        if (in_string_) {
+            if (escaped_) {
+                escaped_ = false;
+            } else if (c == '\\') {
+                escaped_ = true;
+            } else if (c == '"') {
+                in_string_ = false;
+            }
+        } else if (c == '"') {
+            in_string_ = true;
+        } else if (c == '{') {
+            open_.push_back(spans_.size());
+            spans_.push_back({candidate_.size() - 1, std::string::npos});
+        } else if (c == '}') {
+            spans_[open_.back()].end = candidate_.size();
+            open_.pop_back();
+            if (open_.empty()) {
+                resolve(calls);
+            }
+        }
     }
-};
+    
+    return calls;
+}
 
-// Parsed tool call structure
-struct ToolCall {
-    std::string tool_name;
-    std::string parameters_json;
-};
+std::vector<ToolCall> ToolCallScanner::finish() {
+    std::vector<ToolCall> calls;
+    open_.clear();
+    resolve(calls);
+    in_string_ = false;
+    escaped_ = false;
+    return calls;
+}
+
+// Try the recorded objects outermost first. One that isn't valid JSON (e.g.
+// prose in braces) or was never closed may still contain a tool call, so
+// the objects inside it get their turn.
+void ToolCallScanner::resolve(std::vector<ToolCall>& calls) {
+    size_t parsed_end = 0;   // End of the last object that parsed
+    for (const Span& span : spans_) {
+        if (span.end == std::string::npos || span.begin < parsed_end) {
+            continue;
+        }
+        if (extract_tool_calls(candidate_.data() + span.begin, candidate_.data() + span.end, calls)) {
+            parsed_end = span.end;
+        }
+    }
+    spans_.clear();
+    candidate_.clear();
+}
 
 /**
  * @brief Parse tool calls from LLM output
@@ -48,56 +168,17 @@ struct ToolCall {
  * }
  * ```
  * 
+ * Objects may be wrapped in code fences or surrounded by prose, and
+ * parameters may contain nested objects.
+ * 
  * @param text LLM output text
  * @return Vector of parsed tool calls
  */
 std::vector<ToolCall> parse_tool_calls(const std::string& text) {
-    std::vector<ToolCall> tool_calls;
-    
-    try {
-        // Try to find JSON blocks in the output
-        // Look for patterns like ```json ... ``` or just raw JSON
-        std::regex json_block_regex(R"(```(?:json)?\s*(\{[\s\S]*?\})\s*```|\{[\s\S]*?\})");
-        std::smatch match;
-        std::string search_text = text;
-        
-        while (std::regex_search(search_text, match, json_block_regex)) {
-            std::string json_str = match[1].str();
-            if (json_str.empty()) {
-                json_str = match[0].str();
-            }
-            
-            try {
-                json j = json::parse(json_str);
-                
-                // Check if this is a tool call structure
-                if (j.contains("tool_calls") && j["tool_calls"].is_array()) {
-                    for (const auto& call : j["tool_calls"]) {
-                        if (call.contains("name") && call.contains("parameters")) {
-                            ToolCall tc;
-                            tc.tool_name = call["name"].get<std::string>();
-                            tc.parameters_json = call["parameters"].dump();
-                            tool_calls.push_back(tc);
-                        }
-                    }
-                }
-                // Also support direct tool call format
-                else if (j.contains("name") && j.contains("parameters")) {
-                    ToolCall tc;
-                    tc.tool_name = j["name"].get<std::string>();
-                    tc.parameters_json = j["parameters"].dump();
-                    tool_calls.push_back(tc);
-                }
-            } catch (const json::exception&) {
-                // Not valid JSON, continue searching
-            }
-            
-            search_text = match.suffix().str();
-        }
-    } catch (const std::exception&) {
-        // Error parsing, return empty list
-    }
-    
+    ToolCallScanner scanner;
+    std::vector<ToolCall> tool_calls = scanner.feed(text.data(), text.size());
+    std::vector<ToolCall> rest = scanner.finish();
+    tool_calls.insert(tool_calls.end(), rest.begin(), rest.end());
     return tool_calls;
 }
 
@@ -123,32 +204,231 @@ std::string execute_tool(
         };
         return error_result.dump();
     }
+    if (!it->second.enabled) {
+        json error_result = {
+            {"error", "Tool is disabled"},
+            {"tool_name", tool_name}
+        };
+        return error_result.dump();
+    }
     
-    const ToolInfo& tool_info = it->second;
-    
+    return run_tool_callback(it->second, tool_name, parameters_json);
+}
+
+ToolPool::ToolPool(size_t n_workers) : stopping_(false) {
     try {
-        // Execute the tool callback
-        char* result = tool_info.callback(parameters_json.c_str(), tool_info.user_data);
+        for (size_t i = 0; i < n_workers; i++) {
+            workers_.emplace_back(&ToolPool::work, this);
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        available_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        throw;
+    }
+}
+
+ToolPool::~ToolPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        tasks_.clear();
+    }
+    available_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ToolPool::run(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    available_.notify_one();
+}
+
+void ToolPool::work() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            available_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+/**
+ * @brief Execute the tool calls from one response
+ * 
+ * Without a pool the calls run in order on the calling thread. With one,
+ * up to pool->size() calls run at once on its workers, and with
+ * timeout_ms > 0 a call that hasn't finished that long after it was
+ * queued gets an error result. A timed-out call that already started
+ * keeps its worker until the callback returns and its output is dropped;
+ * one still queued never runs. Results are returned in the order of the
+ * calls.
+ * 
+ * @param calls Tool calls to execute
+ * @param tools Map of registered tools
+ * @param pool Workers to run the calls on (nullptr runs them in order)
+ * @param timeout_ms Per-call timeout in milliseconds (0 for none)
+ * @param elapsed_ms If not null, receives each call's wall time in milliseconds
+ * @return One result JSON string per call
+ */
+std::vector<std::string> execute_tools(
+    const std::vector<ToolCall>& calls,
+    const std::map<std::string, ToolInfo>& tools,
+    ToolPool* pool,
+    int timeout_ms,
+    std::vector<double>* elapsed_ms)
+{
+    using clock = std::chrono::steady_clock;
+    using ms = std::chrono::duration<double, std::milli>;
+    const size_t n_calls = calls.size();
+    std::vector<std::string> results(n_calls);
+    std::vector<clock::time_point> starts(n_calls);
+    if (elapsed_ms) {
+        elapsed_ms->assign(n_calls, 0.0);
+    }
+    
+    if (!pool) {
+        for (size_t i = 0; i < n_calls; i++) {
+            starts[i] = clock::now();
+            results[i] = execute_tool(calls[i].tool_name, calls[i].parameters_json, tools);
+            if (elapsed_ms) {
+                (*elapsed_ms)[i] = ms(clock::now() - starts[i]).count();
+            }
+        }
+        return results;
+    }
+    
+    // Shared with the workers, which may still hold it after this returns
+    struct BatchState {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<bool> done;
+        std::vector<bool> abandoned;   // Timed out; skip if not yet started
+        std::vector<std::string> results;
+    };
+    auto state = std::make_shared<BatchState>();
+    state->done.assign(n_calls, false);
+    state->abandoned.assign(n_calls, false);
+    state->results.resize(n_calls);
+    
+    const size_t n_parallel = std::max<size_t>(pool->size(), 1);
+    std::vector<clock::time_point> deadlines(n_calls);
+    std::vector<size_t> running;
+    size_t next = 0;
+    size_t n_finished = 0;
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (n_finished < n_calls) {
+        // Queue calls up to the concurrency limit
+        while (running.size() < n_parallel && next < n_calls) {
+            size_t idx = next++;
+            starts[idx] = clock::now();
+            auto it = tools.find(calls[idx].tool_name);
+            if (it == tools.end() || !it->second.enabled) {
+                results[idx] = execute_tool(calls[idx].tool_name, calls[idx].parameters_json, tools);
+                n_finished++;
+                continue;
+            }
+            
+            deadlines[idx] = clock::now() + std::chrono::milliseconds(timeout_ms);
+            pool->run([state, idx, info = it->second, call = calls[idx]] {
+                {
+                    std::lock_guard<std::mutex> guard(state->mutex);
+                    if (state->abandoned[idx]) {
+                        return;
+                    }
+                }
+                std::string result = run_tool_callback(info, call.tool_name, call.parameters_json);
+                std::lock_guard<std::mutex> guard(state->mutex);
+                state->results[idx] = std::move(result);
+                state->done[idx] = true;
+                state->cv.notify_all();
+            });
+            running.push_back(idx);
+        }
+        if (running.empty()) {
+            continue;
+        }
         
-        if (result) {
-            std::string result_str(result);
-            free(result);  // Free the result returned by callback
-            return result_str;
+        // Wait for a call to finish or the earliest deadline to pass
+        auto any_done = [&] {
+            return std::any_of(running.begin(), running.end(),
+                               [&](size_t idx) { return state->done[idx]; });
+        };
+        if (timeout_ms > 0) {
+            clock::time_point earliest = deadlines[running.front()];
+            for (size_t idx : running) {
+                earliest = std::min(earliest, deadlines[idx]);
+            }
+            state->cv.wait_until(lock, earliest, any_done);
         } else {
-            // Callback returned null - execution failed
-            json error_result = {
-                {"error", "Tool execution failed"},
-                {"tool_name", tool_name}
-            };
-            return error_result.dump();
+            state->cv.wait(lock, any_done);
+        }
+        
+        // Collect finished and timed-out calls
+        clock::time_point now = clock::now();
+        for (auto it = running.begin(); it != running.end();) {
+            size_t idx = *it;
+            if (state->done[idx]) {
+                results[idx] = std::move(state->results[idx]);
+            } else if (timeout_ms > 0 && now >= deadlines[idx]) {
+                state->abandoned[idx] = true;
+                json error_result = {
+                    {"error", "Tool timed out"},
+                    {"tool_name", calls[idx].tool_name},
+                    {"timeout_ms", timeout_ms}
+                };
+                results[idx] = error_result.dump();
+            } else {
+                ++it;
+                continue;
+            }
+            if (elapsed_ms) {
+                (*elapsed_ms)[idx] = ms(now - starts[idx]).count();
+            }
+            n_finished++;
+            it = running.erase(it);
         }
-    } catch (const std::exception& e) {
-        json error_result = {
-            {"error", e.what()},
-            {"tool_name", tool_name}
-        };
-        return error_result.dump();
     }
+    
+    return results;
+}
+
+/**
+ * @brief Write tool calls in the text format parse_tool_calls reads
+ * 
+ * @param calls Tool calls (ids are kept when set)
+ * @return {"tool_calls": [{"id", "name", "parameters"}]}, or "" for no calls
+ */
+std::string format_tool_calls(const std::vector<ToolCall>& calls) {
+    if (calls.empty()) {
+        return "";
+    }
+    json out = json::array();
+    for (const auto& call : calls) {
+        json params = json::parse(call.parameters_json, nullptr, false);
+        json entry = {{"name", call.tool_name}, {"parameters", params.is_discarded()
+                                                     ? json(call.parameters_json) : params}};
+        if (!call.id.empty()) {
+            entry["id"] = call.id;
+        }
+        out.push_back(entry);
+    }
+    return json{{"tool_calls", out}}.dump();
 }
 
 /**
@@ -165,23 +445,87 @@ std::string format_tool_result(const std::string& tool_name, const std::string&
     return oss.str();
 }
 
+namespace {
+    // Drop schema keywords that cost tokens without telling the model
+    // anything: metadata, and types already implied by an enum
+    void compact_schema(json& schema) {
+        if (!schema.is_object()) {
+            return;
+        }
+        schema.erase("$schema");
+        schema.erase("title");
+        if (schema.contains("enum")) {
+            schema.erase("type");
+        }
+        if (schema.contains("properties") && schema["properties"].is_object()) {
+            for (auto& [key, prop] : schema["properties"].items()) {
+                compact_schema(prop);
+            }
+        }
+        if (schema.contains("items")) {
+            compact_schema(schema["items"]);
+        }
+    }
+    
+    // Minified parameter schema for compact rendering
+    std::string compact_parameters(const char* parameters_json) {
+        json schema = json::parse(parameters_json ? parameters_json : "{}", nullptr, false);
+        if (schema.is_discarded()) {
+            return parameters_json ? parameters_json : "{}";
+        }
+        compact_schema(schema);
+        
+        // A top-level object with properties is implied by the call format
+        if (schema.is_object() && schema.contains("properties")) {
+            schema.erase("type");
+        }
+        return schema.dump();
+    }
+}
+
 /**
  * @brief Generate tool schema for system prompt
  * 
- * Creates a description of available tools for the LLM to understand
+ * Creates a description of available tools for the LLM to understand.
+ * Disabled tools are left out. The compact form puts each tool on one
+ * line with a minified parameter schema and shortens the instructions.
  * 
  * @param tools Map of registered tools
- * @return Tool schema as string
+ * @param compact Use the compact rendering
+ * @return Tool schema as string (empty if no tool is enabled)
  */
-std::string generate_tool_schema(const std::map<std::string, ToolInfo>& tools) {
-    if (tools.empty()) {
+std::string generate_tool_schema(const std::map<std::string, ToolInfo>& tools, bool compact) {
+    bool any_enabled = false;
+    for (const auto& entry : tools) {
+        any_enabled = any_enabled || entry.second.enabled;
+    }
+    if (!any_enabled) {
         return "";
     }
     
     std::ostringstream oss;
+    if (compact) {
+        oss << "\n\nTools:\n";
+        for (const auto& [name, info] : tools) {
+            if (!info.enabled) {
+                continue;
+            }
+            oss << "- " << name;
+            if (info.tool.description && info.tool.description[0]) {
+                oss << ": " << info.tool.description;
+            }
+            oss << " " << compact_parameters(info.tool.parameters_json) << "\n";
+        }
+        oss << "To call tools, reply with {\"tool_calls\":[{\"name\":...,\"parameters\":{...}}]}\n\n";
+        return oss.str();
+    }
+    
     oss << "\n\nYou have access to the following tools:\n\n";
     
     for (const auto& [name, info] : tools) {
+        if (!info.enabled) {
+            continue;
+        }
         oss << "Tool: " << name << "\n";
         oss << "Description: " << (info.tool.description ? info.tool.description : "No description") << "\n";
         oss << "Parameters: " << (info.tool.parameters_json ? info.tool.parameters_json : "{}") << "\n\n";
@@ -202,10 +546,154 @@ std::string generate_tool_schema(const std::map<std::string, ToolInfo>& tools) {
     return oss.str();
 }
 
-// TODO: Future enhancements:
-// - JSON schema validation for tool parameters
-// - Retry logic for failed tool calls
-// - Parallel tool execution
-// - Tool call timeouts
-// - Tool call permissions/security
+// Enabled tools as an OpenAI "tools" array for remote backends, or empty
+// string if no tool is enabled
+std::string generate_native_tools(const std::map<std::string, ToolInfo>& tools) {
+    json out = json::array();
+    for (const auto& [name, info] : tools) {
+        if (!info.enabled) {
+            continue;
+        }
+        json parameters = json::parse(info.tool.parameters_json ? info.tool.parameters_json : "",
+                                      nullptr, false);
+        if (parameters.is_discarded() || !parameters.is_object()) {
+            parameters = {{"type", "object"}, {"properties", json::object()}};
+        }
+        out.push_back({
+            {"type", "function"},
+            {"function", {
+                {"name", name},
+                {"description", info.tool.description ? info.tool.description : ""},
+                {"parameters", parameters}
+            }}
+        });
+    }
+    return out.empty() ? "" : out.dump();
+}
 
+namespace {
+    // Quote text as a GBNF string literal
+    std::string gbnf_literal(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            switch (c) {
+                case '"':  out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:   out += c; break;
+            }
+        }
+        return out + "\"";
+    }
+    
+    // Emit rules for a JSON schema and return the rule that matches it.
+    // Covers the subset tool schemas use: enums, scalar types, arrays and
+    // objects with properties. Object keys may appear in any order and
+    // anything else falls back to a generic JSON value.
+    std::string schema_rule(const json& schema, const std::string& name, std::string& rules) {
+        if (!schema.is_object()) {
+            return "value";
+        }
+        
+        if (schema.contains("enum") && schema["enum"].is_array() && !schema["enum"].empty()) {
+            std::string alternatives;
+            for (const auto& option : schema["enum"]) {
+                if (!alternatives.empty()) {
+                    alternatives += " | ";
+                }
+                alternatives += gbnf_literal(option.dump());
+            }
+            rules += name + " ::= " + alternatives + "\n";
+            return name;
+        }
+        
+        std::string type = schema.contains("type") && schema["type"].is_string()
+            ? schema["type"].get<std::string>() : "";
+        if (type == "string" || type == "number" || type == "integer" || type == "boolean") {
+            return type;
+        }
+        if (type == "null") {
+            return "null";
+        }
+        if (type == "array") {
+            std::string item = schema.contains("items")
+                ? schema_rule(schema["items"], name + "-item", rules) : "value";
+            rules += name + " ::= \"[\" ws ( " + item + " ( ws \",\" ws " + item + " )* )? ws \"]\"\n";
+            return name;
+        }
+        if (type == "object" && schema.contains("properties") && schema["properties"].is_object() &&
+            !schema["properties"].empty()) {
+            std::string kvs;
+            int index = 0;
+            for (const auto& [key, prop] : schema["properties"].items()) {
+                std::string kv = name + "-kv" + std::to_string(index++);
+                std::string value = schema_rule(prop, kv + "-value", rules);
+                rules += kv + " ::= " + gbnf_literal(json(key).dump()) + " ws \":\" ws " + value + "\n";
+                kvs += (kvs.empty() ? "" : " | ") + kv;
+            }
+            rules += name + "-kv ::= " + kvs + "\n";
+            rules += name + " ::= \"{\" ws ( " + name + "-kv ( ws \",\" ws " + name + "-kv )* )? ws \"}\"\n";
+            return name;
+        }
+        if (type == "object") {
+            return "object";
+        }
+        return "value";
+    }
+}
+
+/**
+ * @brief Generate a GBNF grammar for tool-call JSON
+ * 
+ * Matches the `{"tool_calls": [...]}` format described by
+ * generate_tool_schema, with each call's name restricted to the registered
+ * tools and its parameters shaped by that tool's JSON schema. Meant to be
+ * attached lazily, once the model starts a tool-call object.
+ * 
+ * @param tools Map of registered tools
+ * @return Grammar with a "root" rule, or empty string if no tool is enabled
+ */
+std::string generate_tool_grammar(const std::map<std::string, ToolInfo>& tools) {
+    if (tools.empty()) {
+        return "";
+    }
+    
+    std::string rules;
+    std::string calls;
+    int index = 0;
+    for (const auto& [name, info] : tools) {
+        if (!info.enabled) {
+            continue;
+        }
+        std::string tool = "tool-" + std::to_string(index++);
+        json schema = json::parse(info.tool.parameters_json ? info.tool.parameters_json : "{}",
+                                  nullptr, false);
+        std::string params = schema_rule(schema, tool + "-params", rules);
+        if (params == "value") {
+            params = "object";  // Parameters are always an object
+        }
+        rules += tool + " ::= \"{\" ws \"\\\"name\\\"\" ws \":\" ws " + gbnf_literal(json(name).dump()) +
+                 " ws \",\" ws \"\\\"parameters\\\"\" ws \":\" ws " + params + " ws \"}\"\n";
+        calls += (calls.empty() ? "" : " | ") + tool;
+    }
+    if (calls.empty()) {
+        return "";
+    }
+    
+    std::string grammar;
+    grammar += "root ::= \"{\" ws \"\\\"tool_calls\\\"\" ws \":\" ws \"[\" ws call ( ws \",\" ws call )* ws \"]\" ws \"}\"\n";
+    grammar += "call ::= " + calls + "\n";
+    grammar += rules;
+    grammar += "value ::= object | array | string | number | boolean | null\n";
+    grammar += "object ::= \"{\" ws ( string ws \":\" ws value ( ws \",\" ws string ws \":\" ws value )* )? ws \"}\"\n";
+    grammar += "array ::= \"[\" ws ( value ( ws \",\" ws value )* )? ws \"]\"\n";
+    grammar += "string ::= \"\\\"\" ( [^\"\\\\\\x7F\\x00-\\x1F] | \"\\\\\" ( [\"\\\\/bfnrt] | \"u\" [0-9a-fA-F]{4} ) )* \"\\\"\"\n";
+    grammar += "number ::= \"-\"? ( [0-9] | [1-9] [0-9]{0,15} ) ( \".\" [0-9]+ )? ( [eE] [-+]? [0-9]+ )?\n";
+    grammar += "integer ::= \"-\"? ( [0-9] | [1-9] [0-9]{0,15} )\n";
+    grammar += "boolean ::= \"true\" | \"false\"\n";
+    grammar += "null ::= \"null\"\n";
+    grammar += "ws ::= [ \\t\\n]{0,20}\n";
+    return grammar;
+}
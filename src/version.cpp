@@ -21,5 +21,9 @@ void luup_version_components(int* major, int* minor, int* patch) {
     if (patch) *patch = LUUP_VERSION_PATCH;
 }
 
+int luup_abi_version(void) {
+    return LUUP_ABI_VERSION;
+}
+
 } // extern "C"
 
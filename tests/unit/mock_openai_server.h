@@ -0,0 +1,151 @@
+/**
+ * @file mock_openai_server.h
+ * @brief Local OpenAI-compatible server for tests against remote models
+ */
+
+#ifndef LUUP_TEST_MOCK_OPENAI_SERVER_H
+#define LUUP_TEST_MOCK_OPENAI_SERVER_H
+
+#include <luup_agent.h>
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Answers /v1/chat/completions with the assistant message returned by the
+// handler ({"content": ..., "tool_calls": [...]}), blocking or as SSE with
+// one event per word. The default handler echoes the last message. Usage
+// counts 10 prompt tokens per message and one completion token per word;
+// streams report it in a final chunk when stream_options.include_usage is set.
+class MockOpenAIServer {
+public:
+    using json = nlohmann::json;
+    using Handler = std::function<json(const json& request)>;
+    
+    MockOpenAIServer() : requests(0), port_(-1) {
+        handler_ = [](const json& request) {
+            const json& last = request["messages"].back();
+            return json{{"content", "echo: " + last.value("content", "")}};
+        };
+    }
+    ~MockOpenAIServer() { stop(); }
+    
+    // Set before start()
+    void set_handler(Handler handler) { handler_ = std::move(handler); }
+    
+    bool start() {
+        server_.Post("/v1/chat/completions", [this](const httplib::Request& req,
+                                                    httplib::Response& res) {
+            handle(req, res);
+        });
+        port_ = server_.bind_to_any_port("127.0.0.1");
+        if (port_ <= 0) {
+            return false;
+        }
+        thread_ = std::thread([this] { server_.listen_after_bind(); });
+        server_.wait_until_ready();
+        return true;
+    }
+    
+    void stop() {
+        if (thread_.joinable()) {
+            server_.stop();
+            thread_.join();
+        }
+    }
+    
+    std::string base_url() const {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/v1";
+    }
+    
+    // Remote model pointed at the server
+    luup_model* create_model(bool stream_usage = false) const {
+        std::string url = base_url();
+        luup_model_config config = luup_model_default_config();
+        config.path = "mock-model";
+        config.api_key = "test-key";
+        config.api_base_url = url.c_str();
+        config.stream_usage = stream_usage;
+        return luup_model_create_remote(&config);
+    }
+    
+    std::atomic<int> requests;
+
+private:
+    void handle(const httplib::Request& req, httplib::Response& res) {
+        requests++;
+        json body = json::parse(req.body, nullptr, false);
+        if (body.is_discarded() || !body.contains("messages") || body["messages"].empty()) {
+            res.status = 400;
+            res.set_content("{\"error\": {\"message\": \"bad request\"}}", "application/json");
+            return;
+        }
+        
+        json message = handler_(body);
+        message["role"] = "assistant";
+        if (!message.contains("content")) {
+            message["content"] = "";
+        }
+        
+        std::vector<std::string> words;
+        std::string content = message["content"].get<std::string>();
+        for (size_t start = 0; start < content.size();) {
+            size_t end = content.find(' ', start + 1);
+            end = end == std::string::npos ? content.size() : end;
+            words.push_back(content.substr(start, end - start));
+            start = end;
+        }
+        json usage = {{"prompt_tokens", 10 * body["messages"].size()},
+                      {"completion_tokens", words.size()}};
+        
+        if (!body.value("stream", false)) {
+            json out = {{"choices", json::array({{{"index", 0}, {"message", message}}})},
+                        {"usage", usage}};
+            res.set_content(out.dump(), "application/json");
+            return;
+        }
+        
+        auto events = std::make_shared<std::vector<std::string>>();
+        auto event = [&](const json& delta) {
+            json chunk = {{"choices", json::array({{{"index", 0}, {"delta", delta}}})}};
+            events->push_back("data: " + chunk.dump() + "\n\n");
+        };
+        for (const auto& word : words) {
+            event({{"content", word}});
+        }
+        if (message.contains("tool_calls")) {
+            json calls = message["tool_calls"];
+            for (size_t i = 0; i < calls.size(); i++) {
+                calls[i]["index"] = i;
+            }
+            event({{"tool_calls", calls}});
+        }
+        if (body.contains("stream_options") && body["stream_options"].value("include_usage", false)) {
+            json chunk = {{"choices", json::array()}, {"usage", usage}};
+            events->push_back("data: " + chunk.dump() + "\n\n");
+        }
+        events->push_back("data: [DONE]\n\n");
+        
+        res.set_chunked_content_provider("text/event-stream",
+                                         [events](size_t, httplib::DataSink& sink) {
+            for (const auto& e : *events) {
+                if (!sink.write(e.data(), e.size())) {
+                    return false;
+                }
+            }
+            sink.done();
+            return true;
+        });
+    }
+    
+    httplib::Server server_;
+    std::thread thread_;
+    int port_;
+    Handler handler_;
+};
+
+#endif // LUUP_TEST_MOCK_OPENAI_SERVER_H
@@ -5,8 +5,15 @@
 
 #include <catch2/catch_test_macros.hpp>
 #include <luup_agent.h>
+#include "mock_openai_server.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <cstring>
+#include <cstdio>
 
 // Helper function to create a mock model for testing
 static luup_model* create_mock_model() {
@@ -84,6 +91,20 @@ TEST_CASE("Agent history management", "[agent]") {
         REQUIRE(history == nullptr);
     }
     
+    SECTION("Add message with unknown role") {
+        luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
+        luup_agent_config config = {
+            .model = dummy_model,
+            .enable_tool_calling = false,
+            .enable_history_management = true
+        };
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_add_message(agent, "tool", "result") == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_agent_add_message(agent, "function", "result") == LUUP_ERROR_INVALID_PARAM);
+        luup_agent_destroy(agent);
+    }
+    
     SECTION("Add and retrieve messages") {
         luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
         luup_agent_config config = {
@@ -134,6 +155,65 @@ TEST_CASE("Agent history management", "[agent]") {
     }
 }
 
+TEST_CASE("Agent state save and restore", "[agent]") {
+    SECTION("Null parameters") {
+        size_t size = 0;
+        REQUIRE(luup_agent_save_state(nullptr, "/tmp/luup_state.bin") == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_agent_load_state(nullptr, "/tmp/luup_state.bin") == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_agent_save_state_buffer(nullptr, &size) == nullptr);
+        REQUIRE(luup_agent_load_state_buffer(nullptr, "x", 1) == LUUP_ERROR_INVALID_PARAM);
+    }
+    
+    SECTION("Round trip history") {
+        luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
+        luup_agent_config config = {
+            .model = dummy_model,
+            .system_prompt = "Test system",
+            .temperature = 0.7f,
+            .max_tokens = 100,
+            .enable_tool_calling = false,
+            .enable_history_management = true
+        };
+        
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_add_message(agent, "user", "Remember the number 42") == LUUP_SUCCESS);
+        REQUIRE(luup_agent_add_message(agent, "assistant", "Noted.") == LUUP_SUCCESS);
+        
+        size_t size = 0;
+        void* state = luup_agent_save_state_buffer(agent, &size);
+        REQUIRE(state != nullptr);
+        REQUIRE(size > 0);
+        REQUIRE(luup_agent_save_state(agent, "/tmp/luup_state.bin") == LUUP_SUCCESS);
+        
+        luup_agent* restored = luup_agent_create(&config);
+        REQUIRE(restored != nullptr);
+        REQUIRE(luup_agent_load_state_buffer(restored, state, size) == LUUP_SUCCESS);
+        
+        char* history_json = luup_agent_get_history_json(restored);
+        REQUIRE(history_json != nullptr);
+        REQUIRE(std::string(history_json).find("Remember the number 42") != std::string::npos);
+        luup_free_string(history_json);
+        
+        // File round trip replaces whatever history was there
+        REQUIRE(luup_agent_clear_history(restored) == LUUP_SUCCESS);
+        REQUIRE(luup_agent_load_state(restored, "/tmp/luup_state.bin") == LUUP_SUCCESS);
+        history_json = luup_agent_get_history_json(restored);
+        REQUIRE(history_json != nullptr);
+        REQUIRE(std::string(history_json).find("Noted.") != std::string::npos);
+        luup_free_string(history_json);
+        
+        // Corrupt data is rejected
+        REQUIRE(luup_agent_load_state_buffer(restored, "not a state", 11) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_agent_load_state_buffer(restored, state, size / 2) != LUUP_SUCCESS);
+        
+        luup_free_buffer(state);
+        std::remove("/tmp/luup_state.bin");
+        luup_agent_destroy(restored);
+        luup_agent_destroy(agent);
+    }
+}
+
 TEST_CASE("Agent tool registration", "[agent]") {
     SECTION("Register tool with null agent") {
         luup_tool tool = {
@@ -186,6 +266,45 @@ TEST_CASE("Agent tool registration", "[agent]") {
     }
 }
 
+TEST_CASE("Agent tool enable/disable", "[agent]") {
+    SECTION("Null agent") {
+        luup_error_t result = luup_agent_set_tool_enabled(nullptr, "test_tool", false);
+        REQUIRE(result == LUUP_ERROR_INVALID_PARAM);
+    }
+    
+    SECTION("Toggle registered and unknown tools") {
+        luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
+        luup_agent_config config = {
+            .model = dummy_model,
+            .system_prompt = "Test",
+            .temperature = 0.7f,
+            .max_tokens = 100,
+            .enable_tool_calling = true,
+            .enable_history_management = true,
+            .enable_builtin_tools = false
+        };
+        
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        
+        luup_tool tool = {
+            .name = "get_weather",
+            .description = "Get current weather for a city",
+            .parameters_json = R"({"type": "object", "properties": {"city": {"type": "string"}}})"
+        };
+        auto callback = [](const char* params, void* data) -> char* {
+            return nullptr;
+        };
+        REQUIRE(luup_agent_register_tool(agent, &tool, callback, nullptr) == LUUP_SUCCESS);
+        
+        REQUIRE(luup_agent_set_tool_enabled(agent, "get_weather", false) == LUUP_SUCCESS);
+        REQUIRE(luup_agent_set_tool_enabled(agent, "get_weather", true) == LUUP_SUCCESS);
+        REQUIRE(luup_agent_set_tool_enabled(agent, "missing_tool", false) == LUUP_ERROR_TOOL_NOT_FOUND);
+        
+        luup_agent_destroy(agent);
+    }
+}
+
 TEST_CASE("Agent generation", "[agent]") {
     SECTION("Generate with null agent") {
         char* response = luup_agent_generate(nullptr, "test");
@@ -217,6 +336,366 @@ TEST_CASE("Agent generation", "[agent]") {
     // These would be integration tests with an actual GGUF file
 }
 
+TEST_CASE("Agent turn metrics", "[agent]") {
+    SECTION("Null parameters") {
+        luup_turn_metrics metrics;
+        REQUIRE(luup_agent_get_last_metrics(nullptr, &metrics) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_agent_set_metrics_callback(nullptr, nullptr, nullptr) == LUUP_ERROR_INVALID_PARAM);
+    }
+    
+    SECTION("Empty before the first turn") {
+        luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
+        luup_agent_config config = {
+            .model = dummy_model,
+            .enable_tool_calling = false,
+            .enable_history_management = true,
+            .enable_builtin_tools = false
+        };
+        
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        
+        REQUIRE(luup_agent_get_last_metrics(agent, nullptr) == LUUP_ERROR_INVALID_PARAM);
+        
+        luup_turn_metrics metrics;
+        REQUIRE(luup_agent_get_last_metrics(agent, &metrics) == LUUP_SUCCESS);
+        REQUIRE(metrics.generations == 0);
+        REQUIRE(metrics.tool_calls == 0);
+        REQUIRE(metrics.n_tools == 0);
+        REQUIRE(metrics.tools == nullptr);
+        
+        auto on_metrics = [](const luup_turn_metrics*, void*) {};
+        REQUIRE(luup_agent_set_metrics_callback(agent, on_metrics, nullptr) == LUUP_SUCCESS);
+        REQUIRE(luup_agent_set_metrics_callback(agent, nullptr, nullptr) == LUUP_SUCCESS);
+        
+        luup_agent_destroy(agent);
+    }
+}
+
+TEST_CASE("Remote turn usage", "[agent][remote]") {
+    std::atomic<size_t> sent_messages(0);
+    std::atomic<bool> sent_stream_options(false);
+    MockOpenAIServer server;
+    server.set_handler([&](const nlohmann::json& request) {
+        sent_messages = request["messages"].size();
+        sent_stream_options = request.contains("stream_options");
+        return nlohmann::json{{"content", "echo: hello"}};
+    });
+    REQUIRE(server.start());
+    luup_model* model = server.create_model(true);
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .enable_tool_calling = false,
+        .enable_history_management = true,
+        .enable_builtin_tools = false
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    SECTION("Blocking") {
+        char* response = luup_agent_generate(agent, "hello");
+        REQUIRE(response != nullptr);
+        luup_free_string(response);
+    }
+    
+    SECTION("Streaming") {
+        auto ignore = [](const char*, void*) { return true; };
+        REQUIRE(luup_agent_generate_stream(agent, "hello", ignore, nullptr) == LUUP_SUCCESS);
+        REQUIRE(sent_stream_options);
+    }
+    
+    // Both report the server's usage, streams from its final chunk
+    luup_turn_metrics metrics;
+    REQUIRE(luup_agent_get_last_metrics(agent, &metrics) == LUUP_SUCCESS);
+    REQUIRE(metrics.generations == 1);
+    REQUIRE(metrics.prompt_tokens == static_cast<int>(10 * sent_messages));
+    REQUIRE(metrics.generated_tokens == 2);
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
+
+TEST_CASE("Remote streams without stream_usage", "[agent][remote]") {
+    std::atomic<bool> sent_stream_options(true);
+    MockOpenAIServer server;
+    server.set_handler([&](const nlohmann::json& request) {
+        sent_stream_options = request.contains("stream_options");
+        return nlohmann::json{{"content", "echo: hello"}};
+    });
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .enable_tool_calling = false,
+        .enable_history_management = true,
+        .enable_builtin_tools = false
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    // Strict servers reject stream_options, so it is only sent on request
+    auto ignore = [](const char*, void*) { return true; };
+    REQUIRE(luup_agent_generate_stream(agent, "hello", ignore, nullptr) == LUUP_SUCCESS);
+    REQUIRE_FALSE(sent_stream_options);
+    
+    luup_turn_metrics metrics;
+    REQUIRE(luup_agent_get_last_metrics(agent, &metrics) == LUUP_SUCCESS);
+    REQUIRE(metrics.generations == 1);
+    REQUIRE(metrics.prompt_tokens == 0);
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
+
+TEST_CASE("Response cache in agent turns", "[agent]") {
+    auto run_twice = [](luup_agent* agent, luup_turn_metrics& second) {
+        for (int i = 0; i < 2; i++) {
+            REQUIRE(luup_agent_clear_history(agent) == LUUP_SUCCESS);
+            char* response = luup_agent_generate(agent, "hello");
+            REQUIRE(response != nullptr);
+            luup_free_string(response);
+        }
+        REQUIRE(luup_agent_get_last_metrics(agent, &second) == LUUP_SUCCESS);
+    };
+    
+    SECTION("Remote turns repeat from the cache") {
+        MockOpenAIServer server;
+        server.set_handler([](const nlohmann::json&) {
+            return nlohmann::json{{"content", "echo: hello"}};
+        });
+        REQUIRE(server.start());
+        luup_model* model = server.create_model();
+        REQUIRE(model != nullptr);
+        REQUIRE(luup_model_set_response_cache(model, 16, 0, nullptr) == LUUP_SUCCESS);
+        
+        luup_agent_config config = {
+            .model = model,
+            .enable_tool_calling = false,
+            .enable_builtin_tools = false
+        };
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        luup_turn_metrics metrics;
+        run_twice(agent, metrics);
+        REQUIRE(metrics.cache_hits == 1);
+        REQUIRE(server.requests == 1);
+        
+        luup_agent_destroy(agent);
+        luup_model_destroy(model);
+    }
+    
+    SECTION("Local turns bypass it") {
+        // A hit would leave the agent's KV cache behind its history
+        luup_model* model = create_mock_model();
+        if (!model) {
+            SKIP("Model file not found - skipping test");
+        }
+        REQUIRE(luup_model_set_response_cache(model, 16, 0, nullptr) == LUUP_SUCCESS);
+        
+        luup_agent_config config = {
+            .model = model,
+            .max_tokens = 4,
+            .enable_tool_calling = false,
+            .enable_builtin_tools = false
+        };
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        luup_turn_metrics metrics;
+        run_twice(agent, metrics);
+        REQUIRE(metrics.cache_hits == 0);
+        REQUIRE(metrics.cache_misses == 0);
+        
+        luup_agent_destroy(agent);
+        luup_model_destroy(model);
+    }
+}
+
+TEST_CASE("Background generation", "[agent]") {
+    SECTION("Null parameters") {
+        REQUIRE(luup_agent_generate_start(nullptr, "test", 0, nullptr, nullptr) == nullptr);
+        
+        luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
+        luup_agent_config config = {
+            .model = dummy_model,
+            .enable_tool_calling = false,
+            .enable_history_management = true,
+            .enable_builtin_tools = false
+        };
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_generate_start(agent, nullptr, 0, nullptr, nullptr) == nullptr);
+        luup_agent_destroy(agent);
+    }
+    
+    SECTION("Null handle") {
+        char buffer[16];
+        size_t len = 1;
+        REQUIRE(luup_generation_read(nullptr, buffer, sizeof(buffer), &len, 0) == LUUP_GENERATION_FAILED);
+        REQUIRE(len == 0);
+        
+        const char* message = nullptr;
+        REQUIRE(luup_generation_error(nullptr, &message) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(message != nullptr);
+        
+        luup_generation_cancel(nullptr);
+        luup_generation_free(nullptr);
+    }
+}
+
+TEST_CASE("Background generation on a remote model", "[agent][remote]") {
+    MockOpenAIServer server;
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .enable_tool_calling = false,
+        .enable_history_management = true,
+        .enable_builtin_tools = false
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    SECTION("Buffer smaller than a UTF-8 character") {
+        // Grown to fit the 4-byte emoji, which a 1-byte ring could never pass on
+        const std::string message = "caf\xC3\xA9 \xF0\x9F\x98\x80";
+        luup_generation* gen = luup_agent_generate_start(agent, message.c_str(), 1, nullptr, nullptr);
+        REQUIRE(gen != nullptr);
+        
+        std::string text;
+        char buffer[8];
+        size_t len = 0;
+        luup_generation_status status;
+        do {
+            status = luup_generation_read(gen, buffer, sizeof(buffer), &len, 1000);
+            text.append(buffer, len);
+        } while (status == LUUP_GENERATION_RUNNING);
+        REQUIRE(status == LUUP_GENERATION_DONE);
+        REQUIRE(text == "echo: " + message);
+        luup_generation_free(gen);
+    }
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
+
+TEST_CASE("Submitted requests", "[agent]") {
+    SECTION("Null parameters") {
+        REQUIRE(luup_agent_submit(nullptr, "test", nullptr, nullptr, nullptr) == LUUP_ERROR_INVALID_PARAM);
+        
+        luup_model* dummy_model = reinterpret_cast<luup_model*>(0x1);
+        luup_agent_config config = {
+            .model = dummy_model,
+            .enable_tool_calling = false,
+            .enable_history_management = true,
+            .enable_builtin_tools = false
+        };
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_submit(agent, nullptr, nullptr, nullptr, nullptr) == LUUP_ERROR_INVALID_PARAM);
+        luup_agent_destroy(agent);
+    }
+    
+    SECTION("Invalid thread count") {
+        REQUIRE(luup_set_executor_threads(-1) == LUUP_ERROR_INVALID_PARAM);
+    }
+}
+
+TEST_CASE("Submitted requests on a remote model", "[agent][remote]") {
+    MockOpenAIServer server;
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .enable_tool_calling = false,
+        .enable_history_management = true,
+        .enable_builtin_tools = false
+    };
+    
+    // One per agent; responses are appended in the order callbacks ran
+    std::mutex mutex;
+    std::condition_variable changed;
+    int remaining = 0;
+    struct Completions {
+        std::mutex* mutex;
+        std::condition_variable* changed;
+        int* remaining;
+        luup_agent* agent;
+        bool destroy;   // Destroy the agent from its first callback
+        std::vector<std::string> responses;
+    };
+    auto on_complete = [](luup_error_t code, const char* response, const char*, void* user_data) {
+        auto completions = static_cast<Completions*>(user_data);
+        if (completions->destroy) {
+            completions->destroy = false;
+            luup_agent_destroy(completions->agent);   // Returns, the agent goes after its queue
+        }
+        std::lock_guard<std::mutex> lock(*completions->mutex);
+        completions->responses.push_back(code == LUUP_SUCCESS ? response : "error");
+        (*completions->remaining)--;
+        completions->changed->notify_all();
+    };
+    auto wait_all = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        return changed.wait_for(lock, std::chrono::seconds(30), [&] { return remaining == 0; });
+    };
+    
+    SECTION("Agents run in parallel, each in submission order") {
+        const int n_agents = 3;
+        const int n_turns = 5;
+        std::vector<Completions> completions(n_agents);
+        for (int a = 0; a < n_agents; a++) {
+            completions[a] = {&mutex, &changed, &remaining, luup_agent_create(&config), false, {}};
+            REQUIRE(completions[a].agent != nullptr);
+        }
+        for (int i = 0; i < n_turns; i++) {
+            for (int a = 0; a < n_agents; a++) {
+                std::string message = "agent " + std::to_string(a) + " turn " + std::to_string(i);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    remaining++;
+                }
+                REQUIRE(luup_agent_submit(completions[a].agent, message.c_str(), nullptr,
+                                          on_complete, &completions[a]) == LUUP_SUCCESS);
+            }
+        }
+        REQUIRE(wait_all());
+        
+        for (int a = 0; a < n_agents; a++) {
+            REQUIRE(completions[a].responses.size() == static_cast<size_t>(n_turns));
+            for (int i = 0; i < n_turns; i++) {
+                REQUIRE(completions[a].responses[i] ==
+                        "echo: agent " + std::to_string(a) + " turn " + std::to_string(i));
+            }
+            luup_agent_destroy(completions[a].agent);
+        }
+        REQUIRE(server.requests == n_agents * n_turns);
+    }
+    
+    SECTION("Destroyed from its own callback") {
+        Completions completions = {&mutex, &changed, &remaining, luup_agent_create(&config), true, {}};
+        REQUIRE(completions.agent != nullptr);
+        remaining = 3;
+        for (int i = 0; i < 3; i++) {
+            REQUIRE(luup_agent_submit(completions.agent, "hi", nullptr, on_complete,
+                                      &completions) == LUUP_SUCCESS);
+        }
+        
+        // The queued turns still run after the destroy call
+        REQUIRE(wait_all());
+        REQUIRE(completions.responses == std::vector<std::string>(3, "echo: hi"));
+    }
+    
+    luup_model_destroy(model);
+}
+
 TEST_CASE("Agent destruction", "[agent]") {
     SECTION("Null agent") {
         // Should not crash
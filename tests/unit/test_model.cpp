@@ -103,6 +103,32 @@ TEST_CASE("Model configuration defaults", "[model]") {
             luup_model_destroy(model);
         }
     }
+    
+    SECTION("Default config") {
+        luup_model_config config = luup_model_default_config();
+        REQUIRE(config.path == nullptr);
+        REQUIRE(config.gpu_layers == -1);
+        REQUIRE(config.context_size == 2048);
+        REQUIRE(config.max_sequences == 1);
+        REQUIRE(config.cache_type_k == LUUP_KV_CACHE_F16);
+        REQUIRE(config.cache_type_v == LUUP_KV_CACHE_F16);
+        REQUIRE(config.flash_attn == LUUP_FLASH_ATTN_AUTO);
+        REQUIRE(config.batch_size == 2048);
+        REQUIRE(config.ubatch_size == 512);
+        REQUIRE(config.no_mmap == false);
+        REQUIRE(config.use_mlock == false);
+        REQUIRE(config.stream_usage == false);
+    }
+    
+    SECTION("Quantized V cache without flash attention") {
+        luup_model_config config = luup_model_default_config();
+        config.path = "test.gguf";
+        config.cache_type_v = LUUP_KV_CACHE_Q8_0;
+        config.flash_attn = LUUP_FLASH_ATTN_OFF;
+        
+        // Rejected whether or not the file exists
+        REQUIRE(luup_model_create_local(&config) == nullptr);
+    }
 }
 
 TEST_CASE("Model info retrieval", "[model]") {
@@ -143,6 +169,48 @@ TEST_CASE("Model warmup", "[model]") {
         // Can't easily test this without creating a partially initialized model
         // This is more of an implementation detail
     }
+    
+    SECTION("Sequences bound to agents are left alone") {
+        const char* test_paths[] = {
+            "models/qwen2-0.5b-instruct-q4_k_m.gguf",
+            "../models/qwen2-0.5b-instruct-q4_k_m.gguf",
+            "../../models/qwen2-0.5b-instruct-q4_k_m.gguf",
+        };
+        luup_model* model = nullptr;
+        for (const char* path : test_paths) {
+            luup_model_config config = luup_model_default_config();
+            config.path = path;
+            config.gpu_layers = 0;
+            config.context_size = 512;
+            model = luup_model_create_local(&config);
+            if (model) {
+                break;
+            }
+        }
+        if (!model) {
+            SKIP("Model file not found - skipping test");
+        }
+        
+        REQUIRE(luup_model_warmup(model) == LUUP_SUCCESS);
+        
+        // The agent binds the only sequence on its first generation
+        luup_agent_config agent_config = {
+            .model = model,
+            .max_tokens = 1,
+            .enable_builtin_tools = false
+        };
+        luup_agent* agent = luup_agent_create(&agent_config);
+        REQUIRE(agent != nullptr);
+        char* response = luup_agent_generate(agent, "Hi");
+        REQUIRE(response != nullptr);
+        luup_free_string(response);
+        REQUIRE(luup_model_warmup(model) == LUUP_ERROR_INFERENCE_FAILED);
+        
+        // Destroying the agent frees it again
+        luup_agent_destroy(agent);
+        REQUIRE(luup_model_warmup(model) == LUUP_SUCCESS);
+        luup_model_destroy(model);
+    }
 }
 
 TEST_CASE("Model destruction", "[model]") {
@@ -288,6 +356,27 @@ TEST_CASE("Remote model creation", "[model][remote]") {
         }
     }
     
+    SECTION("Custom HTTP pool settings") {
+        luup_model_config config = {
+            .path = "gpt-4",
+            .gpu_layers = 0,
+            .context_size = 2048,
+            .threads = 0,
+            .api_key = "test-key",
+            .api_base_url = "https://api.openai.com/v1",
+            .http_pool_size = 8,
+            .http_connect_timeout = 5,
+            .http_read_timeout = 60
+        };
+        
+        luup_model* model = luup_model_create_remote(&config);
+        REQUIRE(model != nullptr);
+        
+        if (model) {
+            luup_model_destroy(model);
+        }
+    }
+    
     SECTION("Invalid URL format") {
         luup_model_config config = {
             .path = "gpt-4",
@@ -350,6 +439,125 @@ TEST_CASE("Remote model warmup", "[model][remote]") {
     }
 }
 
+TEST_CASE("Model token counting", "[model]") {
+    SECTION("Null parameters") {
+        int count = 0;
+        REQUIRE(luup_model_count_tokens(nullptr, "text", &count) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_model_set_token_counter(nullptr, nullptr, nullptr) == LUUP_ERROR_INVALID_PARAM);
+    }
+    
+    SECTION("Remote estimate and custom counter") {
+        luup_model_config config = {
+            .path = "gpt-4",
+            .gpu_layers = 0,
+            .context_size = 2048,
+            .threads = 0,
+            .api_key = "test-key",
+            .api_base_url = "https://api.openai.com/v1"
+        };
+        
+        luup_model* model = luup_model_create_remote(&config);
+        REQUIRE(model != nullptr);
+        
+        // Default estimate: one token per 4 characters
+        int count = 0;
+        REQUIRE(luup_model_count_tokens(model, "abcdefghijklmnop", &count) == LUUP_SUCCESS);
+        REQUIRE(count == 4);
+        REQUIRE(luup_model_count_tokens(model, "abcd", nullptr) == LUUP_ERROR_INVALID_PARAM);
+        
+        // Count words instead
+        auto counter = [](const char* text, void* user_data) -> size_t {
+            (*static_cast<int*>(user_data))++;
+            size_t words = 0;
+            bool in_word = false;
+            for (const char* p = text; *p; p++) {
+                bool space = *p == ' ';
+                if (!space && !in_word) {
+                    words++;
+                }
+                in_word = !space;
+            }
+            return words;
+        };
+        int calls = 0;
+        REQUIRE(luup_model_set_token_counter(model, counter, &calls) == LUUP_SUCCESS);
+        REQUIRE(luup_model_count_tokens(model, "a b c d e f", &count) == LUUP_SUCCESS);
+        REQUIRE(count == 6);
+        REQUIRE(calls == 1);
+        
+        // NULL restores the estimate
+        REQUIRE(luup_model_set_token_counter(model, nullptr, nullptr) == LUUP_SUCCESS);
+        REQUIRE(luup_model_count_tokens(model, "a b c d e f", &count) == LUUP_SUCCESS);
+        REQUIRE(count == 2);
+        REQUIRE(calls == 1);
+        
+        luup_model_destroy(model);
+    }
+}
+
+TEST_CASE("Speculative decoding setup", "[model]") {
+    SECTION("Null model") {
+        REQUIRE(luup_model_set_draft(nullptr, nullptr, 0) == LUUP_ERROR_INVALID_PARAM);
+    }
+    
+    SECTION("Remote models can't draft") {
+        luup_model_config config = {
+            .path = "gpt-4",
+            .gpu_layers = 0,
+            .context_size = 2048,
+            .threads = 0,
+            .api_key = "test-key",
+            .api_base_url = "https://api.openai.com/v1"
+        };
+        
+        luup_model* model = luup_model_create_remote(&config);
+        REQUIRE(model != nullptr);
+        REQUIRE(luup_model_set_draft(model, nullptr, 4) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_model_set_draft(model, model, 4) == LUUP_ERROR_INVALID_PARAM);
+        
+        // No draft statistics without a draft
+        luup_model_info info;
+        REQUIRE(luup_model_get_info(model, &info) == LUUP_SUCCESS);
+        REQUIRE(info.draft_tokens_proposed == 0);
+        REQUIRE(info.draft_tokens_accepted == 0);
+        
+        luup_model_destroy(model);
+    }
+}
+
+TEST_CASE("Response cache setup", "[model]") {
+    SECTION("Invalid parameters") {
+        REQUIRE(luup_model_set_response_cache(nullptr, 16, 0, nullptr) == LUUP_ERROR_INVALID_PARAM);
+    }
+    
+    SECTION("Enable and disable") {
+        luup_model_config config = {
+            .path = "gpt-4",
+            .gpu_layers = 0,
+            .context_size = 2048,
+            .threads = 0,
+            .api_key = "test-key",
+            .api_base_url = "https://api.openai.com/v1"
+        };
+        
+        luup_model* model = luup_model_create_remote(&config);
+        REQUIRE(model != nullptr);
+        REQUIRE(luup_model_set_response_cache(model, -1, 0, nullptr) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_model_set_response_cache(model, 16, -1, nullptr) == LUUP_ERROR_INVALID_PARAM);
+        REQUIRE(luup_model_set_response_cache(model, 16, 60, nullptr) == LUUP_SUCCESS);
+        
+        // Nothing looked up yet
+        luup_model_info info;
+        REQUIRE(luup_model_get_info(model, &info) == LUUP_SUCCESS);
+        REQUIRE(info.response_cache_hits == 0);
+        REQUIRE(info.response_cache_misses == 0);
+        REQUIRE(info.response_cache_entries == 0);
+        
+        REQUIRE(luup_model_set_response_cache(model, 0, 0, nullptr) == LUUP_SUCCESS);
+        luup_model_destroy(model);
+    }
+}
+
 TEST_CASE("Version information", "[version]") {
     SECTION("Version string") {
         const char* version = luup_version();
@@ -369,6 +577,10 @@ TEST_CASE("Version information", "[version]") {
         REQUIRE(minor >= 0);
         REQUIRE(patch >= 0);
     }
+    
+    SECTION("ABI version") {
+        REQUIRE(luup_abi_version() == LUUP_ABI_VERSION);
+    }
 }
 
 TEST_CASE("Memory management", "[model]") {
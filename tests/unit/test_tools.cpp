@@ -5,12 +5,21 @@
 
 #include <catch2/catch_test_macros.hpp>
 #include <luup_agent.h>
+#include "mock_openai_server.h"
+#include "../../src/core/internal.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <thread>
 #include <cstring>
 
 // Helper to create a minimal model config for testing
 // Returns nullptr if model file doesn't exist (tests will skip)
-static luup_model* create_test_model() {
+static luup_model* create_test_model(int max_sequences = 0) {
     const char* test_paths[] = {
         "models/qwen2-0.5b-instruct-q4_k_m.gguf",
         "../models/qwen2-0.5b-instruct-q4_k_m.gguf",
@@ -26,7 +35,8 @@ static luup_model* create_test_model() {
             .context_size = 512,
             .threads = 1,
             .api_key = nullptr,
-            .api_base_url = nullptr
+            .api_base_url = nullptr,
+            .max_sequences = max_sequences
         };
         
         luup_model* model = luup_model_create_local(&config);
@@ -171,6 +181,56 @@ TEST_CASE("Built-in summarization tool", "[tools][builtin][summarization]") {
     luup_model_destroy(model);
 }
 
+TEST_CASE("Summarizer sequence", "[tools][builtin][summarization]") {
+    luup_agent_config config = {
+        .system_prompt = "Test agent",
+        .enable_tool_calling = true,
+        .enable_history_management = true,
+        .enable_builtin_tools = false
+    };
+    
+    SECTION("A spare sequence is reserved for background summaries") {
+        config.model = create_test_model(3);
+        if (!config.model) {
+            SKIP("Model file not found - skipping test");
+        }
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_summarization(agent) == LUUP_SUCCESS);
+        int reserved = agent->maintainer->reserved_sequence();
+        REQUIRE(reserved >= 0);
+        REQUIRE(luup_agent_get_sequence(agent) != reserved);
+        
+        // Agents created later never bind to it either
+        luup_agent* other = luup_agent_create(&config);
+        luup_agent* third = luup_agent_create(&config);
+        REQUIRE(luup_agent_get_sequence(other) != reserved);
+        REQUIRE(luup_agent_get_sequence(third) != reserved);
+        
+        // Re-enabling gives the old reservation back first
+        REQUIRE(luup_agent_enable_builtin_summarization(agent) == LUUP_SUCCESS);
+        REQUIRE(agent->maintainer->reserved_sequence() >= 0);
+        luup_agent_destroy(third);
+        luup_agent_destroy(other);
+        luup_agent_destroy(agent);
+        luup_model_destroy(config.model);
+    }
+    
+    SECTION("Without one, summaries stay on the agent's sequence") {
+        config.model = create_test_model(1);
+        if (!config.model) {
+            SKIP("Model file not found - skipping test");
+        }
+        luup_agent* agent = luup_agent_create(&config);
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_summarization(agent) == LUUP_SUCCESS);
+        REQUIRE(agent->maintainer->reserved_sequence() == -1);
+        REQUIRE(luup_agent_get_sequence(agent) == 0);
+        luup_agent_destroy(agent);
+        luup_model_destroy(config.model);
+    }
+}
+
 TEST_CASE("Built-in tools with persistent storage", "[tools][builtin][storage]") {
     auto model = create_test_model();
     if (!model) {
@@ -200,3 +260,638 @@ TEST_CASE("Built-in tools with persistent storage", "[tools][builtin][storage]")
     luup_model_destroy(model);
 }
 
+
+namespace {
+    // Calls tools through an agent on the mock server: the first request of
+    // a turn gets the queued calls natively, the follow-up carries their
+    // results, which call() returns in order
+    class ToolDriver {
+    public:
+        ToolDriver() {
+            server_.set_handler([this](const nlohmann::json& request) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const nlohmann::json& messages = request["messages"];
+                if (messages.back().value("role", "") == "tool") {
+                    results_.clear();
+                    for (const auto& message : messages) {
+                        if (message.value("role", "") == "tool") {
+                            results_.push_back(nlohmann::json::parse(message["content"].get<std::string>()));
+                        }
+                    }
+                    return nlohmann::json{{"content", "done"}};
+                }
+                nlohmann::json calls = nlohmann::json::array();
+                for (size_t i = 0; i < params_.size(); i++) {
+                    calls.push_back({
+                        {"id", "call_" + std::to_string(i)},
+                        {"type", "function"},
+                        {"function", {{"name", tool_}, {"arguments", params_[i].dump()}}}
+                    });
+                }
+                return nlohmann::json{{"tool_calls", calls}};
+            });
+            started_ = server_.start();
+            model_ = started_ ? server_.create_model() : nullptr;
+        }
+        ~ToolDriver() {
+            if (model_) {
+                luup_model_destroy(model_);
+            }
+        }
+        
+        // Agent without built-in tools, for enabling one with a storage path
+        luup_agent* create_agent() const {
+            if (!model_) {
+                return nullptr;
+            }
+            luup_agent_config config = {
+                .model = model_,
+                .enable_tool_calling = true,
+                .enable_history_management = false,
+                .enable_builtin_tools = false
+            };
+            return luup_agent_create(&config);
+        }
+        
+        std::vector<nlohmann::json> call_all(luup_agent* agent, const std::string& tool,
+                                             const std::vector<nlohmann::json>& params) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tool_ = tool;
+                params_ = params;
+                results_.clear();
+            }
+            char* response = luup_agent_generate(agent, "Go");
+            luup_free_string(response);
+            std::lock_guard<std::mutex> lock(mutex_);
+            return results_;
+        }
+        nlohmann::json call(luup_agent* agent, const std::string& tool, const nlohmann::json& params) {
+            std::vector<nlohmann::json> results = call_all(agent, tool, {params});
+            return results.empty() ? nlohmann::json() : results[0];
+        }
+    
+    private:
+        MockOpenAIServer server_;
+        bool started_;
+        luup_model* model_;
+        std::mutex mutex_;
+        std::string tool_;
+        std::vector<nlohmann::json> params_;
+        std::vector<nlohmann::json> results_;
+    };
+    
+    // Fresh directory under the system temp dir, removed with the object
+    struct TempDir {
+        std::filesystem::path path;
+        
+        TempDir() {
+            static std::atomic<int> counter{0};
+            path = std::filesystem::temp_directory_path() /
+                   ("luup_test_" + std::to_string(
+                       std::chrono::steady_clock::now().time_since_epoch().count()) +
+                    "_" + std::to_string(counter++));
+            std::filesystem::create_directories(path);
+        }
+        ~TempDir() {
+            std::error_code ec;
+            std::filesystem::remove_all(path, ec);
+        }
+        
+        std::string file(const std::string& name) const { return (path / name).string(); }
+    };
+    
+    void write_file(const std::string& path, const std::string& text) {
+        std::ofstream file(path, std::ios::binary);
+        file << text;
+    }
+    
+    std::string read_file(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    
+    // Todos listed by a fresh agent reading the store at path
+    nlohmann::json reopen_todos(ToolDriver& driver, const std::string& path) {
+        luup_agent* agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_todo(agent, path.c_str()) == LUUP_SUCCESS);
+        nlohmann::json todos = driver.call(agent, "todo", {{"operation", "list"}})["todos"];
+        luup_agent_destroy(agent);
+        return todos;
+    }
+}
+
+TEST_CASE("Built-in tool journal", "[tools][builtin][storage]") {
+    ToolDriver driver;
+    TempDir dir;
+    std::string path = dir.file("todos.json");
+    
+    SECTION("Existing snapshot files load unchanged") {
+        write_file(path, "{\"todos\": [{\"id\": 3, \"title\": \"old\", \"status\": \"pending\"}]}");
+        luup_agent* agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_todo(agent, path.c_str()) == LUUP_SUCCESS);
+        
+        nlohmann::json todos = driver.call(agent, "todo", {{"operation", "list"}})["todos"];
+        REQUIRE(todos.size() == 1);
+        REQUIRE(todos[0]["title"] == "old");
+        nlohmann::json added = driver.call(agent, "todo", {{"operation", "add"}, {"title", "new"}});
+        REQUIRE(added["todo"]["id"] == 4);
+        REQUIRE_FALSE(added.contains("error"));
+        luup_agent_destroy(agent);
+        
+        // Notes read theirs the same way, indexes included
+        std::string notes_path = dir.file("notes.json");
+        write_file(notes_path, "{\"notes\": [{\"id\": 1, \"content\": \"Old meeting notes\", "
+                               "\"tags\": [\"work\"]}]}");
+        agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_notes(agent, notes_path.c_str()) == LUUP_SUCCESS);
+        nlohmann::json found = driver.call(agent, "notes", {{"operation", "search"}, {"query", "meet"},
+                                                            {"tag", "work"}});
+        REQUIRE(found["notes"].size() == 1);
+        REQUIRE(found["notes"][0]["id"] == 1);
+        luup_agent_destroy(agent);
+    }
+    
+    SECTION("Changes are appended to the log and replayed") {
+        luup_agent* agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_todo(agent, path.c_str()) == LUUP_SUCCESS);
+        driver.call_all(agent, "todo", {
+            {{"operation", "add"}, {"title", "a"}},
+            {{"operation", "add"}, {"title", "b"}},
+            {{"operation", "complete"}, {"id", 1}},
+            {{"operation", "delete"}, {"id", 2}}
+        });
+        luup_agent_destroy(agent);
+        REQUIRE_FALSE(std::filesystem::exists(path));   // No compaction yet
+        
+        nlohmann::json todos = reopen_todos(driver, path);
+        REQUIRE(todos.size() == 1);
+        REQUIRE(todos[0]["id"] == 1);
+        REQUIRE(todos[0]["status"] == "completed");
+    }
+    
+    SECTION("A torn last line is skipped") {
+        write_file(path + ".log",
+                   "{\"op\": \"put\", \"record\": {\"id\": 1, \"title\": \"kept\", \"status\": \"pending\"}}\n"
+                   "{\"op\": \"put\", \"record\": {\"id\": 2, \"ti");
+        luup_agent* agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_todo(agent, path.c_str()) == LUUP_SUCCESS);
+        nlohmann::json todos = driver.call(agent, "todo", {{"operation", "list"}})["todos"];
+        REQUIRE(todos.size() == 1);
+        REQUIRE(todos[0]["title"] == "kept");
+        
+        // The next change starts a line of its own
+        driver.call(agent, "todo", {{"operation", "add"}, {"title", "after"}});
+        luup_agent_destroy(agent);
+        todos = reopen_todos(driver, path);
+        REQUIRE(todos.size() == 2);
+        REQUIRE(todos[1]["title"] == "after");
+    }
+    
+    SECTION("The log is compacted after 256 operations") {
+        std::vector<nlohmann::json> ops = {{{"operation", "add"}, {"title", "busy"}}};
+        for (int i = 0; i < 254; i++) {
+            ops.push_back({{"operation", "complete"}, {"id", 1}});
+        }
+        luup_agent* agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_todo(agent, path.c_str()) == LUUP_SUCCESS);
+        REQUIRE(driver.call_all(agent, "todo", ops).size() == ops.size());
+        REQUIRE_FALSE(std::filesystem::exists(path));
+        
+        // The 256th operation folds the log into the snapshot
+        driver.call(agent, "todo", {{"operation", "complete"}, {"id", 1}});
+        luup_agent_destroy(agent);
+        REQUIRE(read_file(path + ".log").empty());
+        nlohmann::json snapshot = nlohmann::json::parse(read_file(path));
+        REQUIRE(snapshot["todos"].size() == 1);
+        REQUIRE(snapshot["todos"][0]["status"] == "completed");
+        
+        nlohmann::json todos = reopen_todos(driver, path);
+        REQUIRE(todos.size() == 1);
+        REQUIRE(todos[0]["title"] == "busy");
+    }
+    
+    SECTION("A log left behind by an interrupted compaction replays over its snapshot") {
+        // Crash after the rename, before the truncate: the snapshot already
+        // holds everything the old log describes
+        write_file(path, "{\"todos\": [{\"id\": 1, \"title\": \"a\", \"status\": \"completed\"}, "
+                         "{\"id\": 3, \"title\": \"c\", \"status\": \"pending\"}]}");
+        write_file(path + ".log",
+                   "{\"op\": \"put\", \"record\": {\"id\": 1, \"title\": \"a\", \"status\": \"pending\"}}\n"
+                   "{\"op\": \"put\", \"record\": {\"id\": 2, \"title\": \"b\", \"status\": \"pending\"}}\n"
+                   "{\"op\": \"put\", \"record\": {\"id\": 1, \"title\": \"a\", \"status\": \"completed\"}}\n"
+                   "{\"op\": \"del\", \"id\": 2}\n"
+                   "{\"op\": \"put\", \"record\": {\"id\": 3, \"title\": \"c\", \"status\": \"pending\"}}\n");
+        nlohmann::json todos = reopen_todos(driver, path);
+        REQUIRE(todos.size() == 2);
+        REQUIRE(todos[0]["id"] == 1);
+        REQUIRE(todos[0]["status"] == "completed");
+        REQUIRE(todos[1]["id"] == 3);
+    }
+    
+    SECTION("Failed writes are reported in the result") {
+        std::string missing = dir.file("missing/todos.json");
+        luup_agent* agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_todo(agent, missing.c_str()) == LUUP_SUCCESS);
+        nlohmann::json added = driver.call(agent, "todo", {{"operation", "add"}, {"title", "lost"}});
+        REQUIRE(added["success"] == true);
+        REQUIRE(added.contains("error"));
+        luup_agent_destroy(agent);
+        
+        std::string missing_notes = dir.file("missing/notes.json");
+        agent = driver.create_agent();
+        REQUIRE(agent != nullptr);
+        REQUIRE(luup_agent_enable_builtin_notes(agent, missing_notes.c_str()) == LUUP_SUCCESS);
+        nlohmann::json created = driver.call(agent, "notes", {{"operation", "create"}, {"content", "lost"}});
+        REQUIRE(created.contains("error"));
+        luup_agent_destroy(agent);
+    }
+}
+
+TEST_CASE("Notes search and paging", "[tools][builtin][notes]") {
+    ToolDriver driver;
+    luup_agent* agent = driver.create_agent();
+    REQUIRE(agent != nullptr);
+    REQUIRE(luup_agent_enable_builtin_notes(agent, nullptr) == LUUP_SUCCESS);
+    
+    SECTION("Tag and query must both match") {
+        driver.call_all(agent, "notes", {
+            {{"operation", "create"}, {"content", "Team meeting at noon"}, {"tags", {"work"}}},
+            {{"operation", "create"}, {"content", "Meeting friends for lunch"}, {"tags", {"personal"}}},
+            {{"operation", "create"}, {"content", "Quarterly review"}, {"tags", {"Work"}}}
+        });
+        
+        nlohmann::json found = driver.call(agent, "notes", {{"operation", "search"}, {"query", "MEET"},
+                                                            {"tag", "work"}});
+        REQUIRE(found["total"] == 1);
+        REQUIRE(found["notes"][0]["id"] == 1);
+        
+        found = driver.call(agent, "notes", {{"operation", "search"}, {"tag", "work"}});
+        REQUIRE(found["total"] == 2);
+        found = driver.call(agent, "notes", {{"operation", "search"}, {"query", "meet"}});
+        REQUIRE(found["total"] == 2);
+        
+        // Words match by prefix only
+        found = driver.call(agent, "notes", {{"operation", "search"}, {"query", "eting"}});
+        REQUIRE(found["total"] == 0);
+        found = driver.call(agent, "notes", {{"operation", "search"}, {"query", "lunch"},
+                                             {"tag", "work"}});
+        REQUIRE(found["notes"].empty());
+    }
+    
+    SECTION("Pages link through next_offset") {
+        std::vector<nlohmann::json> creates;
+        for (int i = 0; i < 25; i++) {
+            creates.push_back({{"operation", "create"}, {"content", "note " + std::to_string(i)}});
+        }
+        driver.call_all(agent, "notes", creates);
+        
+        nlohmann::json page = driver.call(agent, "notes", {{"operation", "list"}});
+        REQUIRE(page["count"] == 20);
+        REQUIRE(page["total"] == 25);
+        REQUIRE(page["notes"][0]["id"] == 1);
+        REQUIRE(page["next_offset"] == 20);
+        
+        page = driver.call(agent, "notes", {{"operation", "list"}, {"offset", page["next_offset"]}});
+        REQUIRE(page["count"] == 5);
+        REQUIRE(page["notes"][0]["id"] == 21);
+        REQUIRE_FALSE(page.contains("next_offset"));
+        
+        page = driver.call(agent, "notes", {{"operation", "search"}, {"query", "note"},
+                                            {"limit", 10}, {"offset", 10}});
+        REQUIRE(page["count"] == 10);
+        REQUIRE(page["notes"][0]["id"] == 11);
+        REQUIRE(page["next_offset"] == 20);
+    }
+    
+    luup_agent_destroy(agent);
+}
+
+namespace {
+    std::atomic<int> slow_tool_finished{0};
+    
+    char* slow_tool(const char*, void*) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        slow_tool_finished++;
+        return strdup("{\"ok\": true}");
+    }
+}
+
+TEST_CASE("Tool timeouts", "[tools][remote]") {
+    // The first request gets one call to slow_tool, the rest a plain answer
+    std::atomic<int> n_requests{0};
+    MockOpenAIServer server;
+    server.set_handler([&](const nlohmann::json&) {
+        if (n_requests++ > 0) {
+            return nlohmann::json{{"content", "done"}};
+        }
+        nlohmann::json call = {
+            {"id", "call_0"},
+            {"type", "function"},
+            {"function", {{"name", "slow_tool"}, {"arguments", "{}"}}}
+        };
+        return nlohmann::json{{"content", ""}, {"tool_calls", nlohmann::json::array({call})}};
+    });
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .temperature = 0.0f,
+        .max_tokens = 100,
+        .enable_tool_calling = true,
+        .enable_history_management = true,
+        .enable_builtin_tools = false,
+        .tool_timeout_ms = 50
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    luup_tool tool = {
+        .name = "slow_tool",
+        .description = "Takes longer than the timeout",
+        .parameters_json = "{\"type\": \"object\", \"properties\": {}}"
+    };
+    REQUIRE(luup_agent_register_tool(agent, &tool, slow_tool, nullptr) == LUUP_SUCCESS);
+    
+    slow_tool_finished = 0;
+    char* response = luup_agent_generate(agent, "Go");
+    REQUIRE(response != nullptr);
+    REQUIRE(std::string(response) == "done");
+    luup_free_string(response);
+    
+    // The model saw the timeout while the callback was still running
+    char* history = luup_agent_get_history_json(agent);
+    REQUIRE(history != nullptr);
+    REQUIRE(std::string(history).find("Tool timed out") != std::string::npos);
+    luup_free_string(history);
+    REQUIRE(slow_tool_finished == 0);
+    
+    // Destruction waits for the callback that outlived its timeout
+    luup_agent_destroy(agent);
+    REQUIRE(slow_tool_finished == 1);
+    luup_model_destroy(model);
+}
+
+TEST_CASE("Native tool calls", "[tools][remote]") {
+    // Call echo_tool natively until a "tool" message answers it
+    std::mutex mutex;
+    std::vector<nlohmann::json> requests;
+    MockOpenAIServer server;
+    server.set_handler([&](const nlohmann::json& request) {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(request);
+        if (request["messages"].back().value("role", "") == "tool") {
+            return nlohmann::json{{"content", "done"}};
+        }
+        nlohmann::json call = {
+            {"id", "call_7"},
+            {"type", "function"},
+            {"function", {{"name", "echo_tool"}, {"arguments", "{\"text\": \"hi\"}"}}}
+        };
+        return nlohmann::json{{"content", "Checking."}, {"tool_calls", nlohmann::json::array({call})}};
+    });
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .temperature = 0.0f,
+        .max_tokens = 100,
+        .enable_tool_calling = true,
+        .enable_history_management = true,
+        .enable_builtin_tools = false
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    luup_tool tool = {
+        .name = "echo_tool",
+        .description = "Echoes its parameters",
+        .parameters_json = "{\"type\": \"object\", \"properties\": {\"text\": {\"type\": \"string\"}}}"
+    };
+    auto echo = [](const char* params_json, void*) -> char* { return strdup(params_json); };
+    REQUIRE(luup_agent_register_tool(agent, &tool, echo, nullptr) == LUUP_SUCCESS);
+    
+    SECTION("Blocking") {
+        char* response = luup_agent_generate(agent, "Echo hi");
+        REQUIRE(response != nullptr);
+        REQUIRE(std::string(response) == "done");
+        luup_free_string(response);
+    }
+    
+    SECTION("Streaming") {
+        auto ignore = [](const char*, void*) { return true; };
+        REQUIRE(luup_agent_generate_stream(agent, "Echo hi", ignore, nullptr) == LUUP_SUCCESS);
+    }
+    
+    // The follow-up replays the call natively and answers it by id
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        REQUIRE(requests.size() == 2);
+        const nlohmann::json& messages = requests[1]["messages"];
+        REQUIRE(messages.size() == 3);
+        REQUIRE(messages[1]["role"] == "assistant");
+        REQUIRE(messages[1]["content"] == "Checking.");
+        REQUIRE(messages[1]["tool_calls"].size() == 1);
+        REQUIRE(messages[1]["tool_calls"][0]["id"] == "call_7");
+        REQUIRE(messages[1]["tool_calls"][0]["function"]["name"] == "echo_tool");
+        REQUIRE(messages[2]["role"] == "tool");
+        REQUIRE(messages[2]["tool_call_id"] == "call_7");
+        REQUIRE(nlohmann::json::parse(messages[2]["content"].get<std::string>())["text"] == "hi");
+    }
+    
+    char* history = luup_agent_get_history_json(agent);
+    REQUIRE(history != nullptr);
+    nlohmann::json history_json = nlohmann::json::parse(history);
+    luup_free_string(history);
+    REQUIRE(history_json[1]["tool_calls"][0]["id"] == "call_7");
+    REQUIRE(history_json[2]["tool_call_id"] == "call_7");
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
+
+TEST_CASE("Tool calls in model text", "[tools][remote]") {
+    // The model writes output once, then answers "done" to the tool result.
+    // Streaming delivers output one word per chunk, splitting the calls.
+    struct Case {
+        const char* name;
+        std::string output;
+        std::string text;   // Parameter the tool should receive
+    };
+    
+    // Long runs of braces must not make scanning quadratic
+    const std::string deep_call = "{\"name\": \"record\", \"parameters\": {\"text\": \"deep\"}}";
+    std::string nested_prose;
+    for (int i = 0; i < 20000; i++) {
+        nested_prose += "{a ";
+    }
+    nested_prose += deep_call + std::string(20000, '}');
+    
+    const std::vector<Case> cases = {
+        {"Braces inside strings",
+         "{\"tool_calls\": [{\"name\": \"record\", \"parameters\": {\"text\": \"a } b { c\"}}]}",
+         "a } b { c"},
+        {"Escaped quotes",
+         "{\"name\": \"record\", \"parameters\": {\"text\": \"say \\\"hi }\\\" now\"}}",
+         "say \"hi }\" now"},
+        {"Code fence",
+         "Let me check.\n```json\n{\"tool_calls\": [{\"name\": \"record\", "
+         "\"parameters\": {\"text\": \"fenced\"}}]}\n```\n",
+         "fenced"},
+        {"Unbalanced brace before a call",
+         "Set {x to one. {\"name\": \"record\", \"parameters\": {\"text\": \"after\"}}",
+         "after"},
+        {"Prose in braces around a call",
+         "{note: {\"name\": \"record\", \"parameters\": {\"text\": \"inner\"}} }",
+         "inner"},
+        {"Long run of unmatched braces", std::string(100000, '{') + deep_call, "deep"},
+        {"Deeply nested prose braces", nested_prose, "deep"},
+    };
+    
+    std::mutex mutex;
+    std::string output;
+    MockOpenAIServer server;
+    server.set_handler([&](const nlohmann::json& request) {
+        std::string last = request["messages"].back().value("content", "");
+        if (last.rfind("Tool '", 0) == 0) {
+            return nlohmann::json{{"content", "done"}};
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return nlohmann::json{{"content", output}};
+    });
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .enable_tool_calling = true,
+        .enable_history_management = false,
+        .enable_builtin_tools = false
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    luup_tool tool = {
+        .name = "record",
+        .description = "Records its text",
+        .parameters_json = "{\"type\": \"object\", \"properties\": {\"text\": {\"type\": \"string\"}}}"
+    };
+    std::vector<std::string> received;
+    auto record = [](const char* params_json, void* user_data) -> char* {
+        auto texts = static_cast<std::vector<std::string>*>(user_data);
+        texts->push_back(nlohmann::json::parse(params_json).value("text", ""));
+        return strdup("{\"ok\": true}");
+    };
+    REQUIRE(luup_agent_register_tool(agent, &tool, record, &received) == LUUP_SUCCESS);
+    
+    auto run = [&](bool streaming) {
+        for (const auto& c : cases) {
+            INFO(c.name);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                output = c.output;
+            }
+            received.clear();
+            if (streaming) {
+                auto ignore = [](const char*, void*) { return true; };
+                REQUIRE(luup_agent_generate_stream(agent, "Go", ignore, nullptr) == LUUP_SUCCESS);
+            } else {
+                char* response = luup_agent_generate(agent, "Go");
+                REQUIRE(response != nullptr);
+                REQUIRE(std::string(response) == "done");
+                luup_free_string(response);
+            }
+            REQUIRE(received == std::vector<std::string>{c.text});
+        }
+    };
+    
+    SECTION("Blocking") {
+        run(false);
+    }
+    
+    SECTION("Streaming") {
+        run(true);
+    }
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}
+
+TEST_CASE("Tool round limit", "[tools][remote]") {
+    // Ask for count_tool in every response until `answer_after` results came back
+    std::atomic<int> answer_after(1);
+    MockOpenAIServer server;
+    server.set_handler([&](const nlohmann::json& request) {
+        int results = 0;
+        for (const auto& message : request["messages"]) {
+            results += message.value("role", "") == "tool" ? 1 : 0;
+        }
+        if (results >= answer_after) {
+            return nlohmann::json{{"content", "done"}};
+        }
+        nlohmann::json call = {
+            {"id", "call_" + std::to_string(results)},
+            {"type", "function"},
+            {"function", {{"name", "count_tool"}, {"arguments", "{}"}}}
+        };
+        return nlohmann::json{{"tool_calls", nlohmann::json::array({call})}};
+    });
+    REQUIRE(server.start());
+    luup_model* model = server.create_model();
+    REQUIRE(model != nullptr);
+    
+    luup_agent_config config = {
+        .model = model,
+        .enable_tool_calling = true,
+        .enable_history_management = true,
+        .enable_builtin_tools = false,
+        .max_tool_rounds = 1
+    };
+    luup_agent* agent = luup_agent_create(&config);
+    REQUIRE(agent != nullptr);
+    
+    luup_tool tool = {
+        .name = "count_tool",
+        .description = "Counts its calls",
+        .parameters_json = "{\"type\": \"object\", \"properties\": {}}"
+    };
+    std::atomic<int> calls(0);
+    auto count = [](const char*, void* user_data) -> char* {
+        (*static_cast<std::atomic<int>*>(user_data))++;
+        return strdup("{\"ok\": true}");
+    };
+    REQUIRE(luup_agent_register_tool(agent, &tool, count, &calls) == LUUP_SUCCESS);
+    
+    SECTION("One round runs its calls before answering") {
+        char* response = luup_agent_generate(agent, "Count once");
+        REQUIRE(response != nullptr);
+        REQUIRE(std::string(response) == "done");
+        luup_free_string(response);
+        REQUIRE(calls == 1);
+        REQUIRE(server.requests == 2);
+    }
+    
+    SECTION("Calls past the limit fail the turn") {
+        answer_after = 2;
+        auto ignore = [](const char*, void*) { return true; };
+        REQUIRE(luup_agent_generate_stream(agent, "Count twice", ignore, nullptr) ==
+                LUUP_ERROR_TOOL_LIMIT);
+        REQUIRE(calls == 1);
+        REQUIRE(server.requests == 2);
+    }
+    
+    luup_agent_destroy(agent);
+    luup_model_destroy(model);
+}